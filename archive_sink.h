@@ -0,0 +1,204 @@
+// archive_sink.h - Encode frames straight into mmap'd archive segments.
+//
+// A segment is a preallocated file mapped MAP_SHARED. For every frame the
+// writer reserves the worst case, the encoder writes its bitstream directly
+// into the mapping (stbi_write_jpg_to_buffer), and the commit only advances
+// the write offset by what was used, so the unused tail of the reservation is
+// handed to the next frame. Closing a segment truncates the unused tail of
+// the file. There is no stdio buffer, no write() and no user-to-kernel copy:
+// the encoded bytes land in the page cache once.
+//
+// Segment layout, little-endian, records aligned to 8 bytes:
+//   record: magic "ARC2" u32 | payload length u32 | frame u64 | timestamp_us u64 | crc u32 | 0 u32 | payload
+// The CRC-32 covers the header from the length on (crc field zeroed) and the
+// payload. Writeback of a MAP_SHARED mapping goes page by page in no
+// particular order, so after a power cut the header can be on disk without
+// all of its payload; archive_next() ends the segment at the first record
+// whose CRC does not match, so a record is either whole or not there.
+//
+// One struct archive per writer thread; segments are named
+// <dir>/<prefix>_<seq>.arc with the first free sequence number.
+//
+// Usage:
+//   struct archive ar;
+//   archive_open(&ar, "/data/arc", "cam0", ARCHIVE_SEGMENT_SIZE);
+//   archive_write_jpg(&ar, frame_no, ts_us, w, h, 3, rgb, 90, NULL);
+//   archive_close(&ar);
+
+#ifndef ARCHIVE_SINK_H
+#define ARCHIVE_SINK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifndef INCLUDE_STB_IMAGE_WRITE_H
+#include "stb_image_write.h"    // declarations only; the implementation is included once by the tool
+#endif
+
+#define ARCHIVE_MAGIC        0x32435241u     // "ARC2"
+#define ARCHIVE_HDR_SIZE     32
+#define ARCHIVE_SEGMENT_SIZE (64u << 20)
+#define ARCHIVE_FLUSH_BYTES  (4u << 20)      // start writeback every this many bytes
+
+struct archive_rec {
+    uint32_t len;
+    uint64_t frame, timestamp_us;
+};
+
+struct archive {
+    char dir[256], prefix[32];
+    size_t seg_size;
+    int fd, seq;
+    uint8_t *map;
+    size_t off, flushed;            // write offset, start of the range not yet handed to writeback
+    uint64_t bytes, records, segments;
+};
+
+static inline void archive_put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline void archive_put64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint32_t archive_get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t archive_get64(const uint8_t *p) {
+    return archive_get32(p) | ((uint64_t)archive_get32(p + 4) << 32);
+}
+
+// Record CRC; hdr has its crc field zeroed
+static inline uint32_t archive_crc(const uint8_t *hdr, const uint8_t *payload, uint32_t len) {
+    return stbi_write_crc32(stbi_write_crc32(0, hdr + 4, ARCHIVE_HDR_SIZE - 4), payload, (int)len);
+}
+
+// Worst case for one 8-bit JPEG: ~1.5x the raw RGB size covers 0xFF stuffing at quality 100
+static inline size_t archive_jpg_bound(int w, int h, int comp) {
+    return (size_t)w * h * (comp < 3 ? 3 : comp) * 3 / 2 + 1024;
+}
+
+// Finish the current segment: give back the unused tail and unmap
+static inline void archive_finish_segment(struct archive *ar) {
+    if (!ar->map) return;
+    munmap(ar->map, ar->seg_size);
+    if (ftruncate(ar->fd, ar->off) < 0) perror("archive: ftruncate");
+    close(ar->fd);
+    ar->map = NULL;
+    ar->fd = -1;
+}
+
+static inline int archive_new_segment(struct archive *ar) {
+    char path[320];
+    archive_finish_segment(ar);
+    for (;;) {
+        snprintf(path, sizeof(path), "%s/%s_%06d.arc", ar->dir, ar->prefix, ar->seq++);
+        ar->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (ar->fd >= 0) break;
+        if (errno != EEXIST) { fprintf(stderr, "archive: cannot create %s: %s\n", path, strerror(errno)); return -1; }
+    }
+    // Real blocks up front: no fragmentation, and ENOSPC shows up here instead of as SIGBUS
+    int err = posix_fallocate(ar->fd, 0, ar->seg_size);
+    if (err == EINVAL || err == EOPNOTSUPP) err = ftruncate(ar->fd, ar->seg_size) < 0 ? errno : 0;
+    if (err) {
+        fprintf(stderr, "archive: cannot allocate %s: %s\n", path, strerror(err));
+        close(ar->fd);
+        unlink(path);
+        ar->fd = -1;
+        return -1;
+    }
+    ar->map = mmap(NULL, ar->seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, ar->fd, 0);
+    if (ar->map == MAP_FAILED) {
+        perror("archive: mmap");
+        ar->map = NULL;
+        close(ar->fd);
+        ar->fd = -1;
+        return -1;
+    }
+    ar->off = ar->flushed = 0;
+    ar->segments++;
+    return 0;
+}
+
+static inline int archive_open(struct archive *ar, const char *dir, const char *prefix, size_t seg_size) {
+    memset(ar, 0, sizeof(*ar));
+    snprintf(ar->dir, sizeof(ar->dir), "%s", dir);
+    snprintf(ar->prefix, sizeof(ar->prefix), "%s", prefix);
+    ar->seg_size = seg_size ? seg_size : ARCHIVE_SEGMENT_SIZE;
+    ar->fd = -1;
+    return 0;       // the first segment is created on the first reservation
+}
+
+// Space for a payload of up to max_len bytes, or NULL
+static inline uint8_t *archive_reserve(struct archive *ar, size_t max_len) {
+    if (max_len + ARCHIVE_HDR_SIZE > ar->seg_size) return NULL;
+    if (!ar->map || ar->off + ARCHIVE_HDR_SIZE + max_len > ar->seg_size)
+        if (archive_new_segment(ar) != 0) return NULL;
+    return ar->map + ar->off + ARCHIVE_HDR_SIZE;
+}
+
+// Publish the reserved payload; the rest of the reservation stays free
+static inline void archive_commit(struct archive *ar, uint64_t frame, uint64_t timestamp_us, uint32_t len) {
+    uint8_t *h = ar->map + ar->off;
+    archive_put32(h + 4, len);
+    archive_put64(h + 8, frame);
+    archive_put64(h + 16, timestamp_us);
+    archive_put64(h + 24, 0);
+    archive_put32(h + 24, archive_crc(h, h + ARCHIVE_HDR_SIZE, len));
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    archive_put32(h, ARCHIVE_MAGIC);
+    ar->off += (ARCHIVE_HDR_SIZE + len + 7) & ~(size_t)7;
+    ar->bytes += len;
+    ar->records++;
+
+    // Keep the dirty page count bounded instead of letting it pile up until the segment closes
+    if (ar->off - ar->flushed >= ARCHIVE_FLUSH_BYTES) {
+#ifdef SYNC_FILE_RANGE_WRITE
+        sync_file_range(ar->fd, ar->flushed, ar->off - ar->flushed, SYNC_FILE_RANGE_WRITE);
+#else
+        msync(ar->map + (ar->flushed & ~(size_t)4095), ar->off - (ar->flushed & ~(size_t)4095), MS_ASYNC);
+#endif
+        ar->flushed = ar->off;
+    }
+}
+
+// Encode a JPEG directly into the archive. Returns the payload length or 0.
+static inline int archive_write_jpg(struct archive *ar, uint64_t frame, uint64_t timestamp_us, int w, int h,
+                                    int comp, const void *data, int quality, stbi_jpg_block_energy *features) {
+    size_t bound = archive_jpg_bound(w, h, comp);
+    if (bound > ar->seg_size - ARCHIVE_HDR_SIZE) bound = ar->seg_size - ARCHIVE_HDR_SIZE;
+    uint8_t *p = archive_reserve(ar, bound);
+    if (!p) return 0;
+    int len = stbi_write_jpg_to_buffer(p, (int)bound, w, h, comp, data, quality, features);
+    if (len > 0) archive_commit(ar, frame, timestamp_us, (uint32_t)len);
+    return len;
+}
+
+static inline void archive_close(struct archive *ar) {
+    archive_finish_segment(ar);
+}
+
+// Walk a mapped segment: returns the next payload and fills rec, or NULL at the
+// end (a torn record from a power cut ends the segment too)
+static inline const uint8_t *archive_next(const uint8_t *seg, size_t size, size_t *off, struct archive_rec *rec) {
+    uint8_t hdr[ARCHIVE_HDR_SIZE];
+    if (*off + ARCHIVE_HDR_SIZE > size || archive_get32(seg + *off) != ARCHIVE_MAGIC) return NULL;
+    const uint8_t *h = seg + *off;
+    rec->len = archive_get32(h + 4);
+    if (*off + ARCHIVE_HDR_SIZE + rec->len > size) return NULL;
+    memcpy(hdr, h, ARCHIVE_HDR_SIZE);
+    archive_put32(hdr + 24, 0);
+    if (archive_crc(hdr, h + ARCHIVE_HDR_SIZE, rec->len) != archive_get32(h + 24)) return NULL;
+    rec->frame = archive_get64(h + 8);
+    rec->timestamp_us = archive_get64(h + 16);
+    *off += (ARCHIVE_HDR_SIZE + rec->len + 7) & ~(size_t)7;
+    return h + ARCHIVE_HDR_SIZE;
+}
+
+#endif // ARCHIVE_SINK_H
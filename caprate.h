@@ -0,0 +1,270 @@
+// caprate.h - Adaptive capture rate tied to belt state and activity.
+//
+// When the belt is stopped (serial_pwm's pwm_control(0) clears the PWM
+// enable file) or nothing has moved in front of the camera for a while, the
+// camera is dropped to a low frame rate with VIDIOC_S_PARM and the pipeline
+// stops encoding, so its workers sit parked on their condition variables and
+// the harts are free for archiving. The loop keeps running a cheap presence
+// detector (subsampled luma difference) on the idle frames.
+//
+// Getting back to full rate must not wait for the next idle frame:
+//   - belt start: caprate_timeout_ms() makes the capture loop wake every
+//     CAPRATE_BELT_POLL_MS while idle and caprate_tick() re-reads the enable
+//     file, so the switch happens within a few ms of pwm_control(1),
+//   - motion: the first idle frame that shows it switches to full rate and
+//     is itself processed,
+//   - trigger: a photo-sensor edge (gpiotrig.h) calls caprate_wake().
+// The time from the trigger to the first frame arriving at full cadence is
+// recorded for every transition.
+//
+// Many drivers (uvcvideo among them) refuse S_PARM while streaming. Then the
+// camera stays at full rate and idle mode is done in software: only every
+// Nth frame is looked at and none are encoded.
+//
+// Usage:
+//   struct caprate cr;
+//   caprate_init(&cr, fd, 30, 2, "/sys/class/pwm/pwmchip0/pwm0/enable");
+//   loop: poll(fd, caprate_timeout_ms(&cr));
+//         timeout -> caprate_tick(&cr, now);
+//         frame   -> if (caprate_frame(&cr, data, fourcc, w, h, stride, now)) process it
+//   caprate_print(&cr);
+
+#ifndef CAPRATE_H
+#define CAPRATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include "pixfmt.h"
+
+#define CAPRATE_IDLE_AFTER_S    10.0    // no motion for this long -> idle
+#define CAPRATE_BELT_POLL_MS    20      // belt check interval while idle
+#define CAPRATE_STEP            8       // presence detector subsampling
+#define CAPRATE_DIFF            20      // luma change counted as motion
+#define CAPRATE_MOTION_PERMILLE 5       // changed samples needed, per mille
+
+enum { CAPRATE_FULL = 0, CAPRATE_IDLE };
+
+struct caprate {
+    int fd;
+    int full_fps, idle_fps;
+    int hw;                         // S_PARM works while streaming
+    int mode;
+    int skip, skip_n;               // software idle: look at every skip-th frame
+    char enable_path[256];
+    int belt_on;
+
+    // Presence detector, thresholds default to the CAPRATE_* values
+    double idle_after_s;
+    int motion_diff, motion_permille;
+    uint8_t *prev;
+    int pw, ph, have_prev;
+    double last_motion_ns;
+
+    // Transitions
+    double mode_since_ns;
+    double pending_ns;              // trigger time of a switch to full, 0 if none
+    double last_frame_ns;
+    int pending_reason;
+    unsigned to_idle, to_full;
+    double idle_total_ns;
+    double lat_min, lat_max, lat_sum;
+    uint64_t frames, processed;
+};
+
+enum { CAPRATE_WHY_BELT = 0, CAPRATE_WHY_MOTION, CAPRATE_WHY_TRIGGER };
+
+static inline int caprate_set_fps(struct caprate *cr, int fps) {
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1;
+    parm.parm.capture.timeperframe.denominator = fps;
+    int r;
+    do { r = ioctl(cr->fd, VIDIOC_S_PARM, &parm); } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+static inline int caprate_read_belt(const struct caprate *cr) {
+    char c = '1';
+    int fd = open(cr->enable_path, O_RDONLY);
+    if (fd < 0) return 1;           // no PWM: monitor-only, treat the belt as running
+    if (read(fd, &c, 1) != 1) c = '1';
+    close(fd);
+    return c == '1';
+}
+
+// Call after STREAMON
+static inline int caprate_init(struct caprate *cr, int fd, int full_fps, int idle_fps, const char *enable_path) {
+    struct v4l2_streamparm parm;
+    memset(cr, 0, sizeof(*cr));
+    cr->fd = fd;
+    cr->full_fps = full_fps;
+    cr->idle_fps = idle_fps > 0 ? idle_fps : 1;
+    cr->skip = 1;
+    cr->idle_after_s = CAPRATE_IDLE_AFTER_S;
+    cr->motion_diff = CAPRATE_DIFF;
+    cr->motion_permille = CAPRATE_MOTION_PERMILLE;
+    snprintf(cr->enable_path, sizeof(cr->enable_path), "%s", enable_path);
+    cr->lat_min = 1e30;
+
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(fd, VIDIOC_G_PARM, &parm) == 0 && (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+        cr->hw = caprate_set_fps(cr, full_fps) == 0;
+    printf("Capture rate: %d fps, idle %d fps (%s)\n", full_fps, cr->idle_fps,
+           cr->hw ? "VIDIOC_S_PARM" : "driver cannot change rate while streaming, idle skips frames");
+    cr->belt_on = caprate_read_belt(cr);
+    return 0;
+}
+
+// New frame rates at run time (e.g. a config reload); takes effect at once
+static inline void caprate_set_rates(struct caprate *cr, int full_fps, int idle_fps) {
+    cr->full_fps = full_fps;
+    cr->idle_fps = idle_fps > 0 ? idle_fps : 1;
+    if (cr->mode == CAPRATE_IDLE && !cr->hw) cr->skip = (cr->full_fps + cr->idle_fps - 1) / cr->idle_fps;
+    if (cr->hw && caprate_set_fps(cr, cr->mode == CAPRATE_IDLE ? cr->idle_fps : cr->full_fps) != 0) cr->hw = 0;
+}
+
+static inline void caprate_free(struct caprate *cr) {
+    free(cr->prev);
+    cr->prev = NULL;
+}
+
+static inline void caprate_enter(struct caprate *cr, int mode, double now_ns, int reason) {
+    if (mode == cr->mode) return;
+    if (mode == CAPRATE_IDLE) {
+        if (cr->hw && caprate_set_fps(cr, cr->idle_fps) != 0) cr->hw = 0;
+        cr->skip = cr->hw ? 1 : (cr->full_fps + cr->idle_fps - 1) / cr->idle_fps;
+        cr->skip_n = 0;
+        cr->to_idle++;
+        printf("Capture: idle (%s)\n", cr->belt_on ? "no motion" : "belt stopped");
+    } else {
+        if (cr->hw && caprate_set_fps(cr, cr->full_fps) != 0) cr->hw = 0;
+        cr->skip = 1;
+        cr->idle_total_ns += now_ns - cr->mode_since_ns;
+        cr->pending_ns = now_ns;
+        cr->pending_reason = reason;
+        cr->last_motion_ns = now_ns;
+        cr->to_full++;
+    }
+    cr->mode = mode;
+    cr->mode_since_ns = now_ns;
+}
+
+// Re-read the belt state; a stopped -> running edge ends idle mode at once
+static inline void caprate_check_belt(struct caprate *cr, double now_ns) {
+    int was_on = cr->belt_on;
+    cr->belt_on = caprate_read_belt(cr);
+    if (cr->mode == CAPRATE_IDLE && cr->belt_on && !was_on) caprate_enter(cr, CAPRATE_FULL, now_ns, CAPRATE_WHY_BELT);
+}
+
+// Between frames (poll timeout): catch the belt starting without waiting for an idle frame
+static inline void caprate_tick(struct caprate *cr, double now_ns) {
+    caprate_check_belt(cr, now_ns);
+}
+
+// Something outside the camera saw a box coming: full rate now
+static inline void caprate_wake(struct caprate *cr, double now_ns) {
+    if (cr->mode == CAPRATE_IDLE) caprate_enter(cr, CAPRATE_FULL, now_ns, CAPRATE_WHY_TRIGGER);
+    else cr->last_motion_ns = now_ns;
+}
+
+// poll() timeout for the capture loop
+static inline int caprate_timeout_ms(const struct caprate *cr) {
+    return cr->mode == CAPRATE_IDLE ? CAPRATE_BELT_POLL_MS : 2000;
+}
+
+// Offset of a luma (or luma-like) sample at pixel x of a row
+static inline int caprate_luma_offset(uint32_t fourcc, int x) {
+    switch (fourcc) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_YVYU:  return x * 2;
+    case V4L2_PIX_FMT_UYVY:  return x * 2 + 1;
+    case V4L2_PIX_FMT_RGB24:
+    case V4L2_PIX_FMT_BGR24: return x * 3 + 1;
+    default:                 return (int)((size_t)x * pixfmt_min_stride(fourcc, 64) / 64) & ~1;
+    }
+}
+
+// Returns 1 if enough of the subsampled luma changed since the last look
+static inline int caprate_motion(struct caprate *cr, const uint8_t *frame, uint32_t fourcc, int w, int h, int stride) {
+    int pw = w / CAPRATE_STEP, ph = h / CAPRATE_STEP;
+    if (!cr->prev || pw != cr->pw || ph != cr->ph) {
+        free(cr->prev);
+        cr->prev = malloc((size_t)pw * ph);
+        cr->pw = pw;
+        cr->ph = ph;
+        cr->have_prev = 0;
+        if (!cr->prev) return 1;
+    }
+    if (!stride) stride = pixfmt_min_stride(fourcc, w);
+    int changed = 0;
+    uint8_t *p = cr->prev;
+    for (int y = 0; y < ph; y++) {
+        const uint8_t *row = frame + (size_t)y * CAPRATE_STEP * stride;
+        for (int x = 0; x < pw; x++, p++) {
+            uint8_t v = row[caprate_luma_offset(fourcc, x * CAPRATE_STEP)];
+            int d = v - *p;
+            if (d > cr->motion_diff || d < -cr->motion_diff) changed++;
+            *p = v;
+        }
+    }
+    int moved = cr->have_prev && changed * 1000 > cr->motion_permille * pw * ph;
+    cr->have_prev = 1;
+    return moved;
+}
+
+// Per dequeued frame. Returns 1 if the pipeline should process it.
+static inline int caprate_frame(struct caprate *cr, const uint8_t *frame, uint32_t fourcc, int w, int h, int stride, double now_ns) {
+    double gap = cr->last_frame_ns ? now_ns - cr->last_frame_ns : 0;
+    cr->last_frame_ns = now_ns;
+    cr->frames++;
+
+    // A pending switch to full rate completes with the first frame at full cadence
+    if (cr->pending_ns && gap > 0 && gap < 1.5e9 / cr->full_fps) {
+        double lat = (now_ns - cr->pending_ns) / 1e6;
+        if (lat < cr->lat_min) cr->lat_min = lat;
+        if (lat > cr->lat_max) cr->lat_max = lat;
+        cr->lat_sum += lat;
+        printf("Capture: full rate (%s), %.1f ms to full cadence\n",
+               cr->pending_reason == CAPRATE_WHY_BELT ? "belt started" :
+               cr->pending_reason == CAPRATE_WHY_MOTION ? "motion" : "trigger", lat);
+        cr->pending_ns = 0;
+    }
+
+    caprate_check_belt(cr, now_ns);
+    if (cr->mode == CAPRATE_IDLE && cr->skip > 1 && ++cr->skip_n % cr->skip) return 0;
+
+    int moved = caprate_motion(cr, frame, fourcc, w, h, stride);
+    if (moved) cr->last_motion_ns = now_ns;
+
+    if (cr->mode == CAPRATE_FULL) {
+        if (!cr->last_motion_ns) cr->last_motion_ns = now_ns;
+        if (!cr->belt_on || now_ns - cr->last_motion_ns > cr->idle_after_s * 1e9)
+            caprate_enter(cr, CAPRATE_IDLE, now_ns, 0);
+    } else if (cr->belt_on && moved) {
+        caprate_enter(cr, CAPRATE_FULL, now_ns, CAPRATE_WHY_MOTION);
+    }
+
+    if (cr->mode == CAPRATE_IDLE) return 0;
+    cr->processed++;
+    return 1;
+}
+
+static inline void caprate_print(const struct caprate *cr, double now_ns) {
+    double idle = cr->idle_total_ns + (cr->mode == CAPRATE_IDLE ? now_ns - cr->mode_since_ns : 0);
+    unsigned done = cr->to_full - (cr->pending_ns ? 1 : 0);
+    printf("Capture rate: %llu frames, %llu processed, %.1f s idle, %u to idle, %u to full",
+           (unsigned long long)cr->frames, (unsigned long long)cr->processed, idle / 1e9, cr->to_idle, cr->to_full);
+    if (done) printf(" (to full cadence ms: min %.1f avg %.1f max %.1f)", cr->lat_min, cr->lat_sum / done, cr->lat_max);
+    printf("\n");
+}
+
+#endif // CAPRATE_H
@@ -6,52 +6,43 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/videodev2.h>
 #include <stdint.h>
 
 #define WIDTH 320    // Lower resolution for stability
 #define HEIGHT 240
 #define QUALITY 90   // JPEG Quality (1-100)
+#define NUM_HARTS 4  // Threads used for pixel conversion
+
+// Raw Bayer sensors only
+#define BAYER_BLACK  16          // Black level (8-bit units)
+#define BAYER_GAIN_R 256         // White balance gains, 256 = 1.0
+#define BAYER_GAIN_G 256
+#define BAYER_GAIN_B 256
+#define BAYER_HALF   0           // 1 = cheap half-resolution demosaic
+
+// Illumination normalization, estimated on the last warm-up frame
+#define WB_ENABLE    1
+#define WB_TARGET    118         // Gray world target luma, 0 = keep brightness
+
+// Temporal denoise: the final frame is the average of the last DENOISE_K (packed 4:2:2 only, 1 = off)
+#define DENOISE_K    4
+
+// Golden-template screen against GOLDEN_DIR/<GOLDEN_SKU>.golden and texture pre-screen baseline
+// GOLDEN_DIR/<GOLDEN_SKU>.texscreen; 1 = fold this shot into both as a good box
+#define GOLDEN_DIR   "golden"
+#define GOLDEN_SKU   "default"
+#define GOLDEN_LEARN 0
 // ---------------------
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
-
-static inline uint8_t clamp(int v) {
-    return (v < 0) ? 0 : ((v > 255) ? 255 : (uint8_t)v);
-}
-
-// Convert YUYV (YUV422) to RGB
-// Input: 4 bytes [Y0, U, Y1, V] -> Output: 6 bytes [R,G,B, R,G,B]
-void yuyv_to_rgb(uint8_t *yuyv, uint8_t *rgb, int width, int height) {
-    int i, j;
-    int y0, u, y1, v;
-    int r, g, b;
-    int pixel_count = width * height;
-    
-    for (i = 0, j = 0; i < pixel_count * 2; i += 4, j += 6) {
-        y0 = yuyv[i];
-        u  = yuyv[i + 1] - 128;
-        y1 = yuyv[i + 2];
-        v  = yuyv[i + 3] - 128;
-
-        // --- Pixel 1 (Y0) ---
-        r = y0 + (1.402 * v);
-        g = y0 - (0.344136 * u) - (0.714136 * v);
-        b = y0 + (1.772 * u);
-        rgb[j]     = clamp(r);
-        rgb[j + 1] = clamp(g);
-        rgb[j + 2] = clamp(b);
-
-        // --- Pixel 2 (Y1) ---
-        r = y1 + (1.402 * v);
-        g = y1 - (0.344136 * u) - (0.714136 * v);
-        b = y1 + (1.772 * u);
-        rgb[j + 3] = clamp(r);
-        rgb[j + 4] = clamp(g);
-        rgb[j + 5] = clamp(b);
-    }
-}
+#include "pixfmt.h"
+#include "texture_screen.h"
+#include "golden.h"
+#include "illum.h"
+#include "tdenoise.h"
 
 static int xioctl(int fh, int request, void *arg) {
     int r;
@@ -69,19 +60,27 @@ int main() {
     struct timeval tv;
     int r;
     void *buffer_start;
+    struct pixfmt_ctx conv;
+    uint32_t fourcc;
+    int width, height, stride;
+    struct illum il;
+    struct tdenoise td;
 
     fd = open("/dev/video0", O_RDWR | O_NONBLOCK);
     if (fd < 0) { perror("Opening video0"); return 1; }
 
-    // 2. Set Format to YUYV (Raw Uncompressed)
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    // 2. Negotiate the cheapest format to convert to RGB
+    pixfmt_init(&conv, NUM_HARTS);
+    pixfmt_set_bayer(&conv, BAYER_BLACK, BAYER_GAIN_R, BAYER_GAIN_G, BAYER_GAIN_B);
+    if (pixfmt_calibrate(&conv, WIDTH, HEIGHT) != 0) { fprintf(stderr, "ERROR: pixfmt calibration failed\n"); return 1; }
     fmt.fmt.pix.width = WIDTH;
     fmt.fmt.pix.height = HEIGHT;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV; 
-    fmt.fmt.pix.field = V4L2_FIELD_NONE;
-
-    if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0) { perror("Setting Pixel Format"); return 1; }
-    printf("Camera configured: %d x %d YUYV\n", WIDTH, HEIGHT);
+    if (pixfmt_negotiate(&conv, fd, PIXFMT_DST_RGB24, &fmt) < 0) { perror("Setting Pixel Format"); return 1; }
+    fourcc = fmt.fmt.pix.pixelformat;
+    width = fmt.fmt.pix.width;
+    height = fmt.fmt.pix.height;
+    stride = fmt.fmt.pix.bytesperline;
+    printf("Camera configured: %d x %d %s\n", width, height, pixfmt_name(fourcc));
 
     // 3. Request Buffer
     req.count = 1;
@@ -103,6 +102,17 @@ int main() {
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) { perror("Start Capture"); return 1; }
 
+    // Bayer sources can be demosaiced straight to half resolution
+    int flags = (BAYER_HALF && pixfmt_is_bayer(fourcc)) ? PIXFMT_HALF : 0;
+    int out_w = flags ? width / 2 : width;
+    int out_h = flags ? height / 2 : height;
+
+    // Allocate RGB buffer (3 bytes per pixel)
+    uint8_t *rgb_data = malloc(pixfmt_dst_size(PIXFMT_DST_RGB24, out_w, out_h));
+    if (!rgb_data) { perror("Malloc failed"); return 1; }
+    illum_init(&il, ILLUM_GRAY_WORLD, WB_TARGET);
+    if (DENOISE_K < 2 || tdn_init(&td, fourcc, width, height, DENOISE_K) != 0) td.k = 0;
+
     // 6. Warm Up (Skip 10 frames for auto-exposure)
     printf("Warming up camera...\n");
     for(int i=0; i<10; i++) {
@@ -112,34 +122,99 @@ int main() {
         if (r <= 0) { perror("Timeout waiting for frame"); return 1; }
 
         xioctl(fd, VIDIOC_DQBUF, &buf);
+        if (WB_ENABLE && i == 8 && buf.bytesused > 0) {
+            // Exposure has settled: estimate the correction, it is folded into the LUTs
+            pixfmt_convert_ex(&conv, fourcc, PIXFMT_DST_RGB24, (uint8_t*)buffer_start, stride, rgb_data, width, height, flags);
+            illum_estimate(&il, rgb_data, out_w, out_h, 1.0f);
+            illum_apply(&il, &conv);
+            printf("White balance gains: R %.2f G %.2f B %.2f\n", il.gain[0], il.gain[1], il.gain[2]);
+        }
+        if (td.k && i >= 10 - td.k && buf.bytesused > 0) tdn_push(&td, buffer_start, stride);
         if (i < 9) xioctl(fd, VIDIOC_QBUF, &buf);
     }
 
     // 7. Capture Final Frame
     if (buf.bytesused > 0) {
         printf("Captured Raw Frame: %d bytes. Converting...\n", buf.bytesused);
-        
-        // Allocate RGB buffer (3 bytes per pixel)
-        uint8_t *rgb_data = malloc(WIDTH * HEIGHT * 3);
-        if (!rgb_data) { perror("Malloc failed"); return 1; }
 
-        // Convert Raw YUYV -> RGB
-        yuyv_to_rgb((uint8_t*)buffer_start, rgb_data, WIDTH, HEIGHT);
+        // Average of the last frames, same layout as the camera's
+        uint8_t *src = buffer_start;
+        int src_stride = stride;
+        uint8_t *avg = td.k ? malloc((size_t)td.rowb * height) : NULL;
+        if (avg) {
+            tdn_output(&td, avg, td.rowb);
+            tdn_print(&td);
+            src = avg;
+            src_stride = td.rowb;
+        }
+
+        // Convert Raw -> RGB, and luma for the golden-template screen
+        pixfmt_convert_ex(&conv, fourcc, PIXFMT_DST_RGB24, src, src_stride, rgb_data, width, height, flags);
+        uint8_t *luma = malloc(pixfmt_dst_size(PIXFMT_DST_GREY, out_w, out_h));
+        if (luma && pixfmt_convert_ex(&conv, fourcc, PIXFMT_DST_GREY, src, src_stride, luma, width, height, flags) != 0) {
+            free(luma);
+            luma = NULL;
+        }
+        free(avg);
 
-        // Write JPEG
-        if (stbi_write_jpg("image.jpg", WIDTH, HEIGHT, 3, rgb_data, QUALITY)) {
+        // Write JPEG, keeping the per-block DCT energies for the pre-screen
+        stbi_jpg_block_energy *features = malloc(texscreen_blocks(out_w, out_h) * sizeof(*features));
+        if (!features) { perror("Malloc failed"); return 1; }
+        if (stbi_write_jpg_features("image.jpg", out_w, out_h, 3, rgb_data, QUALITY, features)) {
             printf("Success! Saved as image.jpg\n");
+
+            // Texture pre-screen (tears, crush marks) straight from the encoder
+            struct texscreen ts;
+            struct texscreen_result res;
+            if (texscreen_init(&ts, out_w, out_h) != 0) {
+                printf("Pre-screen: not available\n");
+            } else if (texscreen_load(&ts, GOLDEN_DIR, GOLDEN_SKU) != 0 && errno != ENOENT) {
+                printf("Pre-screen: baseline for %s in %s not usable\n", GOLDEN_SKU, GOLDEN_DIR);
+            } else if (GOLDEN_LEARN) {
+                mkdir(GOLDEN_DIR, 0755);
+                texscreen_learn(&ts, features);
+                if (texscreen_save(&ts, GOLDEN_DIR, GOLDEN_SKU) == 0)
+                    printf("Pre-screen baseline: %s now %d frames\n", GOLDEN_SKU, ts.trained);
+            } else {
+                int suspicious = texscreen_eval(&ts, features, &res);
+                printf("Pre-screen: %s (%d blocks flagged, max z %.1f at block %d,%d%s)\n",
+                       suspicious ? "SUSPICIOUS" : "clean", res.flagged, res.max_z, res.worst_bx, res.worst_by,
+                       res.learned ? "" : ", frame statistics");
+            }
+            texscreen_free(&ts);
+
+            // Golden template: does it look like a good box of this SKU at all
+            struct golden g = {0};
+            struct golden_result gr;
+            if (!luma || golden_init(&g, out_w, out_h) != 0) {
+                printf("Golden screen: not available at %d x %d\n", out_w, out_h);
+            } else if (golden_load(&g, GOLDEN_DIR, GOLDEN_SKU) != 0 && (errno != ENOENT || !GOLDEN_LEARN)) {
+                printf("Golden screen: no template for %s in %s\n", GOLDEN_SKU, GOLDEN_DIR);
+            } else if (GOLDEN_LEARN) {
+                mkdir(GOLDEN_DIR, 0755);
+                if (golden_learn(&g, luma, out_w) != 0) printf("Golden template: frame does not match %s, left out\n", GOLDEN_SKU);
+                else if (golden_save(&g, GOLDEN_DIR, GOLDEN_SKU) == 0) printf("Golden template: %s now %d frames\n", GOLDEN_SKU, g.trained);
+            } else {
+                int suspicious = golden_eval(&g, luma, out_w, &gr);
+                printf("Golden screen: %s (ncc %.2f at %+d,%+d, %d blocks flagged, max z %.1f at block %d,%d)\n",
+                       suspicious ? "SUSPICIOUS" : "clean", gr.ncc, gr.dx, gr.dy, gr.flagged, gr.max_z, gr.worst_bx, gr.worst_by);
+            }
+            golden_free(&g);
         } else {
             printf("Error: Failed to write JPEG file.\n");
         }
 
-        free(rgb_data);
+        free(features);
+        free(luma);
     } else {
         printf("Error: Captured 0 bytes\n");
     }
+    free(rgb_data);
 
     // 8. Cleanup
     xioctl(fd, VIDIOC_STREAMOFF, &type);
     close(fd);
+    if (td.k) tdn_free(&td);
+    pixfmt_destroy(&conv);
     return 0;
 }
\ No newline at end of file
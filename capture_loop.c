@@ -0,0 +1,670 @@
+// Continuous capture daemon.
+// Streams from the camera and encodes frames on the per-hart encoder pool,
+// each hart straight into its own mmap'd archive segments (records carry
+// the frame sequence number; readers merge by it). The frame rate follows the
+// belt: when serial_pwm stops it (or nothing moves for a while) the camera
+// drops to an idle rate and nothing is encoded, see caprate.h.
+//
+// The encoder reads each frame in place in the driver's buffer, under a
+// lease that requeues it when the encoder is done (vlease.h); only when
+// fewer than MIN_QUEUED buffers are left with the driver is a frame copied.
+//
+// The #defines below are defaults; the config file (config.h) overrides
+// them and is reloaded on SIGHUP or when it changes. Frame rates, quality,
+// budget and motion thresholds apply on the next frame; a new ROI drains
+// and rebuilds the encoder pool, and a new resolution also restarts the
+// stream, both between frames so nothing in flight is lost.
+//
+// With trigger_line set, a photo sensor on that GPIO line of TRIGGER_CHIP
+// picks the frames instead: only the frame nearest each edge plus
+// trigger_offset_us is encoded (gpiotrig.h), and an edge ends idle mode.
+//
+// With strobe_channel set, that channel of STROBE_CHIP fires a
+// strobe_pulse_us LED pulse per frame at the V4L2 timestamp plus
+// strobe_offset_us, phase-locked to the frame clock (strobe.h).
+//
+// With denoise_k > 1 (packed 4:2:2 cameras), every full-rate frame goes
+// into a temporal average of the last denoise_k aligned frames
+// (tdenoise.h) and the average is what gets encoded, so a shorter exposure
+// can be used without the noise. The capture buffer goes straight back to
+// the driver; the average is written into one of NBUF output buffers.
+//
+// White balance: every WB_EVERY encoded frames, one is also converted on
+// this thread with the encoder's current tables and goes into a slowly
+// updated gray world estimate (illum.h). The encoder takes the new gains
+// between two submissions (encpool_set_wb()), so no frame is ever converted
+// with tables that are half old, half new.
+//
+// Frames archived per second and capture-to-archive latency go to the HMI
+// chart (nextion.h, NX_CHART_SOCK) when serial_pwm has one configured.
+//
+// Live upgrade: a running capture_loop listens on HANDOFF_DIR/capture_loop-
+// <device>.sock. A new binary started for the same device connects there
+// first and is handed the video fd, the buffer layout and the rate and
+// trigger state (handoff.h); it maps the same buffers and goes on
+// dequeuing, with no format negotiation, no REQBUFS and no warm-up frames.
+// The old process drains its encoder into the archive before letting go
+// and exits without STREAMOFF once the new one has acknowledged. The strobe
+// is not handed over: the new process reopens its channel and re-arms
+// after STROBE_MIN_FRAMES frames.
+//
+// Usage: capture_loop [device] [out_dir] [seconds] [config]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include <stdint.h>
+
+#define WIDTH      320
+#define HEIGHT     240
+#define QUALITY    90
+#define NUM_HARTS  4
+#define NBUF       8            // capture buffers; NUM_HARTS of them can be in the encoder
+#define MIN_QUEUED 2            // fewer left with the driver and frames are copied out (vlease.h)
+#define FULL_FPS   30
+#define IDLE_FPS   2
+#define ENCODE_BUDGET_US 120000 // per frame: NUM_HARTS frame periods at FULL_FPS less margin, 0 = always QUALITY
+#define BELT_ENABLE "/sys/class/pwm/pwmchip0/pwm0/enable"
+#define STATS_EVERY_S 10      // also on SIGUSR1
+#define CONFIG_PATH "/etc/conveyor.conf"
+#define TRIGGER_CHIP "/dev/gpiochip0"
+#define TRIGGER_DEBOUNCE_US 1000
+#define STROBE_CHIP "/sys/class/pwm/pwmchip0"   // belt on channel 0, see serial_pwm
+#define HANDOFF_DIR "/run"
+#define WB_EVERY   30           // encoded frames between white balance estimates, 0 = off
+#define WB_RATE    0.1f         // how much of each new estimate goes in
+// ---------------------
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "pixfmt.h"
+#include "encpool.h"
+#include "archive_sink.h"
+#include "caprate.h"
+#include "telemetry.h"
+#include "config.h"
+#include "gpiotrig.h"
+#include "tdenoise.h"
+#include "handoff.h"
+#include "strobe.h"
+#include "nextion.h"
+#include "vlease.h"
+#include "illum.h"
+
+struct buffer {
+    void *start;
+    size_t length;
+};
+
+// Negotiated camera stream
+struct stream {
+    struct buffer buffers[NBUF];
+    int nbuf;
+    uint32_t fourcc;
+    int width, height, stride;
+};
+
+// What a new binary needs to carry on with the stream (fds: video, trigger line)
+#define HANDOFF_CAPTURE 1
+struct capture_handoff {
+    int cfg_width, cfg_height;          // what the stream was set up for
+    uint32_t fourcc;
+    int width, height, stride, nbuf;
+    uint32_t buf_off[NBUF], buf_len[NBUF];      // mmap offsets; all buffers are queued
+    int rate_mode;
+    int trig_count;
+    double trig_period_ns;
+    uint64_t trig_target[GPIOTRIG_MAX_PENDING];
+};
+
+// Encoded region: byte offset of its first column, first row, size
+struct roi {
+    int x_bytes, y;
+    int width, height;
+};
+
+static volatile int keep_running = 1;
+static volatile int dump_stats = 0;
+
+static struct tm_hist dequeue_us = TM_HIST("dequeue", "us");    // driver timestamp -> DQBUF
+static struct tm_hist archived_us = TM_HIST("archived", "us");  // driver timestamp -> committed to the archive
+static struct tm_counter frames_in = TM_COUNTER("frames");
+static struct tm_counter frames_archived = TM_COUNTER("archived");
+static struct tm_counter frames_dropped = TM_COUNTER("dropped");
+static uint64_t archived, archived_bytes;
+static int chart_fd = -1;                                       // samples for the HMI chart
+static struct illum wb;                                         // gray world estimate
+static uint8_t *wb_rgb;                                         // a frame as the encoder converts it
+static int wb_frames;
+
+void int_handler(int signum) {
+    (void)signum;
+    keep_running = 0;
+}
+
+void usr1_handler(int signum) {
+    (void)signum;
+    dump_stats = 1;
+}
+
+// V4L2 timestamps are CLOCK_MONOTONIC on every driver we use
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int xioctl(int fh, int request, void *arg) {
+    int r;
+    do { r = ioctl(fh, request, arg); } while (-1 == r && EINTR == errno);
+    return r;
+}
+
+static int queue_buffer(int fd, int index) {
+    struct v4l2_buffer buf = {0};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    return xioctl(fd, VIDIOC_QBUF, &buf);
+}
+
+// Format, buffers, STREAMON
+static int stream_start(int fd, struct pixfmt_ctx *conv, const struct cfg *c, struct stream *st) {
+    struct v4l2_format fmt = {0};
+    struct v4l2_requestbuffers req = {0};
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    fmt.fmt.pix.width = c->width;
+    fmt.fmt.pix.height = c->height;
+    if (pixfmt_negotiate(conv, fd, PIXFMT_DST_RGB24, &fmt) < 0) return -1;
+    st->fourcc = fmt.fmt.pix.pixelformat;
+    st->width = fmt.fmt.pix.width;
+    st->height = fmt.fmt.pix.height;
+    st->stride = fmt.fmt.pix.bytesperline;
+    printf("Camera configured: %d x %d %s\n", st->width, st->height, pixfmt_name(st->fourcc));
+
+    req.count = NBUF;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) { perror("Requesting Buffers"); return -1; }
+    st->nbuf = req.count < NBUF ? (int)req.count : NBUF;
+    for (int i = 0; i < st->nbuf; i++) {
+        struct v4l2_buffer buf = {0};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("Querying Buffer"); return -1; }
+        st->buffers[i].length = buf.length;
+        st->buffers[i].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if (st->buffers[i].start == MAP_FAILED) { perror("Mapping Buffer"); return -1; }
+        if (queue_buffer(fd, i) < 0) { perror("Queueing Buffer"); return -1; }
+    }
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) { perror("Start Capture"); return -1; }
+    return 0;
+}
+
+// Map the buffers of a stream another process started; it keeps streaming throughout
+static int stream_adopt(int fd, const struct capture_handoff *h, struct stream *st) {
+    st->fourcc = h->fourcc;
+    st->width = h->width;
+    st->height = h->height;
+    st->stride = h->stride;
+    st->nbuf = 0;
+    if (h->nbuf < 2 || h->nbuf > NBUF) return -1;
+    for (int i = 0; i < h->nbuf; i++) {
+        st->buffers[i].length = h->buf_len[i];
+        st->buffers[i].start = mmap(NULL, h->buf_len[i], PROT_READ | PROT_WRITE, MAP_SHARED, fd, h->buf_off[i]);
+        if (st->buffers[i].start == MAP_FAILED) { perror("Mapping Buffer"); return -1; }
+        st->nbuf++;
+    }
+    printf("Camera taken over: %d x %d %s, %d buffers\n", st->width, st->height, pixfmt_name(st->fourcc), st->nbuf);
+    return 0;
+}
+
+static void stream_unmap(struct stream *st) {
+    for (int i = 0; i < st->nbuf; i++) munmap(st->buffers[i].start, st->buffers[i].length);
+    st->nbuf = 0;
+}
+
+static void stream_stop(int fd, struct stream *st) {
+    struct v4l2_requestbuffers req = {0};
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    stream_unmap(st);
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(fd, VIDIOC_REQBUFS, &req);      // count 0 frees the buffers so S_FMT is allowed again
+}
+
+// Leases on the stream's buffers, all of them queued
+static void lease_start(struct vlease *vl, int fd, const struct stream *st) {
+    vlease_init(vl, fd, MIN_QUEUED);
+    for (int i = 0; i < st->nbuf; i++) vlease_add(vl, st->buffers[i].start, st->buffers[i].length);
+}
+
+// Clip the configured ROI to the stream; planar formats always encode the whole frame
+static struct roi roi_for(const struct cfg *c, const struct stream *st) {
+    struct roi r = { 0, 0, st->width, st->height };
+    if (!c->roi_w || !c->roi_h) return r;
+    if (st->fourcc == V4L2_PIX_FMT_NV12 || st->fourcc == V4L2_PIX_FMT_NV16) {
+        fprintf(stderr, "WARNING: ROI ignored for planar %s\n", pixfmt_name(st->fourcc));
+        return r;
+    }
+    // Even offsets and sizes keep YUYV pairs and Bayer quads whole
+    int x = c->roi_x & ~1, y = c->roi_y & ~1;
+    if (x >= st->width - 16 || y >= st->height - 16) return r;
+    r.width = (c->roi_w < st->width - x ? c->roi_w : st->width - x) & ~1;
+    r.height = (c->roi_h < st->height - y ? c->roi_h : st->height - y) & ~1;
+    r.x_bytes = pixfmt_min_stride(st->fourcc, x);
+    r.y = y;
+    return r;
+}
+
+// Hand the encoder the latest white balance estimate. It refuses while
+// frames submitted under its spare tables are queued; force is for a new pool.
+static void wb_push(struct encpool *ep, int force) {
+    int gain[3], offset[3];
+    if (!force && wb.generation == wb.applied) return;
+    illum_params(&wb, gain, offset);
+    if (encpool_set_wb(ep, gain, offset) == 0) illum_applied(&wb, gain, offset);
+}
+
+// Before each submission: every WB_EVERY frames estimate from this one
+static void white_balance(struct encpool *ep, const uint8_t *src, int stride) {
+    if (!wb_rgb) return;
+    if (++wb_frames >= WB_EVERY) {
+        wb_frames = 0;
+        if (pixfmt_convert_serial(encpool_conv(ep), ep->fourcc, PIXFMT_DST_RGB24, src, stride, wb_rgb, ep->width, ep->height, 0) == 0)
+            illum_estimate(&wb, wb_rgb, ep->width, ep->height, WB_RATE);
+    }
+    wb_push(ep, 0);
+}
+
+// Each hart encodes into its own archive segments, <out_dir>/cam<hart>_<seq>.arc
+static int encoder_start(struct encpool *ep, const struct cfg *c, const struct stream *st, struct roi *roi, const char *out_dir) {
+    // At most one frame per hart in the encoder, the rest stay with the driver
+    int harts = NUM_HARTS < st->nbuf - 1 ? NUM_HARTS : st->nbuf - 1;
+    *roi = roi_for(c, st);
+    if (encpool_init(ep, harts, 1, st->fourcc, roi->width, roi->height, c->quality) != 0) return -1;
+    encpool_archive(ep, out_dir, "cam");
+    if (c->encode_budget_us) encpool_set_budget(ep, c->encode_budget_us);
+    if (WB_EVERY > 0) {
+        // A new pool's tables are neutral; the estimate carries over
+        uint8_t *rgb = realloc(wb_rgb, pixfmt_dst_size(PIXFMT_DST_RGB24, roi->width, roi->height));
+        if (!rgb) fprintf(stderr, "WARNING: no memory for white balance, off\n");
+        else wb_rgb = rgb;
+        wb_push(ep, 1);
+    }
+    if (roi->width != st->width || roi->height != st->height)
+        printf("Encoding ROI %dx%d of %dx%d\n", roi->width, roi->height, st->width, st->height);
+    return 0;
+}
+
+// Temporal denoiser and its output ring, if configured and the format allows
+static void denoise_start(struct tdenoise *td, uint8_t **out, const struct cfg *c, const struct stream *st) {
+    td->k = 0;
+    if (c->denoise_k < 2) return;
+    if (tdn_init(td, st->fourcc, st->width, st->height, c->denoise_k) != 0) {
+        fprintf(stderr, "WARNING: no denoising for %s\n", pixfmt_name(st->fourcc));
+        td->k = 0;
+        return;
+    }
+    // Up to NUM_HARTS averages are in the encoder at once, so NBUF never wrap onto one
+    for (int i = 0; i < NBUF; i++) {
+        out[i] = malloc((size_t)td->rowb * td->height);
+        if (!out[i]) { perror("Malloc failed"); tdn_free(td); td->k = 0; return; }
+    }
+    printf("Denoise: averaging %d frames\n", td->k);
+}
+
+static void denoise_stop(struct tdenoise *td, uint8_t **out) {
+    if (!td->k) return;
+    tdn_free(td);
+    for (int i = 0; i < NBUF; i++) { free(out[i]); out[i] = NULL; }
+}
+
+// Photo-sensor trigger, if configured; without one every frame caprate passes is encoded
+static void trigger_start(struct gpiotrig *gt, const struct cfg *c) {
+    gt->fd = -1;
+    if (c->trigger_line < 0) return;
+    if (gpiotrig_open(gt, TRIGGER_CHIP, c->trigger_line, c->trigger_falling, TRIGGER_DEBOUNCE_US, c->trigger_offset_us) != 0)
+        fprintf(stderr, "WARNING: no trigger, encoding on presence detection\n");
+}
+
+// LED strobe, if configured
+static void strobe_start(struct strobe *sb, const struct cfg *c) {
+    sb->running = 0;
+    if (c->strobe_channel < 0) return;
+    if (strobe_open(sb, STROBE_CHIP, c->strobe_channel, c->strobe_pulse_us, c->strobe_offset_us) != 0)
+        fprintf(stderr, "WARNING: no strobe\n");
+}
+
+// State for a successor; every buffer must be back with the driver (encoder drained)
+static int handoff_state(int fd, const struct cfg *c, const struct stream *st, const struct caprate *cr,
+                         const struct gpiotrig *gt, struct capture_handoff *h) {
+    memset(h, 0, sizeof(*h));
+    h->cfg_width = c->width;
+    h->cfg_height = c->height;
+    h->fourcc = st->fourcc;
+    h->width = st->width;
+    h->height = st->height;
+    h->stride = st->stride;
+    h->nbuf = st->nbuf;
+    for (int i = 0; i < st->nbuf; i++) {
+        struct v4l2_buffer buf = {0};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("Querying Buffer"); return -1; }
+        h->buf_off[i] = buf.m.offset;
+        h->buf_len[i] = buf.length;
+    }
+    h->rate_mode = cr->mode;
+    if (gt->fd >= 0) {
+        h->trig_count = gt->count;
+        h->trig_period_ns = gt->period_ns;
+        for (int i = 0; i < gt->count; i++) h->trig_target[i] = gt->target[(gt->head + i) % GPIOTRIG_MAX_PENDING];
+    }
+    return 0;
+}
+
+// Count one archived frame (the hart committed it already) and drop the
+// encoder's lease on its capture buffer
+static void collect(struct encpool *ep, struct vframe **held, struct encpool_result *r) {
+    if (r->len > 0) {
+        uint64_t lat = now_us() - r->timestamp_us;
+        tm_record(&archived_us, lat);
+        nx_chart_send(chart_fd, NX_CHART_LATENCY, lat / 1000.0);
+        tm_count(&frames_archived, 1);
+        archived++;
+        archived_bytes += r->len;
+    }
+    if (held[r->seq % NBUF]) vlease_put(held[r->seq % NBUF]);     // NULL: denoised copy
+    encpool_release(ep, r);
+}
+
+// Frame boundary: everything submitted is encoded and archived
+static void encoder_drain(struct encpool *ep, struct vframe **held) {
+    struct encpool_result r;
+    encpool_close(ep);
+    while (encpool_next(ep, &r)) collect(ep, held, &r);
+}
+
+int main(int argc, char **argv) {
+    const char *dev = (argc >= 2) ? argv[1] : "/dev/video0";
+    const char *out_dir = (argc >= 3) ? argv[2] : "archive";
+    double seconds = (argc >= 4) ? atof(argv[3]) : 0;
+    const char *config_path = (argc >= 5) ? argv[4] : CONFIG_PATH;
+    struct pixfmt_ctx conv;
+    struct stream st = {0};
+    struct roi roi;
+    struct encpool ep;
+    struct caprate cr;
+    struct encpool_result r;
+    struct cfg_store cs;
+    struct gpiotrig gt;
+    struct strobe sb;
+    struct tdenoise td;
+    uint8_t *den_out[NBUF] = {0};
+    uint64_t den_next = 0;
+    struct vlease vl;
+    struct vframe *held[NBUF];          // the encoder's leases, by sequence number
+    int fd, handed = 0, calibrated = 0;
+
+    // 1. Config: the #defines are the defaults
+    struct cfg def = cfg_builtin();
+    def.width = WIDTH;
+    def.height = HEIGHT;
+    def.quality = QUALITY;
+    def.fps = FULL_FPS;
+    def.idle_fps = IDLE_FPS;
+    def.encode_budget_us = ENCODE_BUDGET_US;
+    if (cfg_init(&cs, config_path, &def) != 0) return 1;
+    const struct cfg *c = cfg_get(&cs);
+    cfg_print(c);
+    illum_init(&wb, ILLUM_GRAY_WORLD, 0);
+
+    // 2. Stream: take over from a running capture_loop on this device, or start it
+    char sock_path[108];
+    const char *base = strrchr(dev, '/');
+    snprintf(sock_path, sizeof(sock_path), "%s/capture_loop-%s.sock", HANDOFF_DIR, base ? base + 1 : dev);
+    struct capture_handoff h;
+    int hfds[2], nh = 0;
+    int peer = handoff_connect(sock_path);
+    pixfmt_init(&conv, 1);
+    if (peer >= 0) {
+        nh = handoff_recv(peer, HANDOFF_CAPTURE, &h, sizeof(h), hfds, 2);
+        if (nh < 1 || stream_adopt(hfds[0], &h, &st) != 0) {
+            fprintf(stderr, "ERROR: cannot take over from the running capture_loop\n");
+            return 1;
+        }
+        fd = hfds[0];
+        if (handoff_ack(peer) != 0) { fprintf(stderr, "ERROR: predecessor went away during the handoff\n"); return 1; }
+        if (h.cfg_width != c->width || h.cfg_height != c->height) {
+            // The config changed under the old binary; renegotiate as a reload would,
+            // once it has unmapped the buffers (REQBUFS refuses while they are mapped)
+            handoff_wait_close(peer);
+            if (pixfmt_calibrate(&conv, c->width, c->height) != 0) { fprintf(stderr, "ERROR: pixfmt calibration failed\n"); return 1; }
+            calibrated = 1;
+            stream_stop(fd, &st);
+            if (stream_start(fd, &conv, c, &st) != 0) return 1;
+        }
+        close(peer);
+    } else {
+        fd = open(dev, O_RDWR | O_NONBLOCK);
+        if (fd < 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", dev, strerror(errno)); return 1; }
+        if (pixfmt_calibrate(&conv, c->width, c->height) != 0) { fprintf(stderr, "ERROR: pixfmt calibration failed\n"); return 1; }
+        calibrated = 1;
+        if (stream_start(fd, &conv, c, &st) != 0) return 1;
+    }
+    lease_start(&vl, fd, &st);
+    mkdir(out_dir, 0755);
+    if (encoder_start(&ep, c, &st, &roi, out_dir) != 0) return 1;
+    denoise_start(&td, den_out, c, &st);
+
+    caprate_init(&cr, fd, c->fps, c->idle_fps, BELT_ENABLE);
+    cr.idle_after_s = c->idle_after_s;
+    cr.motion_diff = c->motion_diff;
+    cr.motion_permille = c->motion_permille;
+    if (peer >= 0 && h.rate_mode == CAPRATE_IDLE) caprate_enter(&cr, CAPRATE_IDLE, pixfmt_now_ns(), 0);
+    if (nh == 2 && c->trigger_line >= 0) {
+        gpiotrig_adopt(&gt, hfds[1], c->trigger_offset_us);
+        gt.period_ns = h.trig_period_ns;
+        gt.count = h.trig_count;
+        memcpy(gt.target, h.trig_target, sizeof(gt.target));
+    } else {
+        if (nh == 2) close(hfds[1]);
+        trigger_start(&gt, c);
+    }
+    strobe_start(&sb, c);
+    int hs = handoff_listen(sock_path);
+
+    signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
+    signal(SIGUSR1, usr1_handler);
+
+    double t0 = pixfmt_now_ns(), next_stats = t0 + STATS_EVERY_S * 1e9, next_chart = t0;
+    chart_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    uint64_t dropped = 0;
+    while (keep_running && (seconds <= 0 || pixfmt_now_ns() - t0 < seconds * 1e9)) {
+        struct pollfd pfd[4] = { { fd, POLLIN, 0 }, { cfg_fd(&cs), POLLIN, 0 }, { gt.fd, POLLIN, 0 }, { hs, POLLIN, 0 } };
+        int n = poll(pfd, 4, caprate_timeout_ms(&cr));
+        double now = pixfmt_now_ns();
+        if (n < 0 && errno != EINTR) { perror("poll"); break; }
+
+        // Edges first, so a frame dequeued in the same wakeup can already match
+        if (n > 0 && (pfd[2].revents & POLLIN) && gpiotrig_read(&gt)) caprate_wake(&cr, now);
+
+        if (n > 0 && (pfd[0].revents & POLLIN)) {
+            struct vframe *f = vlease_dequeue(&vl);
+            if (f) {
+                const uint8_t *data = f->data;
+                uint64_t ts = f->ts_us;
+                tm_record(&dequeue_us, now_us() - ts);
+                tm_count(&frames_in, 1);
+                int take = f->bytesused && caprate_frame(&cr, data, st.fourcc, st.width, st.height, st.stride, now);
+                if (gt.fd >= 0) take = f->bytesused && gpiotrig_frame(&gt, ts * 1000);
+                if (sb.running && f->bytesused) strobe_frame(&sb, ts * 1000);
+                if (td.k && f->bytesused) {
+                    if (cr.mode == CAPRATE_FULL) tdn_push(&td, data, st.stride);
+                    else tdn_reset(&td);
+                }
+                if (!take) {
+                    vlease_put(f);
+                } else if (encpool_full(&ep)) {
+                    // Every hart busy: drop rather than stall the driver
+                    vlease_put(f);
+                    dropped++;
+                    tm_count(&frames_dropped, 1);
+                } else if (td.k && td.n) {
+                    uint8_t *avg = den_out[den_next++ % NBUF];
+                    tdn_output(&td, avg, td.rowb);
+                    vlease_put(f);
+                    white_balance(&ep, avg + (size_t)roi.y * td.rowb + roi.x_bytes, td.rowb);
+                    held[encpool_submit(&ep, avg + (size_t)roi.y * td.rowb + roi.x_bytes, td.rowb, ts) % NBUF] = NULL;
+                } else {
+                    // The encoder reads the driver buffer (or its copy) in place; collect() drops the lease.
+                    // Also the way out when a trigger fires outside full rate and the denoiser has no history.
+                    white_balance(&ep, data + (size_t)roi.y * st.stride + roi.x_bytes, st.stride);
+                    held[encpool_submit(&ep, data + (size_t)roi.y * st.stride + roi.x_bytes, st.stride, ts) % NBUF] = f;
+                }
+            } else if (errno != EAGAIN) {
+                perror("Dequeue Buffer");
+                break;
+            }
+        } else if (n == 0) {
+            caprate_tick(&cr, now);
+        }
+
+        while (encpool_ready(&ep) && encpool_next(&ep, &r))
+            collect(&ep, held, &r);
+
+        // Config reload (SIGHUP or the file changed); we hold no snapshot across this
+        const struct cfg *old = c;
+        if (cfg_poll(&cs)) {
+            c = cfg_get(&cs);
+            unsigned what = cfg_diff(old, c);
+            cfg_print(c);
+            if (c->quality != old->quality) encpool_set_quality(&ep, c->quality);
+            if (c->encode_budget_us != old->encode_budget_us) encpool_set_budget(&ep, c->encode_budget_us);
+            if (c->fps != old->fps || c->idle_fps != old->idle_fps) caprate_set_rates(&cr, c->fps, c->idle_fps);
+            cr.idle_after_s = c->idle_after_s;
+            cr.motion_diff = c->motion_diff;
+            cr.motion_permille = c->motion_permille;
+            gt.offset_us = c->trigger_offset_us;
+            if (what & CFG_APPLY_TRIGGER) {
+                gpiotrig_close(&gt);
+                trigger_start(&gt, c);
+            }
+            if (what & CFG_APPLY_STROBE) {
+                strobe_close(&sb);
+                strobe_start(&sb, c);
+            } else if (sb.running) {
+                strobe_set(&sb, c->strobe_pulse_us, c->strobe_offset_us);
+            }
+
+            if (what & (CFG_APPLY_ENCODER | CFG_APPLY_STREAM)) {
+                double t1 = pixfmt_now_ns();
+                encoder_drain(&ep, held);
+                encpool_budget_print(&ep);
+                encpool_destroy(&ep);
+                denoise_stop(&td, den_out);
+                if (what & CFG_APPLY_STREAM) {
+                    if (!calibrated) pixfmt_calibrate(&conv, c->width, c->height);     // skipped after a takeover
+                    calibrated = 1;
+                    vlease_free(&vl);
+                    stream_stop(fd, &st);
+                    if (stream_start(fd, &conv, c, &st) != 0) return 1;
+                    lease_start(&vl, fd, &st);
+                    caprate_set_rates(&cr, c->fps, c->idle_fps);    // S_PARM does not survive S_FMT everywhere
+                }
+                if (encoder_start(&ep, c, &st, &roi, out_dir) != 0) return 1;
+                denoise_start(&td, den_out, c, &st);
+                printf("Config: %s applied in %.1f ms\n", what & CFG_APPLY_STREAM ? "stream" : "encoder",
+                       (pixfmt_now_ns() - t1) / 1e6);
+            }
+        }
+
+        // A new binary wants the camera: finish what is in flight, hand over, and go if it took it
+        if (n > 0 && (pfd[3].revents & POLLIN) && (peer = handoff_accept(hs)) >= 0) {
+            int fds[2] = { fd, gt.fd };
+            encoder_drain(&ep, held);
+            encpool_budget_print(&ep);
+            encpool_destroy(&ep);
+            denoise_stop(&td, den_out);
+            strobe_close(&sb);              // the successor reopens the channel and re-arms
+            handed = handoff_state(fd, c, &st, &cr, &gt, &h) == 0 &&
+                     handoff_send(peer, HANDOFF_CAPTURE, &h, sizeof(h), fds, gt.fd >= 0 ? 2 : 1) == 0 &&
+                     handoff_wait_ack(peer) == 0;
+            if (handed) stream_unmap(&st);
+            close(peer);
+            if (handed) {
+                printf("Handoff: stream handed to the new binary\n");
+                break;
+            }
+            if (encoder_start(&ep, c, &st, &roi, out_dir) != 0) return 1;
+            denoise_start(&td, den_out, c, &st);
+            strobe_start(&sb, c);
+        }
+
+        if (now >= next_chart) {
+            nx_chart_send(chart_fd, NX_CHART_THROUGHPUT, tm_counter_rate(&frames_archived, 1));
+            next_chart = now + 1e9;
+        }
+
+        if (now >= next_stats || dump_stats) {
+            caprate_print(&cr, now);
+            if (gt.fd >= 0) gpiotrig_print(&gt);
+            if (sb.running) strobe_print(&sb);
+            vlease_print(&vl);
+            if (td.k) tdn_print(&td);
+            printf("Archive: %llu frames, %.1f MB, %llu dropped (encoder busy)\n", (unsigned long long)archived,
+                   archived_bytes / 1e6, (unsigned long long)dropped);
+            encpool_budget_print(&ep);
+            tm_print(stdout);
+            next_stats = now + STATS_EVERY_S * 1e9;
+            dump_stats = 0;
+        }
+    }
+
+    // 3. Drain and clean up. After a handoff the encoder and archive are closed
+    // already, and the stream and trigger line carry on in the new process.
+    if (!handed) encoder_drain(&ep, held);
+    caprate_print(&cr, pixfmt_now_ns());
+    if (gt.fd >= 0) gpiotrig_print(&gt);
+    if (sb.running) strobe_print(&sb);
+    vlease_print(&vl);
+    printf("Archive: %llu frames, %.1f MB, %llu dropped (encoder busy)\n", (unsigned long long)archived,
+           archived_bytes / 1e6, (unsigned long long)dropped);
+    if (!handed) encpool_budget_print(&ep);
+    tm_print(stdout);
+
+    vlease_free(&vl);
+    if (!handed) {
+        stream_stop(fd, &st);
+        encpool_destroy(&ep);
+        denoise_stop(&td, den_out);
+    }
+    if (hs >= 0) {
+        close(hs);
+        if (!handed) unlink(sock_path);     // after a handoff the path is the new process's socket
+    }
+    caprate_free(&cr);
+    gpiotrig_close(&gt);
+    strobe_close(&sb);
+    pixfmt_destroy(&conv);
+    cfg_destroy(&cs);
+    if (chart_fd >= 0) close(chart_fd);
+    free(wb_rgb);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// PNG checksum throughput benchmark.
+// Times the CRC-32 and Adler-32 in stb_image_write.h bytewise and with the
+// fast paths (slicing-by-8 CRC, 8-bytes-per-word Adler), checks they agree
+// on every length and alignment, then encodes a lossless evidence-sized PNG
+// with each and compares time and output.
+//
+// Usage: checksum_bench [MB] [width] [height]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define REPEAT 5
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned int run(int which, int impl, unsigned char *buf, int len) {
+    stbi_write_checksum_impl = impl;
+    return which ? stbiw__adler32(buf, len) : stbiw__crc32(buf, len);
+}
+
+int main(int argc, char **argv) {
+    int mb = (argc >= 2) ? atoi(argv[1]) : 16;
+    int width = (argc >= 3) ? atoi(argv[2]) : 1280;
+    int height = (argc >= 4) ? atoi(argv[3]) : 960;
+    int len = mb << 20;
+    unsigned char *buf = malloc(len + 8);
+    if (!buf) { perror("Malloc failed"); return 1; }
+    srand(1);
+    for (int i = 0; i < len + 8; i++) buf[i] = (unsigned char)rand();
+
+    // 1. Same answer for every short length and misalignment
+    for (int which = 0; which < 2; which++) {
+        for (int off = 0; off < 8; off++) {
+            for (int n = 0; n < 300; n++) {
+                if (run(which, 1, buf + off, n) != run(which, 2, buf + off, n)) {
+                    fprintf(stderr, "ERROR: %s mismatch at offset %d length %d\n", which ? "Adler-32" : "CRC-32", off, n);
+                    return 1;
+                }
+            }
+        }
+        if (run(which, 1, buf + 3, len) != run(which, 2, buf + 3, len)) {
+            fprintf(stderr, "ERROR: %s mismatch on %d MB\n", which ? "Adler-32" : "CRC-32", mb);
+            return 1;
+        }
+    }
+
+    // 2. Raw throughput
+    printf("%d MB buffer, best of %d\n", mb, REPEAT);
+    printf("checksum    bytewise MB/s   fast MB/s   speedup\n");
+    for (int which = 0; which < 2; which++) {
+        double best[3] = { 0, 1e30, 1e30 };
+        for (int impl = 1; impl <= 2; impl++) {
+            for (int r = 0; r < REPEAT; r++) {
+                double t0 = now_ns();
+                volatile unsigned int c = run(which, impl, buf, len);
+                (void)c;
+                double dt = now_ns() - t0;
+                if (dt < best[impl]) best[impl] = dt;
+            }
+        }
+        printf("%-10s  %12.1f   %9.1f   %6.2fx\n", which ? "Adler-32" : "CRC-32",
+               len / best[1] * 1e3, len / best[2] * 1e3, best[1] / best[2]);
+    }
+
+    // 3. Whole PNG: smooth image so deflate is quick and the checksums show
+    unsigned char *rgb = malloc((size_t)width * height * 3);
+    if (!rgb) { perror("Malloc failed"); return 1; }
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width * 3; x++) rgb[(size_t)y * width * 3 + x] = (unsigned char)((x / 3 + y) / 4 + (x % 3) * 40);
+    unsigned char *png[3] = { 0 };
+    int png_len[3] = { 0 };
+    double best[3] = { 0, 1e30, 1e30 };
+    for (int r = 0; r < REPEAT; r++) {
+        for (int impl = 1; impl <= 2; impl++) {     // interleaved, so drift hits both alike
+            stbi_write_checksum_impl = impl;
+            double t0 = now_ns();
+            unsigned char *p = stbi_write_png_to_mem(rgb, width * 3, width, height, 3, &png_len[impl]);
+            double dt = now_ns() - t0;
+            if (!p) { fprintf(stderr, "ERROR: PNG encode failed\n"); return 1; }
+            if (dt < best[impl]) best[impl] = dt;
+            STBIW_FREE(png[impl]);
+            png[impl] = p;
+        }
+    }
+    if (png_len[1] != png_len[2] || memcmp(png[1], png[2], png_len[1])) { fprintf(stderr, "ERROR: PNG output differs\n"); return 1; }
+    printf("PNG %dx%d (%d KB): %.1f ms bytewise, %.1f ms fast (%.2fx)\n", width, height, png_len[1] / 1024,
+           best[1] / 1e6, best[2] / 1e6, best[1] / best[2]);
+
+    STBIW_FREE(png[1]);
+    STBIW_FREE(png[2]);
+    free(rgb);
+    free(buf);
+    return 0;
+}
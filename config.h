@@ -0,0 +1,362 @@
+// config.h - Hot-reloadable runtime configuration.
+//
+// The #defines at the top of each tool stay as the defaults; a config file
+// of "key = value" lines (# starts a comment) overrides them, and is re-read
+// on SIGHUP or when the file is rewritten (inotify on its directory, so
+// editors that save via rename are caught too).
+//
+// Every load produces a new immutable struct cfg that is published with an
+// atomic pointer swap. There is a single reader: the thread that calls
+// cfg_poll() reads cfg_get() and hands the values on to its encoder,
+// strobe and UART code itself; worker threads never see a snapshot. The
+// snapshot it held before a reload stays valid until its next cfg_poll(),
+// so it can diff the old against the new one, and is freed then.
+// A file that fails to parse or validate leaves the current snapshot live.
+//
+// Not every key can change under a running pipeline. cfg_diff() reports
+// what a reload touched as CFG_APPLY_* bits, so the tool can apply live
+// keys at once and hold the others for a safe frame boundary (drain the
+// encoder, or renegotiate the camera stream).
+//
+// Usage:
+//   struct cfg_store cs;
+//   struct cfg def = cfg_builtin(); def.quality = QUALITY; ...
+//   cfg_init(&cs, "/etc/conveyor.conf", &def);
+//   poll() on cfg_fd(&cs) too, then:
+//   const struct cfg *old = cfg_get(&cs);
+//   if (cfg_poll(&cs)) { unsigned what = cfg_diff(old, cfg_get(&cs)); ... }
+//
+// Only one thread may call cfg_poll().
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <sys/inotify.h>
+
+// What has to happen for a changed key to take effect
+#define CFG_APPLY_LIVE    0x0       // next frame / next command
+#define CFG_APPLY_ENCODER 0x1       // drain and rebuild the encoder pool
+#define CFG_APPLY_STREAM  0x2       // stop the camera stream and renegotiate the format
+#define CFG_APPLY_PWM     0x4       // rewrite the PWM period / duty cycle
+#define CFG_APPLY_UART    0x8       // reconfigure the serial port between commands
+#define CFG_APPLY_TRIGGER 0x10      // re-request the GPIO trigger line
+#define CFG_APPLY_STROBE  0x20      // reopen the strobe PWM channel
+
+struct cfg {
+    uint64_t version;               // 0 = built-in defaults, +1 per successful load
+
+    // Camera
+    int width, height;
+    int fps, idle_fps;
+
+    // Encoder
+    int quality;
+    int encode_budget_us;           // 0 = always quality
+    int roi_x, roi_y, roi_w, roi_h; // encoded region, roi_w/roi_h 0 = whole frame
+    int denoise_k;                  // frames averaged (tdenoise.h), 0/1 = off
+
+    // Presence detection (caprate.h)
+    double idle_after_s;
+    int motion_diff, motion_permille;
+
+    // Photo-sensor trigger (gpiotrig.h)
+    int trigger_line;               // -1 = off
+    int trigger_falling;
+    int trigger_offset_us;
+
+    // Strobe (strobe.h)
+    int strobe_channel;             // PWM channel, -1 = off
+    int strobe_pulse_us, strobe_offset_us;
+
+    // Belt and HMI (serial_pwm)
+    int pwm_period_ns, pwm_duty_ns;
+    int baud;
+    int hmi_poll_ms;                // HMI_QUERIES every this often (nextion.h), 0 = off
+    int hmi_window;                 // queries in flight, 1 = stop-and-wait
+    int hmi_chart_id;               // waveform component for throughput/latency, -1 = off
+    double hmi_chart_pps;           // chart points per second, cut to the link budget
+};
+
+enum { CFG_INT, CFG_DOUBLE };
+
+struct cfg_key {
+    const char *name;
+    int type;
+    size_t offset;
+    double min, max;
+    unsigned apply;
+};
+
+static const struct cfg_key cfg_keys[] = {
+    { "width",            CFG_INT,    offsetof(struct cfg, width),            16, 4096,      CFG_APPLY_STREAM },
+    { "height",           CFG_INT,    offsetof(struct cfg, height),           16, 4096,      CFG_APPLY_STREAM },
+    { "fps",              CFG_INT,    offsetof(struct cfg, fps),              1, 240,        CFG_APPLY_LIVE },
+    { "idle_fps",         CFG_INT,    offsetof(struct cfg, idle_fps),         1, 240,        CFG_APPLY_LIVE },
+    { "quality",          CFG_INT,    offsetof(struct cfg, quality),          1, 100,        CFG_APPLY_LIVE },
+    { "encode_budget_us", CFG_INT,    offsetof(struct cfg, encode_budget_us), 0, 10000000,   CFG_APPLY_LIVE },
+    { "roi_x",            CFG_INT,    offsetof(struct cfg, roi_x),            0, 4096,       CFG_APPLY_ENCODER },
+    { "roi_y",            CFG_INT,    offsetof(struct cfg, roi_y),            0, 4096,       CFG_APPLY_ENCODER },
+    { "roi_w",            CFG_INT,    offsetof(struct cfg, roi_w),            0, 4096,       CFG_APPLY_ENCODER },
+    { "roi_h",            CFG_INT,    offsetof(struct cfg, roi_h),            0, 4096,       CFG_APPLY_ENCODER },
+    { "denoise_k",        CFG_INT,    offsetof(struct cfg, denoise_k),        0, 16,         CFG_APPLY_ENCODER },
+    { "idle_after_s",     CFG_DOUBLE, offsetof(struct cfg, idle_after_s),     0.1, 86400,    CFG_APPLY_LIVE },
+    { "motion_diff",      CFG_INT,    offsetof(struct cfg, motion_diff),      1, 255,        CFG_APPLY_LIVE },
+    { "motion_permille",  CFG_INT,    offsetof(struct cfg, motion_permille),  0, 1000,       CFG_APPLY_LIVE },
+    { "trigger_line",     CFG_INT,    offsetof(struct cfg, trigger_line),     -1, 1023,      CFG_APPLY_TRIGGER },
+    { "trigger_falling",  CFG_INT,    offsetof(struct cfg, trigger_falling),  0, 1,          CFG_APPLY_TRIGGER },
+    { "trigger_offset_us", CFG_INT,   offsetof(struct cfg, trigger_offset_us), -1000000, 1000000, CFG_APPLY_LIVE },
+    { "strobe_channel",   CFG_INT,    offsetof(struct cfg, strobe_channel),   -1, 63,        CFG_APPLY_STROBE },
+    { "strobe_pulse_us",  CFG_INT,    offsetof(struct cfg, strobe_pulse_us),  1, 100000,     CFG_APPLY_LIVE },
+    { "strobe_offset_us", CFG_INT,    offsetof(struct cfg, strobe_offset_us), -1000000, 1000000, CFG_APPLY_LIVE },
+    { "pwm_period_ns",    CFG_INT,    offsetof(struct cfg, pwm_period_ns),    1000, 1000000000, CFG_APPLY_PWM },
+    { "pwm_duty_ns",      CFG_INT,    offsetof(struct cfg, pwm_duty_ns),      0, 1000000000, CFG_APPLY_PWM },
+    { "baud",             CFG_INT,    offsetof(struct cfg, baud),             9600, 115200,  CFG_APPLY_UART },    // see cfg_baud_ok()
+    { "hmi_poll_ms",      CFG_INT,    offsetof(struct cfg, hmi_poll_ms),      0, 60000,      CFG_APPLY_LIVE },
+    { "hmi_window",       CFG_INT,    offsetof(struct cfg, hmi_window),       1, 32,         CFG_APPLY_LIVE },
+    { "hmi_chart_id",     CFG_INT,    offsetof(struct cfg, hmi_chart_id),     -1, 255,       CFG_APPLY_LIVE },
+    { "hmi_chart_pps",    CFG_DOUBLE, offsetof(struct cfg, hmi_chart_pps),    0.1, 1000,     CFG_APPLY_LIVE },
+};
+#define CFG_NKEYS ((int)(sizeof(cfg_keys) / sizeof(cfg_keys[0])))
+
+struct cfg_store {
+    struct cfg *cur;                // atomic
+    struct cfg *prev;               // the caller's snapshot before the last reload
+    struct cfg defaults;
+    char path[256], name[256];
+    int ino_fd, ino_wd;
+    uint64_t reloads, rejected;
+};
+
+static volatile sig_atomic_t cfg_sighup;
+
+static void cfg_hup_handler(int signum) {
+    (void)signum;
+    cfg_sighup = 1;
+}
+
+// Defaults matching the #defines the tools ship with
+static inline struct cfg cfg_builtin(void) {
+    struct cfg c;
+    memset(&c, 0, sizeof(c));
+    c.width = 320;
+    c.height = 240;
+    c.fps = 30;
+    c.idle_fps = 2;
+    c.quality = 90;
+    c.idle_after_s = 10.0;
+    c.motion_diff = 20;
+    c.motion_permille = 5;
+    c.trigger_line = -1;
+    c.strobe_channel = -1;
+    c.strobe_pulse_us = 500;
+    c.pwm_period_ns = 1000000;
+    c.pwm_duty_ns = 500000;
+    c.baud = 9600;
+    c.hmi_window = 8;
+    c.hmi_chart_id = -1;
+    c.hmi_chart_pps = 10;
+    return c;
+}
+
+// The rates configure_serial() sets up; anything else would leave the display at another speed
+static inline int cfg_baud_ok(int baud) {
+    return baud == 9600 || baud == 19200 || baud == 38400 || baud == 115200;
+}
+
+// Parse path over a copy of base. Returns 0, -1 with the reason on stderr,
+// or -2 if the file does not exist.
+static inline int cfg_parse(const char *path, const struct cfg *base, struct cfg *out) {
+    char line[256];
+    int lineno = 0, bad = 0;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (errno == ENOENT) return -2;
+        fprintf(stderr, "config %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    *out = *base;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line, *key, *val, *end;
+        lineno++;
+        if ((end = strchr(p, '#'))) *end = 0;
+        while (isspace((unsigned char)*p)) p++;
+        if (!*p) continue;
+        key = p;
+        while (*p && !isspace((unsigned char)*p) && *p != '=') p++;
+        end = p;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p != '=') { fprintf(stderr, "config %s:%d: expected key = value\n", path, lineno); bad = 1; continue; }
+        *end = 0;
+        val = p + 1;
+
+        int k;
+        for (k = 0; k < CFG_NKEYS && strcmp(cfg_keys[k].name, key); k++) {}
+        if (k == CFG_NKEYS) { fprintf(stderr, "config %s:%d: unknown key '%s'\n", path, lineno, key); bad = 1; continue; }
+        errno = 0;
+        double v = strtod(val, &end);
+        while (isspace((unsigned char)*end)) end++;
+        if (errno || end == val || *end || v < cfg_keys[k].min || v > cfg_keys[k].max) {
+            fprintf(stderr, "config %s:%d: bad value for %s (%g..%g)\n", path, lineno, key, cfg_keys[k].min, cfg_keys[k].max);
+            bad = 1;
+            continue;
+        }
+        char *field = (char *)out + cfg_keys[k].offset;
+        if (cfg_keys[k].type == CFG_INT) *(int *)field = (int)v;
+        else *(double *)field = v;
+    }
+    fclose(f);
+
+    // Cross-field checks
+    if (!cfg_baud_ok(out->baud)) { fprintf(stderr, "config %s: baud must be 9600, 19200, 38400 or 115200\n", path); bad = 1; }
+    if (out->pwm_duty_ns > out->pwm_period_ns) { fprintf(stderr, "config %s: pwm_duty_ns > pwm_period_ns\n", path); bad = 1; }
+    if (out->roi_w && (out->roi_x + out->roi_w > out->width || out->roi_y + out->roi_h > out->height || !out->roi_h)) {
+        fprintf(stderr, "config %s: ROI outside %dx%d\n", path, out->width, out->height);
+        bad = 1;
+    }
+    return bad ? -1 : 0;
+}
+
+static inline int cfg_key_differs(const struct cfg *a, const struct cfg *b, int k) {
+    return memcmp((const char *)a + cfg_keys[k].offset, (const char *)b + cfg_keys[k].offset,
+                  cfg_keys[k].type == CFG_INT ? sizeof(int) : sizeof(double)) != 0;
+}
+
+// What changed between two snapshots, as CFG_APPLY_* bits. Live keys add no
+// bits: the caller re-reads those from every new snapshot anyway.
+static inline unsigned cfg_diff(const struct cfg *a, const struct cfg *b) {
+    unsigned what = 0;
+    for (int k = 0; k < CFG_NKEYS; k++)
+        if (cfg_key_differs(a, b, k)) what |= cfg_keys[k].apply;
+    return what;
+}
+
+static inline int cfg_equal(const struct cfg *a, const struct cfg *b) {
+    for (int k = 0; k < CFG_NKEYS; k++)
+        if (cfg_key_differs(a, b, k)) return 0;
+    return 1;
+}
+
+// The current snapshot, valid until the next cfg_poll()
+static inline const struct cfg *cfg_get(struct cfg_store *cs) {
+    return __atomic_load_n(&cs->cur, __ATOMIC_ACQUIRE);
+}
+
+static inline void cfg_publish(struct cfg_store *cs, struct cfg *next) {
+    struct cfg *old = cs->cur;
+    next->version = old ? old->version + 1 : 0;
+    __atomic_store_n(&cs->cur, next, __ATOMIC_RELEASE);
+    cs->prev = old;
+}
+
+// Re-read the file now. Returns 1 if a new snapshot was published.
+static inline int cfg_reload(struct cfg_store *cs) {
+    free(cs->prev);         // the caller is done diffing against it
+    cs->prev = NULL;
+    struct cfg *next = malloc(sizeof(*next));
+    if (!next) { perror("Malloc failed"); return 0; }
+    int r = cfg_parse(cs->path, &cs->defaults, next);
+    if (r != 0) {
+        if (r == -1) {
+            fprintf(stderr, "config %s rejected, keeping version %llu\n", cs->path, (unsigned long long)cfg_get(cs)->version);
+            cs->rejected++;
+        }
+        free(next);         // a deleted file keeps the current settings too
+        return 0;
+    }
+    if (cfg_equal(next, cs->cur)) {
+        free(next);         // touched but unchanged
+        return 0;
+    }
+    cfg_publish(cs, next);
+    cs->reloads++;
+    return 1;
+}
+
+// Load path (a missing file means defaults), watch it, install the SIGHUP handler
+static inline int cfg_init(struct cfg_store *cs, const char *path, const struct cfg *defaults) {
+    memset(cs, 0, sizeof(*cs));
+    cs->defaults = *defaults;
+    snprintf(cs->path, sizeof(cs->path), "%s", path);
+    const char *slash = strrchr(cs->path, '/');
+    snprintf(cs->name, sizeof(cs->name), "%s", slash ? slash + 1 : cs->path);
+
+    struct cfg *first = malloc(sizeof(*first));
+    if (!first) { perror("Malloc failed"); return -1; }
+    *first = *defaults;
+    int r = cfg_parse(path, defaults, first);
+    if (r == -1) {
+        fprintf(stderr, "ERROR: config %s rejected\n", path);
+        free(first);
+        return -1;
+    }
+    cfg_publish(cs, first);
+
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - cs->path) : 1, slash ? cs->path : ".");
+    if (!dir[0]) snprintf(dir, sizeof(dir), "/");
+    cs->ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cs->ino_fd >= 0) cs->ino_wd = inotify_add_watch(cs->ino_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (cs->ino_fd < 0 || cs->ino_wd < 0) perror("config: inotify (SIGHUP still reloads)");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = cfg_hup_handler;    // no SA_RESTART: blocking reads return to the loop
+    sigaction(SIGHUP, &sa, NULL);
+    printf("Config: %s (%s)\n", path, r == 0 ? "loaded" : "not found, built-in defaults");
+    return 0;
+}
+
+// For the caller's poll() set; -1 if inotify is unavailable
+static inline int cfg_fd(const struct cfg_store *cs) {
+    return cs->ino_fd;
+}
+
+// Call from the main loop. Returns 1 if a new snapshot is live; the caller
+// compares it against the one it was using with cfg_diff().
+static inline int cfg_poll(struct cfg_store *cs) {
+    int reload = 0;
+    if (cfg_sighup) {
+        cfg_sighup = 0;
+        reload = 1;
+    }
+    if (cs->ino_fd >= 0) {
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t n;
+        while ((n = read(cs->ino_fd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + n;) {
+                const struct inotify_event *ev = (const struct inotify_event *)p;
+                if (ev->len && !strcmp(ev->name, cs->name)) reload = 1;
+                p += sizeof(*ev) + ev->len;
+            }
+        }
+    }
+    return reload ? cfg_reload(cs) : 0;
+}
+
+static inline void cfg_print(const struct cfg *c) {
+    printf("Config v%llu: %dx%d @ %d fps (idle %d), q%d budget %d us, ROI %d,%d %dx%d, denoise %d, idle after %.1f s, "
+           "motion %d/%d, trigger %d%s%+d us, strobe %d %d us%+d us, PWM %d/%d ns, %d baud, HMI poll %d ms x%d, chart %d at %.1f/s\n", (unsigned long long)c->version, c->width, c->height,
+           c->fps, c->idle_fps, c->quality, c->encode_budget_us, c->roi_x, c->roi_y, c->roi_w, c->roi_h, c->denoise_k, c->idle_after_s,
+           c->motion_diff, c->motion_permille, c->trigger_line, c->trigger_falling ? "v" : "^", c->trigger_offset_us,
+           c->strobe_channel, c->strobe_pulse_us, c->strobe_offset_us,
+           c->pwm_period_ns, c->pwm_duty_ns, c->baud, c->hmi_poll_ms, c->hmi_window, c->hmi_chart_id, c->hmi_chart_pps);
+}
+
+static inline void cfg_destroy(struct cfg_store *cs) {
+    if (cs->ino_fd >= 0) close(cs->ino_fd);
+    free(cs->prev);
+    free(cs->cur);
+    memset(cs, 0, sizeof(*cs));
+    cs->ino_fd = -1;
+}
+
+#endif // CONFIG_H
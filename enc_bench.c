@@ -0,0 +1,114 @@
+// Encoder pool throughput benchmark.
+// Pushes frames through encpool.h with 1..max harts and reports frames/s,
+// scaling against one hart, and per-frame encode latency. Frames come from a
+// raw archive (as used by transcode) or a synthetic moving gradient. Results
+// are checked to come back in sequence order.
+//
+// Usage: enc_bench [width] [height] [format] [frames] [max_harts] [quality] [frames.raw]
+
+#define _GNU_SOURCE             // pthread_setaffinity_np in encpool.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "encpool.h"
+
+#define DEPTH 2                 // frames in flight per hart
+#define NSRC  8                 // distinct synthetic frames
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    int width = (argc >= 2) ? atoi(argv[1]) : 320;
+    int height = (argc >= 3) ? atoi(argv[2]) : 240;
+    uint32_t fourcc = V4L2_PIX_FMT_YUYV;
+    if (argc >= 4 && !(fourcc = pixfmt_from_name(argv[3]))) { fprintf(stderr, "Unknown format %s\n", argv[3]); return 1; }
+    long frames = (argc >= 5) ? atol(argv[4]) : 400;
+    int max_harts = (argc >= 6) ? atoi(argv[5]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int quality = (argc >= 7) ? atoi(argv[6]) : 90;
+    if (max_harts < 1) max_harts = 1;
+    if (max_harts > ENCPOOL_MAX_HARTS) max_harts = ENCPOOL_MAX_HARTS;
+
+    size_t frame_size = pixfmt_frame_size(fourcc, width, height);
+    const uint8_t *src;
+    long nsrc;
+    size_t map_size = 0;
+
+    if (argc >= 8) {
+        int fd = open(argv[7], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", argv[7], strerror(errno)); return 1; }
+        nsrc = frame_size ? st.st_size / (off_t)frame_size : 0;
+        if (!nsrc) { fprintf(stderr, "ERROR: %s holds no complete %dx%d frame\n", argv[7], width, height); return 1; }
+        map_size = st.st_size;
+        src = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (src == MAP_FAILED) { perror("Mapping input"); return 1; }
+    } else {
+        uint8_t *s = malloc(frame_size * NSRC);
+        if (!s) { perror("Malloc failed"); return 1; }
+        for (size_t i = 0; i < frame_size * NSRC; i++) {
+            size_t f = i / frame_size, o = i % frame_size;
+            s[i] = (uint8_t)((o % (width * 2)) / 2 + f * 9 + (o / (width * 2)) / 3);
+        }
+        src = s;
+        nsrc = NSRC;
+    }
+
+    double *lat = malloc(frames * sizeof(double));
+    if (!lat) { perror("Malloc failed"); return 1; }
+
+    printf("%ld frames %dx%d %s -> JPEG q%d, %d frames in flight per hart\n",
+           frames, width, height, pixfmt_name(fourcc), quality, DEPTH);
+    printf("harts   frames/s   scaling   encode ms p50/p99   KB/frame\n");
+
+    double base = 0;
+    for (int n = 1; n <= max_harts; n++) {
+        struct encpool ep;
+        struct encpool_result r;
+        if (encpool_init(&ep, n, DEPTH, fourcc, width, height, quality) != 0) return 1;
+
+        long submitted = 0, done = 0;
+        uint64_t bytes = 0;
+        double t0 = pixfmt_now_ns();
+        while (done < frames) {
+            // Keep the pool full, then collect in order
+            while (submitted < frames && !encpool_full(&ep)) {
+                encpool_submit(&ep, src + (submitted % nsrc) * frame_size, 0, submitted);
+                submitted++;
+            }
+            if (submitted == frames) encpool_close(&ep);
+            if (!encpool_next(&ep, &r)) break;
+            if (r.seq != (uint64_t)done || r.len <= 0) {
+                fprintf(stderr, "ERROR: got frame %llu (len %d), expected %ld\n", (unsigned long long)r.seq, r.len, done);
+                return 1;
+            }
+            lat[done++] = r.encode_ns / 1e6;
+            bytes += r.len;
+            encpool_release(&ep, &r);
+        }
+        double secs = (pixfmt_now_ns() - t0) / 1e9;
+        encpool_destroy(&ep);
+
+        double fps = done / secs;
+        if (n == 1) base = fps;
+        qsort(lat, done, sizeof(double), cmp_double);
+        printf("%5d   %8.1f   %5.2fx    %6.2f / %6.2f      %6.1f\n", n, fps, fps / base,
+               lat[done / 2], lat[done * 99 / 100], bytes / 1024.0 / done);
+    }
+
+    if (map_size) munmap((void *)src, map_size);
+    else free((void *)src);
+    free(lat);
+    return 0;
+}
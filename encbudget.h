@@ -0,0 +1,169 @@
+// encbudget.h - Time-budgeted JPEG encoding.
+//
+// When the encoder falls behind, a fixed QUALITY 90 encode can take longer
+// than a frame is allowed. encbudget picks, per frame, the best rung
+// of a ladder of stbi_jpg_params settings (chroma subsampling, quality,
+// zigzag coefficients kept) that its cost model predicts will fit the
+// budget, and arms the encoder's deadline callback so a frame that runs long
+// anyway has its remaining MCU rows coded DC-only instead of overrunning.
+//
+// Cost model, learned online from the frames actually encoded:
+//   predicted(level) = scale * rel[level]
+// scale follows the scene and hart load quickly (EWMA 0.25), rel[] is the
+// relative cost of each rung and adapts slowly (EWMA 0.05) from priors
+// measured with stb_image_write at 320x240. 4:2:0 halves the chroma DCTs;
+// lower quality and dropped coefficients only save entropy coding, so the
+// lower rungs flatten out and the deadline is what bounds the worst case.
+// A frame cut short by the deadline is extrapolated to its full cost before
+// it is learned from.
+// Moving up the ladder needs ENCBUDGET_HEADROOM spare; moving down happens
+// as soon as the prediction exceeds the budget.
+//
+// The settings used are written into the JPEG as a COM segment
+// ("enc q=70 ss=420 k=36 budget=120000us"), so they travel with the frame
+// into the archive.
+//
+// One model per encoding thread; nothing here is shared.
+//
+// Usage:
+//   struct encbudget eb;
+//   encbudget_init(&eb, 120000, 90);
+//   per frame: t0 = now; stbi_jpg_params p;
+//              encbudget_choose(&eb, t0, &p);   // before the colour conversion if that counts too
+//              stbi_write_jpg_to_buffer_ex(buf, cap, w, h, 3, rgb, &p, NULL);
+//              encbudget_update(&eb, &p, now - t0, (h + 15) / 16);
+
+#ifndef ENCBUDGET_H
+#define ENCBUDGET_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#ifndef INCLUDE_STB_IMAGE_WRITE_H
+#include "stb_image_write.h"    // declarations only; the implementation is included once by the tool
+#endif
+
+#define ENCBUDGET_HEADROOM 1.15     // predicted * this must fit before moving to a better rung
+#define ENCBUDGET_FAST     0.25     // scale EWMA
+#define ENCBUDGET_SLOW     0.05     // rel[] EWMA
+
+struct encbudget_level {
+    int quality, subsample, coeffs;     // as in stbi_jpg_params
+    double prior;                       // cost relative to q90 4:2:0
+};
+
+// Best first. The top rung used is the first at or below the configured
+// quality, so at QUALITY 90 an unhurried frame is exactly what
+// stbi_write_jpg() would produce.
+static const struct encbudget_level encbudget_ladder[] = {
+    { 100, 2, 64, 1.70 },
+    {  95, 2, 64, 1.55 },
+    {  90, 1, 64, 1.00 },
+    {  80, 1, 64, 0.75 },
+    {  70, 1, 36, 0.68 },
+    {  60, 1, 21, 0.60 },
+    {  50, 1, 10, 0.56 },
+    {  40, 1,  6, 0.53 },
+    {  30, 1,  3, 0.50 },
+};
+#define ENCBUDGET_LEVELS ((int)(sizeof(encbudget_ladder) / sizeof(encbudget_ladder[0])))
+
+struct encbudget {
+    double budget_ns;
+    double scale;                       // ns at rel 1.0, 0 until the first frame
+    double rel[ENCBUDGET_LEVELS];
+    int top, level;
+    double deadline_ns;                 // CLOCK_MONOTONIC, for the expired() callback
+    char comment[64];
+
+    uint64_t frames, over, cut;         // cut: frames with DC-only rows
+    uint64_t per_level[ENCBUDGET_LEVELS];
+};
+
+static inline double encbudget_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline int encbudget_expired(void *user) {
+    const struct encbudget *b = user;
+    return encbudget_now_ns() >= b->deadline_ns;
+}
+
+static inline void encbudget_init(struct encbudget *b, int budget_us, int quality) {
+    memset(b, 0, sizeof(*b));
+    b->budget_ns = budget_us * 1e3;
+    while (b->top < ENCBUDGET_LEVELS - 1 && encbudget_ladder[b->top].quality > quality) b->top++;
+    b->level = b->top;
+    for (int l = 0; l < ENCBUDGET_LEVELS; l++) b->rel[l] = encbudget_ladder[l].prior;
+}
+
+// Fill *p for the next frame, whose encode started at start_ns
+static inline void encbudget_choose(struct encbudget *b, double start_ns, stbi_jpg_params *p) {
+    int l = b->top;
+    if (b->scale > 0) {
+        // Best rung that fits; the current one and worse need no headroom
+        for (; l < ENCBUDGET_LEVELS - 1; l++) {
+            double need = b->scale * b->rel[l] * (l < b->level ? ENCBUDGET_HEADROOM : 1.0);
+            if (need <= b->budget_ns) break;
+        }
+    }
+    b->level = l;
+    const struct encbudget_level *e = &encbudget_ladder[l];
+    snprintf(b->comment, sizeof(b->comment), "enc q=%d ss=%s k=%d budget=%.0fus", e->quality,
+             e->subsample == 1 ? "420" : "444", e->coeffs, b->budget_ns / 1e3);
+    memset(p, 0, sizeof(*p));
+    p->quality = e->quality;
+    p->subsample = e->subsample;
+    p->coeffs = e->coeffs;
+    p->comment = b->comment;
+    p->expired = encbudget_expired;
+    p->user = b;
+    b->deadline_ns = start_ns + b->budget_ns;
+}
+
+// After the encode: elapsed_ns since start_ns, mcu_rows in the image
+static inline void encbudget_update(struct encbudget *b, const stbi_jpg_params *p, double elapsed_ns, int mcu_rows) {
+    int l = b->level;
+    b->frames++;
+    b->per_level[l]++;
+    if (elapsed_ns > b->budget_ns) b->over++;
+    if (p->dc_only_rows) {
+        b->cut++;
+        // What the full encode would have cost, assuming DC-only rows are free
+        if (p->dc_only_rows < mcu_rows) elapsed_ns *= (double)mcu_rows / (mcu_rows - p->dc_only_rows);
+        else elapsed_ns *= 2;
+    }
+    double s = elapsed_ns / b->rel[l];
+    if (b->scale <= 0) {
+        b->scale = s;
+    } else {
+        b->scale += ENCBUDGET_FAST * (s - b->scale);
+        b->rel[l] += ENCBUDGET_SLOW * (elapsed_ns / b->scale - b->rel[l]);
+    }
+}
+
+// Accumulate the counters of one model into another (e.g. one per hart)
+static inline void encbudget_add(struct encbudget *sum, const struct encbudget *b) {
+    if (!sum->budget_ns) sum->budget_ns = b->budget_ns;
+    sum->frames += b->frames;
+    sum->over += b->over;
+    sum->cut += b->cut;
+    for (int l = 0; l < ENCBUDGET_LEVELS; l++) sum->per_level[l] += b->per_level[l];
+}
+
+// Frames per rung, over-budget and deadline-cut counts
+static inline void encbudget_print(const struct encbudget *b) {
+    printf("Encode budget %.1f ms: %llu frames, %llu over, %llu cut to DC |", b->budget_ns / 1e6,
+           (unsigned long long)b->frames, (unsigned long long)b->over, (unsigned long long)b->cut);
+    for (int l = 0; l < ENCBUDGET_LEVELS; l++) {
+        if (b->per_level[l]) printf(" q%d/%s/k%d %llu", encbudget_ladder[l].quality,
+                                    encbudget_ladder[l].subsample == 1 ? "420" : "444", encbudget_ladder[l].coeffs,
+                                    (unsigned long long)b->per_level[l]);
+    }
+    printf("\n");
+}
+
+#endif // ENCBUDGET_H
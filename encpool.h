@@ -0,0 +1,395 @@
+// encpool.h - Frame-parallel JPEG encoder pool, one encoder per hart.
+//
+// At 320x240 a frame has too few MCU rows to split one JPEG across harts
+// without restart-marker overhead, so for throughput whole frames are dealt
+// out instead: frame seq goes to worker seq % nharts. Every worker owns its
+// RGB buffer and every slot its output buffer, all allocated up front; the
+// encoder writes into them with stbi_write_jpg_to_buffer(), so nothing is
+// allocated per frame.
+//
+// Slots form one ring of nharts * depth entries indexed by seq, which is
+// also the reorder stage: encpool_next() hands results back strictly in
+// submission order, whichever worker finishes first.
+//
+// The source buffer passed to encpool_submit() must stay valid until its
+// result has come out of encpool_next().
+//
+// encpool_archive() points the output at archive segments instead: each
+// worker owns a struct archive (archive_sink.h), reserves the worst case in
+// its own mapping, encodes into it and commits the frame under its sequence
+// number, so the JPEG is written once, in the page cache. Results then carry
+// the length only; readers merge the per-hart segments by frame number.
+//
+// encpool_set_budget() switches the workers to time-budgeted encoding: each
+// keeps its own encbudget.h cost model and trades quality for time per frame
+// instead of letting a backed-up pipeline drop frames. It and
+// encpool_set_quality() may be called at any time; each worker picks the
+// change up before its next frame.
+//
+// encpool_set_wb() changes the white balance (pixfmt_set_wb()) between two
+// submissions without draining: the conversion tables are double buffered,
+// each frame is converted with the set that was current when it was
+// submitted, and the new values go into the other set. It fails while frames
+// submitted under that set are still waiting to be converted; call it again
+// before a later submission.
+//
+// Usage:
+//   struct encpool ep;
+//   encpool_init(&ep, 4, 2, V4L2_PIX_FMT_YUYV, 320, 240, 90);
+//   producer: encpool_submit(&ep, frame, stride, ts_us);
+//   consumer: while (encpool_next(&ep, &r)) { use r.data, r.len; encpool_release(&ep, &r); }
+//   encpool_close(&ep); ... encpool_destroy(&ep);
+//
+// Build with -lpthread.
+
+#ifndef ENCPOOL_H
+#define ENCPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "pixfmt.h"
+#include "telemetry.h"
+#include "encbudget.h"
+#include "archive_sink.h"
+#ifndef INCLUDE_STB_IMAGE_WRITE_H
+#include "stb_image_write.h"    // declarations only; the implementation is included once by the tool
+#endif
+
+#define ENCPOOL_MAX_HARTS 16
+
+static struct tm_hist encpool_encode_us = TM_HIST("encode", "us");     // convert + JPEG, per worker shard
+
+enum { ENCPOOL_FREE = 0, ENCPOOL_QUEUED, ENCPOOL_DONE };
+
+struct encpool_slot {
+    int state;
+    uint64_t seq, timestamp_us;
+    const uint8_t *src;
+    int stride;
+    int wb;                     // conv[] set it is converted with
+    uint8_t *out;               // NULL when archiving
+    int len;                    // 0 if the encode failed
+    double encode_ns;
+    int quality, subsample, coeffs, dc_only_rows;
+};
+
+struct encpool_result {
+    uint64_t seq, timestamp_us;
+    const uint8_t *data;        // NULL when archiving: the frame is in the archive already
+    int len;
+    double encode_ns;           // convert + encode time on the worker
+    int quality, subsample, coeffs;     // settings used, as in stbi_jpg_params
+    int dc_only_rows;           // MCU rows cut to DC by the budget deadline
+};
+
+struct encpool;
+
+struct encpool_worker {
+    struct encpool *pool;
+    int index;
+    pthread_t thread;
+    pthread_cond_t cv;
+    uint8_t *rgb;
+    uint64_t frames;
+    double busy_ns;
+    struct encbudget eb;
+    unsigned settings_gen;      // last p->settings_gen applied to eb
+    struct archive ar;          // this hart's segments, see encpool_archive()
+};
+
+struct encpool {
+    int nharts, depth, nslots;
+    uint32_t fourcc;
+    int width, height, quality, out_cap;
+    int budget_us;              // 0: fixed quality
+    int archive;                // workers encode into their archives
+    unsigned settings_gen;      // bumped when quality or budget change
+    struct pixfmt_ctx conv[2];  // only their tables are used; conversions run serially per worker
+    int wb;                     // conv[] set for new submissions, see encpool_set_wb()
+    struct encpool_slot *slots;
+    struct encpool_worker workers[ENCPOOL_MAX_HARTS];
+    pthread_mutex_t lock;
+    pthread_cond_t out_cv, free_cv;
+    uint64_t submitted, next_out;
+    int closed;
+};
+
+static void *encpool_thread(void *arg) {
+    struct encpool_worker *w = arg;
+    struct encpool *p = w->pool;
+
+#ifdef CPU_SET
+    // One encoder per hart; Linux numbers the U54 application harts from 0
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > 1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->index % ncpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    pthread_mutex_lock(&p->lock);
+    for (uint64_t seq = w->index;; seq += p->nharts) {
+        struct encpool_slot *s = &p->slots[seq % p->nslots];
+        while (!(s->state == ENCPOOL_QUEUED && s->seq == seq) && !(p->closed && seq >= p->submitted))
+            pthread_cond_wait(&w->cv, &p->lock);
+        if (s->state != ENCPOOL_QUEUED || s->seq != seq) break;
+        int quality = p->quality, budget_us = p->budget_us;
+        if (w->settings_gen != p->settings_gen) {
+            encbudget_init(&w->eb, budget_us, quality);
+            w->settings_gen = p->settings_gen;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        stbi_jpg_params jp = { 0 };
+        jp.quality = quality;
+        double t0 = pixfmt_now_ns();
+        if (budget_us) encbudget_choose(&w->eb, t0, &jp);       // the budget covers the conversion too
+        pixfmt_convert_serial(&p->conv[s->wb], p->fourcc, PIXFMT_DST_RGB24, s->src, s->stride, w->rgb, p->width, p->height, 0);
+        uint8_t *out = p->archive ? archive_reserve(&w->ar, p->out_cap) : s->out;
+        int len = out ? stbi_write_jpg_to_buffer_ex(out, p->out_cap, p->width, p->height, 3, w->rgb, &jp, NULL) : 0;
+        double dt = pixfmt_now_ns() - t0;
+        tm_record(&encpool_encode_us, (uint64_t)(dt / 1000));
+        if (p->archive && len > 0) archive_commit(&w->ar, seq, s->timestamp_us, (uint32_t)len);
+
+        pthread_mutex_lock(&p->lock);
+        if (budget_us && w->settings_gen == p->settings_gen)
+            encbudget_update(&w->eb, &jp, dt, jp.subsample == 1 ? (p->height + 15) / 16 : (p->height + 7) / 8);
+        s->len = len;
+        s->encode_ns = dt;
+        s->quality = jp.quality;
+        s->subsample = jp.subsample ? jp.subsample : jp.quality <= 90 ? 1 : 2;
+        s->coeffs = jp.coeffs ? jp.coeffs : 64;
+        s->dc_only_rows = jp.dc_only_rows;
+        s->state = ENCPOOL_DONE;
+        w->frames++;
+        w->busy_ns += dt;
+        if (seq == p->next_out) pthread_cond_signal(&p->out_cv);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static inline void encpool_destroy(struct encpool *p);
+
+static inline int encpool_init(struct encpool *p, int nharts, int depth, uint32_t fourcc, int width, int height, int quality) {
+    memset(p, 0, sizeof(*p));
+    if (nharts < 1) nharts = 1;
+    if (nharts > ENCPOOL_MAX_HARTS) nharts = ENCPOOL_MAX_HARTS;
+    if (depth < 1) depth = 1;
+    if (!pixfmt_lookup(fourcc, PIXFMT_DST_RGB24)) { fprintf(stderr, "encpool: unsupported format %s\n", pixfmt_name(fourcc)); return -1; }
+    p->nharts = nharts;
+    p->depth = depth;
+    p->nslots = nharts * depth;
+    p->fourcc = fourcc;
+    p->width = width;
+    p->height = height;
+    p->quality = quality;
+    p->out_cap = width * height * 9 / 2 + 1024;     // 1.5x raw RGB, see archive_jpg_bound()
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->out_cv, NULL);
+    pthread_cond_init(&p->free_cv, NULL);
+    pixfmt_init(&p->conv[0], 1);
+    pixfmt_init(&p->conv[1], 1);
+
+    p->slots = calloc(p->nslots, sizeof(*p->slots));
+    if (!p->slots) { perror("Malloc failed"); return -1; }
+    for (int i = 0; i < p->nslots; i++) {
+        if (!(p->slots[i].out = malloc(p->out_cap))) { perror("Malloc failed"); encpool_destroy(p); return -1; }
+    }
+    for (int i = 0; i < nharts; i++) {
+        struct encpool_worker *w = &p->workers[i];
+        w->pool = p;
+        w->index = i;
+        pthread_cond_init(&w->cv, NULL);
+        w->rgb = malloc(pixfmt_dst_size(PIXFMT_DST_RGB24, width, height));
+        if (!w->rgb) { perror("Malloc failed"); encpool_destroy(p); return -1; }
+    }
+    for (int i = 0; i < nharts; i++) {
+        if (pthread_create(&p->workers[i].thread, NULL, encpool_thread, &p->workers[i]) != 0) {
+            perror("encpool: pthread_create");
+            p->nharts = i;      // the next round-robin target does not exist; close now
+            encpool_destroy(p);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Encode into archive segments <dir>/<prefix><hart>_<seq>.arc instead of the
+// slot buffers. Call before the first encpool_submit(); encpool_destroy()
+// closes the segments.
+static inline void encpool_archive(struct encpool *p, const char *dir, const char *prefix) {
+    char name[32];
+    for (int i = 0; i < p->nharts; i++) {
+        snprintf(name, sizeof(name), "%.24s%d", prefix, i);
+        archive_open(&p->workers[i].ar, dir, name, ARCHIVE_SEGMENT_SIZE);
+    }
+    for (int i = 0; i < p->nslots; i++) {
+        free(p->slots[i].out);
+        p->slots[i].out = NULL;
+    }
+    p->archive = 1;
+}
+
+// Encode every frame within budget_us (conversion included), see encbudget.h.
+// The cost models and their counters start over.
+static inline void encpool_set_budget(struct encpool *p, int budget_us) {
+    pthread_mutex_lock(&p->lock);
+    p->budget_us = budget_us;
+    p->settings_gen++;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static inline void encpool_set_quality(struct encpool *p, int quality) {
+    pthread_mutex_lock(&p->lock);
+    p->quality = quality;
+    p->settings_gen++;
+    pthread_mutex_unlock(&p->lock);
+}
+
+// White balance for the frames submitted from now on, see the top of the file.
+// Producer thread only. Returns -1 if the spare set is still in use.
+static inline int encpool_set_wb(struct encpool *p, const int gain[3], const int offset[3]) {
+    int next = !p->wb;
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i < p->nslots; i++) {
+        if (p->slots[i].state == ENCPOOL_QUEUED && p->slots[i].wb == next) {
+            pthread_mutex_unlock(&p->lock);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    // Nothing queued reads conv[next], and nothing new will until the switch
+    pixfmt_set_wb(&p->conv[next], gain, offset);
+    pthread_mutex_lock(&p->lock);
+    p->wb = next;
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+// The tables the next submission will be converted with, for a look at a
+// frame as the encoder sees it (pixfmt_convert_serial()). Producer thread only.
+static inline const struct pixfmt_ctx *encpool_conv(const struct encpool *p) {
+    return &p->conv[p->wb];
+}
+
+// Rungs chosen so far, all harts together
+static inline void encpool_budget_print(struct encpool *p) {
+    struct encbudget sum;
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i < p->nharts; i++) encbudget_add(&sum, &p->workers[i].eb);
+    pthread_mutex_unlock(&p->lock);
+    if (p->budget_us) encbudget_print(&sum);
+}
+
+// Queue a frame for worker seq % nharts. Blocks while that slot's previous
+// result has not been released. Returns the sequence number.
+static inline uint64_t encpool_submit(struct encpool *p, const uint8_t *src, int stride, uint64_t timestamp_us) {
+    pthread_mutex_lock(&p->lock);
+    uint64_t seq = p->submitted;
+    struct encpool_slot *s = &p->slots[seq % p->nslots];
+    while (s->state != ENCPOOL_FREE)
+        pthread_cond_wait(&p->free_cv, &p->lock);
+    s->seq = seq;
+    s->src = src;
+    s->stride = stride;
+    s->wb = p->wb;
+    s->timestamp_us = timestamp_us;
+    s->state = ENCPOOL_QUEUED;
+    p->submitted++;
+    pthread_cond_signal(&p->workers[seq % p->nharts].cv);
+    pthread_mutex_unlock(&p->lock);
+    return seq;
+}
+
+// Non-blocking check: would encpool_submit() have to wait?
+static inline int encpool_full(struct encpool *p) {
+    pthread_mutex_lock(&p->lock);
+    int full = p->slots[p->submitted % p->nslots].state != ENCPOOL_FREE;
+    pthread_mutex_unlock(&p->lock);
+    return full;
+}
+
+// Non-blocking check: is the next result in order finished?
+static inline int encpool_ready(struct encpool *p) {
+    pthread_mutex_lock(&p->lock);
+    const struct encpool_slot *s = &p->slots[p->next_out % p->nslots];
+    int ready = s->state == ENCPOOL_DONE && s->seq == p->next_out;
+    pthread_mutex_unlock(&p->lock);
+    return ready;
+}
+
+// Next result in sequence order. Returns 0 once the pool is closed and drained.
+static inline int encpool_next(struct encpool *p, struct encpool_result *r) {
+    pthread_mutex_lock(&p->lock);
+    struct encpool_slot *s = &p->slots[p->next_out % p->nslots];
+    while (!(s->state == ENCPOOL_DONE && s->seq == p->next_out) && !(p->closed && p->next_out >= p->submitted))
+        pthread_cond_wait(&p->out_cv, &p->lock);
+    int have = s->state == ENCPOOL_DONE && s->seq == p->next_out;
+    if (have) {
+        r->seq = s->seq;
+        r->timestamp_us = s->timestamp_us;
+        r->data = s->out;
+        r->len = s->len;
+        r->encode_ns = s->encode_ns;
+        r->quality = s->quality;
+        r->subsample = s->subsample;
+        r->coeffs = s->coeffs;
+        r->dc_only_rows = s->dc_only_rows;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return have;
+}
+
+// Hand the result's slot (and the source frame) back
+static inline void encpool_release(struct encpool *p, const struct encpool_result *r) {
+    pthread_mutex_lock(&p->lock);
+    struct encpool_slot *s = &p->slots[r->seq % p->nslots];
+    s->state = ENCPOOL_FREE;
+    p->next_out = r->seq + 1;
+    pthread_cond_broadcast(&p->free_cv);
+    // The next result may already be waiting
+    if (p->slots[p->next_out % p->nslots].state == ENCPOOL_DONE) pthread_cond_signal(&p->out_cv);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// No more submissions: workers finish what is queued, encpool_next() drains it
+static inline void encpool_close(struct encpool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->closed = 1;
+    for (int i = 0; i < p->nharts; i++) pthread_cond_signal(&p->workers[i].cv);
+    pthread_cond_broadcast(&p->out_cv);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static inline void encpool_destroy(struct encpool *p) {
+    encpool_close(p);
+    for (int i = 0; i < p->nharts; i++) {
+        if (p->workers[i].thread) pthread_join(p->workers[i].thread, NULL);
+        if (p->archive) archive_close(&p->workers[i].ar);
+    }
+    for (int i = 0; i < ENCPOOL_MAX_HARTS; i++) {
+        free(p->workers[i].rgb);
+        if (p->workers[i].pool) pthread_cond_destroy(&p->workers[i].cv);
+    }
+    if (p->slots) {
+        for (int i = 0; i < p->nslots; i++) free(p->slots[i].out);
+        free(p->slots);
+    }
+    pixfmt_destroy(&p->conv[0]);
+    pixfmt_destroy(&p->conv[1]);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->out_cv);
+    pthread_cond_destroy(&p->free_cv);
+    memset(p, 0, sizeof(*p));
+}
+
+#endif // ENCPOOL_H
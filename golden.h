@@ -0,0 +1,510 @@
+// golden.h - Golden-template defect screen for a fixed box SKU.
+//
+// On a known SKU most defects come down to "does not look like a good box",
+// which is far cheaper to check than running the CNN. Each SKU keeps a
+// golden template, the average luma of known-good frames, plus per-block
+// statistics of how far good frames stray from it. A frame is aligned to
+// the template by normalized cross-correlation and scored block by block;
+// blocks well outside the good-frame spread are flagged.
+//
+// Everything runs on a working plane (the luma halved, 2x2 box average)
+// with summed-area tables of luma and luma^2:
+//   - alignment: NCC of the template's centre (a GOLDEN_SEARCH margin all
+//     round) against the frame, first at every shift of a coarse level (the
+//     working plane halved twice more), then hill-climbing at the working
+//     level from the parabola-fitted coarse peak. Only every
+//     GOLDEN_NCC_ROWS-th row of the window is correlated; the tables give
+//     each row's sum and sum of squares in O(1), so a shift costs one byte
+//     dot product over those rows.
+//   - scores: per GOLDEN_BLOCK square block, the sum of absolute differences
+//     once each side's block mean (again from the tables) is taken out, so
+//     a brightness drift does not count.
+//   - reference: the learned per-block mean/variance of good-frame scores,
+//     or until enough frames are learned, the median/MAD of the frame's own
+//     block scores (as texture_screen.h does).
+// It is all integer: 32-bit tables (the sums of squares wrap, but a row
+// or block of fewer than 66051 pixels still comes out exact), 64-bit NCC
+// terms with an integer square root, NCC in Q15, scores in grey levels
+// with 4 fractional bits for the statistics. The U54 has no vector unit:
+// the halving goes four pixels per 64-bit word (SWAR), the dot products
+// and block sums are plain byte loops (GCC vectorizes them on hosts that
+// have SIMD). At 320x240 a frame is 77k luma bytes halved, 40k table
+// entries, about 60k multiply-adds of alignment and 19k pixels of scores.
+//
+// Templates live in a directory per SKU: <sku>.golden holds the 8.8 fixed
+// point template and the block statistics, <sku>.pgm the template to look at.
+//
+// Usage:
+//   struct golden g;
+//   golden_init(&g, WIDTH, HEIGHT);
+//   golden_load(&g, "golden", "sku123");        // -1: no template yet
+//   golden_learn(&g, luma, stride);             // known-good frames
+//   golden_save(&g, "golden", "sku123");
+//   struct golden_result r;
+//   if (golden_eval(&g, luma, stride, &r)) ...  // suspicious, send to the CNN
+//   golden_free(&g);
+
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define GOLDEN_STEP        2        // luma pixels per working pixel, each way (one halving)
+#define GOLDEN_COARSE      4        // working pixels per coarse pixel (two halvings)
+#define GOLDEN_SEARCH      16       // alignment range in working pixels, either way (multiple of GOLDEN_COARSE)
+#define GOLDEN_CLIMB       4        // hill-climbing steps at the working level
+#define GOLDEN_NCC_ROWS    2        // correlate every n-th row of the NCC window
+#define GOLDEN_BLOCK       8        // score block side in working pixels
+#define GOLDEN_MAX_WINDOW  65536    // pixels correlated per shift (64-bit NCC terms)
+#define GOLDEN_MIN_TRAIN   20       // template frames before scoring them, and statistic frames before using them
+#define GOLDEN_ALPHA_SHIFT 4        // template and statistics update rate once trained, 1/16
+#define GOLDEN_Z           6        // per-block z-score threshold
+#define GOLDEN_MIN_BLOCKS  3        // flagged blocks needed to call a frame suspicious
+#define GOLDEN_MIN_SD      32       // score spread floor, half a grey level per pixel of a block
+#define GOLDEN_FRAME_SD    128      // floor against the frame's own blocks: edges and gain drift leave more until learned
+#define GOLDEN_MIN_NCC     19661    // Q15 0.6: below this the frame is not this SKU, or not where it should be
+
+#define GOLDEN_RANGE       (2 * GOLDEN_SEARCH + 1)
+
+// A plane with its summed-area tables, (w+1) x (h+1) with a zero first row and column
+struct golden_plane {
+    int w, h;
+    uint8_t *px;
+    uint32_t *sum, *sq;
+};
+
+// The template's NCC window on one level, every GOLDEN_NCC_ROWS-th row
+struct golden_win {
+    int x, y, w, h;
+    int64_t n, s, sd;           // pixels, sum, sqrt(n * sum of squares - sum^2)
+};
+
+struct golden {
+    int width, height;          // luma
+    int w, h;                   // working level
+    int bw, bh;                 // block grid
+    struct golden_plane tmpl, tmpl_c, cur, cur_c;
+    uint8_t *half;              // between the working and coarse levels
+    struct golden_win win, win_c;
+    uint16_t *acc;              // template, 8.8 fixed point
+    int32_t *mean, *sd;         // learned block scores, 4 fractional bits
+    int64_t *var;               // 8 fractional bits
+    int32_t *score, *scratch;
+    int32_t memo[GOLDEN_RANGE * GOLDEN_RANGE];
+    int trained;                // frames in the template
+    int stats;                  // frames in the block statistics
+};
+
+struct golden_result {
+    int flagged;                // blocks over the threshold
+    float max_z;
+    int worst_bx, worst_by;
+    int learned;                // 1 if the learned statistics were used
+    int aligned;                // 0: NCC under GOLDEN_MIN_NCC, suspicious whatever the blocks say
+    float ncc;
+    int dx, dy;                 // frame offset against the template, luma pixels
+};
+
+static inline uint64_t golden_isqrt(uint64_t v) {
+    uint64_t r = 0, b = 1ULL << 62;
+    while (b > v) b >>= 2;
+    while (b) {
+        if (v >= r + b) {
+            v -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+    return r;
+}
+
+// Sum over a w x h window at (x, y); exact mod 2^32, so exact for any window that fits
+static inline uint32_t golden_box(const uint32_t *t, int stride, int x, int y, int w, int h) {
+    const uint32_t *a = t + (size_t)y * stride + x, *b = a + (size_t)h * stride;
+    return b[w] - b[0] - a[w] + a[0];
+}
+
+static inline int golden_plane_alloc(struct golden_plane *p, int w, int h) {
+    p->w = w;
+    p->h = h;
+    p->px = malloc((size_t)w * h);
+    p->sum = malloc((size_t)(w + 1) * (h + 1) * sizeof(uint32_t));
+    p->sq = malloc((size_t)(w + 1) * (h + 1) * sizeof(uint32_t));
+    return p->px && p->sum && p->sq ? 0 : -1;
+}
+
+static inline void golden_plane_free(struct golden_plane *p) {
+    free(p->px);
+    free(p->sum);
+    free(p->sq);
+}
+
+static inline void golden_tables(struct golden_plane *p) {
+    int W = p->w + 1;
+    memset(p->sum, 0, W * sizeof(uint32_t));
+    memset(p->sq, 0, W * sizeof(uint32_t));
+    for (int y = 0; y < p->h; y++) {
+        const uint8_t *row = p->px + (size_t)y * p->w;
+        const uint32_t *s0 = p->sum + (size_t)y * W, *q0 = p->sq + (size_t)y * W;
+        uint32_t *s1 = p->sum + (size_t)(y + 1) * W, *q1 = p->sq + (size_t)(y + 1) * W;
+        uint32_t rs = 0, rq = 0;
+        s1[0] = q1[0] = 0;
+        for (int x = 0; x < p->w; x++) {
+            rs += row[x];
+            rq += (uint32_t)row[x] * row[x];
+            s1[x + 1] = s0[x + 1] + rs;
+            q1[x + 1] = q0[x + 1] + rq;
+        }
+    }
+}
+
+// 2x2 box average of src into dst (dw x dh). Eight source bytes to four
+// output bytes per step in 16-bit lanes of a 64-bit word (SWAR; the U54
+// has no vector unit) when the rows are 8-byte aligned.
+static inline void golden_halve(const uint8_t *src, int stride, uint8_t *dst, int dw, int dh) {
+    const uint64_t m = 0x00ff00ff00ff00ffULL;
+    int swar = ((uintptr_t)src % 8 == 0 && stride % 8 == 0 && (uintptr_t)dst % 4 == 0 && dw % 4 == 0) ? dw / 4 : 0;
+    for (int y = 0; y < dh; y++, src += 2 * stride, dst += dw) {
+        const uint64_t *a = (const uint64_t *)src, *b = (const uint64_t *)(src + stride);
+        uint32_t *d = (uint32_t *)dst;
+        for (int i = 0; i < swar; i++) {
+            uint64_t s = (a[i] & m) + (a[i] >> 8 & m) + (b[i] & m) + (b[i] >> 8 & m) + 0x0002000200020002ULL;
+            s = s >> 2 & m;
+            s = (s | s >> 8) & 0x0000ffff0000ffffULL;
+            d[i] = (uint32_t)(s | s >> 16);
+        }
+        for (int x = swar * 4; x < dw; x++)
+            dst[x] = (src[2 * x] + src[2 * x + 1] + src[stride + 2 * x] + src[stride + 2 * x + 1] + 2) >> 2;
+    }
+}
+
+// Sum over the correlated rows of a w x h window at (x, y), a row at a time from the table
+static inline int64_t golden_rows(const uint32_t *t, int stride, int x, int y, int w, int h) {
+    int64_t s = 0;
+    for (int r = 0; r < h; r += GOLDEN_NCC_ROWS) s += golden_box(t, stride, x, y + r, w, 1);
+    return s;
+}
+
+static inline void golden_window(struct golden_win *win, const struct golden_plane *p, int margin) {
+    win->x = win->y = margin;
+    win->w = p->w - 2 * margin;
+    win->h = p->h - 2 * margin;
+    win->n = (int64_t)win->w * ((win->h + GOLDEN_NCC_ROWS - 1) / GOLDEN_NCC_ROWS);
+    win->s = golden_rows(p->sum, p->w + 1, win->x, win->y, win->w, win->h);
+    int64_t v = win->n * golden_rows(p->sq, p->w + 1, win->x, win->y, win->w, win->h) - win->s * win->s;
+    win->sd = v > 0 ? (int64_t)golden_isqrt(v) : 0;
+}
+
+static inline void golden_free(struct golden *g) {
+    golden_plane_free(&g->tmpl);
+    golden_plane_free(&g->tmpl_c);
+    golden_plane_free(&g->cur);
+    golden_plane_free(&g->cur_c);
+    free(g->acc);
+    free(g->mean);
+    free(g->sd);
+    free(g->var);
+    free(g->score);
+    free(g->scratch);
+    free(g->half);
+    memset(g, 0, sizeof(*g));
+}
+
+// Returns -1 if the frame is too small for the search, too large for the
+// NCC terms or out of memory
+static inline int golden_init(struct golden *g, int width, int height) {
+    memset(g, 0, sizeof(*g));
+    g->width = width;
+    g->height = height;
+    g->w = width / GOLDEN_STEP;
+    g->h = height / GOLDEN_STEP;
+    int wc = g->w / GOLDEN_COARSE, hc = g->h / GOLDEN_COARSE, mc = GOLDEN_SEARCH / GOLDEN_COARSE;
+    if (wc - 2 * mc < 4 || hc - 2 * mc < 4) return -1;
+    if ((int64_t)(g->w - 2 * GOLDEN_SEARCH) * (g->h - 2 * GOLDEN_SEARCH) / GOLDEN_NCC_ROWS > GOLDEN_MAX_WINDOW) return -1;
+    g->bw = g->w / GOLDEN_BLOCK;
+    g->bh = g->h / GOLDEN_BLOCK;
+    size_t n = (size_t)g->bw * g->bh;
+    if (golden_plane_alloc(&g->tmpl, g->w, g->h) || golden_plane_alloc(&g->cur, g->w, g->h) ||
+        golden_plane_alloc(&g->tmpl_c, wc, hc) || golden_plane_alloc(&g->cur_c, wc, hc)) return -1;
+    g->acc = calloc((size_t)g->w * g->h, sizeof(uint16_t));
+    g->mean = calloc(n, sizeof(int32_t));
+    g->sd = calloc(n, sizeof(int32_t));
+    g->var = calloc(n, sizeof(int64_t));
+    g->score = calloc(n, sizeof(int32_t));
+    g->scratch = calloc(n, sizeof(int32_t));
+    g->half = malloc((size_t)(g->w / 2) * (g->h / 2));
+    if (!g->acc || !g->mean || !g->sd || !g->var || !g->score || !g->scratch || !g->half) return -1;
+    return 0;
+}
+
+// Coarse level of a working plane, with the tables of both
+static inline void golden_levels(struct golden *g, struct golden_plane *p, struct golden_plane *c) {
+    golden_tables(p);
+    golden_halve(p->px, p->w, g->half, p->w / 2, p->h / 2);
+    golden_halve(g->half, p->w / 2, c->px, c->w, c->h);
+    golden_tables(c);
+}
+
+static inline void golden_frame(struct golden *g, const uint8_t *luma, int stride) {
+    golden_halve(luma, stride ? stride : g->width, g->cur.px, g->w, g->h);
+    golden_levels(g, &g->cur, &g->cur_c);
+}
+
+// The template planes from the accumulator
+static inline void golden_template(struct golden *g) {
+    size_t n = (size_t)g->w * g->h;
+    for (size_t i = 0; i < n; i++) g->tmpl.px[i] = (g->acc[i] + 128) >> 8;
+    golden_levels(g, &g->tmpl, &g->tmpl_c);
+    golden_window(&g->win, &g->tmpl, GOLDEN_SEARCH);
+    golden_window(&g->win_c, &g->tmpl_c, GOLDEN_SEARCH / GOLDEN_COARSE);
+}
+
+static inline uint64_t golden_dot(const uint8_t *a, int astride, const uint8_t *b, int bstride, int w, int h) {
+    uint64_t s = 0;
+    for (int y = 0; y < h; y++, a += astride, b += bstride) {
+        uint32_t r = 0;
+        for (int x = 0; x < w; x++) r += (uint32_t)a[x] * b[x];
+        s += r;
+    }
+    return s;
+}
+
+// NCC in Q15 of the template window against the frame shifted by (dx, dy)
+static inline int32_t golden_ncc(const struct golden_plane *t, const struct golden_win *win,
+                                 const struct golden_plane *f, int dx, int dy) {
+    int x = win->x + dx, y = win->y + dy, W = f->w + 1;
+    int64_t sf = golden_rows(f->sum, W, x, y, win->w, win->h);
+    int64_t vf = win->n * golden_rows(f->sq, W, x, y, win->w, win->h) - sf * sf;
+    if (vf <= 0 || win->sd == 0) return 0;
+    int64_t sft = golden_dot(f->px + (size_t)y * f->w + x, f->w * GOLDEN_NCC_ROWS,
+                             t->px + (size_t)win->y * t->w + win->x, t->w * GOLDEN_NCC_ROWS,
+                             win->w, (win->h + GOLDEN_NCC_ROWS - 1) / GOLDEN_NCC_ROWS);
+    int64_t num = win->n * sft - sf * win->s;
+    return (int32_t)(num * 32768 / ((int64_t)golden_isqrt(vf) * win->sd));
+}
+
+// Peak offset of a parabola through three samples one coarse pixel apart, in working pixels
+static inline int golden_peak(int32_t l, int32_t c, int32_t r) {
+    int64_t den = 2 * ((int64_t)l - 2 * c + r);
+    if (den >= 0) return 0;
+    int64_t num = (int64_t)GOLDEN_COARSE * (l - r);
+    return (int)((num + (num < 0 ? den / 2 : -den / 2)) / den);
+}
+
+// Best shift of the frame against the template in working pixels; returns its NCC
+static inline int32_t golden_align(struct golden *g, int *dx, int *dy) {
+    const int r = GOLDEN_SEARCH / GOLDEN_COARSE, cn = 2 * r + 1;
+    int32_t c[(2 * (GOLDEN_SEARCH / GOLDEN_COARSE) + 1) * (2 * (GOLDEN_SEARCH / GOLDEN_COARSE) + 1)];
+    int32_t best = INT32_MIN;
+    int bx = 0, by = 0;
+    for (int y = -r; y <= r; y++)
+        for (int x = -r; x <= r; x++) {
+            int32_t v = c[(y + r) * cn + x + r] = golden_ncc(&g->tmpl_c, &g->win_c, &g->cur_c, x, y);
+            if (v > best) { best = v; bx = x; by = y; }
+        }
+    int x = bx * GOLDEN_COARSE, y = by * GOLDEN_COARSE;
+    const int32_t *p = &c[(by + r) * cn + bx + r];
+    if (bx > -r && bx < r) x += golden_peak(p[-1], p[0], p[1]);
+    if (by > -r && by < r) y += golden_peak(p[-cn], p[0], p[cn]);
+
+    // Hill-climb at the working level over the four neighbours, each shift evaluated once
+    static const int8_t step_x[5] = { 0, -1, 1, 0, 0 }, step_y[5] = { 0, 0, 0, -1, 1 };
+    for (int i = 0; i < GOLDEN_RANGE * GOLDEN_RANGE; i++) g->memo[i] = INT32_MIN;
+    if (x < -GOLDEN_SEARCH) x = -GOLDEN_SEARCH;
+    if (x > GOLDEN_SEARCH) x = GOLDEN_SEARCH;
+    if (y < -GOLDEN_SEARCH) y = -GOLDEN_SEARCH;
+    if (y > GOLDEN_SEARCH) y = GOLDEN_SEARCH;
+    best = INT32_MIN;
+    for (int step = 0; step <= GOLDEN_CLIMB; step++) {
+        int nx = x, ny = y;
+        for (int k = 0; k < 5; k++) {
+            int sx = x + step_x[k], sy = y + step_y[k];
+            if (sx < -GOLDEN_SEARCH || sx > GOLDEN_SEARCH || sy < -GOLDEN_SEARCH || sy > GOLDEN_SEARCH) continue;
+            int32_t *m = &g->memo[(sy + GOLDEN_SEARCH) * GOLDEN_RANGE + sx + GOLDEN_SEARCH];
+            if (*m == INT32_MIN) *m = golden_ncc(&g->tmpl, &g->win, &g->cur, sx, sy);
+            if (*m > best) { best = *m; nx = sx; ny = sy; }
+        }
+        if (nx == x && ny == y) break;
+        x = nx;
+        y = ny;
+    }
+    *dx = x;
+    *dy = y;
+    return best;
+}
+
+// Mean-removed SAD per block, in grey levels, at shift (dx, dy); -1 where the block leaves the frame
+static inline void golden_scores(struct golden *g, int dx, int dy) {
+    const int B = GOLDEN_BLOCK, n = B * B, W = g->w + 1;
+    int32_t *score = g->score;
+    for (int by = 0; by < g->bh; by++)
+        for (int bx = 0; bx < g->bw; bx++, score++) {
+            int tx = bx * B, ty = by * B, fx = tx + dx, fy = ty + dy;
+            if (fx < 0 || fy < 0 || fx + B > g->w || fy + B > g->h) { *score = -1; continue; }
+            int32_t o = (int32_t)golden_box(g->cur.sum, W, fx, fy, B, B) - (int32_t)golden_box(g->tmpl.sum, W, tx, ty, B, B);
+            const uint8_t *f = g->cur.px + (size_t)fy * g->w + fx, *t = g->tmpl.px + (size_t)ty * g->w + tx;
+            uint32_t s = 0;
+            for (int y = 0; y < B; y++, f += g->w, t += g->w)
+                for (int x = 0; x < B; x++) {
+                    int32_t d = n * (f[x] - t[x]) - o;
+                    s += d < 0 ? -d : d;
+                }
+            *score = s / n;
+        }
+}
+
+// Fold a known-good frame into the template and, once that has settled, the
+// block statistics. Returns -1 if the frame does not align (left out).
+static inline int golden_learn(struct golden *g, const uint8_t *luma, int stride) {
+    int dx = 0, dy = 0, n = g->bw * g->bh;
+    golden_frame(g, luma, stride);
+    if (g->trained && golden_align(g, &dx, &dy) < GOLDEN_MIN_NCC) return -1;
+
+    // Plain average for the first frames, then an exponential moving average
+    if (g->trained >= GOLDEN_MIN_TRAIN) {
+        int64_t m = g->stats < GOLDEN_MIN_TRAIN ? g->stats + 1 : 1 << GOLDEN_ALPHA_SHIFT;
+        golden_scores(g, dx, dy);
+        for (int i = 0; i < n; i++) {
+            if (g->score[i] < 0) continue;
+            int64_t d = ((int64_t)g->score[i] << 4) - g->mean[i];
+            int64_t v = g->var[i] + d * d / m;
+            g->mean[i] += d / m;
+            g->var[i] = v - v / m;
+            int64_t sd = golden_isqrt(g->var[i]);
+            g->sd[i] = sd < GOLDEN_MIN_SD << 4 ? GOLDEN_MIN_SD << 4 : sd;
+        }
+        g->stats++;
+    }
+    int32_t m = g->trained < GOLDEN_MIN_TRAIN ? g->trained + 1 : 1 << GOLDEN_ALPHA_SHIFT;
+    for (int y = 0; y < g->h; y++) {
+        int fy = y + dy;
+        if (fy < 0 || fy >= g->h) continue;
+        uint16_t *a = g->acc + (size_t)y * g->w;
+        const uint8_t *f = g->cur.px + (size_t)fy * g->w;
+        for (int x = 0; x < g->w; x++) {
+            int fx = x + dx;
+            if (fx >= 0 && fx < g->w) a[x] += (((int32_t)f[fx] << 8) - a[x]) / m;
+        }
+    }
+    g->trained++;
+    golden_template(g);
+    return 0;
+}
+
+static int golden_cmp(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Screen a frame. Returns 1 if it looks suspicious; 0 with no template yet.
+static inline int golden_eval(struct golden *g, const uint8_t *luma, int stride, struct golden_result *r) {
+    int n = g->bw * g->bh, k = 0, dx, dy;
+    int32_t med = 0, scale = GOLDEN_FRAME_SD << 4, max_z = INT32_MIN;
+
+    memset(r, 0, sizeof(*r));
+    if (!g->trained) return 0;
+    golden_frame(g, luma, stride);
+    int32_t ncc = golden_align(g, &dx, &dy);
+    r->ncc = ncc / 32768.0f;
+    r->aligned = ncc >= GOLDEN_MIN_NCC;
+    r->dx = dx * GOLDEN_STEP;
+    r->dy = dy * GOLDEN_STEP;
+    golden_scores(g, dx, dy);
+    r->learned = g->stats >= GOLDEN_MIN_TRAIN;
+
+    if (!r->learned) {
+        // Robust frame statistics: median and MAD (scaled to a sigma)
+        for (int i = 0; i < n; i++)
+            if (g->score[i] >= 0) g->scratch[k++] = g->score[i] << 4;
+        if (!k) return !r->aligned;
+        qsort(g->scratch, k, sizeof(int32_t), golden_cmp);
+        med = g->scratch[k / 2];
+        for (int i = 0; i < k; i++) g->scratch[i] = abs(g->scratch[i] - med);
+        qsort(g->scratch, k, sizeof(int32_t), golden_cmp);
+        int32_t mad = g->scratch[k / 2] * 1518 >> 10;
+        if (mad > scale) scale = mad;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (g->score[i] < 0) continue;
+        int64_t d = ((int64_t)g->score[i] << 4) - (r->learned ? g->mean[i] : med);
+        int32_t z = (int32_t)(d * 256 / (r->learned ? g->sd[i] : scale));
+        if (z > GOLDEN_Z * 256) r->flagged++;
+        if (z > max_z) {
+            max_z = z;
+            r->worst_bx = i % g->bw;
+            r->worst_by = i / g->bw;
+        }
+    }
+    r->max_z = max_z / 256.0f;
+    return r->flagged >= GOLDEN_MIN_BLOCKS || !r->aligned;
+}
+
+// <sku>.golden: this header, then the accumulator, block means and variances
+struct golden_file {
+    char magic[8];
+    int32_t width, height, step, block, trained, stats;
+};
+
+#define GOLDEN_MAGIC "GOLDEN1"
+
+static inline int golden_write(const char *path, const void *a, size_t alen, const void *b, size_t blen,
+                               const void *c, size_t clen, const void *d, size_t dlen) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { fprintf(stderr, "golden: cannot write %s: %s\n", tmp, strerror(errno)); return -1; }
+    int ok = fwrite(a, 1, alen, f) == alen && fwrite(b, 1, blen, f) == blen &&
+             fwrite(c, 1, clen, f) == clen && fwrite(d, 1, dlen, f) == dlen;
+    if (fclose(f) != 0 || !ok) { fprintf(stderr, "golden: cannot write %s\n", tmp); remove(tmp); return -1; }
+    return rename(tmp, path);
+}
+
+static inline int golden_save(const struct golden *g, const char *dir, const char *sku) {
+    char path[512], head[96];
+    size_t n = (size_t)g->bw * g->bh;
+    struct golden_file h = { GOLDEN_MAGIC, g->width, g->height, GOLDEN_STEP, GOLDEN_BLOCK, g->trained, g->stats };
+    snprintf(path, sizeof(path), "%s/%s.golden", dir, sku);
+    if (golden_write(path, &h, sizeof(h), g->acc, (size_t)g->w * g->h * sizeof(uint16_t),
+                     g->mean, n * sizeof(int32_t), g->var, n * sizeof(int64_t)) != 0) return -1;
+    int hl = snprintf(head, sizeof(head), "P5\n# golden %s, %d frames\n%d %d\n255\n", sku, g->trained, g->w, g->h);
+    snprintf(path, sizeof(path), "%s/%s.pgm", dir, sku);
+    return golden_write(path, head, hl, g->tmpl.px, (size_t)g->w * g->h, NULL, 0, NULL, 0);
+}
+
+// Returns -1 if there is no template for the SKU (errno ENOENT) or it does not fit this frame size
+static inline int golden_load(struct golden *g, const char *dir, const char *sku) {
+    char path[512];
+    size_t n = (size_t)g->bw * g->bh;
+    struct golden_file h;
+    snprintf(path, sizeof(path), "%s/%s.golden", dir, sku);
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, GOLDEN_MAGIC, sizeof(h.magic)) == 0;
+    if (ok && (h.width != g->width || h.height != g->height || h.step != GOLDEN_STEP || h.block != GOLDEN_BLOCK)) {
+        fprintf(stderr, "golden: %s is for %dx%d frames, step %d, block %d\n", path, h.width, h.height, h.step, h.block);
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    ok = ok && fread(g->acc, sizeof(uint16_t), (size_t)g->w * g->h, f) == (size_t)g->w * g->h &&
+         fread(g->mean, sizeof(int32_t), n, f) == n && fread(g->var, sizeof(int64_t), n, f) == n;
+    fclose(f);
+    if (!ok) { fprintf(stderr, "golden: %s is truncated or not a template\n", path); errno = EINVAL; return -1; }
+    g->trained = h.trained;
+    g->stats = h.stats;
+    for (size_t i = 0; i < n; i++) {
+        int64_t sd = golden_isqrt(g->var[i]);
+        g->sd[i] = sd < GOLDEN_MIN_SD << 4 ? GOLDEN_MIN_SD << 4 : sd;
+    }
+    golden_template(g);
+    return 0;
+}
+
+#endif // GOLDEN_H
@@ -0,0 +1,116 @@
+// Golden-template screen on recorded frames (golden.h).
+// Memory-maps a file of back-to-back raw frames (as transcode reads them),
+// takes the luma of each and either folds it into the SKU's template
+// (learn, the frames must be known-good boxes) or screens it against the
+// template (screen), timing the screen per frame. The template is loaded
+// from and saved to <template_dir>/<sku>.golden.
+//
+// Usage: golden_check <learn|screen> <template_dir> <sku> <frames.raw> <width> <height> [format]
+//        format is a pixfmt name (YUYV, UYVY, NV12, RGB24, GREY, BA81, RG10, ...), default YUYV
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#include "pixfmt.h"
+#include "telemetry.h"
+#include "golden.h"
+
+static struct tm_hist screen_us = TM_HIST("golden_screen", "us");    // luma in, verdict out
+static struct tm_hist learn_us = TM_HIST("golden_learn", "us");
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 7 || argc > 8 || (strcmp(argv[1], "learn") != 0 && strcmp(argv[1], "screen") != 0)) {
+        fprintf(stderr, "Usage: %s <learn|screen> <template_dir> <sku> <frames.raw> <width> <height> [format]\n", argv[0]);
+        return 1;
+    }
+    int learn = strcmp(argv[1], "learn") == 0;
+    const char *dir = argv[2], *sku = argv[3], *in_path = argv[4];
+    int width = atoi(argv[5]), height = atoi(argv[6]);
+    uint32_t fourcc = argc > 7 ? pixfmt_from_name(argv[7]) : V4L2_PIX_FMT_YUYV;
+    if (!fourcc) { fprintf(stderr, "ERROR: unknown format %s\n", argv[7]); return 1; }
+
+    struct golden g;
+    if (golden_init(&g, width, height) != 0) {
+        fprintf(stderr, "ERROR: %dx%d does not fit the screen (search %d, step %d)\n", width, height, GOLDEN_SEARCH, GOLDEN_STEP);
+        return 1;
+    }
+    if (golden_load(&g, dir, sku) != 0) {
+        if (errno != ENOENT) return 1;
+        if (!learn) { fprintf(stderr, "ERROR: no template for %s in %s\n", sku, dir); return 1; }
+        printf("New template for %s\n", sku);
+    } else {
+        printf("Template %s: %d frames, block statistics from %d\n", sku, g.trained, g.stats);
+    }
+
+    struct stat st;
+    int fd = open(in_path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", in_path, strerror(errno)); return 1; }
+    size_t frame_size = pixfmt_frame_size(fourcc, width, height);
+    long nframes = frame_size ? st.st_size / (off_t)frame_size : 0;
+    if (nframes == 0) { fprintf(stderr, "ERROR: %s holds no %dx%d %s frame\n", in_path, width, height, pixfmt_name(fourcc)); return 1; }
+    const uint8_t *input = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (input == MAP_FAILED) { perror("mmap"); return 1; }
+
+    struct pixfmt_ctx conv;
+    pixfmt_init(&conv, 1);
+    uint8_t *luma = malloc((size_t)width * height);
+    if (!luma) { perror("Malloc failed"); return 1; }
+
+    long suspicious = 0, misaligned = 0, left_out = 0;
+    for (long f = 0; f < nframes; f++) {
+        if (pixfmt_convert_serial(&conv, fourcc, PIXFMT_DST_GREY, input + f * frame_size, 0, luma, width, height, 0) != 0) {
+            fprintf(stderr, "ERROR: no luma for %s\n", pixfmt_name(fourcc));
+            return 1;
+        }
+        uint64_t t0 = now_ns();
+        if (learn) {
+            int r = golden_learn(&g, luma, width);
+            tm_record(&learn_us, (now_ns() - t0) / 1000);
+            if (r != 0) {
+                fprintf(stderr, "WARNING: frame %ld does not match the template, left out\n", f);
+                left_out++;
+            }
+            continue;
+        }
+        struct golden_result res;
+        int bad = golden_eval(&g, luma, width, &res);
+        tm_record(&screen_us, (now_ns() - t0) / 1000);
+        suspicious += bad;
+        misaligned += !res.aligned;
+        printf("frame %ld: %s (ncc %.3f at %+d,%+d, %d blocks flagged, max z %.1f at block %d,%d%s)\n", f,
+               bad ? "SUSPICIOUS" : "clean", res.ncc, res.dx, res.dy, res.flagged, res.max_z, res.worst_bx, res.worst_by,
+               res.learned ? "" : ", frame statistics");
+    }
+
+    if (learn) {
+        printf("%ld frames learned, %ld left out; template %s: %d frames, block statistics from %d%s\n",
+               nframes - left_out, left_out, sku, g.trained, g.stats,
+               g.stats < GOLDEN_MIN_TRAIN ? " (not used yet)" : "");
+        mkdir(dir, 0755);
+        if (golden_save(&g, dir, sku) != 0) return 1;
+    } else {
+        printf("%ld frames: %ld suspicious, %ld not aligned\n", nframes, suspicious, misaligned);
+    }
+    tm_print(stdout);
+
+    free(luma);
+    pixfmt_destroy(&conv);
+    munmap((void *)input, st.st_size);
+    close(fd);
+    golden_free(&g);
+    return 0;
+}
@@ -0,0 +1,100 @@
+// GPIO trigger check (gpiotrig.h) against a synthetic frame clock.
+// Reads edges from a GPIO line and matches each to the nearest frame of a
+// free-running fps clock, as capture_loop does with V4L2 timestamps. Given
+// the sysfs "pull" attribute of a gpio-sim line, it also drives the edges
+// itself at random times and reports how far the kernel timestamp is from
+// the write that caused it:
+//
+//   modprobe gpio-sim
+//   mkdir -p /sys/kernel/config/gpio-sim/trig/bank0/line0
+//   echo 1 > /sys/kernel/config/gpio-sim/trig/live
+//   chip=$(cat /sys/kernel/config/gpio-sim/trig/bank0/chip_name)
+//   gpio_trigger /dev/$chip 0 /sys/devices/platform/$(cat /sys/kernel/config/gpio-sim/trig/dev_name)/$chip/sim_gpio0/pull
+//
+// Usage: gpio_trigger <gpiochip> <line> [sim_pull] [offset_us] [fps] [edges]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "telemetry.h"
+#include "gpiotrig.h"
+
+static struct tm_hist inject_us = TM_HIST("sim_to_edge", "us");    // sysfs write -> kernel edge timestamp
+
+static int sim_write(const char *path, const char *v) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) { perror(path); return -1; }
+    int r = write(fd, v, strlen(v)) < 0 ? -1 : 0;
+    if (r) perror(path);
+    close(fd);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <gpiochip> <line> [sim_pull] [offset_us] [fps] [edges]\n", argv[0]);
+        return 1;
+    }
+    const char *chip = argv[1];
+    int line = atoi(argv[2]);
+    const char *sim = (argc >= 4 && strcmp(argv[3], "-")) ? argv[3] : NULL;
+    int offset_us = (argc >= 5) ? atoi(argv[4]) : 0;
+    int fps = (argc >= 6) ? atoi(argv[5]) : 30;
+    int want = (argc >= 7) ? atoi(argv[6]) : 50;
+    struct gpiotrig gt;
+
+    if (sim && sim_write(sim, "pull-down") != 0) return 1;
+    if (gpiotrig_open(&gt, chip, line, 0, 0, offset_us) != 0) return 1;
+
+    uint64_t period = 1000000000ull / fps;
+    uint64_t start = gpiotrig_now_ns(), next_frame = start + period;
+    uint64_t next_edge = start + period * 3, release = 0, written = 0;
+    srand(1);
+    while (gt.edges < (uint64_t)want) {
+        uint64_t now = gpiotrig_now_ns(), wake = next_frame;
+        if (sim && next_edge < wake) wake = next_edge;
+        if (sim && release && release < wake) wake = release;
+        struct pollfd pfd = { gt.fd, POLLIN, 0 };
+        int timeout = wake > now ? (int)((wake - now + 999999) / 1000000) : 0;
+        if (poll(&pfd, 1, timeout) > 0) {
+            if (gpiotrig_read(&gt) && written) {
+                // The newest event is the one our write caused
+                uint64_t edge = gt.target[(gt.head + gt.count - 1) % GPIOTRIG_MAX_PENDING] - (int64_t)offset_us * 1000;
+                if (edge > written) tm_record(&inject_us, (edge - written) / 1000);
+                written = 0;
+            }
+        }
+        now = gpiotrig_now_ns();
+        if (now >= next_frame) {
+            // A frame is dequeued about one period after its timestamp
+            if (gpiotrig_frame(&gt, next_frame - period))
+                printf("frame %.3f ms taken\n", (next_frame - period - start) / 1e6);
+            next_frame += period;
+        }
+        if (sim && now >= next_edge) {
+            written = gpiotrig_now_ns();
+            if (sim_write(sim, "pull-up") != 0) return 1;
+            release = now + 5000000;
+            next_edge = now + period * 2 + (uint64_t)(rand() % 200) * period / 20;
+        }
+        if (sim && release && now >= release) {
+            sim_write(sim, "pull-down");
+            release = 0;
+        }
+    }
+    // Let the last target meet its frame
+    for (int i = 0; i < 8; i++) {
+        usleep(period / 1000);
+        gpiotrig_frame(&gt, next_frame - period);
+        next_frame += period;
+    }
+
+    gpiotrig_print(&gt);
+    tm_print(stdout);
+    gpiotrig_close(&gt);
+    return 0;
+}
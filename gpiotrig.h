@@ -0,0 +1,206 @@
+// gpiotrig.h - Photo-sensor capture trigger on a GPIO line.
+//
+// A light barrier just upstream of the camera marks the moment a box
+// arrives, so the frame to inspect can be picked by time instead of by
+// running presence detection on every frame.
+//
+// The line is requested through the GPIO character device (uAPI v2, the
+// interface libgpiod wraps) as an edge-detecting input. The kernel stamps
+// every edge in its interrupt handler with CLOCK_MONOTONIC, the same clock
+// V4L2 uses for buffer timestamps, so the two can be compared directly and
+// the latency of reading the event does not matter. The line fd goes into
+// the capture loop's poll() set; gpiotrig_read() drains it.
+//
+// Each edge sets a target time: edge + offset_us (belt travel from the
+// sensor to the middle of the field of view, negative if the sensor sits
+// downstream). gpiotrig_frame() is called with every frame's timestamp and
+// says whether this frame is the one nearest a pending target. With the
+// frame period tracked from the timestamps, a frame is taken as soon as it
+// is within half a period of the target, so no frame has to be held back
+// waiting for its successor. A target whose nearest frame was already
+// requeued before the edge was read is served by the next frame and
+// counted as late.
+//
+// Testing without a sensor: the gpio-sim module provides a chip whose line
+// levels are set from sysfs, see gpio_trigger.c.
+//
+// Usage:
+//   struct gpiotrig gt;
+//   gpiotrig_open(&gt, "/dev/gpiochip0", 17, 0, 1000, 35000);
+//   poll() on gt.fd too; POLLIN -> gpiotrig_read(&gt);
+//   per frame: if (gpiotrig_frame(&gt, ts_ns)) encode it
+//   gpiotrig_print(&gt); gpiotrig_close(&gt);
+
+#ifndef GPIOTRIG_H
+#define GPIOTRIG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "telemetry.h"
+
+#define GPIOTRIG_MAX_PENDING 16         // edges waiting for their frame
+#define GPIOTRIG_STALE_PERIODS 4        // a target this many periods old with no frame is missed
+
+struct gpiotrig {
+    int fd;                             // line request fd, -1 if not open
+    int offset_us;
+    uint64_t target[GPIOTRIG_MAX_PENDING];      // CLOCK_MONOTONIC ns
+    int head, count;
+    uint64_t last_frame_ns;
+    double period_ns;                   // EWMA of frame timestamp deltas, 0 until known
+    uint32_t last_seqno;
+
+    uint64_t edges, taken, late, missed, lost, overflow;
+    int64_t err_min, err_max;           // frame - target, ns
+    double err_sum;
+};
+
+static struct tm_hist gpiotrig_err_us = TM_HIST("trigger_err", "us");       // |frame - (edge + offset)|
+static struct tm_hist gpiotrig_edge_us = TM_HIST("trigger_edge", "us");     // edge -> read by the loop
+static struct tm_counter gpiotrig_edges = TM_COUNTER("trigger_edges");
+
+static inline uint64_t gpiotrig_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void gpiotrig_reset(struct gpiotrig *gt, int fd, int offset_us) {
+    memset(gt, 0, sizeof(*gt));
+    gt->fd = fd;
+    gt->offset_us = offset_us;
+    gt->err_min = INT64_MAX;
+    gt->err_max = INT64_MIN;
+}
+
+// Request line on chip (e.g. "/dev/gpiochip0") as an edge input. falling: trigger
+// on the falling edge instead of the rising one (beam broken on a dark-on sensor).
+static inline int gpiotrig_open(struct gpiotrig *gt, const char *chip, int line, int falling, int debounce_us, int offset_us) {
+    struct gpio_v2_line_request req;
+    gpiotrig_reset(gt, -1, offset_us);
+
+    int cfd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (cfd < 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", chip, strerror(errno)); return -1; }
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = line;
+    req.num_lines = 1;
+    req.event_buffer_size = GPIOTRIG_MAX_PENDING * 4;
+    snprintf(req.consumer, sizeof(req.consumer), "capture-trigger");
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+                       (falling ? GPIO_V2_LINE_FLAG_EDGE_FALLING : GPIO_V2_LINE_FLAG_EDGE_RISING);
+    if (debounce_us > 0) {
+        req.config.num_attrs = 1;
+        req.config.attrs[0].mask = 1;
+        req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+        req.config.attrs[0].attr.debounce_period_us = debounce_us;
+    }
+    int r = ioctl(cfd, GPIO_V2_GET_LINE_IOCTL, &req);
+    if (r < 0 && debounce_us > 0 && errno == EINVAL) {
+        // Not every controller (or kernel) debounces; a bouncing sensor then shows up as extra edges
+        fprintf(stderr, "WARNING: %s line %d: no debounce\n", chip, line);
+        req.config.num_attrs = 0;
+        r = ioctl(cfd, GPIO_V2_GET_LINE_IOCTL, &req);
+    }
+    close(cfd);
+    if (r < 0) { fprintf(stderr, "ERROR: %s line %d: %s\n", chip, line, strerror(errno)); return -1; }
+    gt->fd = req.fd;
+    fcntl(gt->fd, F_SETFL, fcntl(gt->fd, F_GETFL) | O_NONBLOCK);
+    printf("Trigger: %s line %d, %s edge, offset %d us\n", chip, line, falling ? "falling" : "rising", offset_us);
+    return 0;
+}
+
+// A line request fd another process opened (live upgrade, handoff.h); edges
+// it has not read yet are still queued in it
+static inline void gpiotrig_adopt(struct gpiotrig *gt, int fd, int offset_us) {
+    gpiotrig_reset(gt, fd, offset_us);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    printf("Trigger: line taken over, offset %d us\n", offset_us);
+}
+
+static inline void gpiotrig_close(struct gpiotrig *gt) {
+    if (gt->fd >= 0) close(gt->fd);
+    gt->fd = -1;
+}
+
+// Queue a target; also the entry point for edges that come from somewhere else
+static inline void gpiotrig_edge(struct gpiotrig *gt, uint64_t edge_ns) {
+    gt->edges++;
+    tm_count(&gpiotrig_edges, 1);
+    if (gt->count == GPIOTRIG_MAX_PENDING) {
+        gt->head = (gt->head + 1) % GPIOTRIG_MAX_PENDING;      // drop the oldest
+        gt->count--;
+        gt->overflow++;
+    }
+    gt->target[(gt->head + gt->count) % GPIOTRIG_MAX_PENDING] = edge_ns + (int64_t)gt->offset_us * 1000;
+    gt->count++;
+}
+
+// Drain the line's event queue. Returns the number of edges read.
+static inline int gpiotrig_read(struct gpiotrig *gt) {
+    struct gpio_v2_line_event ev[8];
+    int edges = 0;
+    ssize_t n;
+    while ((n = read(gt->fd, ev, sizeof(ev))) > 0) {
+        uint64_t now = gpiotrig_now_ns();
+        for (size_t i = 0; i < (size_t)n / sizeof(ev[0]); i++) {
+            // The kernel drops events when its FIFO fills; the sequence number shows it
+            if (gt->last_seqno && ev[i].line_seqno > gt->last_seqno + 1) gt->lost += ev[i].line_seqno - gt->last_seqno - 1;
+            gt->last_seqno = ev[i].line_seqno;
+            if (now > ev[i].timestamp_ns) tm_record(&gpiotrig_edge_us, (now - ev[i].timestamp_ns) / 1000);
+            gpiotrig_edge(gt, ev[i].timestamp_ns);
+            edges++;
+        }
+    }
+    return edges;
+}
+
+// Per frame, with its V4L2 timestamp in ns. Returns 1 if it is the frame for a pending target.
+static inline int gpiotrig_frame(struct gpiotrig *gt, uint64_t ts_ns) {
+    if (gt->last_frame_ns && ts_ns > gt->last_frame_ns) {
+        double d = (double)(ts_ns - gt->last_frame_ns);
+        // Skipped frames are not a new rate: only follow deltas near the current estimate
+        if (!gt->period_ns || d < gt->period_ns * 1.5) gt->period_ns = gt->period_ns ? gt->period_ns + 0.125 * (d - gt->period_ns) : d;
+        else if (d > gt->period_ns * 4) gt->period_ns = d;     // rate really dropped (idle)
+    }
+    gt->last_frame_ns = ts_ns;
+
+    int take = 0;
+    double half = gt->period_ns ? gt->period_ns / 2 : 0;
+    while (gt->count) {
+        uint64_t t = gt->target[gt->head];
+        int64_t err = (int64_t)(ts_ns - t);
+        if (err < -(int64_t)half) break;        // target still ahead; the next frame is nearer
+        if (gt->period_ns && err > gt->period_ns * GPIOTRIG_STALE_PERIODS) {
+            gt->missed++;                       // no frame near it any more (dropped, or stream stalled)
+        } else {
+            if (take) break;                    // two targets on one frame: leave the second for the next frame
+            take = 1;
+            gt->taken++;
+            if (err > half) gt->late++;
+            if (err < gt->err_min) gt->err_min = err;
+            if (err > gt->err_max) gt->err_max = err;
+            gt->err_sum += err;
+            tm_record(&gpiotrig_err_us, (uint64_t)(err < 0 ? -err : err) / 1000);
+        }
+        gt->head = (gt->head + 1) % GPIOTRIG_MAX_PENDING;
+        gt->count--;
+    }
+    return take;
+}
+
+static inline void gpiotrig_print(const struct gpiotrig *gt) {
+    printf("Trigger: %llu edges, %llu frames taken, %llu late, %llu missed, %llu lost by the kernel, %llu overflowed",
+           (unsigned long long)gt->edges, (unsigned long long)gt->taken, (unsigned long long)gt->late,
+           (unsigned long long)gt->missed, (unsigned long long)gt->lost, (unsigned long long)gt->overflow);
+    if (gt->taken) printf(" (frame - target ms: min %.2f avg %.2f max %.2f)", gt->err_min / 1e6,
+                          gt->err_sum / gt->taken / 1e6, gt->err_max / 1e6);
+    printf("\n");
+}
+
+#endif // GPIOTRIG_H
@@ -0,0 +1,195 @@
+// handoff.h - Live upgrade: pass open fds and state to a new binary.
+//
+// Restarting capture_loop costs the V4L2 stream (renegotiation, buffer
+// setup and the warm-up frames); restarting serial_pwm costs the tty setup
+// (configure_serial() flushes whatever the display sent) and pwm_init()
+// stops the belt. Instead, the running daemon listens on a Unix socket and
+// the new binary, started alongside it, connects and is handed the open fds
+// (SCM_RIGHTS) plus a state blob describing them. The old process then
+// exits without tearing anything down: no STREAMOFF, no PWM writes, no
+// termios change. The device keeps running; only the process changes.
+//
+// Sequence:
+//   new: handoff_connect(path)          -> fails if nothing is listening: normal start
+//   old: listen fd readable -> accept, quiesce (drain the encoder, close the
+//        archive segment), handoff_send(state, fds)
+//   new: handoff_recv(), adopt fds and state, handoff_ack()
+//   old: handoff_wait_ack() -> exit; on timeout or error it resumes instead
+//   new: handoff_wait_close() if it must wait for the old one to be gone
+//   new: handoff_listen(path) for the next upgrade
+//
+// The state blob is a plain struct owned by each tool, tagged with a kind
+// and its size so a binary with a different layout refuses it rather than
+// misreading it (the old process then just keeps running).
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define HANDOFF_MAGIC    0x31464f48u    // "HOF1"
+#define HANDOFF_MAX_FDS  8
+#define HANDOFF_ACK_MS   5000           // new binary's time to adopt everything
+
+struct handoff_hdr {
+    uint32_t magic;
+    uint32_t kind;                      // which tool's state
+    uint32_t len;                       // state bytes that follow
+    uint32_t nfds;
+};
+
+static inline int handoff_addr(struct sockaddr_un *a, const char *path) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(a->sun_path)) { fprintf(stderr, "handoff: path too long: %s\n", path); return -1; }
+    strcpy(a->sun_path, path);
+    return 0;
+}
+
+// Old side: listening socket for the poll() set
+static inline int handoff_listen(const char *path) {
+    struct sockaddr_un a;
+    if (handoff_addr(&a, path) != 0) return -1;
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (s < 0) { perror("handoff: socket"); return -1; }
+    unlink(path);
+    if (bind(s, (struct sockaddr *)&a, sizeof(a)) != 0 || listen(s, 1) != 0) {
+        fprintf(stderr, "handoff: cannot listen on %s: %s (live upgrade off)\n", path, strerror(errno));
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// Old side, listen fd readable: the new binary, or -1
+static inline int handoff_accept(int ls) {
+    int s = accept(ls, NULL, NULL);
+    if (s < 0) {
+        if (errno != EAGAIN) perror("handoff: accept");
+        return -1;
+    }
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK);    // inherited from the listener on some systems
+    return s;
+}
+
+// New side: a running predecessor, or -1 if there is none
+static inline int handoff_connect(const char *path) {
+    struct sockaddr_un a;
+    if (handoff_addr(&a, path) != 0) return -1;
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) != 0) {
+        close(s);                       // ENOENT / ECONNREFUSED: nobody there, a stale socket file at most
+        return -1;
+    }
+    return s;
+}
+
+static inline int handoff_send(int s, uint32_t kind, const void *state, uint32_t len, const int *fds, int nfds) {
+    struct handoff_hdr h = { HANDOFF_MAGIC, kind, len, (uint32_t)nfds };
+    struct iovec iov[2] = { { &h, sizeof(h) }, { (void *)state, len } };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } u;
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    memset(&u, 0, sizeof(u));
+    m.msg_iov = iov;
+    m.msg_iovlen = 2;
+    if (nfds > 0) {
+        m.msg_control = u.buf;
+        m.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+    }
+    if (sendmsg(s, &m, MSG_NOSIGNAL) != (ssize_t)(sizeof(h) + len)) { perror("handoff: send"); return -1; }
+    return 0;
+}
+
+// New side. Fills state (exactly len bytes of the given kind) and fds.
+// Returns the number of fds, or -1; received fds are closed on a mismatch.
+static inline int handoff_recv(int s, uint32_t kind, void *state, uint32_t len, int *fds, int max_fds) {
+    struct handoff_hdr h;
+    struct iovec iov[2] = { { &h, sizeof(h) }, { state, len } };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } u;
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    memset(&u, 0, sizeof(u));
+    m.msg_iov = iov;
+    m.msg_iovlen = 2;
+    m.msg_control = u.buf;
+    m.msg_controllen = sizeof(u.buf);
+    struct pollfd p = { s, POLLIN, 0 };
+    if (poll(&p, 1, HANDOFF_ACK_MS) != 1) { fprintf(stderr, "handoff: predecessor did not send its state\n"); return -1; }
+    ssize_t n = recvmsg(s, &m, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        if (n < 0) perror("handoff: recv");
+        else fprintf(stderr, "handoff: predecessor closed the socket\n");
+        return -1;
+    }
+
+    // Whatever arrived is ours to close, even when the rest is rejected
+    int got = 0, tmp[HANDOFF_MAX_FDS];
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS || c->cmsg_len < CMSG_LEN(0)) continue;
+        int k = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *p = (int *)CMSG_DATA(c);
+        for (int i = 0; i < k; i++) {
+            if (got < HANDOFF_MAX_FDS && got < max_fds) tmp[got++] = p[i];
+            else close(p[i]);
+        }
+    }
+    if (m.msg_flags & MSG_CTRUNC) {
+        fprintf(stderr, "handoff: predecessor sent more fds than fit, not taking over\n");
+        for (int i = 0; i < got; i++) close(tmp[i]);
+        return -1;
+    }
+    if (n != (ssize_t)(sizeof(h) + len) || (m.msg_flags & MSG_TRUNC) || h.magic != HANDOFF_MAGIC ||
+        h.kind != kind || h.len != len || (int)h.nfds != got) {
+        fprintf(stderr, "handoff: predecessor's state does not match this binary, not taking over\n");
+        for (int i = 0; i < got; i++) close(tmp[i]);
+        return -1;
+    }
+    memcpy(fds, tmp, sizeof(int) * got);
+    return got;
+}
+
+// New side: everything adopted, the predecessor may go
+static inline int handoff_ack(int s) {
+    return send(s, "K", 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+// Old side: 0 if the successor took over, -1 if it failed or went away
+static inline int handoff_wait_ack(int s) {
+    struct pollfd p = { s, POLLIN, 0 };
+    char c = 0;
+    if (poll(&p, 1, HANDOFF_ACK_MS) == 1 && recv(s, &c, 1, 0) == 1 && c == 'K') return 0;
+    fprintf(stderr, "handoff: successor did not take over, carrying on\n");
+    return -1;
+}
+
+// New side: wait until the predecessor is gone from the socket, i.e. it has
+// dropped its mappings and no longer touches the devices
+static inline void handoff_wait_close(int s) {
+    struct pollfd p = { s, POLLIN, 0 };
+    char c;
+    while (poll(&p, 1, HANDOFF_ACK_MS) == 1 && recv(s, &c, 1, 0) > 0) ;
+}
+
+#endif // HANDOFF_H
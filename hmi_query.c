@@ -0,0 +1,291 @@
+// Nextion query throughput: stop-and-wait versus pipelined (nextion.h).
+// Reads the given expressions round-robin, first one query at a time (what
+// a polling loop does), then with `window` queries in flight, and reports
+// queries per second and round-trip times for both.
+//
+// With chart_pps > 0 it then runs a chart on waveform CHART_ID for
+// CHART_RUN_S seconds next to the pipelined queries: two channels fed at
+// CHART_SAMPLE_HZ, binned to chart_pps (cut to the link budget) and sent
+// with addt. It reports the points delivered, the link use against what
+// one `add` per sample would have needed, and the queries/s left over.
+//
+// With "-" as the device a simulated display runs on a pty: input and
+// output are paced at the baud rate (10 bits per byte, full duplex) and each
+// command takes SIM_PARSE_US to execute, in order. It implements addt
+// (0xFE, the samples, 0xFD) and counts the samples. It answers "x.txt" with
+// the string "x.txt", names starting with "bad" with 0x1A (invalid
+// variable) and anything else with a number derived from the name, which
+// is checked on arrival, so a reply matched to the wrong query shows up as
+// wrong. On the board give the UART the display is on.
+//
+// Usage: hmi_query <tty|-> [baud] [window] [queries] [chart_pps] [expr ...]
+//        defaults: 9600 8 200 0, dp h0.val n0.val t0.txt
+
+#define _GNU_SOURCE             // posix_openpt, ptsname
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+
+#define SERIAL_PWM_NO_MAIN      // for configure_serial()
+#include "serial_pwm.c"
+
+#define SIM_PARSE_US  1000
+#define MAX_EXPRS     16
+#define CHART_ID      1
+#define CHART_RUN_S   5
+#define CHART_SAMPLE_HZ 30
+
+static int sim_master = -1, sim_baud;
+static int sim_pipe[2];
+static volatile long sim_points;
+
+static uint32_t expr_value(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h & 0xffff;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = { (time_t)(t / 1000000000), (long)(t % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+// One command executed: its reply frame into r, less the ff ff ff
+static int sim_command(const char *cmd, unsigned char *r, int *samples) {
+    const char *e = cmd + 4;
+    int id, ch, k = 0;
+    if (sscanf(cmd, "addt %d,%d,%d", &id, &ch, samples) == 3 && *samples > 0) {
+        r[k++] = 0xFE;
+    } else if (strncmp(cmd, "get ", 4) != 0 || strncmp(e, "bad", 3) == 0) {
+        *samples = 0;
+        r[k++] = 0x1A;
+    } else if (strlen(e) > 4 && strcmp(e + strlen(e) - 4, ".txt") == 0) {
+        r[k++] = 0x70;
+        k += snprintf((char *)r + k, 64, "%s", e);
+    } else {
+        uint32_t v = expr_value(e);
+        r[k++] = 0x71;
+        for (int b = 0; b < 4; b++) r[k++] = v >> (8 * b);
+    }
+    return k;
+}
+
+// Display input: commands arrive at the baud rate and are executed in order;
+// after an addt the next bytes are samples
+static void *sim_rx(void *arg) {
+    (void)arg;
+    uint64_t byte_ns = 10000000000ull / sim_baud, wire = 0;
+    unsigned char buf[256], cmd[128], r[8 + 80];
+    int len = 0, ffs = 0, samples = 0;
+    ssize_t n;
+    while ((n = read(sim_master, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            uint64_t now = nx_now_ns();
+            wire = (wire > now ? wire : now) + byte_ns;
+            int k = 8;
+            if (samples) {
+                sim_points++;
+                if (--samples) continue;
+                sleep_until(wire);
+                r[k++] = 0xFD;
+            } else {
+                if (len < (int)sizeof(cmd) - 1) cmd[len++] = buf[i];
+                ffs = buf[i] == 0xff ? ffs + 1 : 0;
+                if (ffs < 3) continue;
+                cmd[len - 3] = 0;
+                len = ffs = 0;
+                sleep_until(wire + SIM_PARSE_US * 1000ull);
+                wire = nx_now_ns();
+                k += sim_command((const char *)cmd, r + k, &samples);
+            }
+
+            // Reply: ready time, then the frame
+            r[k++] = 0xff; r[k++] = 0xff; r[k++] = 0xff;
+            memcpy(r, &wire, 8);
+            uint32_t rl = k;
+            if (write(sim_pipe[1], &rl, 4) != 4 || write(sim_pipe[1], r, rl) != (ssize_t)rl) return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Display output: replies leave at the baud rate, independently of the input
+static void *sim_tx(void *arg) {
+    (void)arg;
+    uint64_t byte_ns = 10000000000ull / sim_baud, wire = 0, ready;
+    unsigned char r[8 + 80];
+    uint32_t rl;
+    while (read(sim_pipe[0], &rl, 4) == 4 && rl <= sizeof(r) && read(sim_pipe[0], r, rl) == (ssize_t)rl) {
+        memcpy(&ready, r, 8);
+        wire = (wire > ready ? wire : ready) + (rl - 8) * byte_ns;
+        sleep_until(wire);
+        if (write(sim_master, r + 8, rl - 8) != (ssize_t)(rl - 8)) return NULL;
+    }
+    return NULL;
+}
+
+static int sim_open(int baud) {
+    sim_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sim_master < 0 || grantpt(sim_master) < 0 || unlockpt(sim_master) < 0) { perror("pty"); return -1; }
+    const char *name = ptsname(sim_master);
+    int fd = name ? open(name, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+    if (fd < 0) { perror("Opening pty slave"); return -1; }
+    sim_baud = baud;
+    pthread_t t;
+    if (pipe(sim_pipe) != 0 || pthread_create(&t, NULL, sim_rx, NULL) != 0 || pthread_create(&t, NULL, sim_tx, NULL) != 0) {
+        perror("sim");
+        return -1;
+    }
+    return fd;
+}
+
+static int sim, nexprs;
+static const char *exprs[MAX_EXPRS];
+static long answered, wrong;
+static uint64_t rtt_sum;
+
+static void on_answer(void *arg, const char *expr, const struct nx_result *r) {
+    (void)arg;
+    answered++;
+    rtt_sum += r->rtt_ns;
+    if (!sim) return;
+    int ok = r->status == NX_NUM ? (uint32_t)r->num == expr_value(expr)
+           : r->status == NX_STR ? strcmp(r->str, expr) == 0
+           : r->status == NX_ERR ? strncmp(expr, "bad", 3) == 0 : 0;
+    if (!ok) wrong++;
+}
+
+static void on_raw(void *arg, unsigned char c) {
+    (void)arg;
+    printf("[display sent 0x%02X]\n", c);
+}
+
+// Returns queries per second
+static double run(int fd, int window, int queries) {
+    struct nextion nx;
+    unsigned char buf[256];
+    nx_init(&nx, fd, window, HMI_TIMEOUT_MS, on_raw, NULL);
+    answered = wrong = 0;
+    rtt_sum = 0;
+    int issued = 0;
+    uint64_t t0 = nx_now_ns();
+    while (answered < queries) {
+        // Keep the queue topped up, as a controller with more to read would
+        while (issued < queries && (int)(nx.tail - nx.head) < 2 * window && nx_get(&nx, exprs[issued % nexprs], on_answer, NULL) == 0) issued++;
+        struct pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, nx_timeout_ms(&nx)) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) nx_input(&nx, buf, n);
+        }
+        nx_expire(&nx);
+    }
+    double secs = (nx_now_ns() - t0) / 1e9;
+    printf("window %2d%s: %d queries in %.2f s, %.1f queries/s, round trip %.1f ms avg", window,
+           window == 1 ? " (serial polling)" : "", queries, secs, queries / secs, answered ? rtt_sum / 1e6 / answered : 0);
+    if (sim) printf(", %ld wrong", wrong);
+    printf("\n  ");
+    nx_print(&nx);
+    return queries / secs;
+}
+
+// Chart next to pipelined queries
+static void run_chart(int fd, int window, double pps, int baud) {
+    struct nextion nx;
+    struct nx_wave wv;
+    unsigned char buf[256];
+    nx_init(&nx, fd, window, HMI_TIMEOUT_MS, on_raw, NULL);
+    nx_set_baud(&nx, baud);
+    nx_wave_init(&wv, &nx, CHART_ID, 2, pps, baud);
+    nx_wave_scale(&wv, 0, 60, 0);
+    nx_wave_scale(&wv, 1, 500, 1);
+    answered = wrong = 0;
+    sim_points = 0;
+    long issued = 0, nsamples = 0;
+    uint64_t t0 = nx_now_ns(), end = t0 + CHART_RUN_S * 1000000000ull, next_sample = t0;
+    uint64_t sample_ns = 1000000000ull / CHART_SAMPLE_HZ;
+    unsigned seed = 1;
+    while (nx_now_ns() < end) {
+        uint64_t now = nx_now_ns();
+        if (now >= next_sample) {
+            // Throughput around 30 frames/s, latency around 40 ms with the odd spike
+            double t = (now - t0) / 1e9;
+            nx_wave_sample(&wv, 0, 30 + 10 * sin(t));
+            nx_wave_sample(&wv, 1, rand_r(&seed) % 50 ? 40 + rand_r(&seed) % 20 : 300);
+            nsamples++;
+            next_sample += sample_ns;
+        }
+        nx_wave_tick(&wv);
+        while ((int)(nx.tail - nx.head) < window && nx_get(&nx, exprs[issued % nexprs], on_answer, NULL) == 0) issued++;
+        int timeout = nx_timeout_ms(&nx), t = nx_wave_timeout_ms(&wv);
+        if (timeout < 0 || t < timeout) timeout = t;
+        t = next_sample > now ? (int)((next_sample - now) / 1000000) : 0;
+        if (t < timeout) timeout = t;
+        struct pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, timeout) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) nx_input(&nx, buf, n);
+        }
+        nx_expire(&nx);
+    }
+    double secs = (nx_now_ns() - t0) / 1e9, link = baud / 10.0;
+    // Let the last transfer finish so the display's count is complete
+    while (nx.head != nx.tail && nx_now_ns() < end + 3000000000ull) {
+        struct pollfd p = { fd, POLLIN, 0 };
+        if (poll(&p, 1, nx_timeout_ms(&nx)) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) nx_input(&nx, buf, n);
+        }
+        nx_expire(&nx);
+    }
+    double addt_bytes = wv.sent + wv.transfers * 17.0, add_bytes = nsamples * 2 * 14.0;    // "add 1,0,255" + ff ff ff
+    printf("chart: %ld samples/channel at %d Hz -> %.1f points/s per channel, %llu points sent in %llu addt, %llu lost",
+           nsamples, CHART_SAMPLE_HZ, wv.pps, (unsigned long long)wv.sent, (unsigned long long)wv.transfers,
+           (unsigned long long)wv.lost);
+    if (sim) printf(", display got %ld", (long)sim_points);
+    printf("\n  link: chart %.0f B/s (%.0f%%), one add per sample would be %.0f B/s (%.0f%%); queries alongside %.1f/s, %ld wrong\n  ",
+           addt_bytes / secs, 100 * addt_bytes / secs / link, add_bytes / secs, 100 * add_bytes / secs / link, answered / secs, wrong);
+    nx_print(&nx);
+    printf("  ");
+    nx_wave_print(&wv);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <tty|-> [baud] [window] [queries] [chart_pps] [expr ...]\n", argv[0]);
+        return 1;
+    }
+    int baud = argc > 2 ? atoi(argv[2]) : 9600;
+    int window = argc > 3 ? atoi(argv[3]) : NX_WINDOW;
+    int queries = argc > 4 ? atoi(argv[4]) : 200;
+    double chart_pps = argc > 5 ? atof(argv[5]) : 0;
+    static const char *def[] = { "dp", "h0.val", "n0.val", "t0.txt" };
+    for (int i = 6; i < argc && nexprs < MAX_EXPRS; i++) exprs[nexprs++] = argv[i];
+    if (!nexprs)
+        for (int i = 0; i < 4; i++) exprs[nexprs++] = def[i];
+
+    int fd;
+    sim = strcmp(argv[1], "-") == 0;
+    if (sim) {
+        fd = sim_open(baud);
+        if (fd < 0) return 1;
+        printf("Simulated display: %d baud, %d us per command\n", baud, SIM_PARSE_US);
+    } else {
+        fd = open(argv[1], O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (fd < 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", argv[1], strerror(errno)); return 1; }
+    }
+    if (configure_serial(fd, baud) != 0) return 1;
+
+    double serial = run(fd, 1, queries);
+    double piped = run(fd, window, queries);
+    printf("Pipelined: %.2fx the queries/s of serial polling\n", piped / serial);
+    if (chart_pps > 0) run_chart(fd, window, chart_pps, baud);
+    tm_print(stdout);
+    return 0;
+}
@@ -0,0 +1,183 @@
+// illum.h - White balance / illumination normalization for pixfmt.
+//
+// Estimates a per-channel gain and offset from converted RGB frames and
+// hands them to pixfmt_set_wb(), which folds them into the conversion
+// lookup tables. The correction itself is therefore free; this file only
+// decides what it should be.
+//
+// Two modes:
+//   ILLUM_GRAY_WORLD  scale each channel so the frame mean is neutral grey,
+//                     optionally at a target brightness (the mean of the
+//                     training set) to undo lighting drift over a shift
+//   ILLUM_PATCH       solve gain + offset per channel from a bright reference
+//                     patch and, if given, a dark one with known values
+//
+// illum_estimate() works on a 1/64 subsample of a settled frame, blending
+// the new parameters in at a given rate (1 = jump); illum_apply() then puts
+// them into the tables. Both run on the caller's thread, between frames:
+// pixfmt_set_wb() must not race a conversion using the same context.
+//
+// Usage:
+//   struct illum il;
+//   illum_init(&il, ILLUM_GRAY_WORLD, 118);
+//   pixfmt_convert(...); illum_estimate(&il, rgb, w, h, 1.0f); illum_apply(&il, &conv);
+
+#ifndef ILLUM_H
+#define ILLUM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "pixfmt.h"
+
+#define ILLUM_STEP       8        // subsample stride in x and y
+#define ILLUM_MAX_SAMPLE (640 * 480 / (ILLUM_STEP * ILLUM_STEP) * 3)
+
+enum { ILLUM_GRAY_WORLD = 0, ILLUM_PATCH };
+
+struct illum_patch {
+    int x, y, w, h;               // in frame pixels; w = 0 disables
+    int target[3];                // expected R, G, B on this patch
+};
+
+struct illum {
+    int mode;
+    int target_luma;              // gray world brightness target, 0 = keep
+    struct illum_patch bright, dark;
+
+    // Subsample of the last frame estimated from
+    uint8_t sample[ILLUM_MAX_SAMPLE];
+    int sw, sh;
+
+    // Parameters the sample was converted with, and the smoothed estimate
+    float used_gain[3], used_offset[3];
+    float gain[3], offset[3];
+    unsigned generation, applied;
+};
+
+static inline void illum_init(struct illum *il, int mode, int target_luma) {
+    memset(il, 0, sizeof(*il));
+    il->mode = mode;
+    il->target_luma = target_luma;
+    for (int c = 0; c < 3; c++) il->gain[c] = il->used_gain[c] = 1.0f;
+}
+
+static inline void illum_set_patch(struct illum *il, int which_dark, int x, int y, int w, int h,
+                                   int r, int g, int b) {
+    struct illum_patch *p = which_dark ? &il->dark : &il->bright;
+    p->x = x; p->y = y; p->w = w; p->h = h;
+    p->target[0] = r; p->target[1] = g; p->target[2] = b;
+}
+
+// Mean of each channel over a rectangle of the subsample, in sensor terms
+// (the correction the frame was converted with is undone). Clipped pixels
+// are skipped. Returns the number of pixels used.
+static inline int illum_mean(const struct illum *il, int x0, int y0, int x1, int y1, float mean[3]) {
+    double sum[3] = {0, 0, 0};
+    int n = 0;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *p = il->sample + ((size_t)y * il->sw + x0) * 3;
+        for (int x = x0; x < x1; x++, p += 3) {
+            if (p[0] >= 250 || p[1] >= 250 || p[2] >= 250) continue;
+            sum[0] += p[0]; sum[1] += p[1]; sum[2] += p[2];
+            n++;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        float m = n ? (float)(sum[c] / n) : 0;
+        mean[c] = (m - il->used_offset[c]) / il->used_gain[c];
+    }
+    return n;
+}
+
+static inline int illum_patch_mean(const struct illum *il, const struct illum_patch *p, float mean[3]) {
+    int x0 = p->x / ILLUM_STEP, y0 = p->y / ILLUM_STEP;
+    int x1 = (p->x + p->w + ILLUM_STEP - 1) / ILLUM_STEP, y1 = (p->y + p->h + ILLUM_STEP - 1) / ILLUM_STEP;
+    if (x1 > il->sw) x1 = il->sw;
+    if (y1 > il->sh) y1 = il->sh;
+    if (x0 >= x1 || y0 >= y1) return 0;
+    return illum_mean(il, x0, y0, x1, y1, mean);
+}
+
+// Compute a new target from the current sample and blend it in with rate
+static inline void illum_estimate_sample(struct illum *il, float rate) {
+    float g[3], o[3] = {0, 0, 0}, m[3], d[3];
+
+    if (il->mode == ILLUM_PATCH && il->bright.w > 0) {
+        if (!illum_patch_mean(il, &il->bright, m)) return;
+        if (il->dark.w > 0 && illum_patch_mean(il, &il->dark, d)) {
+            // Two-point fit per channel: target = g * sensor + o
+            for (int c = 0; c < 3; c++) {
+                float span = m[c] - d[c];
+                g[c] = (span > 4) ? (il->bright.target[c] - il->dark.target[c]) / span : 1.0f;
+                o[c] = il->dark.target[c] - g[c] * d[c];
+            }
+        } else {
+            for (int c = 0; c < 3; c++) g[c] = (m[c] > 1) ? il->bright.target[c] / m[c] : 1.0f;
+        }
+    } else {
+        if (!illum_mean(il, 0, 0, il->sw, il->sh, m)) return;
+        float luma = 0.299f * m[0] + 0.587f * m[1] + 0.114f * m[2];
+        float target = il->target_luma > 0 ? (float)il->target_luma : luma;
+        for (int c = 0; c < 3; c++) g[c] = (m[c] > 1) ? target / m[c] : 1.0f;
+    }
+
+    for (int c = 0; c < 3; c++) {
+        if (g[c] < 0.25f) g[c] = 0.25f;
+        if (g[c] > 4.0f) g[c] = 4.0f;
+        il->gain[c] += rate * (g[c] - il->gain[c]);
+        il->offset[c] += rate * (o[c] - il->offset[c]);
+    }
+    il->generation++;
+}
+
+// Copy the subsample of a converted RGB24 frame
+static inline void illum_take_sample(struct illum *il, const uint8_t *rgb, int width, int height) {
+    int sw = width / ILLUM_STEP, sh = height / ILLUM_STEP;
+    if ((size_t)sw * sh * 3 > sizeof(il->sample)) sh = (int)(sizeof(il->sample) / 3 / sw);
+    for (int y = 0; y < sh; y++) {
+        const uint8_t *s = rgb + (size_t)y * ILLUM_STEP * width * 3;
+        uint8_t *d = il->sample + (size_t)y * sw * 3;
+        for (int x = 0; x < sw; x++, s += ILLUM_STEP * 3, d += 3) {
+            d[0] = s[0]; d[1] = s[1]; d[2] = s[2];
+        }
+    }
+    il->sw = sw;
+    il->sh = sh;
+}
+
+// Estimate from a converted RGB24 frame; rate 1 takes the new estimate as
+// is, less smooths it into the current one
+static inline void illum_estimate(struct illum *il, const uint8_t *rgb, int width, int height, float rate) {
+    illum_take_sample(il, rgb, width, height);
+    illum_estimate_sample(il, rate);
+}
+
+// The latest estimate as pixfmt_set_wb() arguments
+static inline void illum_params(const struct illum *il, int gain[3], int offset[3]) {
+    for (int c = 0; c < 3; c++) {
+        gain[c] = (int)(il->gain[c] * 256 + 0.5f);
+        offset[c] = (int)(il->offset[c] + (il->offset[c] < 0 ? -0.5f : 0.5f));
+    }
+}
+
+// Frames are converted with these from now on; the next estimate undoes them
+static inline void illum_applied(struct illum *il, const int gain[3], const int offset[3]) {
+    for (int c = 0; c < 3; c++) {
+        il->used_gain[c] = gain[c] / 256.0f;
+        il->used_offset[c] = (float)offset[c];
+    }
+    il->applied = il->generation;
+}
+
+// Push the latest estimate into the conversion tables. Call between frames.
+// (encpool.h keeps two sets of tables instead: illum_params() and
+// encpool_set_wb(), then illum_applied() once it took them.)
+static inline void illum_apply(struct illum *il, struct pixfmt_ctx *ctx) {
+    int gain[3], offset[3];
+    if (il->generation == il->applied) return;
+    illum_params(il, gain, offset);
+    pixfmt_set_wb(ctx, gain, offset);
+    illum_applied(il, gain, offset);
+}
+
+#endif // ILLUM_H
@@ -0,0 +1,147 @@
+// Archive tiering and evidence crops without decoding (jpegcoef.h).
+// Re-quantizes JPEGs to a lower quality and/or crops them on the MCU grid
+// working on the quantized DCT coefficients: Huffman decode, integer
+// rescale, Huffman encode with optimized tables. No IDCT, no colour
+// conversion and no second generation of pixel rounding.
+//
+// A single JPEG goes to a single file. An archive segment (.arc) goes record
+// by record into new segments in out_dir under the same prefix, with frame
+// numbers and timestamps unchanged; a record that does not parse is copied
+// as it is.
+//
+// Usage: jpeg_tier <in.jpg|in.arc> <out.jpg|out_dir> <quality> [x y w h]
+//        quality 0 keeps the quantizers (crop and table optimization only)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "archive_sink.h"
+#include "telemetry.h"
+#include "jpegcoef.h"
+
+#define OUT_SLACK 4096          // output bound: input size plus tables and comment
+
+static struct tm_hist tier_us = TM_HIST("tier", "us");     // decode + crop + requant + encode, per image
+
+static int quality, crop, cx, cy, cw, ch;
+static char comment[96];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// One image: returns the output length, 0 if it failed
+static size_t tier_one(struct jpc_image *img, const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    uint64_t t0 = now_ns();
+    if (jpc_decode(img, in, len) != 0) return 0;
+    if (crop && jpc_crop(img, cx, cy, cw, ch) != 0) { fprintf(stderr, "ERROR: crop outside the %dx%d image\n", img->width, img->height); return 0; }
+    if (quality) jpc_requant(img, quality);
+    size_t n = jpc_encode(img, out, cap, comment[0] ? comment : NULL);
+    tm_record(&tier_us, (now_ns() - t0) / 1000);
+    return n;
+}
+
+static const uint8_t *map_file(const char *path, size_t *len) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno)); return NULL; }
+    *len = st.st_size;
+    void *p = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) { fprintf(stderr, "ERROR: cannot map %s\n", path); return NULL; }
+    return p;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4 && argc != 8) {
+        fprintf(stderr, "Usage: %s <in.jpg|in.arc> <out.jpg|out_dir> <quality> [x y w h]\n", argv[0]);
+        return 1;
+    }
+    const char *in_path = argv[1], *out_path = argv[2];
+    quality = atoi(argv[3]);
+    if (argc == 8) {
+        crop = 1;
+        cx = atoi(argv[4]);
+        cy = atoi(argv[5]);
+        cw = atoi(argv[6]);
+        ch = atoi(argv[7]);
+    }
+    // Travels with the image, next to the encoder's own "enc ..." comment
+    int k = 0;
+    if (quality) k += snprintf(comment + k, sizeof(comment) - k, "tier q=%d", quality);
+    if (crop) snprintf(comment + k, sizeof(comment) - k, "%scrop=%d,%d,%dx%d", k ? " " : "tier ", cx, cy, cw, ch);
+
+    size_t in_len;
+    const uint8_t *in = map_file(in_path, &in_len);
+    if (!in) return 1;
+    struct jpc_image img = {0};
+    uint64_t t0 = now_ns(), in_bytes = 0, out_bytes = 0, records = 0, copied = 0;
+    size_t n = strlen(in_path);
+
+    if (n > 4 && strcmp(in_path + n - 4, ".arc") == 0) {
+        // Segment: same prefix as the input, "cam_000012.arc" -> "cam"
+        char prefix[32];
+        const char *base = strrchr(in_path, '/');
+        base = base ? base + 1 : in_path;
+        const char *us = strrchr(base, '_');
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(us ? us - base : (long)strlen(base) - 4), base);
+        mkdir(out_path, 0755);
+        struct archive ar;
+        archive_open(&ar, out_path, prefix, ARCHIVE_SEGMENT_SIZE);
+
+        struct archive_rec rec;
+        size_t off = 0;
+        const uint8_t *payload;
+        while ((payload = archive_next(in, in_len, &off, &rec))) {
+            uint8_t *dst = archive_reserve(&ar, rec.len + OUT_SLACK);
+            if (!dst) { fprintf(stderr, "ERROR: cannot write to %s\n", out_path); break; }
+            size_t len = tier_one(&img, payload, rec.len, dst, rec.len + OUT_SLACK);
+            if (!len) {
+                fprintf(stderr, "WARNING: frame %llu copied unchanged\n", (unsigned long long)rec.frame);
+                memcpy(dst, payload, rec.len);
+                len = rec.len;
+                copied++;
+            }
+            archive_commit(&ar, rec.frame, rec.timestamp_us, len);
+            in_bytes += rec.len;
+            out_bytes += len;
+            records++;
+        }
+        archive_close(&ar);
+    } else {
+        size_t cap = in_len + OUT_SLACK;
+        uint8_t *out = malloc(cap);
+        if (!out) { perror("Malloc failed"); return 1; }
+        size_t len = tier_one(&img, in, in_len, out, cap);
+        if (!len) return 1;
+        FILE *f = fopen(out_path, "wb");
+        if (!f || fwrite(out, 1, len, f) != len) { fprintf(stderr, "ERROR: cannot write %s\n", out_path); return 1; }
+        fclose(f);
+        printf("%dx%d, %d components\n", img.width, img.height, img.ncomp);
+        in_bytes = in_len;
+        out_bytes = len;
+        records = 1;
+        free(out);
+    }
+
+    double secs = (now_ns() - t0) / 1e9;
+    printf("%llu images (%llu copied) in %.2f s: %.1f images/s, %.2f MB -> %.2f MB (%.1f%%)\n", (unsigned long long)records,
+           (unsigned long long)copied, secs, records / secs, in_bytes / 1e6, out_bytes / 1e6,
+           in_bytes ? 100.0 * out_bytes / in_bytes : 0);
+    tm_print(stdout);
+    jpc_free(&img);
+    munmap((void *)in, in_len);
+    return 0;
+}
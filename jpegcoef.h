@@ -0,0 +1,688 @@
+// jpegcoef.h - Lossless JPEG crop and re-quantization on DCT coefficients.
+//
+// Cutting the box out of an archived frame, or shrinking frames that have
+// aged out of the hot tier, used to mean a full decode, colour conversion
+// and stbi_write_jpg() again: the DCT twice, the colour conversion twice,
+// and a second round of quantization error on top of the first.
+//
+// The quantized coefficients are already in the file. jpc_decode() stops
+// after the Huffman decode and keeps them, jpc_crop() and jpc_requant()
+// work on them, and jpc_encode() Huffman-codes them again. No IDCT, no
+// colour space, no rounding of pixels:
+//   - crop: whole blocks are kept, so the top-left corner moves down to an
+//     MCU boundary (16 px for 4:2:0, 8 px for 4:4:4); the right and bottom
+//     edges can be anywhere. Bit-exact with the source inside the region.
+//   - requant: every quantizer step becomes max(old, table for the new
+//     quality) and each coefficient is rounded to the coarser step. This
+//     is one quantization of the existing values, not decode + re-encode,
+//     and it can never make a step finer than the source had.
+// The output always gets Huffman tables built from its own symbol counts
+// (two passes, as libjpeg's optimize_coding), which alone saves several
+// percent against the stock tables stb_image_write uses.
+//
+// Input: baseline or extended sequential, 8-bit, Huffman coded, 1-4
+// components, any sampling factors, restart intervals, one interleaved scan
+// or one scan per component. Progressive and arithmetic-coded files are
+// refused. APPn and COM segments are carried over (the encoder's "enc ..."
+// settings comment stays with the frame).
+// Output: one interleaved sequential scan, no restart markers.
+//
+// Coefficients are stored per component in a block grid padded to whole
+// MCUs, 64 int16 per block in zigzag order, like the DQT tables.
+//
+// Usage:
+//   struct jpc_image img = {0};
+//   jpc_decode(&img, jpg, len);
+//   jpc_crop(&img, x, y, w, h);            // optional
+//   jpc_requant(&img, 50);                 // optional
+//   n = jpc_encode(&img, out, cap, NULL);  // 0 if it did not fit
+//   jpc_free(&img);
+
+#ifndef JPEGCOEF_H
+#define JPEGCOEF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define JPC_MAX_COMP 4
+#define JPC_LOOKAHEAD 9             // bits resolved by one table lookup when decoding
+
+// Position in the 8x8 block (row-major) of the k-th zigzag coefficient
+static const uint8_t jpc_natural[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Annex K tables, row-major, as stb_image_write scales them
+static const uint8_t jpc_std_luma[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+static const uint8_t jpc_std_chroma[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Decoding table for one DHT class/slot
+struct jpc_dhuff {
+    int defined;
+    uint16_t look[1 << JPC_LOOKAHEAD];  // (length << 8) | value, 0 for longer codes
+    int32_t maxcode[18];                // largest code of each length, -1 if none
+    int32_t valoff[17];                 // val[] index of a code: valoff[len] + code
+    uint8_t val[256];
+};
+
+struct jpc_comp {
+    int id, h, v, tq;
+    int td, ta;                         // Huffman slots of the current scan
+    int bw, bh;                         // block grid, padded to whole MCUs
+    int16_t *coef;                      // bw * bh * 64, zigzag order
+    size_t cap;                         // allocated coefficients
+};
+
+struct jpc_image {
+    int width, height, ncomp;
+    int hmax, vmax, mcus_x, mcus_y;
+    struct jpc_comp comp[JPC_MAX_COMP];
+    uint16_t qt[4][64];                 // zigzag order
+    int restart;                        // MCUs per restart interval, 0 = none
+    struct jpc_dhuff dc[4], ac[4];
+    uint8_t *extra;                     // APPn and COM segments, verbatim
+    size_t extra_len, extra_cap;
+};
+
+static inline void jpc_free(struct jpc_image *img) {
+    for (int c = 0; c < JPC_MAX_COMP; c++) free(img->comp[c].coef);
+    free(img->extra);
+    memset(img, 0, sizeof(*img));
+}
+
+static inline int jpc_get16(const uint8_t *p) {
+    return p[0] << 8 | p[1];
+}
+
+/* --- Decoding --- */
+
+static inline int jpc_build_dhuff(struct jpc_dhuff *t, const uint8_t *counts, const uint8_t *vals, int nvals) {
+    int code = 0, k = 0;
+    memset(t, 0, sizeof(*t));
+    memcpy(t->val, vals, nvals);
+    for (int len = 1; len <= 16; len++) {
+        t->valoff[len] = k - code;
+        t->maxcode[len] = counts[len - 1] ? code + counts[len - 1] - 1 : -1;
+        for (int i = 0; i < counts[len - 1]; i++, code++, k++) {
+            if (len <= JPC_LOOKAHEAD) {
+                int shift = JPC_LOOKAHEAD - len;
+                for (int j = 0; j < 1 << shift; j++) t->look[(code << shift) | j] = (uint16_t)(len << 8 | vals[k]);
+            }
+        }
+        if (code > 1 << len) return -1;    // over-subscribed
+        code <<= 1;
+    }
+    t->maxcode[17] = 0x7fffffff;        // sentinel: ends the slow path
+    t->defined = 1;
+    return 0;
+}
+
+// Entropy-coded data reader; stops at the first marker and feeds zeros after it
+struct jpc_bits {
+    const uint8_t *p, *end;
+    uint64_t acc;
+    int n, marker;
+};
+
+static inline void jpc_fill(struct jpc_bits *b) {
+    while (b->n <= 56) {
+        unsigned byte = 0;
+        if (!b->marker && b->p < b->end) {
+            byte = *b->p++;
+            if (byte == 0xFF) {
+                unsigned next = b->p < b->end ? *b->p : 0xD9;
+                if (next == 0) {
+                    b->p++;
+                } else {
+                    b->marker = next;
+                    b->p--;                 // left on the 0xFF
+                    byte = 0;
+                }
+            }
+        }
+        b->acc |= (uint64_t)byte << (56 - b->n);
+        b->n += 8;
+    }
+}
+
+static inline int jpc_decode_sym(struct jpc_bits *b, const struct jpc_dhuff *t) {
+    if (b->n < 16) jpc_fill(b);
+    unsigned e = t->look[b->acc >> (64 - JPC_LOOKAHEAD)];
+    if (e) {
+        b->acc <<= e >> 8;
+        b->n -= e >> 8;
+        return e & 0xff;
+    }
+    int len = JPC_LOOKAHEAD + 1;
+    int32_t code = (int32_t)(b->acc >> (64 - len));
+    while (code > t->maxcode[len]) code = (int32_t)(b->acc >> (64 - ++len));
+    if (len > 16) return -1;
+    b->acc <<= len;
+    b->n -= len;
+    return t->val[t->valoff[len] + code];
+}
+
+static inline int jpc_receive(struct jpc_bits *b, int s) {
+    if (!s) return 0;
+    if (b->n < s) jpc_fill(b);
+    int v = (int)(b->acc >> (64 - s));
+    b->acc <<= s;
+    b->n -= s;
+    return v < 1 << (s - 1) ? v - (1 << s) + 1 : v;
+}
+
+static inline int jpc_decode_block(struct jpc_bits *b, int16_t *blk, const struct jpc_dhuff *dc, const struct jpc_dhuff *ac, int *pred) {
+    int s = jpc_decode_sym(b, dc);
+    if (s < 0 || s > 11) return -1;
+    *pred += jpc_receive(b, s);
+    blk[0] = (int16_t)*pred;
+    for (int k = 1; k < 64; k++) {
+        int rs = jpc_decode_sym(b, ac);
+        if (rs < 0) return -1;
+        int r = rs >> 4;
+        s = rs & 15;
+        if (!s) {
+            if (r != 15) break;             // EOB
+            k += 15;                        // ZRL
+            continue;
+        }
+        k += r;
+        if (k > 63) return -1;
+        blk[k] = (int16_t)jpc_receive(b, s);
+    }
+    return 0;
+}
+
+// One scan over the components in list[0..ns). Returns the end of its data, or NULL.
+static inline const uint8_t *jpc_decode_scan(struct jpc_image *img, const uint8_t *p, const uint8_t *end, const int *list, int ns) {
+    struct jpc_bits b = { p, end, 0, 0, 0 };
+    int pred[JPC_MAX_COMP] = {0};
+    long units_x, units_y;              // MCUs, or a single component's real blocks
+    if (ns == 1) {
+        const struct jpc_comp *c = &img->comp[list[0]];
+        units_x = ((img->width * c->h + img->hmax - 1) / img->hmax + 7) / 8;
+        units_y = ((img->height * c->v + img->vmax - 1) / img->vmax + 7) / 8;
+    } else {
+        units_x = img->mcus_x;
+        units_y = img->mcus_y;
+    }
+    for (int i = 0; i < ns; i++) {
+        struct jpc_comp *c = &img->comp[list[i]];
+        if (!img->dc[c->td].defined || !img->ac[c->ta].defined) { fprintf(stderr, "jpegcoef: scan uses an undefined Huffman table\n"); return NULL; }
+    }
+
+    long n = 0;
+    for (long uy = 0; uy < units_y; uy++) {
+        for (long ux = 0; ux < units_x; ux++, n++) {
+            if (img->restart && n && n % img->restart == 0) {
+                // Byte-aligned RSTn: drop the padding bits, step over the marker, predictors restart
+                b.acc = 0;
+                b.n = 0;
+                if (b.marker >= 0xD0 && b.marker <= 0xD7) { b.p += 2; b.marker = 0; }
+                memset(pred, 0, sizeof(pred));
+            }
+            for (int i = 0; i < ns; i++) {
+                struct jpc_comp *c = &img->comp[list[i]];
+                int hn = ns == 1 ? 1 : c->h, vn = ns == 1 ? 1 : c->v;
+                for (int v = 0; v < vn; v++)
+                    for (int h = 0; h < hn; h++) {
+                        long bx = ux * hn + h, by = uy * vn + v;
+                        int16_t *blk = c->coef + (by * c->bw + bx) * 64;
+                        if (jpc_decode_block(&b, blk, &img->dc[c->td], &img->ac[c->ta], &pred[list[i]]) != 0) {
+                            fprintf(stderr, "jpegcoef: corrupt entropy data\n");
+                            return NULL;
+                        }
+                    }
+            }
+        }
+    }
+    // Past the data: the next marker (b.p is on it, or just before if the reader never got there)
+    const uint8_t *q = b.p;
+    while (q + 1 < end && !(q[0] == 0xFF && q[1] != 0 && !(q[1] >= 0xD0 && q[1] <= 0xD7))) q++;
+    return q;
+}
+
+static inline int jpc_keep_segment(struct jpc_image *img, const uint8_t *seg, size_t len) {
+    if (img->extra_len + len > img->extra_cap) {
+        size_t cap = img->extra_cap ? img->extra_cap * 2 : 1024;
+        while (cap < img->extra_len + len) cap *= 2;
+        uint8_t *e = realloc(img->extra, cap);
+        if (!e) { perror("Malloc failed"); return -1; }
+        img->extra = e;
+        img->extra_cap = cap;
+    }
+    memcpy(img->extra + img->extra_len, seg, len);
+    img->extra_len += len;
+    return 0;
+}
+
+static inline int jpc_sof(struct jpc_image *img, const uint8_t *s, int len) {
+    if (len < 6 || s[0] != 8) { fprintf(stderr, "jpegcoef: only 8-bit samples\n"); return -1; }
+    img->height = jpc_get16(s + 1);
+    img->width = jpc_get16(s + 3);
+    img->ncomp = s[5];
+    if (!img->width || !img->height) { fprintf(stderr, "jpegcoef: no size in SOF (DNL not supported)\n"); return -1; }
+    if (img->ncomp < 1 || img->ncomp > JPC_MAX_COMP || len < 6 + 3 * img->ncomp) { fprintf(stderr, "jpegcoef: bad SOF\n"); return -1; }
+    img->hmax = img->vmax = 1;
+    for (int i = 0; i < img->ncomp; i++) {
+        struct jpc_comp *c = &img->comp[i];
+        c->id = s[6 + 3 * i];
+        c->h = s[7 + 3 * i] >> 4;
+        c->v = s[7 + 3 * i] & 15;
+        c->tq = s[8 + 3 * i] & 3;
+        if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4) { fprintf(stderr, "jpegcoef: bad sampling factors\n"); return -1; }
+        if (img->ncomp == 1) c->h = c->v = 1;      // a lone component is never interleaved
+        if (c->h > img->hmax) img->hmax = c->h;
+        if (c->v > img->vmax) img->vmax = c->v;
+    }
+    img->mcus_x = (img->width + 8 * img->hmax - 1) / (8 * img->hmax);
+    img->mcus_y = (img->height + 8 * img->vmax - 1) / (8 * img->vmax);
+    for (int i = 0; i < img->ncomp; i++) {
+        struct jpc_comp *c = &img->comp[i];
+        c->bw = img->mcus_x * c->h;
+        c->bh = img->mcus_y * c->v;
+        size_t n = (size_t)c->bw * c->bh * 64;
+        if (n > c->cap) {
+            free(c->coef);
+            c->coef = malloc(n * sizeof(*c->coef));
+            c->cap = c->coef ? n : 0;
+            if (!c->coef) { perror("Malloc failed"); return -1; }
+        }
+        memset(c->coef, 0, n * sizeof(*c->coef));
+    }
+    return 0;
+}
+
+// Parse a JPEG into img (buffers are reused between calls). Returns 0 or -1.
+static inline int jpc_decode(struct jpc_image *img, const uint8_t *data, size_t len) {
+    const uint8_t *p = data, *end = data + len;
+    int have_sof = 0, scans = 0;
+    img->restart = 0;
+    img->extra_len = 0;
+    for (int i = 0; i < 4; i++) img->dc[i].defined = img->ac[i].defined = 0;
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) { fprintf(stderr, "jpegcoef: not a JPEG\n"); return -1; }
+    p += 2;
+    for (;;) {
+        while (p < end && *p != 0xFF) p++;
+        while (p < end && *p == 0xFF) p++;  // fill bytes
+        if (p >= end) break;
+        int m = *p++;
+        if (m == 0xD9) break;               // EOI
+        if (m >= 0xD0 && m <= 0xD7) continue;
+        if (p + 2 > end) break;
+        int seglen = jpc_get16(p);
+        const uint8_t *s = p + 2, *next = p + seglen;
+        if (seglen < 2 || next > end) { fprintf(stderr, "jpegcoef: truncated segment\n"); return -1; }
+        int slen = seglen - 2;
+
+        if (m == 0xDB) {
+            while (s < next) {
+                int pq = s[0] >> 4, tq = s[0] & 3;
+                if (s + 1 + 64 * (pq + 1) > next) { fprintf(stderr, "jpegcoef: bad DQT\n"); return -1; }
+                for (int k = 0; k < 64; k++) img->qt[tq][k] = pq ? jpc_get16(s + 1 + 2 * k) : s[1 + k];
+                s += 1 + 64 * (pq + 1);
+            }
+        } else if (m == 0xC4) {
+            while (s + 17 <= next) {
+                int tc = s[0] >> 4, th = s[0] & 3, n = 0;
+                for (int i = 0; i < 16; i++) n += s[1 + i];
+                if (n > 256 || s + 17 + n > next || tc > 1 ||
+                    jpc_build_dhuff(tc ? &img->ac[th] : &img->dc[th], s + 1, s + 17, n) != 0) {
+                    fprintf(stderr, "jpegcoef: bad DHT\n");
+                    return -1;
+                }
+                s += 17 + n;
+            }
+        } else if (m == 0xC0 || m == 0xC1) {
+            if (jpc_sof(img, s, slen) != 0) return -1;
+            have_sof = 1;
+        } else if ((m >= 0xC2 && m <= 0xCF) && m != 0xC4 && m != 0xC8 && m != 0xCC) {
+            fprintf(stderr, "jpegcoef: %s JPEG not supported\n", m == 0xC2 || m == 0xC6 || m == 0xCA || m == 0xCE ? "progressive" :
+                    m >= 0xC9 ? "arithmetic-coded" : "lossless");
+            return -1;
+        } else if (m == 0xDD) {
+            if (slen >= 2) img->restart = jpc_get16(s);
+        } else if (m == 0xDA) {
+            int ns = slen ? s[0] : 0, list[JPC_MAX_COMP];
+            if (!have_sof || ns < 1 || ns > img->ncomp || slen < 4 + 2 * ns) { fprintf(stderr, "jpegcoef: bad SOS\n"); return -1; }
+            for (int i = 0; i < ns; i++) {
+                int id = s[1 + 2 * i], c = 0;
+                while (c < img->ncomp && img->comp[c].id != id) c++;
+                if (c == img->ncomp) { fprintf(stderr, "jpegcoef: scan names an unknown component\n"); return -1; }
+                img->comp[c].td = s[2 + 2 * i] >> 4 & 3;
+                img->comp[c].ta = s[2 + 2 * i] & 3;
+                list[i] = c;
+            }
+            const uint8_t *q = s + 1 + 2 * ns;
+            if (q[0] != 0 || q[1] != 63 || q[2] != 0) { fprintf(stderr, "jpegcoef: not a sequential scan\n"); return -1; }
+            p = jpc_decode_scan(img, next, end, list, ns);
+            if (!p) return -1;
+            scans++;
+            continue;
+        } else if ((m >= 0xE0 && m <= 0xEF) || m == 0xFE) {
+            if (jpc_keep_segment(img, p - 2, seglen + 2) != 0) return -1;
+        }
+        p = next;
+    }
+    if (!scans) { fprintf(stderr, "jpegcoef: no image data\n"); return -1; }
+    return 0;
+}
+
+/* --- Crop and re-quantization --- */
+
+// Keep the region x, y, w, h. x and y are rounded down to the MCU grid; returns 0 or -1.
+static inline int jpc_crop(struct jpc_image *img, int x, int y, int w, int h) {
+    int mw = 8 * img->hmax, mh = 8 * img->vmax;
+    int x0 = x / mw * mw, y0 = y / mh * mh;
+    if (x < 0 || y < 0 || w < 1 || h < 1 || x0 >= img->width || y0 >= img->height) return -1;
+    int x1 = x + w < img->width ? x + w : img->width, y1 = y + h < img->height ? y + h : img->height;
+    int mx0 = x0 / mw, my0 = y0 / mh;
+    img->width = x1 - x0;
+    img->height = y1 - y0;
+    img->mcus_x = (img->width + mw - 1) / mw;
+    img->mcus_y = (img->height + mh - 1) / mh;
+    for (int i = 0; i < img->ncomp; i++) {
+        struct jpc_comp *c = &img->comp[i];
+        int bw = img->mcus_x * c->h, bh = img->mcus_y * c->v;
+        // In place: every destination block lies at or before its source
+        for (int by = 0; by < bh; by++)
+            memmove(c->coef + (size_t)by * bw * 64, c->coef + ((size_t)(my0 * c->v + by) * c->bw + mx0 * c->h) * 64,
+                    (size_t)bw * 64 * sizeof(*c->coef));
+        c->bw = bw;
+        c->bh = bh;
+    }
+    return 0;
+}
+
+// Quantizer table stb_image_write uses at this quality, zigzag order
+static inline void jpc_quality_table(const uint8_t *std, int quality, uint16_t *qz) {
+    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int k = 0; k < 64; k++) {
+        int q = (std[jpc_natural[k]] * scale + 50) / 100;
+        qz[k] = (uint16_t)(q < 1 ? 1 : q > 255 ? 255 : q);
+    }
+}
+
+// Coarsen to the tables of quality (never finer than the source's). Returns the number of tables changed.
+static inline int jpc_requant(struct jpc_image *img, int quality) {
+    int changed = 0, done[4] = {0};
+    for (int i = 0; i < img->ncomp; i++) {
+        int tq = img->comp[i].tq;
+        if (done[tq]) continue;
+        done[tq] = 1;
+        uint16_t target[64], *old = img->qt[tq];
+        int div[64], any = 0;
+        jpc_quality_table(i == 0 ? jpc_std_luma : jpc_std_chroma, quality, target);
+        for (int k = 0; k < 64; k++) {
+            int q = target[k] > old[k] ? target[k] : old[k];
+            div[k] = q;
+            any |= q != old[k];
+        }
+        if (!any) continue;
+        changed++;
+        // c * old / new, rounded to nearest
+        for (int j = 0; j < img->ncomp; j++) {
+            struct jpc_comp *c = &img->comp[j];
+            if (c->tq != tq) continue;
+            size_t n = (size_t)c->bw * c->bh;
+            for (size_t b = 0; b < n; b++) {
+                int16_t *blk = c->coef + b * 64;
+                for (int k = 0; k < 64; k++) {
+                    if (!blk[k] || div[k] == old[k]) continue;
+                    int v = blk[k] * old[k];
+                    blk[k] = (int16_t)(v >= 0 ? (v + div[k] / 2) / div[k] : -((-v + div[k] / 2) / div[k]));
+                }
+            }
+        }
+        for (int k = 0; k < 64; k++) old[k] = (uint16_t)div[k];
+    }
+    return changed;
+}
+
+/* --- Encoding --- */
+
+struct jpc_ehuff {
+    uint16_t code[256];
+    uint8_t size[256];
+    uint8_t bits[17], val[256];         // DHT contents
+    int nval;
+};
+
+// Length-limited optimal code from symbol counts (JPEG Annex K.2, as libjpeg's jpeg_gen_optimal_table)
+static inline void jpc_gen_table(struct jpc_ehuff *t, const long *count) {
+    long freq[257];
+    int codesize[257], others[257], bits[33];
+    memcpy(freq, count, 256 * sizeof(long));
+    freq[256] = 1;                      // reserved, so no code is all ones
+    memset(codesize, 0, sizeof(codesize));
+    memset(bits, 0, sizeof(bits));
+    for (int i = 0; i < 257; i++) others[i] = -1;
+    for (;;) {
+        int c1 = -1, c2 = -1;
+        long v = 0x7fffffffffffffffL;
+        for (int i = 0; i <= 256; i++)
+            if (freq[i] && freq[i] <= v) { v = freq[i]; c1 = i; }
+        v = 0x7fffffffffffffffL;
+        for (int i = 0; i <= 256; i++)
+            if (freq[i] && freq[i] <= v && i != c1) { v = freq[i]; c2 = i; }
+        if (c2 < 0) break;
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+        codesize[c1]++;
+        while (others[c1] >= 0) { c1 = others[c1]; codesize[c1]++; }
+        others[c1] = c2;
+        codesize[c2]++;
+        while (others[c2] >= 0) { c2 = others[c2]; codesize[c2]++; }
+    }
+    for (int i = 0; i <= 256; i++)
+        if (codesize[i]) bits[codesize[i] > 32 ? 32 : codesize[i]]++;
+    for (int i = 32; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) j--;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+    int i = 16;
+    while (i > 0 && bits[i] == 0) i--;
+    if (i) bits[i]--;                   // drop the reserved symbol's code
+
+    t->nval = 0;
+    memset(t->size, 0, sizeof(t->size));
+    for (int len = 1; len <= 32; len++)
+        for (int s = 0; s < 256; s++)
+            if (codesize[s] == len) t->val[t->nval++] = (uint8_t)s;
+    int code = 0, k = 0;
+    for (int len = 1; len <= 16; len++) {
+        t->bits[len] = (uint8_t)bits[len];
+        for (int n = 0; n < bits[len]; n++, k++) {
+            t->code[t->val[k]] = (uint16_t)code++;
+            t->size[t->val[k]] = (uint8_t)len;
+        }
+        code <<= 1;
+    }
+}
+
+struct jpc_out {
+    uint8_t *p, *end;
+    int overflow;
+    uint32_t acc;
+    int n;
+};
+
+static inline void jpc_put(struct jpc_out *o, int byte) {
+    if (o->p < o->end) *o->p++ = (uint8_t)byte;
+    else o->overflow = 1;
+}
+
+static inline void jpc_put_bits(struct jpc_out *o, uint32_t v, int len) {
+    o->acc = (o->acc << len) | (v & ((1u << len) - 1));
+    o->n += len;
+    while (o->n >= 8) {
+        int byte = (o->acc >> (o->n - 8)) & 0xff;
+        jpc_put(o, byte);
+        if (byte == 0xFF) jpc_put(o, 0);
+        o->n -= 8;
+    }
+}
+
+static inline int jpc_nbits(int v) {
+    int n = 0;
+    if (v < 0) v = -v;
+    while (v) { n++; v >>= 1; }
+    return n;
+}
+
+// One block: counts symbols (o == NULL) or writes them
+static inline void jpc_encode_block(const int16_t *blk, int *pred, long *dcf, long *acf, const struct jpc_ehuff *dct,
+                                    const struct jpc_ehuff *act, struct jpc_out *o) {
+    int diff = blk[0] - *pred, s = jpc_nbits(diff);
+    *pred = blk[0];
+    if (o) {
+        jpc_put_bits(o, dct->code[s], dct->size[s]);
+        if (s) jpc_put_bits(o, diff < 0 ? diff - 1 : diff, s);
+    } else {
+        dcf[s]++;
+    }
+    int r = 0;
+    for (int k = 1; k < 64; k++) {
+        int v = blk[k];
+        if (!v) { r++; continue; }
+        for (; r > 15; r -= 16) {
+            if (o) jpc_put_bits(o, act->code[0xF0], act->size[0xF0]);
+            else acf[0xF0]++;
+        }
+        s = jpc_nbits(v);
+        int rs = r << 4 | s;
+        if (o) {
+            jpc_put_bits(o, act->code[rs], act->size[rs]);
+            jpc_put_bits(o, v < 0 ? v - 1 : v, s);
+        } else {
+            acf[rs]++;
+        }
+        r = 0;
+    }
+    if (r) {
+        if (o) jpc_put_bits(o, act->code[0], act->size[0]);
+        else acf[0]++;
+    }
+}
+
+// Every MCU of one interleaved scan; luma uses table 0, the other components table 1
+static inline void jpc_encode_scan(const struct jpc_image *img, long (*dcf)[256], long (*acf)[256], const struct jpc_ehuff *dct,
+                                   const struct jpc_ehuff *act, struct jpc_out *o) {
+    int pred[JPC_MAX_COMP] = {0};
+    for (int my = 0; my < img->mcus_y; my++)
+        for (int mx = 0; mx < img->mcus_x; mx++)
+            for (int i = 0; i < img->ncomp; i++) {
+                const struct jpc_comp *c = &img->comp[i];
+                int t = i ? 1 : 0;
+                for (int v = 0; v < c->v; v++)
+                    for (int h = 0; h < c->h; h++)
+                        jpc_encode_block(c->coef + ((size_t)(my * c->v + v) * c->bw + mx * c->h + h) * 64, &pred[i],
+                                         dcf ? dcf[t] : NULL, acf ? acf[t] : NULL, &dct[t], &act[t], o);
+            }
+}
+
+static inline void jpc_put_marker(struct jpc_out *o, int m, int len) {
+    jpc_put(o, 0xFF);
+    jpc_put(o, m);
+    jpc_put(o, len >> 8);
+    jpc_put(o, len & 0xff);
+}
+
+// Write img as a JPEG into out[0..cap), with an optional extra COM segment.
+// Returns the length, or 0 if it does not fit.
+static inline size_t jpc_encode(const struct jpc_image *img, uint8_t *out, size_t cap, const char *comment) {
+    long dcf[2][256], acf[2][256];
+    struct jpc_ehuff dct[2], act[2];
+    struct jpc_out o = { out, out + cap, 0, 0, 0 };
+    int tables = img->ncomp > 1 ? 2 : 1, used[4] = {0}, wide = 0;
+
+    // Pass 1: symbol statistics -> tables
+    memset(dcf, 0, sizeof(dcf));
+    memset(acf, 0, sizeof(acf));
+    jpc_encode_scan(img, dcf, acf, dct, act, NULL);
+    for (int t = 0; t < tables; t++) {
+        jpc_gen_table(&dct[t], dcf[t]);
+        jpc_gen_table(&act[t], acf[t]);
+    }
+
+    // Headers
+    jpc_put(&o, 0xFF);
+    jpc_put(&o, 0xD8);
+    for (size_t i = 0; i < img->extra_len; i++) jpc_put(&o, img->extra[i]);
+    if (comment) {
+        int len = (int)strlen(comment);
+        if (len > 65533) len = 65533;
+        jpc_put_marker(&o, 0xFE, len + 2);
+        for (int i = 0; i < len; i++) jpc_put(&o, comment[i]);
+    }
+    for (int i = 0; i < img->ncomp; i++) used[img->comp[i].tq] = 1;
+    for (int t = 0; t < 4; t++) {
+        if (!used[t]) continue;
+        int pq = 0;
+        for (int k = 0; k < 64; k++) pq |= img->qt[t][k] > 255;
+        wide |= pq;
+        jpc_put_marker(&o, 0xDB, 3 + 64 * (pq + 1));
+        jpc_put(&o, pq << 4 | t);
+        for (int k = 0; k < 64; k++) {
+            if (pq) jpc_put(&o, img->qt[t][k] >> 8);
+            jpc_put(&o, img->qt[t][k] & 0xff);
+        }
+    }
+    jpc_put_marker(&o, wide ? 0xC1 : 0xC0, 8 + 3 * img->ncomp);    // 16-bit tables are not baseline
+    jpc_put(&o, 8);
+    jpc_put(&o, img->height >> 8);
+    jpc_put(&o, img->height & 0xff);
+    jpc_put(&o, img->width >> 8);
+    jpc_put(&o, img->width & 0xff);
+    jpc_put(&o, img->ncomp);
+    for (int i = 0; i < img->ncomp; i++) {
+        jpc_put(&o, img->comp[i].id);
+        jpc_put(&o, img->comp[i].h << 4 | img->comp[i].v);
+        jpc_put(&o, img->comp[i].tq);
+    }
+    for (int t = 0; t < tables; t++) {
+        for (int ac = 0; ac < 2; ac++) {
+            const struct jpc_ehuff *e = ac ? &act[t] : &dct[t];
+            jpc_put_marker(&o, 0xC4, 2 + 17 + e->nval);
+            jpc_put(&o, ac << 4 | t);
+            for (int len = 1; len <= 16; len++) jpc_put(&o, e->bits[len]);
+            for (int k = 0; k < e->nval; k++) jpc_put(&o, e->val[k]);
+        }
+    }
+    jpc_put_marker(&o, 0xDA, 6 + 2 * img->ncomp);
+    jpc_put(&o, img->ncomp);
+    for (int i = 0; i < img->ncomp; i++) {
+        jpc_put(&o, img->comp[i].id);
+        jpc_put(&o, i ? 0x11 : 0x00);
+    }
+    jpc_put(&o, 0);
+    jpc_put(&o, 63);
+    jpc_put(&o, 0);
+
+    // Pass 2: the data, padded with ones to a byte
+    jpc_encode_scan(img, NULL, NULL, dct, act, &o);
+    if (o.n) jpc_put_bits(&o, 0x7f, 8 - o.n);
+    jpc_put(&o, 0xFF);
+    jpc_put(&o, 0xD9);
+    return o.overflow ? 0 : (size_t)(o.p - out);
+}
+
+#endif // JPEGCOEF_H
@@ -0,0 +1,269 @@
+// Line aggregator daemon.
+// Collects verdict batches from the inspection nodes (see verdict_publisher.h),
+// appends them to <out_dir>/verdicts.csv, stores thumbnails under
+// <out_dir>/thumbs/ and prints per-node rates every few seconds.
+//
+// Usage: line_aggregator [port] [out_dir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include "verdict.h"
+
+#define MAX_CLIENTS   256
+#define MAX_NODES     256
+#define NODE_SESSIONS 4             // publisher runs remembered per node, for their spool replays
+#define STATS_PERIOD  5       // seconds
+
+struct client {
+    int fd;
+    uint8_t *buf;
+    size_t len, cap;
+    char addr[64];
+};
+
+struct node_stats {
+    int used;
+    uint16_t node_id;
+    struct { uint32_t id, last; int seen; } sess[NODE_SESSIONS];
+    int next_sess;
+    uint64_t records, batches, duplicates, thumbs, bytes;
+    uint64_t window_records;
+    uint32_t last_latency_us;
+};
+
+static volatile int keep_running = 1;
+static struct client clients[MAX_CLIENTS];
+static struct node_stats nodes[MAX_NODES];
+static struct verdict_record recs[VERDICT_MAX_BATCH];
+static const char *out_dir = ".";
+static FILE *csv;
+
+void int_handler(int signum) {
+    (void)signum;
+    keep_running = 0;
+}
+
+static struct node_stats *node_lookup(uint16_t node_id) {
+    for (int i = 0; i < MAX_NODES; i++)
+        if (nodes[i].used && nodes[i].node_id == node_id) return &nodes[i];
+    for (int i = 0; i < MAX_NODES; i++) {
+        if (!nodes[i].used) {
+            nodes[i].used = 1;
+            nodes[i].node_id = node_id;
+            return &nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static void save_thumb(uint16_t node_id, const struct verdict_record *r) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/thumbs/n%u_%u.jpg", out_dir, node_id, r->id);
+    FILE *f = fopen(path, "wb");
+    if (!f) { fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno)); return; }
+    fwrite(r->thumb, 1, r->thumb_len, f);
+    fclose(f);
+}
+
+// Handle one complete batch. Returns -1 if the client sent garbage.
+static int handle_batch(struct client *c, const uint8_t *frame, size_t len) {
+    uint16_t node_id;
+    uint64_t seq;
+    int n = verdict_decode_batch(frame, len, &node_id, &seq, recs);
+    if (n < 0) {
+        fprintf(stderr, "%s: malformed batch\n", c->addr);
+        return -1;
+    }
+
+    // Duplicate only if this session of the node already delivered the batch;
+    // a restarted publisher is a new session and counts from 0 again
+    struct node_stats *ns = node_lookup(node_id);
+    uint32_t session = verdict_seq_session(seq), count = verdict_seq_count(seq);
+    int si = -1;
+    if (ns) {
+        for (int i = 0; i < NODE_SESSIONS && si < 0; i++)
+            if (ns->sess[i].seen && ns->sess[i].id == session) si = i;
+        if (si < 0) {
+            si = ns->next_sess;
+            ns->next_sess = (si + 1) % NODE_SESSIONS;
+            ns->sess[si].id = session;
+            ns->sess[si].seen = 0;
+        }
+    }
+    if (ns && ns->sess[si].seen && count <= ns->sess[si].last) {
+        // Replayed from the node's spool after a lost ack
+        ns->duplicates++;
+    } else {
+        for (int i = 0; i < n; i++) {
+            const struct verdict_record *r = &recs[i];
+            int has_thumb = r->thumb_len > 0;
+            if (has_thumb) save_thumb(node_id, r);
+            fprintf(csv, "%u,%u,%llu,%u,%.4f,%u,%d\n", node_id, r->id, (unsigned long long)r->ts_us,
+                    r->verdict, r->score / 10000.0, r->latency_us, has_thumb);
+        }
+        if (ns) {
+            ns->sess[si].last = count;
+            ns->sess[si].seen = 1;
+            ns->records += n;
+            ns->window_records += n;
+            ns->batches++;
+            ns->bytes += len;
+            for (int i = 0; i < n; i++) ns->thumbs += recs[i].thumb_len > 0;
+            if (n > 0) ns->last_latency_us = recs[n - 1].latency_us;
+        }
+    }
+
+    // Ack, so the node can forget the batch
+    uint8_t ack[8];
+    verdict_put64(ack, seq);
+    if (send(c->fd, ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack)) return -1;
+    return 0;
+}
+
+static void drop_client(struct client *c) {
+    printf("%s disconnected\n", c->addr);
+    close(c->fd);
+    free(c->buf);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+static void read_client(struct client *c) {
+    if (c->cap - c->len < 64 * 1024) {
+        size_t cap = c->cap ? c->cap * 2 : 256 * 1024;
+        if (cap > VERDICT_MAX_FRAME + 4) cap = VERDICT_MAX_FRAME + 4;
+        uint8_t *b = (cap > c->cap) ? realloc(c->buf, cap) : c->buf;
+        if (!b) { drop_client(c); return; }
+        c->buf = b;
+        c->cap = cap;
+    }
+
+    ssize_t n = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+    if (n <= 0) {
+        if (n < 0 && errno == EINTR) return;
+        drop_client(c);
+        return;
+    }
+    c->len += n;
+
+    // Process every complete frame in the buffer
+    size_t off = 0;
+    while (c->len - off >= 4) {
+        size_t flen = verdict_get32(c->buf + off);
+        if (flen > VERDICT_MAX_FRAME) { fprintf(stderr, "%s: frame too large\n", c->addr); drop_client(c); return; }
+        if (c->len - off < 4 + flen) break;
+        if (handle_batch(c, c->buf + off + 4, flen) < 0) { drop_client(c); return; }
+        off += 4 + flen;
+    }
+    memmove(c->buf, c->buf + off, c->len - off);
+    c->len -= off;
+}
+
+static void print_stats(double dt) {
+    printf("--- %-6s %10s %9s %8s %6s %7s %10s\n", "node", "records", "rec/s", "batches", "dups", "thumbs", "lat(us)");
+    for (int i = 0; i < MAX_NODES; i++) {
+        struct node_stats *ns = &nodes[i];
+        if (!ns->used) continue;
+        printf("    %-6u %10llu %9.1f %8llu %6llu %7llu %10u\n", ns->node_id,
+               (unsigned long long)ns->records, ns->window_records / dt, (unsigned long long)ns->batches,
+               (unsigned long long)ns->duplicates, (unsigned long long)ns->thumbs, ns->last_latency_us);
+        ns->window_records = 0;
+    }
+    fflush(stdout);
+    fflush(csv);
+}
+
+int main(int argc, char **argv) {
+    int port = VERDICT_DEFAULT_PORT;
+    char path[512];
+
+    if (argc >= 2) port = atoi(argv[1]);
+    if (argc >= 3) out_dir = argv[2];
+
+    // 1. Output files
+    snprintf(path, sizeof(path), "%s/thumbs", out_dir);
+    mkdir(out_dir, 0755);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/verdicts.csv", out_dir);
+    csv = fopen(path, "a");
+    if (!csv) { fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno)); return 1; }
+    if (ftell(csv) == 0) fprintf(csv, "node,id,ts_us,verdict,score,latency_us,thumb\n");
+
+    // 2. Listening socket
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0) { perror("socket"); return 1; }
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port);
+    if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0) { perror("bind"); return 1; }
+    if (listen(lfd, 64) < 0) { perror("listen"); return 1; }
+
+    signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < MAX_CLIENTS; i++) clients[i].fd = -1;
+
+    printf("Aggregator listening on port %d, writing to %s\n", port, out_dir);
+
+    // 3. Event loop
+    struct pollfd pfds[MAX_CLIENTS + 1];
+    struct client *owners[MAX_CLIENTS + 1];
+    time_t last_stats = time(NULL);
+
+    while (keep_running) {
+        int n = 0;
+        pfds[n].fd = lfd; pfds[n].events = POLLIN; owners[n++] = NULL;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0) continue;
+            pfds[n].fd = clients[i].fd; pfds[n].events = POLLIN; owners[n++] = &clients[i];
+        }
+
+        int r = poll(pfds, n, 1000);
+        if (r < 0 && errno != EINTR) { perror("poll"); break; }
+
+        for (int i = 0; r > 0 && i < n; i++) {
+            if (!pfds[i].revents) continue;
+            if (!owners[i]) {
+                struct sockaddr_in ca;
+                socklen_t cl = sizeof(ca);
+                int cfd = accept(lfd, (struct sockaddr *)&ca, &cl);
+                if (cfd < 0) continue;
+                int slot = -1;
+                for (int k = 0; k < MAX_CLIENTS; k++) if (clients[k].fd < 0) { slot = k; break; }
+                if (slot < 0) { close(cfd); continue; }
+                clients[slot].fd = cfd;
+                unsigned char *ip = (unsigned char *)&ca.sin_addr.s_addr;
+                snprintf(clients[slot].addr, sizeof(clients[slot].addr), "%u.%u.%u.%u:%u",
+                         ip[0], ip[1], ip[2], ip[3], ntohs(ca.sin_port));
+                printf("%s connected\n", clients[slot].addr);
+            } else {
+                read_client(owners[i]);
+            }
+        }
+
+        time_t now = time(NULL);
+        if (now - last_stats >= STATS_PERIOD) {
+            print_stats((double)(now - last_stats));
+            last_stats = now;
+        }
+    }
+
+    printf("\nShutting down\n");
+    for (int i = 0; i < MAX_CLIENTS; i++) if (clients[i].fd >= 0) drop_client(&clients[i]);
+    close(lfd);
+    fclose(csv);
+    return 0;
+}
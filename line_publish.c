@@ -0,0 +1,132 @@
+// Node-side verdict publisher.
+// Reads verdict lines from stdin and forwards them to the line aggregator:
+//
+//   <id> <verdict 0|1> <score 0..1> <latency_us> [thumbnail.jpg]
+//
+// With a rate argument it generates synthetic verdicts instead, which is how
+// the publisher/aggregator pair is load tested over localhost:
+//
+//   line_aggregator 5600 /tmp/agg &
+//   line_publish 127.0.0.1 5600 1 /tmp/spool.bin 500 10 image.jpg
+//
+// With a ledger path every verdict is also appended to a local group-commit
+// ledger (vledger.h) before it is published ("-" for no thumbnail).
+//
+// Usage: line_publish <host> [port] [node_id] [spool] [rate/s] [seconds] [thumb.jpg] [ledger]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include "verdict_publisher.h"
+#include "vledger.h"
+
+static volatile int keep_running = 1;
+
+void int_handler(int signum) {
+    (void)signum;
+    keep_running = 0;
+}
+
+static uint8_t *load_file(const char *path, uint32_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno)); return NULL; }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data && fread(data, 1, size, f) != (size_t)size) { free(data); data = NULL; }
+    fclose(f);
+    *len = data ? (uint32_t)size : 0;
+    return data;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct vledger ledger;
+static int use_ledger = 0;
+
+static void publish(struct vpub *pub, uint32_t id, int verdict, uint16_t score, uint32_t latency_us,
+                    const uint8_t *thumb, uint32_t thumb_len) {
+    if (use_ledger) vledger_append(&ledger, id, verdict_now_us(), verdict, score, latency_us);
+    vpub_submit(pub, id, verdict, score, latency_us, thumb, thumb_len);
+}
+
+static void print_stats(const struct vpub *pub, double elapsed) {
+    printf("submitted %llu (%.1f/s)  batches sent %llu acked %llu spooled %llu  dropped %llu\n",
+           (unsigned long long)pub->submitted, pub->submitted / elapsed,
+           (unsigned long long)pub->sent_batches, (unsigned long long)pub->acked_batches,
+           (unsigned long long)pub->spooled_batches, (unsigned long long)pub->dropped);
+    if (use_ledger) vledger_print(&ledger);
+    tm_print(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = VERDICT_DEFAULT_PORT;
+    int node_id = 1;
+    const char *spool = "verdict_spool.bin";
+    double rate = 0, seconds = 10;
+    uint8_t *thumb = NULL;
+    uint32_t thumb_len = 0;
+    struct vpub pub;
+
+    if (argc >= 2) host = argv[1];
+    if (argc >= 3) port = atoi(argv[2]);
+    if (argc >= 4) node_id = atoi(argv[3]);
+    if (argc >= 5) spool = argv[4];
+    if (argc >= 6) rate = atof(argv[5]);
+    if (argc >= 7) seconds = atof(argv[6]);
+    if (argc >= 8 && strcmp(argv[7], "-") && !(thumb = load_file(argv[7], &thumb_len))) return 1;
+    if (argc >= 9) {
+        if (vledger_open(&ledger, argv[8], 0) != 0) return 1;
+        use_ledger = 1;
+    }
+
+    signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
+
+    if (vpub_init(&pub, host, port, (uint16_t)node_id, spool) != 0) return 1;
+    double t0 = now_s();
+
+    if (rate > 0) {
+        // Synthetic load: one thumbnail every 10 records
+        printf("Publishing %.0f verdicts/s for %.0f s as node %d\n", rate, seconds, node_id);
+        uint32_t id = 0;
+        double next = t0;
+        while (keep_running && now_s() - t0 < seconds) {
+            publish(&pub, id, (id % 17) == 0 ? VERDICT_DEFECTIVE : VERDICT_GOOD,
+                    (uint16_t)(9000 + id % 1000), 20000 + (id * 37) % 5000,
+                    (id % 10 == 0) ? thumb : NULL, thumb_len);
+            id++;
+            next += 1.0 / rate;
+            double wait = next - now_s();
+            if (wait > 0) usleep((useconds_t)(wait * 1e6));
+        }
+    } else {
+        char line[512], path[256];
+        unsigned id, verdict, latency;
+        double score;
+        while (keep_running && fgets(line, sizeof(line), stdin)) {
+            int n = sscanf(line, "%u %u %lf %u %255s", &id, &verdict, &score, &latency, path);
+            if (n < 4) { fprintf(stderr, "Skipping: %s", line); continue; }
+            uint8_t *t = NULL;
+            uint32_t tl = 0;
+            if (n == 5) t = load_file(path, &tl);
+            publish(&pub, id, verdict, (uint16_t)(score * 10000 + 0.5), latency, t, tl);
+            free(t);
+        }
+    }
+
+    vpub_close(&pub);
+    if (use_ledger) vledger_close(&ledger);
+    print_stats(&pub, now_s() - t0);
+    free(thumb);
+    return 0;
+}
@@ -0,0 +1,688 @@
+// Deterministic end-to-end line simulator.
+// Runs the inspection pipeline under a virtual clock to predict boxes/minute
+// before changing the belt speed, camera or model:
+//
+//   - boxes arrive on the belt at a given rate (Poisson or evenly spaced),
+//   - the camera delivers frames at a fixed rate into a small V4L2-like
+//     buffer queue (frames are dropped when every buffer is in use),
+//   - frames are synthetic (belt + boxes drawn at their current position) or
+//     replayed from a raw archive, and go through the real pixfmt conversion
+//     and JPEG encoder,
+//   - inference is a mock backend with a log-normal or measured latency
+//     distribution,
+//   - the belt is started and stopped by a simulated Nextion over a pty,
+//     handled by the real serial_pwm.c code writing to a mock sysfs PWM tree;
+//     the belt speed follows the mock `enable` file.
+//
+// Stage durations come from the virtual clock only, so a given seed always
+// gives the same result. Measure the real costs on the target with
+// --calibrate and pass them in with --convert-ms / --encode-ms.
+//
+// Usage: line_sim [options]
+//   --seconds S       virtual run time (600)
+//   --rate N          boxes per minute at full belt speed (30)
+//   --arrival poisson|fixed
+//   --speed MM        belt speed in mm/s (200)
+//   --box MM          box length along the belt (300)
+//   --fov MM          camera field of view along the belt (400)
+//   --fps F           camera frame rate (15)
+//   --bufs N          capture buffers (4)
+//   --workers N       harts converting + encoding (3)
+//   --convert-ms X    conversion cost per frame (6)
+//   --encode-ms X     JPEG encode cost per frame (22)
+//   --infer MED[:SIG] log-normal inference latency, median ms and sigma (45:0.25)
+//   --infer-file F    inference latencies in ms, one per line (sampled uniformly)
+//   --queue N         frames waiting for inference before new ones are dropped (8)
+//   --defects P       fraction of defective boxes (0.05)
+//   --stop T:D        stop the belt from the HMI at T s for D s (repeatable)
+//   --trigger         only process frames with a box fully in view
+//   --replay F:WxH[:FMT]  replay raw frames instead of synthesizing them
+//   --size WxH        synthetic frame size (320x240)
+//   --no-exec         skip running the real conversion/encode (timing is unchanged)
+//   --seed N          random seed (1)
+//   --calibrate       time the real conversion + encode on this machine and exit
+
+#define _GNU_SOURCE             // posix_openpt, ptsname
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "pixfmt.h"
+
+// The real belt controller, pointed at a mock sysfs tree
+static char sim_pwm_chip[128];
+#define PWM_CHIP_PATH sim_pwm_chip
+#define SERIAL_PWM_NO_MAIN
+#include "serial_pwm.c"
+
+#define NS_PER_MS      1000000LL
+#define NS_PER_S       1000000000LL
+#define MAX_STOPS      32
+#define MAX_FRAME_BOX  4
+#define MAX_BUFS       32
+
+enum { EV_FRAME, EV_PREP_DONE, EV_INFER_DONE, EV_HMI, EV_END };
+
+struct event {
+    int64_t t;
+    uint64_t seq;               // ties are broken by insertion order
+    int type, arg;
+};
+
+struct box {
+    double pos;                 // belt position at which the leading edge enters the view
+    int defective;
+    int inspected;              // a frame showing it got a verdict
+    int64_t first_seen;         // capture time of the first frame showing it, -1 if none
+};
+
+struct frame {
+    int64_t t_capture;
+    long index;
+    double belt;                // belt position at capture
+    int nbox, box[MAX_FRAME_BOX];
+};
+
+struct samples {
+    double *v;
+    size_t n, cap;
+};
+
+// --- Configuration ---
+static double cfg_seconds = 600, cfg_rate = 30, cfg_speed = 200, cfg_box = 300, cfg_fov = 400;
+static double cfg_fps = 15, cfg_convert_ms = 6, cfg_encode_ms = 22, cfg_defects = 0.05;
+static double cfg_infer_med = 45, cfg_infer_sigma = 0.25;
+static int cfg_bufs = 4, cfg_workers = 3, cfg_queue = 8, cfg_trigger = 0, cfg_exec = 1, cfg_poisson = 1;
+static uint64_t cfg_seed = 1;
+static struct { double at, dur; } cfg_stops[MAX_STOPS];
+static int cfg_nstops;
+static struct samples infer_table;
+
+// --- Deterministic PRNG (xorshift64*) ---
+// Separate streams, so the box layout does not change with the pipeline settings
+static uint64_t rng_boxes, rng_infer;
+
+static double rng_uniform(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return ((*s * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_normal(uint64_t *s) {
+    double u = rng_uniform(s), v = rng_uniform(s);
+    if (u < 1e-12) u = 1e-12;
+    return sqrt(-2.0 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double rng_exp(uint64_t *s, double mean) {
+    return -mean * log(1.0 - rng_uniform(s));
+}
+
+// --- Event queue (binary heap) ---
+static struct event *heap;
+static size_t heap_n, heap_cap;
+static uint64_t heap_seq;
+static int64_t now;             // the virtual clock
+
+static int ev_before(const struct event *a, const struct event *b) {
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void ev_push(int64_t t, int type, int arg) {
+    if (heap_n == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 256;
+        heap = realloc(heap, heap_cap * sizeof(*heap));
+        if (!heap) { perror("Malloc failed"); exit(1); }
+    }
+    size_t i = heap_n++;
+    struct event e = { t, heap_seq++, type, arg };
+    while (i > 0 && ev_before(&e, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = e;
+}
+
+static struct event ev_pop(void) {
+    struct event top = heap[0], last = heap[--heap_n];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_n) break;
+        if (c + 1 < heap_n && ev_before(&heap[c + 1], &heap[c])) c++;
+        if (!ev_before(&heap[c], &last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static void samples_add(struct samples *s, double v) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(double));
+        if (!s->v) { perror("Malloc failed"); exit(1); }
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double samples_pct(struct samples *s, double q) {
+    if (!s->n) return 0;
+    size_t i = (size_t)(q / 100.0 * s->n);
+    return s->v[i < s->n ? i : s->n - 1];
+}
+
+// --- Belt: position integrates speed while the mock PWM is enabled ---
+static double belt_pos;
+static int64_t belt_t;
+static int belt_running;
+
+static double belt_at(int64_t t) {
+    return belt_pos + (belt_running ? cfg_speed * (t - belt_t) / (double)NS_PER_S : 0);
+}
+
+static int read_pwm_enable(void) {
+    char path[300], c = '0';
+    snprintf(path, sizeof(path), "%s/pwm%d/enable", sim_pwm_chip, PWM_CHANNEL);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &c, 1) != 1) c = '0';
+        close(fd);
+    }
+    return c == '1';
+}
+
+static void belt_update(void) {
+    int run = read_pwm_enable();
+    if (run == belt_running) return;
+    belt_pos = belt_at(now);
+    belt_t = now;
+    belt_running = run;
+}
+
+// --- Boxes, generated ahead of the belt ---
+static struct box *boxes;
+static long nboxes, box_cap, first_active;
+static double next_box_pos;
+
+static void boxes_fill(double upto) {
+    // Shifted exponential: boxes cannot overlap, the mean gap still gives the requested rate
+    double mean_gap = cfg_speed * 60.0 / cfg_rate, min_gap = cfg_box + 10;
+    while (next_box_pos <= upto) {
+        if (nboxes == box_cap) {
+            box_cap = box_cap ? box_cap * 2 : 1024;
+            boxes = realloc(boxes, box_cap * sizeof(*boxes));
+            if (!boxes) { perror("Malloc failed"); exit(1); }
+        }
+        struct box *b = &boxes[nboxes++];
+        b->pos = next_box_pos;
+        b->defective = rng_uniform(&rng_boxes) < cfg_defects;
+        b->inspected = 0;
+        b->first_seen = -1;
+        double gap = mean_gap;
+        if (cfg_poisson && mean_gap > min_gap) gap = min_gap + rng_exp(&rng_boxes, mean_gap - min_gap);
+        next_box_pos += gap > min_gap ? gap : min_gap;
+    }
+}
+
+// --- Simulated Nextion on the master side of a pty ---
+static int hmi_master = -1, hmi_slave = -1;
+static uint64_t hmi_bytes_out;
+
+static int hmi_open(void) {
+    hmi_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (hmi_master < 0 || grantpt(hmi_master) < 0 || unlockpt(hmi_master) < 0) { perror("pty"); return -1; }
+    const char *name = ptsname(hmi_master);
+    hmi_slave = name ? open(name, O_RDWR | O_NOCTTY) : -1;
+    if (hmi_slave < 0) { perror("Opening pty slave"); return -1; }
+    if (configure_serial(hmi_slave, 9600) != 0) return -1;
+    fcntl(hmi_master, F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+// The display sends a touch event; the controller handles whatever arrives
+static void hmi_press(char c) {
+    unsigned char buf[64];
+    if (write(hmi_master, &c, 1) != 1) { perror("pty write"); return; }
+    struct pollfd p = { hmi_slave, POLLIN, 0 };
+    if (poll(&p, 1, 1000) <= 0) { fprintf(stderr, "HMI: controller saw nothing\n"); return; }
+    ssize_t n = read(hmi_slave, buf, sizeof(buf));
+    for (ssize_t i = 0; i < n; i++) handle_command(buf[i]);
+    fflush(stdout);
+    belt_update();
+}
+
+// The controller updates the counter on the display
+static void hmi_show_count(long count) {
+    char msg[48], sink[256];
+    int len = snprintf(msg, sizeof(msg), "n0.val=%ld\xff\xff\xff", count);
+    if (write(hmi_slave, msg, len) == len) hmi_bytes_out += len;
+    while (read(hmi_master, sink, sizeof(sink)) > 0) {}
+}
+
+static int mock_sysfs(char *dir, size_t len) {
+    char path[512];
+    snprintf(dir, len, "/tmp/line_sim.XXXXXX");
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return -1; }
+    snprintf(sim_pwm_chip, sizeof(sim_pwm_chip), "%s/pwmchip0", dir);
+    mkdir(sim_pwm_chip, 0755);
+    snprintf(path, sizeof(path), "%s/pwm%d", sim_pwm_chip, PWM_CHANNEL);
+    mkdir(path, 0755);
+    const char *files[] = { "export", "unexport", "pwm0/period", "pwm0/duty_cycle", "pwm0/enable" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", sim_pwm_chip, files[i]);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) { perror(path); return -1; }
+        close(fd);
+    }
+    return 0;
+}
+
+static void mock_sysfs_remove(const char *dir) {
+    char path[600];
+    const char *files[] = { "pwm0/period", "pwm0/duty_cycle", "pwm0/enable", "export", "unexport", "pwm0", "" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", sim_pwm_chip, files[i]);
+        remove(path);
+    }
+    remove(dir);
+}
+
+// --- Frame source ---
+static int width = 320, height = 240;
+static uint32_t fourcc = V4L2_PIX_FMT_YUYV;
+static const uint8_t *replay;
+static size_t replay_size, frame_size;
+static long replay_frames;
+static uint8_t *synth;
+
+// Belt texture plus every box in view, leading edge towards +x
+static void synth_frame(const struct frame *f) {
+    double px_per_mm = width / cfg_fov;
+    int y0 = height / 5, y1 = height - height / 5;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = synth + (size_t)y * width * 2;
+        for (int x = 0; x < width; x += 2) {
+            uint8_t l = 90 + ((x * 7 + y * 13) & 15);
+            row[x * 2] = l; row[x * 2 + 1] = 128; row[x * 2 + 2] = l; row[x * 2 + 3] = 128;
+        }
+    }
+    for (long i = first_active; i < nboxes && boxes[i].pos < f->belt; i++) {
+        double front = f->belt - boxes[i].pos;
+        int xa = (int)((front - cfg_box) * px_per_mm), xb = (int)(front * px_per_mm);
+        if (xa < 0) xa = 0;
+        if (xb > width) xb = width;
+        for (int y = y0; y < y1; y++) {
+            uint8_t *row = synth + (size_t)y * width * 2;
+            for (int x = xa & ~1; x < xb; x++) {
+                row[x * 2] = 150 + ((x + y) & 7);
+                row[x * 2 + 1] = (x & 1) ? 150 : 110;   // U on even, V on odd samples
+            }
+            if (boxes[i].defective) {
+                int xt = xa + (xb - xa) * (y - y0) / (y1 - y0);    // diagonal tear
+                for (int x = xt; x < xt + 3 && x < xb; x++) row[x * 2] = 30;
+            }
+        }
+    }
+}
+
+static uint64_t jpeg_bytes, jpeg_frames;
+static uint8_t *rgb;
+static struct pixfmt_ctx conv;
+
+static void count_write(void *context, void *data, int size) {
+    (void)data;
+    *(uint64_t *)context += size;
+}
+
+// The real conversion + encode for one frame
+static void run_pipeline(const struct frame *f) {
+    const uint8_t *src;
+    if (replay) {
+        src = replay + (f->index % replay_frames) * frame_size;
+    } else {
+        synth_frame(f);
+        src = synth;
+    }
+    pixfmt_convert_serial(&conv, fourcc, PIXFMT_DST_RGB24, src, 0, rgb, width, height, 0);
+    uint64_t bytes = 0;
+    stbi_write_jpg_to_func(count_write, &bytes, width, height, 3, rgb, 90);
+    jpeg_bytes += bytes;
+    jpeg_frames++;
+}
+
+// --- Pipeline state ---
+static struct frame *frames;        // ring of in-flight frames, one slot per buffer + queue entry
+static int nslots;
+static int *free_slots, nfree_slots;
+static int bufs_used;
+static int *capq, capq_n;           // captured, waiting for a worker (FIFO)
+static int *infq, infq_n;           // encoded, waiting for inference (FIFO)
+static int workers_busy, infer_busy;
+static long frame_count;
+
+static struct {
+    long captured, dropped_nobuf, dropped_queue, skipped, processed;
+    long inspected, rejected, false_pass;
+    int64_t worker_busy_ns, infer_busy_ns;
+    struct samples box_lat, frame_lat;
+} st;
+
+static double infer_sample_ms(void) {
+    if (infer_table.n) return infer_table.v[(size_t)(rng_uniform(&rng_infer) * infer_table.n) % infer_table.n];
+    return cfg_infer_med * exp(cfg_infer_sigma * rng_normal(&rng_infer));
+}
+
+static int slot_get(void) { return nfree_slots ? free_slots[--nfree_slots] : -1; }
+static void slot_put(int s) { free_slots[nfree_slots++] = s; }
+
+static void start_work(void) {
+    while (workers_busy < cfg_workers && capq_n > 0) {
+        int s = capq[0];
+        memmove(capq, capq + 1, --capq_n * sizeof(int));
+        workers_busy++;
+        if (cfg_exec) run_pipeline(&frames[s]);
+        int64_t cost = (int64_t)((cfg_convert_ms + cfg_encode_ms) * NS_PER_MS);
+        st.worker_busy_ns += cost;
+        ev_push(now + cost, EV_PREP_DONE, s);
+    }
+    if (!infer_busy && infq_n > 0) {
+        int s = infq[0];
+        memmove(infq, infq + 1, --infq_n * sizeof(int));
+        infer_busy = 1;
+        int64_t cost = (int64_t)(infer_sample_ms() * NS_PER_MS);
+        st.infer_busy_ns += cost;
+        ev_push(now + cost, EV_INFER_DONE, s);
+    }
+}
+
+static void on_frame(void) {
+    struct frame f = { now, frame_count++, belt_at(now), 0, {0} };
+    st.captured++;
+
+    // Boxes fully inside the field of view
+    boxes_fill(f.belt + cfg_fov);
+    while (first_active < nboxes && boxes[first_active].pos + cfg_fov < f.belt) first_active++;
+    for (long i = first_active; i < nboxes && f.nbox < MAX_FRAME_BOX; i++) {
+        double front = f.belt - boxes[i].pos;
+        if (front < cfg_box) break;
+        if (front <= cfg_fov) {
+            f.box[f.nbox++] = (int)i;
+            if (boxes[i].first_seen < 0) boxes[i].first_seen = now;
+        }
+    }
+
+    if (cfg_trigger && f.nbox == 0) {
+        st.skipped++;
+    } else if (bufs_used >= cfg_bufs) {
+        st.dropped_nobuf++;
+    } else {
+        int s = slot_get();
+        frames[s] = f;
+        bufs_used++;
+        capq[capq_n++] = s;
+        start_work();
+    }
+    ev_push(now + (int64_t)(NS_PER_S / cfg_fps), EV_FRAME, 0);
+}
+
+static void on_prep_done(int s) {
+    workers_busy--;
+    bufs_used--;                // encoded, the capture buffer goes back to the driver
+    if (infq_n >= cfg_queue) {
+        st.dropped_queue++;
+        slot_put(s);
+    } else {
+        infq[infq_n++] = s;
+    }
+    start_work();
+}
+
+static void on_infer_done(int s) {
+    struct frame *f = &frames[s];
+    infer_busy = 0;
+    st.processed++;
+    samples_add(&st.frame_lat, (now - f->t_capture) / 1e6);
+    for (int i = 0; i < f->nbox; i++) {
+        struct box *b = &boxes[f->box[i]];
+        if (b->inspected) continue;
+        b->inspected = 1;
+        st.inspected++;
+        // Mock verdict: the backend is right; the latency model is what matters here
+        if (b->defective) st.rejected++;
+        samples_add(&st.box_lat, (now - b->first_seen) / 1e6);
+        hmi_show_count(st.inspected);
+    }
+    slot_put(s);
+    start_work();
+}
+
+static int load_infer_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    double v;
+    if (!f) { fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno)); return -1; }
+    while (fscanf(f, "%lf", &v) == 1) samples_add(&infer_table, v);
+    fclose(f);
+    if (!infer_table.n) { fprintf(stderr, "No latencies in %s\n", path); return -1; }
+    return 0;
+}
+
+static int open_replay(const char *spec) {
+    char path[256], fmt[16] = "YUYV";
+    if (sscanf(spec, "%255[^:]:%dx%d:%15s", path, &width, &height, fmt) < 3) {
+        fprintf(stderr, "Bad --replay %s, expected file:WxH[:FMT]\n", spec);
+        return -1;
+    }
+    if (!(fourcc = pixfmt_from_name(fmt))) { fprintf(stderr, "Unknown format %s\n", fmt); return -1; }
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) < 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno)); return -1; }
+    frame_size = pixfmt_frame_size(fourcc, width, height);
+    replay_frames = frame_size ? sb.st_size / (off_t)frame_size : 0;
+    if (!replay_frames) { fprintf(stderr, "ERROR: %s holds no complete %dx%d frame\n", path, width, height); return -1; }
+    replay_size = sb.st_size;
+    replay = mmap(NULL, replay_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (replay == MAP_FAILED) { perror("Mapping replay"); return -1; }
+    return 0;
+}
+
+static void calibrate(void) {
+    struct frame f = { 0, 0, cfg_box + 50, 0, {0} };
+    uint64_t bytes = 0;
+    double conv_ns[51], enc_ns[51];
+    boxes_fill(f.belt + cfg_fov);
+    for (int i = 0; i < 51; i++) {
+        const uint8_t *src = replay ? replay + (i % replay_frames) * frame_size : synth;
+        if (!replay) synth_frame(&f);
+        double t0 = pixfmt_now_ns();
+        pixfmt_convert_serial(&conv, fourcc, PIXFMT_DST_RGB24, src, 0, rgb, width, height, 0);
+        double t1 = pixfmt_now_ns();
+        stbi_write_jpg_to_func(count_write, &bytes, width, height, 3, rgb, 90);
+        conv_ns[i] = t1 - t0;
+        enc_ns[i] = pixfmt_now_ns() - t1;
+    }
+    qsort(conv_ns, 51, sizeof(double), cmp_double);
+    qsort(enc_ns, 51, sizeof(double), cmp_double);
+    printf("%dx%d %s on this machine: --convert-ms %.2f --encode-ms %.2f\n",
+           width, height, pixfmt_name(fourcc), conv_ns[25] / 1e6, enc_ns[25] / 1e6);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--seconds S] [--rate N] [--arrival poisson|fixed] [--speed MM] [--box MM] [--fov MM]\n"
+                    "          [--fps F] [--bufs N] [--workers N] [--convert-ms X] [--encode-ms X]\n"
+                    "          [--infer MED[:SIG]] [--infer-file F] [--queue N] [--defects P] [--stop T:D]...\n"
+                    "          [--trigger] [--replay F:WxH[:FMT]] [--size WxH] [--no-exec] [--seed N] [--calibrate]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        {"seconds", 1, 0, 's'}, {"rate", 1, 0, 'r'}, {"arrival", 1, 0, 'a'}, {"speed", 1, 0, 'v'},
+        {"box", 1, 0, 'b'}, {"fov", 1, 0, 'f'}, {"fps", 1, 0, 'F'}, {"bufs", 1, 0, 'B'},
+        {"workers", 1, 0, 'w'}, {"convert-ms", 1, 0, 'c'}, {"encode-ms", 1, 0, 'e'},
+        {"infer", 1, 0, 'i'}, {"infer-file", 1, 0, 'I'}, {"queue", 1, 0, 'q'}, {"defects", 1, 0, 'd'},
+        {"stop", 1, 0, 'S'}, {"trigger", 0, 0, 't'}, {"replay", 1, 0, 'R'}, {"size", 1, 0, 'z'},
+        {"no-exec", 0, 0, 'n'}, {"seed", 1, 0, 'x'}, {"calibrate", 0, 0, 'C'}, {0, 0, 0, 0}
+    };
+    const char *replay_spec = NULL;
+    int do_calibrate = 0, o;
+
+    while ((o = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+        switch (o) {
+        case 's': cfg_seconds = atof(optarg); break;
+        case 'r': cfg_rate = atof(optarg); break;
+        case 'a': cfg_poisson = strcmp(optarg, "fixed") != 0; break;
+        case 'v': cfg_speed = atof(optarg); break;
+        case 'b': cfg_box = atof(optarg); break;
+        case 'f': cfg_fov = atof(optarg); break;
+        case 'F': cfg_fps = atof(optarg); break;
+        case 'B': cfg_bufs = atoi(optarg); break;
+        case 'w': cfg_workers = atoi(optarg); break;
+        case 'c': cfg_convert_ms = atof(optarg); break;
+        case 'e': cfg_encode_ms = atof(optarg); break;
+        case 'i': if (sscanf(optarg, "%lf:%lf", &cfg_infer_med, &cfg_infer_sigma) < 1) { usage(argv[0]); return 1; } break;
+        case 'I': if (load_infer_file(optarg) != 0) return 1; break;
+        case 'q': cfg_queue = atoi(optarg); break;
+        case 'd': cfg_defects = atof(optarg); break;
+        case 'S':
+            if (cfg_nstops == MAX_STOPS || sscanf(optarg, "%lf:%lf", &cfg_stops[cfg_nstops].at, &cfg_stops[cfg_nstops].dur) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            cfg_nstops++;
+            break;
+        case 't': cfg_trigger = 1; break;
+        case 'R': replay_spec = optarg; break;
+        case 'z': if (sscanf(optarg, "%dx%d", &width, &height) != 2) { usage(argv[0]); return 1; } break;
+        case 'n': cfg_exec = 0; break;
+        case 'x': cfg_seed = strtoull(optarg, NULL, 0); break;
+        case 'C': do_calibrate = 1; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (cfg_box > cfg_fov || cfg_rate <= 0 || cfg_fps <= 0 || cfg_workers < 1 || cfg_queue < 1 || cfg_bufs < 1 || cfg_bufs > MAX_BUFS) {
+        fprintf(stderr, "Need box <= fov, rate > 0, fps > 0, workers >= 1, queue >= 1, 1 <= bufs <= %d\n", MAX_BUFS);
+        return 1;
+    }
+    rng_boxes = (cfg_seed + 1) * 0x9E3779B97F4A7C15ULL;
+    rng_infer = (cfg_seed + 2) * 0xD1B54A32D192ED03ULL;
+
+    if (replay_spec && open_replay(replay_spec) != 0) return 1;
+    pixfmt_init(&conv, 1);
+    rgb = malloc(pixfmt_dst_size(PIXFMT_DST_RGB24, width, height));
+    synth = malloc((size_t)width * height * 2);
+    if (!rgb || !synth) { perror("Malloc failed"); return 1; }
+
+    if (do_calibrate) {
+        calibrate();
+        return 0;
+    }
+
+    // Mock hardware: sysfs PWM tree and the Nextion on a pty
+    char sysfs_dir[64];
+    if (mock_sysfs(sysfs_dir, sizeof(sysfs_dir)) != 0) return 1;
+    if (pwm_init() != 0 || hmi_open() != 0) return 1;
+
+    nslots = cfg_bufs + cfg_queue + cfg_workers + 1;
+    frames = calloc(nslots, sizeof(*frames));
+    free_slots = calloc(nslots, sizeof(int));
+    capq = calloc(nslots, sizeof(int));
+    infq = calloc(nslots, sizeof(int));
+    if (!frames || !free_slots || !capq || !infq) { perror("Malloc failed"); return 1; }
+    for (int i = nslots - 1; i >= 0; i--) slot_put(i);
+
+    printf("Simulating %.0f s: %.1f boxes/min (%s), belt %.0f mm/s, %.0f fps, %d workers, "
+           "prep %.1f ms, inference %s\n", cfg_seconds, cfg_rate, cfg_poisson ? "poisson" : "fixed",
+           cfg_speed, cfg_fps, cfg_workers, cfg_convert_ms + cfg_encode_ms,
+           infer_table.n ? "from file" : "log-normal");
+
+    // The operator presses start, then whatever stops were scheduled
+    int64_t end = (int64_t)(cfg_seconds * NS_PER_S);
+    ev_push(0, EV_HMI, 'A');
+    for (int i = 0; i < cfg_nstops; i++) {
+        ev_push((int64_t)(cfg_stops[i].at * NS_PER_S), EV_HMI, 'B');
+        ev_push((int64_t)((cfg_stops[i].at + cfg_stops[i].dur) * NS_PER_S), EV_HMI, 'A');
+    }
+    ev_push(0, EV_FRAME, 0);
+    ev_push(end, EV_END, 0);
+
+    int64_t running_ns = 0, run_since = -1;
+    while (heap_n) {
+        struct event e = ev_pop();
+        now = e.t;
+        if (e.type == EV_END) break;
+        switch (e.type) {
+        case EV_FRAME:      on_frame(); break;
+        case EV_PREP_DONE:  on_prep_done(e.arg); break;
+        case EV_INFER_DONE: on_infer_done(e.arg); break;
+        case EV_HMI:
+            hmi_press((char)e.arg);
+            if (belt_running && run_since < 0) run_since = now;
+            if (!belt_running && run_since >= 0) { running_ns += now - run_since; run_since = -1; }
+            break;
+        }
+    }
+    if (run_since >= 0) running_ns += end - run_since;
+
+    // Boxes that left the view without a verdict; the ones still in view or in flight are not counted
+    double belt_end = belt_at(end);
+    long passed = 0, missed = 0;
+    for (long i = 0; i < nboxes; i++) {
+        if (boxes[i].pos + cfg_fov >= belt_end) break;
+        passed++;
+        if (!boxes[i].inspected) missed++;
+    }
+
+    qsort(st.box_lat.v, st.box_lat.n, sizeof(double), cmp_double);
+    qsort(st.frame_lat.v, st.frame_lat.n, sizeof(double), cmp_double);
+    double minutes = cfg_seconds / 60.0;
+
+    printf("\n--- %.0f s simulated, belt running %.0f s ---\n", cfg_seconds, running_ns / 1e9);
+    printf("Boxes: %ld passed, %ld inspected, %ld missed (%.2f%%), %ld rejected\n",
+           passed, st.inspected, missed, passed ? 100.0 * missed / passed : 0.0, st.rejected);
+    printf("Throughput: %.1f boxes/min inspected (%.1f/min while running)\n", st.inspected / minutes,
+           running_ns ? st.inspected / (running_ns / 60e9) : 0.0);
+    printf("Frames: %ld captured, %ld processed, %ld dropped (no buffer), %ld dropped (inference queue full)",
+           st.captured, st.processed, st.dropped_nobuf, st.dropped_queue);
+    if (cfg_trigger) printf(", %ld skipped (no box)", st.skipped);
+    printf("\n");
+    printf("Box latency ms (first seen -> verdict): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           samples_pct(&st.box_lat, 50), samples_pct(&st.box_lat, 90), samples_pct(&st.box_lat, 99),
+           st.box_lat.n ? st.box_lat.v[st.box_lat.n - 1] : 0.0);
+    printf("Frame latency ms (capture -> verdict): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           samples_pct(&st.frame_lat, 50), samples_pct(&st.frame_lat, 90), samples_pct(&st.frame_lat, 99),
+           st.frame_lat.n ? st.frame_lat.v[st.frame_lat.n - 1] : 0.0);
+    printf("Utilisation: workers %.0f%%, inference %.0f%%\n",
+           100.0 * st.worker_busy_ns / ((double)end * cfg_workers), 100.0 * st.infer_busy_ns / (double)end);
+    if (jpeg_frames) printf("JPEG: %.1f KB/frame average over %llu frames\n", jpeg_bytes / 1024.0 / jpeg_frames,
+                            (unsigned long long)jpeg_frames);
+    printf("HMI: %llu bytes to the display (%.1f%% of 9600 baud)\n", (unsigned long long)hmi_bytes_out,
+           100.0 * hmi_bytes_out * 10 / (9600.0 * cfg_seconds));
+
+    close(hmi_slave);
+    close(hmi_master);
+    mock_sysfs_remove(sysfs_dir);
+    if (replay) munmap((void *)replay, replay_size);
+    pixfmt_destroy(&conv);
+    free(rgb);
+    free(synth);
+    return 0;
+}
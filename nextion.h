@@ -0,0 +1,512 @@
+// nextion.h - Pipelined `get` queries and bulk waveform data to a Nextion display.
+//
+// "get h0.val" is answered with 0x71 + 4 bytes (little-endian int32) or
+// 0x70 + string, each ended by ff ff ff, or with an error code (0x1A
+// invalid variable, ...) when bkcmd asks for them. Stop-and-wait costs a
+// full round trip per value: command out, the display's parse, the answer
+// back, all at UART speed. The display executes its serial input in order
+// and answers in order, so several queries can be on the wire at once and
+// each answer belongs to the oldest query still open. Up to `window` are
+// in flight (the display buffers 1 KB of input; NX_WINDOW_BYTES keeps well
+// under that); the rest wait in the queue and go out as answers come back.
+//
+// Everything else the display sends (the bytes its buttons print, 'A' and
+// 'B' for the belt) is handed to raw_cb unchanged. A response frame is only
+// recognized while a query is open, so with nothing in flight the byte
+// stream is exactly what it was before. Frames cannot interleave with
+// printed bytes: the display's UART sends one thing at a time.
+//
+// Timeouts: the oldest open query fails with NX_TIMEOUT after timeout_ms.
+// Its answer may still come and would then be taken for the next one's,
+// so every open query fails with it and response frames are discarded
+// for another timeout_ms before the queue resumes.
+//
+// Callbacks run from nx_input() / nx_expire(), i.e. in the caller's event
+// loop; they may queue new queries.
+//
+// Waveforms: "add id,ch,val" is 12+ bytes on the wire per sample, so at
+// 9600 baud a chart alone could take the whole link. "addt id,ch,n" instead
+// switches the display to transparent mode: it answers 0xFE when ready,
+// takes the next n bytes as samples and answers 0xFD when done. An addt
+// goes out only when nothing else is in flight, and nothing goes out
+// behind it until the 0xFD (the display would take it for samples).
+// struct nx_wave on top of it averages (or takes the maximum of) the
+// samples of each channel over fixed time bins, one chart point per bin,
+// and sends each channel's points in one addt every NX_WAVE_FLUSH_MS. The
+// bin rate is what was asked for, cut to what NX_WAVE_SHARE of the baud
+// rate can carry, so the chart scrolls at a steady speed whatever the link
+// and the rest of the traffic keeps its share.
+//
+// Other processes feed a chart through a datagram socket (NX_CHART_SOCK):
+// nx_chart_send() from the producer, nx_chart_recv() into nx_wave_sample()
+// in the process that owns the UART.
+//
+// Usage:
+//   struct nextion nx;
+//   nx_init(&nx, uart_fd, NX_WINDOW, 200, on_raw, NULL);
+//   nx_get(&nx, "h0.val", on_value, NULL);
+//   loop: poll(uart_fd, nx_timeout_ms(&nx)); nx_input(&nx, buf, n); nx_expire(&nx);
+//   nx_print(&nx);
+//
+//   struct nx_wave wv;
+//   nx_wave_init(&wv, &nx, 1, 2, 10, 9600);          // waveform id 1, 2 channels, 10 points/s
+//   nx_wave_scale(&wv, 0, 60, 0);                    // channel 0: mean, 60 = top of the chart
+//   nx_wave_sample(&wv, 0, fps);
+//   loop: poll(..., min(nx_timeout_ms(&nx), nx_wave_timeout_ms(&wv))); nx_wave_tick(&wv);
+
+#ifndef NEXTION_H
+#define NEXTION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "telemetry.h"
+
+#define NX_QUEUE         32             // queries queued or in flight
+#define NX_WINDOW        8              // default queries in flight
+#define NX_WINDOW_BYTES  512            // command bytes in flight, half the display's input buffer
+#define NX_EXPR_MAX      32
+#define NX_STR_MAX       64             // longer string answers are cut
+#define NX_ADDT_MAX      1024           // samples per addt, the display's limit
+
+#define NX_WAVE_CH       4              // channels per waveform component
+#define NX_WAVE_SHARE    0.5            // of the link for charts
+#define NX_WAVE_FLUSH_MS 250
+#define NX_CHART_SOCK    "/run/conveyor-chart.sock"
+#define NX_CHART_THROUGHPUT 0          // channel: frames archived per second (capture_loop)
+#define NX_CHART_LATENCY    1          // channel: capture to archived, ms (capture_loop)
+
+enum { NX_NUM = 0, NX_STR, NX_ERR, NX_TIMEOUT, NX_DONE };
+enum { NX_GET = 0, NX_ADDT };
+
+struct nx_result {
+    int status;                         // NX_NUM, NX_STR, NX_ERR (code set), NX_TIMEOUT, NX_DONE (addt)
+    int code;                           // the display's error code for NX_ERR
+    int32_t num;
+    const char *str;
+    uint64_t rtt_ns;
+};
+
+typedef void (*nx_cb)(void *arg, const char *expr, const struct nx_result *r);
+typedef void (*nx_raw_cb)(void *arg, unsigned char c);
+
+struct nx_query {
+    char expr[NX_EXPR_MAX];             // for NX_ADDT the whole "addt id,ch,n"
+    int kind;
+    const uint8_t *data;                // NX_ADDT samples, the caller's until the callback
+    int ndata, stage;                   // stage 1: 0xFE seen, samples written
+    nx_cb cb;
+    void *arg;
+    uint64_t sent_ns, deadline_ns;
+    int len;                            // command bytes
+};
+
+struct nextion {
+    int fd, window;
+    uint64_t timeout_ns, byte_ns;
+    nx_raw_cb raw_cb;
+    void *raw_arg;
+
+    struct nx_query q[NX_QUEUE];
+    unsigned head, sent, tail;          // head..sent in flight, sent..tail waiting
+    int bytes_in_flight;
+    uint64_t discard_until;             // after a timeout: drop answers until then
+
+    // Response being received
+    int frame;                          // 0 = none, else its first byte
+    unsigned char fbuf[NX_STR_MAX + 8];
+    int flen, ffs;                      // bytes so far, trailing ff count
+
+    uint64_t done, errors, timeouts, dropped, full;
+};
+
+static struct tm_hist nx_rtt_us = TM_HIST("nx_rtt", "us");             // get written to answer parsed
+static struct tm_hist nx_addt_us = TM_HIST("nx_addt", "us");           // addt written to 0xFD
+
+static inline uint64_t nx_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// window 1 is plain stop-and-wait polling
+static inline void nx_init(struct nextion *nx, int fd, int window, int timeout_ms, nx_raw_cb raw_cb, void *raw_arg) {
+    memset(nx, 0, sizeof(*nx));
+    nx->fd = fd;
+    nx->window = window < 1 ? 1 : window > NX_QUEUE ? NX_QUEUE : window;
+    nx->timeout_ns = (uint64_t)timeout_ms * 1000000;
+    nx->byte_ns = 10000000000ull / 9600;
+    nx->raw_cb = raw_cb;
+    nx->raw_arg = raw_arg;
+}
+
+// 10 bits per byte; addt timeouts allow for the samples' time on the wire
+static inline void nx_set_baud(struct nextion *nx, int baud) {
+    nx->byte_ns = 10000000000ull / (baud > 0 ? baud : 9600);
+}
+
+static inline int nx_in_flight(const struct nextion *nx) {
+    return nx->sent - nx->head;
+}
+
+// Send what the window allows
+static inline void nx_pump(struct nextion *nx) {
+    uint64_t now = nx_now_ns();
+    if (now < nx->discard_until) return;
+    while (nx->sent != nx->tail && (int)(nx->sent - nx->head) < nx->window) {
+        struct nx_query *q = &nx->q[nx->sent % NX_QUEUE];
+        // Transparent mode: an addt is alone on the line until its 0xFD
+        if (nx->sent != nx->head && (q->kind == NX_ADDT || nx->q[nx->head % NX_QUEUE].kind == NX_ADDT)) break;
+        char cmd[NX_EXPR_MAX + 8];
+        int len = snprintf(cmd, sizeof(cmd), q->kind == NX_ADDT ? "%s\xff\xff\xff" : "get %s\xff\xff\xff", q->expr);
+        if (nx->sent != nx->head && nx->bytes_in_flight + len > NX_WINDOW_BYTES) break;
+        if (write(nx->fd, cmd, len) != len) {
+            fprintf(stderr, "nextion: write: %s\n", strerror(errno));
+            break;
+        }
+        q->sent_ns = now;
+        q->deadline_ns = now + nx->timeout_ns;
+        q->stage = 0;
+        q->len = len;
+        nx->bytes_in_flight += len;
+        nx->sent++;
+    }
+}
+
+// Queue a query; -1 if the queue is full
+static inline int nx_get(struct nextion *nx, const char *expr, nx_cb cb, void *arg) {
+    if (nx->tail - nx->head >= NX_QUEUE) { nx->full++; return -1; }
+    struct nx_query *q = &nx->q[nx->tail % NX_QUEUE];
+    snprintf(q->expr, sizeof(q->expr), "%s", expr);
+    q->kind = NX_GET;
+    q->cb = cb;
+    q->arg = arg;
+    nx->tail++;
+    nx_pump(nx);
+    return 0;
+}
+
+// Queue n (<= NX_ADDT_MAX) samples for channel ch of waveform id; data must
+// stay valid until cb. -1 if the queue is full
+static inline int nx_addt(struct nextion *nx, int id, int ch, const uint8_t *data, int n, nx_cb cb, void *arg) {
+    if (nx->tail - nx->head >= NX_QUEUE) { nx->full++; return -1; }
+    struct nx_query *q = &nx->q[nx->tail % NX_QUEUE];
+    snprintf(q->expr, sizeof(q->expr), "addt %d,%d,%d", id, ch, n);
+    q->kind = NX_ADDT;
+    q->data = data;
+    q->ndata = n;
+    q->cb = cb;
+    q->arg = arg;
+    nx->tail++;
+    nx_pump(nx);
+    return 0;
+}
+
+// The oldest open query is answered (or has failed)
+static inline void nx_complete(struct nextion *nx, struct nx_result *r) {
+    struct nx_query q = nx->q[nx->head % NX_QUEUE];
+    nx->head++;
+    nx->bytes_in_flight -= q.len;
+    r->rtt_ns = nx_now_ns() - q.sent_ns;
+    if (r->status == NX_TIMEOUT) nx->timeouts++;
+    else {
+        tm_record(q.kind == NX_ADDT ? &nx_addt_us : &nx_rtt_us, r->rtt_ns / 1000);
+        if (r->status == NX_ERR) nx->errors++;
+        else nx->done++;
+    }
+    if (q.cb) q.cb(q.arg, q.expr, r);
+}
+
+static inline int nx_is_error(unsigned char c) {
+    // Invalid instruction, component, page, picture, font, baud, variable, operation, ...
+    return c == 0x00 || c == 0x02 || c == 0x03 || c == 0x04 || c == 0x05 || c == 0x11 ||
+           (c >= 0x1A && c <= 0x1C) || c == 0x1E || c == 0x1F || c == 0x20 || c == 0x23 || c == 0x24;
+}
+
+static inline void nx_frame_done(struct nextion *nx) {
+    struct nx_result r = { 0 };
+    int body = nx->flen - 3;            // less the ff ff ff
+    struct nx_query *q = &nx->q[nx->head % NX_QUEUE];
+    if (nx->head != nx->sent && q->kind == NX_ADDT && nx->frame == 0xFE && !q->stage) {
+        // Ready for the samples
+        nx->frame = 0;
+        if (write(nx->fd, q->data, q->ndata) != q->ndata) fprintf(stderr, "nextion: write: %s\n", strerror(errno));
+        q->stage = 1;
+        q->deadline_ns = nx_now_ns() + nx->timeout_ns + (uint64_t)q->ndata * nx->byte_ns;
+        return;
+    }
+    if (nx->frame == 0xFD) {
+        r.status = q->kind == NX_ADDT && q->stage ? NX_DONE : NX_ERR;
+        r.code = -1;
+    } else if (nx->frame == 0xFE) {
+        r.status = NX_ERR;
+        r.code = -1;
+    } else if (nx->frame == 0x71) {
+        if (body != 5) { r.status = NX_ERR; r.code = -1; }
+        else {
+            r.status = NX_NUM;
+            r.num = (int32_t)((uint32_t)nx->fbuf[1] | (uint32_t)nx->fbuf[2] << 8 | (uint32_t)nx->fbuf[3] << 16 |
+                              (uint32_t)nx->fbuf[4] << 24);
+        }
+    } else if (nx->frame == 0x70) {
+        int len = body - 1 > NX_STR_MAX ? NX_STR_MAX : body - 1;
+        memmove(nx->fbuf, nx->fbuf + 1, len);
+        nx->fbuf[len] = 0;
+        r.status = NX_STR;
+        r.str = (const char *)nx->fbuf;
+    } else {
+        r.status = NX_ERR;
+        r.code = nx->frame;
+    }
+    nx->frame = 0;
+    if (nx->head == nx->sent || nx_now_ns() < nx->discard_until) nx->dropped++;
+    else nx_complete(nx, &r);
+}
+
+// Bytes read from the UART
+static inline void nx_input(struct nextion *nx, const unsigned char *buf, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = buf[i];
+        if (!nx->frame) {
+            int open = nx->head != nx->sent || nx_now_ns() < nx->discard_until;
+            if (open && (c == 0x70 || c == 0x71 || c == 0xFE || c == 0xFD || nx_is_error(c))) {
+                nx->frame = c;
+                nx->fbuf[0] = c;
+                nx->flen = 1;
+                nx->ffs = 0;
+            } else if (nx->raw_cb) {
+                nx->raw_cb(nx->raw_arg, c);
+            }
+            continue;
+        }
+        // A 0x71 body may contain ff bytes: its length is fixed, so only count the terminator after it
+        if (nx->flen < (int)sizeof(nx->fbuf)) nx->fbuf[nx->flen] = c;
+        nx->flen++;
+        int in_body = nx->frame == 0x71 && nx->flen <= 5;
+        nx->ffs = !in_body && c == 0xff ? nx->ffs + 1 : 0;
+        if (nx->ffs == 3) {
+            if (nx->flen > (int)sizeof(nx->fbuf)) nx->flen = sizeof(nx->fbuf);
+            nx_frame_done(nx);
+        } else if (nx->flen > (int)sizeof(nx->fbuf) + 256) {
+            nx->frame = 0;              // no terminator: give up on it
+            nx->dropped++;
+        }
+    }
+    nx_pump(nx);
+}
+
+// poll() timeout until the oldest open query expires, -1 if none is open
+static inline int nx_timeout_ms(const struct nextion *nx) {
+    uint64_t now = nx_now_ns(), t;
+    if (nx->discard_until > now) t = nx->discard_until;
+    else if (nx->head != nx->sent) t = nx->q[nx->head % NX_QUEUE].deadline_ns;
+    else return -1;
+    return t > now ? (int)((t - now + 999999) / 1000000) : 0;
+}
+
+// Fail timed-out queries, resume sending after the discard period
+static inline void nx_expire(struct nextion *nx) {
+    uint64_t now = nx_now_ns();
+    if (nx->head != nx->sent && now >= nx->q[nx->head % NX_QUEUE].deadline_ns) {
+        nx->discard_until = now + nx->timeout_ns;
+        nx->frame = 0;
+        while (nx->head != nx->sent) {
+            struct nx_result r = { NX_TIMEOUT, 0, 0, NULL, 0 };
+            nx_complete(nx, &r);
+        }
+    }
+    nx_pump(nx);
+}
+
+static inline void nx_print(const struct nextion *nx) {
+    printf("Nextion: %llu answered, %llu errors, %llu timeouts, %llu stray answers, %llu refused (queue full), window %d\n",
+           (unsigned long long)nx->done, (unsigned long long)nx->errors, (unsigned long long)nx->timeouts,
+           (unsigned long long)nx->dropped, (unsigned long long)nx->full, nx->window);
+}
+
+// --- Waveform publisher ---
+
+struct nx_wave {
+    struct nextion *nx;
+    int id, nch;
+    double pps;                         // chart points per second per channel, after the budget cut
+    uint64_t bin_ns, bin_end, next_flush;
+    double full[NX_WAVE_CH];            // value at the top of the chart (255)
+    int use_max[NX_WAVE_CH];            // bin = maximum (latency) instead of mean (rates)
+    double acc[NX_WAVE_CH];
+    int nacc[NX_WAVE_CH];
+    uint8_t last[NX_WAVE_CH];           // repeated for empty bins
+
+    uint8_t pend[NX_WAVE_CH][NX_ADDT_MAX];
+    int npend[NX_WAVE_CH];
+    uint8_t out[NX_ADDT_MAX];           // the addt in flight
+    int busy, flush_ch;                 // addt open; next channel of this flush, nch = none
+
+    uint64_t samples, points, sent, transfers, lost, failed;
+};
+
+// Points per second each of nch channels may have: NX_WAVE_SHARE of the link
+// less the addt commands ("addt id,ch,nnnn" + ff ff ff) of every flush
+static inline double nx_wave_budget(int nch, int baud) {
+    double bytes_s = baud / 10.0 * NX_WAVE_SHARE, cmds_s = nch * 1000.0 / NX_WAVE_FLUSH_MS * 20;
+    return bytes_s > cmds_s ? (bytes_s - cmds_s) / nch : 0;
+}
+
+// (Re)configure; points already binned are kept
+static inline void nx_wave_rate(struct nx_wave *wv, double pps, int baud) {
+    double budget = nx_wave_budget(wv->nch, baud);
+    wv->pps = pps < budget ? pps : budget;
+    if (wv->pps < 0.1) wv->pps = 0.1;
+    wv->bin_ns = (uint64_t)(1e9 / wv->pps);
+}
+
+static inline void nx_wave_init(struct nx_wave *wv, struct nextion *nx, int id, int nch, double pps, int baud) {
+    memset(wv, 0, sizeof(*wv));
+    wv->nx = nx;
+    wv->id = id;
+    wv->nch = nch < 1 ? 1 : nch > NX_WAVE_CH ? NX_WAVE_CH : nch;
+    for (int c = 0; c < NX_WAVE_CH; c++) wv->full[c] = 255;
+    nx_wave_rate(wv, pps, baud);
+    wv->bin_end = nx_now_ns() + wv->bin_ns;
+    wv->next_flush = nx_now_ns() + NX_WAVE_FLUSH_MS * 1000000ull;
+    wv->flush_ch = wv->nch;
+}
+
+static inline void nx_wave_scale(struct nx_wave *wv, int ch, double full, int use_max) {
+    if (ch < 0 || ch >= wv->nch) return;
+    wv->full[ch] = full > 0 ? full : 1;
+    wv->use_max[ch] = use_max;
+}
+
+static inline void nx_wave_sample(struct nx_wave *wv, int ch, double v) {
+    if (ch < 0 || ch >= wv->nch) return;
+    wv->samples++;
+    if (!wv->nacc[ch]) wv->acc[ch] = v;
+    else if (!wv->use_max[ch]) wv->acc[ch] += v;
+    else if (v > wv->acc[ch]) wv->acc[ch] = v;
+    wv->nacc[ch]++;
+}
+
+// One point per channel for the bin that just ended
+static inline void nx_wave_bin(struct nx_wave *wv) {
+    for (int c = 0; c < wv->nch; c++) {
+        if (wv->nacc[c]) {
+            double v = wv->use_max[c] ? wv->acc[c] : wv->acc[c] / wv->nacc[c];
+            v = v / wv->full[c] * 255 + 0.5;
+            wv->last[c] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+            wv->nacc[c] = 0;
+        }
+        if (wv->npend[c] == NX_ADDT_MAX) {
+            // The link is not keeping up: the oldest point goes
+            memmove(wv->pend[c], wv->pend[c] + 1, NX_ADDT_MAX - 1);
+            wv->npend[c]--;
+            wv->lost++;
+        }
+        wv->pend[c][wv->npend[c]++] = wv->last[c];
+        wv->points++;
+    }
+}
+
+static inline void nx_wave_send(struct nx_wave *wv);
+
+static inline void nx_wave_done(void *arg, const char *expr, const struct nx_result *r) {
+    struct nx_wave *wv = arg;
+    (void)expr;
+    wv->busy = 0;
+    if (r->status != NX_DONE) wv->failed++;
+    nx_wave_send(wv);
+}
+
+// Next channel of the current flush with points waiting
+static inline void nx_wave_send(struct nx_wave *wv) {
+    while (!wv->busy && wv->flush_ch < wv->nch) {
+        int c = wv->flush_ch++, n = wv->npend[c];
+        if (!n) continue;
+        memcpy(wv->out, wv->pend[c], n);
+        if (nx_addt(wv->nx, wv->id, c, wv->out, n, nx_wave_done, wv) != 0) return;    // queue full: next flush
+        wv->npend[c] = 0;
+        wv->sent += n;
+        wv->transfers++;
+        wv->busy = 1;
+    }
+}
+
+// From the event loop: close finished bins, start a flush when it is time
+static inline void nx_wave_tick(struct nx_wave *wv) {
+    uint64_t now = nx_now_ns();
+    for (int k = 0; now >= wv->bin_end && k < NX_ADDT_MAX; k++) {
+        nx_wave_bin(wv);
+        wv->bin_end += wv->bin_ns;
+    }
+    if (now >= wv->bin_end) wv->bin_end = now + wv->bin_ns;     // stalled for more than a whole chart
+    if (now >= wv->next_flush) {
+        wv->next_flush = now + NX_WAVE_FLUSH_MS * 1000000ull;
+        if (wv->flush_ch >= wv->nch && !wv->busy) {
+            wv->flush_ch = 0;
+            nx_wave_send(wv);
+        }
+    }
+}
+
+static inline int nx_wave_timeout_ms(const struct nx_wave *wv) {
+    uint64_t now = nx_now_ns(), t = wv->bin_end < wv->next_flush ? wv->bin_end : wv->next_flush;
+    return t > now ? (int)((t - now + 999999) / 1000000) : 0;
+}
+
+static inline void nx_wave_print(const struct nx_wave *wv) {
+    printf("Chart %d: %d channels at %.1f points/s, %llu samples -> %llu points, %llu sent, %llu lost, %llu addt failed\n", wv->id,
+           wv->nch, wv->pps, (unsigned long long)wv->samples, (unsigned long long)wv->points, (unsigned long long)wv->sent,
+           (unsigned long long)wv->lost, (unsigned long long)wv->failed);
+}
+
+// --- Chart samples from other processes: "ch value" datagrams ---
+
+static inline void nx_chart_addr(struct sockaddr_un *a) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    snprintf(a->sun_path, sizeof(a->sun_path), "%s", NX_CHART_SOCK);
+}
+
+// The UART owner's end, -1 if it cannot be bound
+static inline int nx_chart_listen(void) {
+    struct sockaddr_un a;
+    nx_chart_addr(&a);
+    int s = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (s < 0) return -1;
+    unlink(a.sun_path);
+    if (bind(s, (struct sockaddr *)&a, sizeof(a)) != 0) {
+        fprintf(stderr, "nextion: cannot bind %s: %s (no chart samples)\n", a.sun_path, strerror(errno));
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// Producer: fd from socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0). Dropped
+// if nobody is listening or the receiver is behind
+static inline void nx_chart_send(int fd, int ch, double v) {
+    struct sockaddr_un a;
+    char msg[48];
+    nx_chart_addr(&a);
+    int n = snprintf(msg, sizeof(msg), "%d %.3f", ch, v);
+    if (sendto(fd, msg, n, MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&a, sizeof(a)) < 0) {}
+}
+
+// Everything waiting on the listening socket into the chart
+static inline void nx_chart_recv(int s, struct nx_wave *wv) {
+    char msg[64];
+    ssize_t n;
+    while ((n = recv(s, msg, sizeof(msg) - 1, MSG_DONTWAIT)) > 0) {
+        int ch;
+        double v;
+        msg[n] = 0;
+        if (wv && sscanf(msg, "%d %lf", &ch, &v) == 2) nx_wave_sample(wv, ch, v);
+    }
+}
+
+#endif // NEXTION_H
@@ -0,0 +1,836 @@
+// pixfmt.h - Pixel format conversion for V4L2 capture buffers
+//
+// Conversions are looked up in a dispatch table keyed by (source fourcc,
+// destination format). Every kernel works on a band of rows so a frame can be
+// split across the harts by a small persistent worker pool.
+//
+// The U54 harts on the PolarFire SoC have no vector unit, so the kernels are
+// fixed-point and table driven (libjpeg style) instead of SIMD, and each one
+// handles a whole chroma pair per iteration.
+//
+// Usage:
+//   struct pixfmt_ctx ctx;
+//   pixfmt_init(&ctx, 4);                       // 4 harts
+//   pixfmt_calibrate(&ctx, WIDTH, HEIGHT);      // measure kernel costs, size line buffers
+//   pixfmt_negotiate(&ctx, fd, PIXFMT_DST_RGB24, &fmt);  // pick + S_FMT
+//   pixfmt_convert(&ctx, fourcc, PIXFMT_DST_RGB24, src, stride, dst, w, h);
+//   pixfmt_destroy(&ctx);
+//
+// Build with -lpthread.
+
+#ifndef PIXFMT_H
+#define PIXFMT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#define PIXFMT_MAX_THREADS 8
+#define PIXFMT_SERIAL_MAX_WIDTH 4096    // Bayer line buffers of pixfmt_convert_serial() live on the stack
+
+// Destination formats
+enum pixfmt_dst {
+    PIXFMT_DST_RGB24 = 0,   // interleaved R,G,B (JPEG encoder input)
+    PIXFMT_DST_TENSOR,      // planar R,G,B (CHW, model input)
+    PIXFMT_DST_GREY,        // 8-bit luma
+    PIXFMT_DST_COUNT
+};
+
+// Raw Bayer correction: black level and white balance are folded into
+// per-channel lookup tables, so they cost nothing on top of the demosaic.
+// GREY output uses a second set without the white balance, like the other
+// sources' luma.
+struct pixfmt_bayer {
+    int black;              // black level in 8-bit units (scaled x4 for 10-bit)
+    int gain[3];            // R, G, B gains, Q8 (256 = 1.0)
+    uint8_t lut8[3][256];
+    uint8_t lut10[3][1024];
+    uint8_t luma8[3][256];
+    uint8_t luma10[3][1024];
+};
+
+// Per-channel gain/offset (white balance, illumination normalization).
+// The kernels already finish every channel with a clamp-table lookup, so the
+// correction is folded into those tables and costs nothing per pixel.
+// lut[c][v + 256] maps an unclamped channel value v in -256..511 to the output.
+struct pixfmt_wb {
+    int gain[3];            // R, G, B, Q8 (256 = 1.0)
+    int offset[3];          // added after the gain, 8-bit units
+    int identity;
+    uint8_t lut[3][768];
+};
+
+#define PIXFMT_HALF 1       // pixfmt_convert_ex flag: Bayer 2x2 -> 1 RGB pixel
+
+struct pixfmt_job {
+    const uint8_t *src;
+    int stride;             // source bytes per line (plane 0)
+    uint8_t *dst;
+    int width, height;      // source size
+    int half;               // output is width/2 x height/2 (Bayer only)
+    const struct pixfmt_bayer *bayer;
+    const struct pixfmt_wb *wb;
+    uint8_t *line;          // PIXFMT_LINE_BYTES(width) of scratch, owned by the thread running the band
+};
+
+// Three demosaic lines with a mirrored pixel on either side
+#define PIXFMT_LINE_BYTES(width) (3 * ((size_t)(width) + 2))
+
+// Converts rows [y0, y1) of the job. y0/y1 are always even.
+typedef void (*pixfmt_kernel)(const struct pixfmt_job *job, int y0, int y1);
+
+struct pixfmt_ctx;
+struct pixfmt_worker_arg {
+    struct pixfmt_ctx *ctx;
+    int idx;
+    uint8_t *line;          // this hart's pixfmt_job.line
+};
+
+struct pixfmt_ctx {
+    int nthreads;
+    pthread_t threads[PIXFMT_MAX_THREADS];
+    struct pixfmt_worker_arg args[PIXFMT_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv, done_cv;
+    unsigned generation;
+    int pending;
+    int quit;
+    pixfmt_kernel kernel;
+    struct pixfmt_job job;
+    struct pixfmt_bayer bayer;
+    struct pixfmt_wb wb;
+    double cost_ns[PIXFMT_DST_COUNT][32];   // measured ns/pixel, per table entry
+    int line_width;                         // args[].line hold PIXFMT_LINE_BYTES(line_width)
+};
+
+/* --- FIXED-POINT TABLES --- */
+
+// BT.601 full range (same coefficients as the original yuyv_to_rgb), Q16.
+#define PIXFMT_FIX(x) ((int)((x) * 65536.0 + 0.5))
+
+static int16_t pixfmt_cr_r[256], pixfmt_cb_b[256];
+static int32_t pixfmt_cr_g[256], pixfmt_cb_g[256];
+// Clamp table indexed by value + 256, covers -256..511
+static uint8_t pixfmt_clamp_tab[768];
+static int pixfmt_tables_ready = 0;
+
+static inline void pixfmt_build_tables(void) {
+    if (pixfmt_tables_ready) return;
+    for (int i = 0; i < 256; i++) {
+        int c = i - 128;
+        pixfmt_cr_r[i] = (int16_t)((PIXFMT_FIX(1.402) * c + 32768) >> 16);
+        pixfmt_cb_b[i] = (int16_t)((PIXFMT_FIX(1.772) * c + 32768) >> 16);
+        pixfmt_cr_g[i] = -PIXFMT_FIX(0.714136) * c;
+        pixfmt_cb_g[i] = -PIXFMT_FIX(0.344136) * c + 32768;
+    }
+    for (int i = 0; i < 768; i++) {
+        int v = i - 256;
+        pixfmt_clamp_tab[i] = (v < 0) ? 0 : ((v > 255) ? 255 : (uint8_t)v);
+    }
+    pixfmt_tables_ready = 1;
+}
+
+#define PIXFMT_CLAMP(v) pixfmt_clamp_tab[(v) + 256]
+
+static inline void pixfmt_wb_build(struct pixfmt_wb *wb) {
+    wb->identity = 1;
+    for (int c = 0; c < 3; c++) {
+        if (wb->gain[c] != 256 || wb->offset[c] != 0) wb->identity = 0;
+        for (int i = 0; i < 768; i++) {
+            int v = i - 256;
+            v = PIXFMT_CLAMP(v);
+            v = ((v * wb->gain[c] + 128) >> 8) + wb->offset[c];
+            wb->lut[c][i] = (v < 0) ? 0 : ((v > 255) ? 255 : (uint8_t)v);
+        }
+    }
+}
+
+// Per-channel output tables, offset so they can be indexed with -256..511
+#define PIXFMT_WB_LUTS(j) \
+    const uint8_t *lr = (j)->wb->lut[0] + 256, *lg = (j)->wb->lut[1] + 256, *lb = (j)->wb->lut[2] + 256
+
+/* --- DESTINATION ROW POINTERS --- */
+
+// RGB24 and TENSOR only differ in where R/G/B land, so YUV kernels write
+// through three channel pointers and a step.
+struct pixfmt_rgb_row { uint8_t *r, *g, *b; int step; };
+
+static inline struct pixfmt_rgb_row pixfmt_row(uint8_t *dst, int width, int height, int planar, int y) {
+    struct pixfmt_rgb_row o;
+    if (planar) {
+        size_t plane = (size_t)width * height;
+        o.r = dst + (size_t)y * width;
+        o.g = o.r + plane;
+        o.b = o.g + plane;
+        o.step = 1;
+    } else {
+        o.r = dst + (size_t)y * width * 3;
+        o.g = o.r + 1;
+        o.b = o.r + 2;
+        o.step = 3;
+    }
+    return o;
+}
+
+// Two pixels sharing one chroma pair; needs PIXFMT_WB_LUTS in scope
+#define PIXFMT_PUT2(o, x, y0v, y1v, u, v) do {                     \
+        int cr_ = pixfmt_cr_r[v], cb_ = pixfmt_cb_b[u];             \
+        int cg_ = (pixfmt_cb_g[u] + pixfmt_cr_g[v]) >> 16;          \
+        int k_ = (x) * (o).step;                                    \
+        (o).r[k_] = lr[(y0v) + cr_];                                \
+        (o).g[k_] = lg[(y0v) + cg_];                                \
+        (o).b[k_] = lb[(y0v) + cb_];                                \
+        k_ += (o).step;                                             \
+        (o).r[k_] = lr[(y1v) + cr_];                                \
+        (o).g[k_] = lg[(y1v) + cg_];                                \
+        (o).b[k_] = lb[(y1v) + cb_];                                \
+    } while (0)
+
+/* --- KERNELS --- */
+
+// Packed 4:2:2 (YUYV, UYVY, YVYU). Offsets are byte positions in a macropixel.
+#define PIXFMT_PACKED422(name, OY0, OU, OY1, OV)                               \
+static void name##_rgb_common(const struct pixfmt_job *j, int y0, int y1, int planar) { \
+    PIXFMT_WB_LUTS(j);                                                         \
+    for (int y = y0; y < y1; y++) {                                            \
+        const uint8_t *s = j->src + (size_t)y * j->stride;                     \
+        struct pixfmt_rgb_row o = pixfmt_row(j->dst, j->width, j->height, planar, y); \
+        for (int x = 0; x < j->width; x += 2, s += 4)                          \
+            PIXFMT_PUT2(o, x, s[OY0], s[OY1], s[OU], s[OV]);                   \
+    }                                                                          \
+}                                                                              \
+static void name##_rgb(const struct pixfmt_job *j, int y0, int y1) {           \
+    name##_rgb_common(j, y0, y1, 0);                                           \
+}                                                                              \
+static void name##_tensor(const struct pixfmt_job *j, int y0, int y1) {        \
+    name##_rgb_common(j, y0, y1, 1);                                           \
+}                                                                              \
+static void name##_grey(const struct pixfmt_job *j, int y0, int y1) {          \
+    for (int y = y0; y < y1; y++) {                                            \
+        const uint8_t *s = j->src + (size_t)y * j->stride;                     \
+        uint8_t *d = j->dst + (size_t)y * j->width;                            \
+        for (int x = 0; x < j->width; x += 2, s += 4) {                        \
+            d[x] = s[OY0];                                                     \
+            d[x + 1] = s[OY1];                                                 \
+        }                                                                      \
+    }                                                                          \
+}
+
+PIXFMT_PACKED422(pixfmt_yuyv, 0, 1, 2, 3)
+PIXFMT_PACKED422(pixfmt_uyvy, 1, 0, 3, 2)
+PIXFMT_PACKED422(pixfmt_yvyu, 0, 3, 2, 1)
+
+// Semi-planar NV12 (4:2:0) and NV16 (4:2:2): Y plane then interleaved CbCr.
+// chroma_shift is 1 for NV12 (one chroma row per two luma rows), 0 for NV16.
+static void pixfmt_nv_common(const struct pixfmt_job *j, int y0, int y1, int planar, int chroma_shift) {
+    const uint8_t *uv_plane = j->src + (size_t)j->stride * j->height;
+    PIXFMT_WB_LUTS(j);
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *s = j->src + (size_t)y * j->stride;
+        const uint8_t *c = uv_plane + (size_t)(y >> chroma_shift) * j->stride;
+        struct pixfmt_rgb_row o = pixfmt_row(j->dst, j->width, j->height, planar, y);
+        for (int x = 0; x < j->width; x += 2)
+            PIXFMT_PUT2(o, x, s[x], s[x + 1], c[x], c[x + 1]);
+    }
+}
+
+static void pixfmt_nv12_rgb(const struct pixfmt_job *j, int y0, int y1)    { pixfmt_nv_common(j, y0, y1, 0, 1); }
+static void pixfmt_nv12_tensor(const struct pixfmt_job *j, int y0, int y1) { pixfmt_nv_common(j, y0, y1, 1, 1); }
+static void pixfmt_nv16_rgb(const struct pixfmt_job *j, int y0, int y1)    { pixfmt_nv_common(j, y0, y1, 0, 0); }
+static void pixfmt_nv16_tensor(const struct pixfmt_job *j, int y0, int y1) { pixfmt_nv_common(j, y0, y1, 1, 0); }
+
+// NV12/NV16/GREY to grey is a copy of the luma plane
+static void pixfmt_luma_grey(const struct pixfmt_job *j, int y0, int y1) {
+    for (int y = y0; y < y1; y++)
+        memcpy(j->dst + (size_t)y * j->width, j->src + (size_t)y * j->stride, j->width);
+}
+
+// Packed 24-bit RGB/BGR. swap selects BGR input.
+static void pixfmt_rgb24_common(const struct pixfmt_job *j, int y0, int y1, int planar, int swap) {
+    PIXFMT_WB_LUTS(j);
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *s = j->src + (size_t)y * j->stride;
+        if (!planar && !swap && j->wb->identity) {
+            memcpy(j->dst + (size_t)y * j->width * 3, s, (size_t)j->width * 3);
+            continue;
+        }
+        struct pixfmt_rgb_row o = pixfmt_row(j->dst, j->width, j->height, planar, y);
+        int ri = swap ? 2 : 0, bi = swap ? 0 : 2;
+        for (int x = 0, k = 0; x < j->width; x++, s += 3, k += o.step) {
+            o.r[k] = lr[s[ri]];
+            o.g[k] = lg[s[1]];
+            o.b[k] = lb[s[bi]];
+        }
+    }
+}
+
+static void pixfmt_rgb24_grey_common(const struct pixfmt_job *j, int y0, int y1, int swap) {
+    int ri = swap ? 2 : 0, bi = swap ? 0 : 2;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *s = j->src + (size_t)y * j->stride;
+        uint8_t *d = j->dst + (size_t)y * j->width;
+        for (int x = 0; x < j->width; x++, s += 3)
+            d[x] = (uint8_t)((77 * s[ri] + 150 * s[1] + 29 * s[bi] + 128) >> 8);
+    }
+}
+
+static void pixfmt_rgb24_rgb(const struct pixfmt_job *j, int y0, int y1)    { pixfmt_rgb24_common(j, y0, y1, 0, 0); }
+static void pixfmt_rgb24_tensor(const struct pixfmt_job *j, int y0, int y1) { pixfmt_rgb24_common(j, y0, y1, 1, 0); }
+static void pixfmt_rgb24_grey(const struct pixfmt_job *j, int y0, int y1)   { pixfmt_rgb24_grey_common(j, y0, y1, 0); }
+static void pixfmt_bgr24_rgb(const struct pixfmt_job *j, int y0, int y1)    { pixfmt_rgb24_common(j, y0, y1, 0, 1); }
+static void pixfmt_bgr24_tensor(const struct pixfmt_job *j, int y0, int y1) { pixfmt_rgb24_common(j, y0, y1, 1, 1); }
+static void pixfmt_bgr24_grey(const struct pixfmt_job *j, int y0, int y1)   { pixfmt_rgb24_grey_common(j, y0, y1, 1); }
+
+// GREY to RGB/tensor replicates luma
+static void pixfmt_grey_common(const struct pixfmt_job *j, int y0, int y1, int planar) {
+    PIXFMT_WB_LUTS(j);
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *s = j->src + (size_t)y * j->stride;
+        struct pixfmt_rgb_row o = pixfmt_row(j->dst, j->width, j->height, planar, y);
+        for (int x = 0, k = 0; x < j->width; x++, k += o.step) {
+            o.r[k] = lr[s[x]];
+            o.g[k] = lg[s[x]];
+            o.b[k] = lb[s[x]];
+        }
+    }
+}
+
+static void pixfmt_grey_rgb(const struct pixfmt_job *j, int y0, int y1)    { pixfmt_grey_common(j, y0, y1, 0); }
+static void pixfmt_grey_tensor(const struct pixfmt_job *j, int y0, int y1) { pixfmt_grey_common(j, y0, y1, 1); }
+
+/* --- RAW BAYER --- */
+
+// The CFA pattern is described by where red sits in the 2x2 tile (rx, ry);
+// blue is on the opposite diagonal and green fills the rest.
+enum { PIXFMT_SITE_R, PIXFMT_SITE_GR, PIXFMT_SITE_GB, PIXFMT_SITE_B };
+
+// The white balance / illumination tables (wb) are composed in as well.
+// Both are per-channel affine maps and bilinear interpolation is linear, so
+// applying them before the demosaic gives the same result as after.
+static inline void pixfmt_bayer_build_luts(struct pixfmt_bayer *b, const struct pixfmt_wb *wb) {
+    for (int c = 0; c < 3; c++) {
+        const uint8_t *out = wb->lut[c] + 256;
+        int black = b->black, range = 255 - b->black;
+        for (int v = 0; v < 256; v++) {
+            int o = (v <= black || range <= 0) ? 0 : ((v - black) * 255 * b->gain[c] / range) >> 8;
+            b->luma8[c][v] = (o > 255) ? 255 : o;
+            b->lut8[c][v] = out[b->luma8[c][v]];
+        }
+        black *= 4;
+        range = 1023 - black;
+        for (int v = 0; v < 1024; v++) {
+            int o = (v <= black || range <= 0) ? 0 : ((v - black) * 255 * b->gain[c] / range) >> 8;
+            b->luma10[c][v] = (o > 255) ? 255 : o;
+            b->lut10[c][v] = out[b->luma10[c][v]];
+        }
+    }
+}
+
+// Load one raw row through the correction LUTs (the luma ones for GREY) into
+// line[1..width], with the neighbours mirrored into line[0] and line[width+1]
+// (mirroring by 2 keeps the CFA phase). Rows outside the frame are mirrored
+// the same way.
+static inline void pixfmt_bayer_line(const struct pixfmt_job *j, int y, int rx, int ry, int bits, int grey, uint8_t *line) {
+    const struct pixfmt_bayer *b = j->bayer;
+    int w = j->width;
+    if (y < 0) y = 1;
+    if (y >= j->height) y = j->height - 2;
+
+    // Red rows hold R on column parity rx and G elsewhere; blue rows hold G
+    // on parity rx and B elsewhere.
+    int red_row = ((y & 1) == ry);
+    int c_at = red_row ? 0 : 1, c_other = red_row ? 1 : 2;
+    int ce = (rx == 0) ? c_at : c_other;
+    int co = (rx == 1) ? c_at : c_other;
+
+    uint8_t *d = line + 1;
+    if (bits == 8) {
+        const uint8_t *s = j->src + (size_t)y * j->stride;
+        const uint8_t *le = grey ? b->luma8[ce] : b->lut8[ce], *lo = grey ? b->luma8[co] : b->lut8[co];
+        for (int x = 0; x < w; x += 2) {
+            d[x] = le[s[x]];
+            d[x + 1] = lo[s[x + 1]];
+        }
+    } else {
+        const uint16_t *s = (const uint16_t *)(j->src + (size_t)y * j->stride);
+        const uint8_t *le = grey ? b->luma10[ce] : b->lut10[ce], *lo = grey ? b->luma10[co] : b->lut10[co];
+        for (int x = 0; x < w; x += 2) {
+            d[x] = le[s[x] & 0x3ff];
+            d[x + 1] = lo[s[x + 1] & 0x3ff];
+        }
+    }
+    line[0] = d[1];
+    line[w + 1] = d[w - 2];
+}
+
+// Bilinear interpolation at column x (line pointers already offset by 1)
+static inline void pixfmt_bayer_px(const uint8_t *p, const uint8_t *c, const uint8_t *n,
+                                   int x, int site, int *r, int *g, int *b) {
+    int cross = (c[x - 1] + c[x + 1] + p[x] + n[x] + 2) >> 2;
+    int diag = (p[x - 1] + p[x + 1] + n[x - 1] + n[x + 1] + 2) >> 2;
+    int horiz = (c[x - 1] + c[x + 1] + 1) >> 1;
+    int vert = (p[x] + n[x] + 1) >> 1;
+    switch (site) {
+        case PIXFMT_SITE_R:  *r = c[x]; *g = cross; *b = diag; break;
+        case PIXFMT_SITE_GR: *r = horiz; *g = c[x]; *b = vert; break;
+        case PIXFMT_SITE_GB: *r = vert; *g = c[x]; *b = horiz; break;
+        default:             *r = diag; *g = cross; *b = c[x]; break;
+    }
+}
+
+static inline void pixfmt_store(uint8_t *grey_row, struct pixfmt_rgb_row *o, int x, int r, int g, int b) {
+    if (grey_row) {
+        grey_row[x] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+    } else {
+        int k = x * o->step;
+        o->r[k] = (uint8_t)r;
+        o->g[k] = (uint8_t)g;
+        o->b[k] = (uint8_t)b;
+    }
+}
+
+// Half resolution: each 2x2 tile becomes one pixel, greens averaged
+static void pixfmt_bayer_half(const struct pixfmt_job *j, int y0, int y1, int dst, int rx, int ry, int bits) {
+    const struct pixfmt_bayer *b = j->bayer;
+    const uint8_t (*l8)[256] = dst == PIXFMT_DST_GREY ? b->luma8 : b->lut8;
+    const uint8_t (*l10)[1024] = dst == PIXFMT_DST_GREY ? b->luma10 : b->lut10;
+    int ow = j->width / 2, oh = j->height / 2;
+    for (int y = y0; y + 1 < y1; y += 2) {
+        const uint8_t *s0 = j->src + (size_t)y * j->stride, *s1 = s0 + j->stride;
+        const uint8_t *rr = ry ? s1 : s0, *br = ry ? s0 : s1;   // red / blue rows
+        int oy = y / 2;
+        struct pixfmt_rgb_row o = pixfmt_row(j->dst, ow, oh, dst == PIXFMT_DST_TENSOR, oy);
+        uint8_t *grey = (dst == PIXFMT_DST_GREY) ? j->dst + (size_t)oy * ow : NULL;
+        for (int x = 0; x < ow; x++) {
+            int xr = 2 * x + rx, xb = 2 * x + 1 - rx;
+            int r, g, bl;
+            if (bits == 8) {
+                r = l8[0][rr[xr]];
+                g = (l8[1][rr[xb]] + l8[1][br[xr]] + 1) >> 1;
+                bl = l8[2][br[xb]];
+            } else {
+                const uint16_t *r16 = (const uint16_t *)rr, *b16 = (const uint16_t *)br;
+                r = l10[0][r16[xr] & 0x3ff];
+                g = (l10[1][r16[xb] & 0x3ff] + l10[1][b16[xr] & 0x3ff] + 1) >> 1;
+                bl = l10[2][b16[xb] & 0x3ff];
+            }
+            pixfmt_store(grey, &o, x, r, g, bl);
+        }
+    }
+}
+
+static void pixfmt_bayer_common(const struct pixfmt_job *j, int y0, int y1, int dst, int rx, int ry, int bits) {
+    if (j->half) { pixfmt_bayer_half(j, y0, y1, dst, rx, ry, bits); return; }
+
+    int w = j->width;
+    uint8_t *p = j->line, *c = p + w + 2, *n = p + 2 * (w + 2);
+    int luma = dst == PIXFMT_DST_GREY;
+    pixfmt_bayer_line(j, y0 - 1, rx, ry, bits, luma, p);
+    pixfmt_bayer_line(j, y0, rx, ry, bits, luma, c);
+
+    for (int y = y0; y < y1; y++) {
+        pixfmt_bayer_line(j, y + 1, rx, ry, bits, luma, n);
+
+        int red_row = ((y & 1) == ry);
+        int s_at = red_row ? PIXFMT_SITE_R : PIXFMT_SITE_GB;     // site on column parity rx
+        int s_other = red_row ? PIXFMT_SITE_GR : PIXFMT_SITE_B;
+        int s0 = rx ? s_other : s_at, s1 = rx ? s_at : s_other;
+        struct pixfmt_rgb_row o = pixfmt_row(j->dst, w, j->height, dst == PIXFMT_DST_TENSOR, y);
+        uint8_t *grey = (dst == PIXFMT_DST_GREY) ? j->dst + (size_t)y * w : NULL;
+
+        for (int x = 0; x < w; x += 2) {
+            int r, g, b;
+            pixfmt_bayer_px(p + 1, c + 1, n + 1, x, s0, &r, &g, &b);
+            pixfmt_store(grey, &o, x, r, g, b);
+            pixfmt_bayer_px(p + 1, c + 1, n + 1, x + 1, s1, &r, &g, &b);
+            pixfmt_store(grey, &o, x + 1, r, g, b);
+        }
+
+        uint8_t *t = p; p = c; c = n; n = t;
+    }
+}
+
+#define PIXFMT_BAYER(name, RX, RY, BITS)                                                                               \
+static void name##_rgb(const struct pixfmt_job *j, int y0, int y1)    { pixfmt_bayer_common(j, y0, y1, PIXFMT_DST_RGB24, RX, RY, BITS); }  \
+static void name##_tensor(const struct pixfmt_job *j, int y0, int y1) { pixfmt_bayer_common(j, y0, y1, PIXFMT_DST_TENSOR, RX, RY, BITS); } \
+static void name##_grey(const struct pixfmt_job *j, int y0, int y1)   { pixfmt_bayer_common(j, y0, y1, PIXFMT_DST_GREY, RX, RY, BITS); }
+
+PIXFMT_BAYER(pixfmt_sbggr8,  1, 1, 8)
+PIXFMT_BAYER(pixfmt_sgbrg8,  0, 1, 8)
+PIXFMT_BAYER(pixfmt_sgrbg8,  1, 0, 8)
+PIXFMT_BAYER(pixfmt_srggb8,  0, 0, 8)
+PIXFMT_BAYER(pixfmt_sbggr10, 1, 1, 10)
+PIXFMT_BAYER(pixfmt_sgbrg10, 0, 1, 10)
+PIXFMT_BAYER(pixfmt_sgrbg10, 1, 0, 10)
+PIXFMT_BAYER(pixfmt_srggb10, 0, 0, 10)
+
+static inline int pixfmt_is_bayer(uint32_t fourcc) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_SBGGR8: case V4L2_PIX_FMT_SGBRG8: case V4L2_PIX_FMT_SGRBG8: case V4L2_PIX_FMT_SRGGB8:
+        case V4L2_PIX_FMT_SBGGR10: case V4L2_PIX_FMT_SGBRG10: case V4L2_PIX_FMT_SGRBG10: case V4L2_PIX_FMT_SRGGB10:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* --- DISPATCH TABLE --- */
+
+struct pixfmt_entry {
+    uint32_t fourcc;
+    const char *name;
+    int bpp_num, bpp_den;       // bytes per pixel of the whole frame (all planes)
+    pixfmt_kernel fn[PIXFMT_DST_COUNT];
+};
+
+static const struct pixfmt_entry pixfmt_table[] = {
+    { V4L2_PIX_FMT_YUYV,   "YUYV",  2, 1, { pixfmt_yuyv_rgb,  pixfmt_yuyv_tensor,  pixfmt_yuyv_grey  } },
+    { V4L2_PIX_FMT_UYVY,   "UYVY",  2, 1, { pixfmt_uyvy_rgb,  pixfmt_uyvy_tensor,  pixfmt_uyvy_grey  } },
+    { V4L2_PIX_FMT_YVYU,   "YVYU",  2, 1, { pixfmt_yvyu_rgb,  pixfmt_yvyu_tensor,  pixfmt_yvyu_grey  } },
+    { V4L2_PIX_FMT_NV12,   "NV12",  3, 2, { pixfmt_nv12_rgb,  pixfmt_nv12_tensor,  pixfmt_luma_grey  } },
+    { V4L2_PIX_FMT_NV16,   "NV16",  2, 1, { pixfmt_nv16_rgb,  pixfmt_nv16_tensor,  pixfmt_luma_grey  } },
+    { V4L2_PIX_FMT_RGB24,  "RGB24", 3, 1, { pixfmt_rgb24_rgb, pixfmt_rgb24_tensor, pixfmt_rgb24_grey } },
+    { V4L2_PIX_FMT_BGR24,  "BGR24", 3, 1, { pixfmt_bgr24_rgb, pixfmt_bgr24_tensor, pixfmt_bgr24_grey } },
+    { V4L2_PIX_FMT_GREY,   "GREY",  1, 1, { pixfmt_grey_rgb,  pixfmt_grey_tensor,  pixfmt_luma_grey  } },
+    { V4L2_PIX_FMT_SBGGR8,  "BA81", 1, 1, { pixfmt_sbggr8_rgb,  pixfmt_sbggr8_tensor,  pixfmt_sbggr8_grey  } },
+    { V4L2_PIX_FMT_SGBRG8,  "GBRG", 1, 1, { pixfmt_sgbrg8_rgb,  pixfmt_sgbrg8_tensor,  pixfmt_sgbrg8_grey  } },
+    { V4L2_PIX_FMT_SGRBG8,  "GRBG", 1, 1, { pixfmt_sgrbg8_rgb,  pixfmt_sgrbg8_tensor,  pixfmt_sgrbg8_grey  } },
+    { V4L2_PIX_FMT_SRGGB8,  "RGGB", 1, 1, { pixfmt_srggb8_rgb,  pixfmt_srggb8_tensor,  pixfmt_srggb8_grey  } },
+    { V4L2_PIX_FMT_SBGGR10, "BG10", 2, 1, { pixfmt_sbggr10_rgb, pixfmt_sbggr10_tensor, pixfmt_sbggr10_grey } },
+    { V4L2_PIX_FMT_SGBRG10, "GB10", 2, 1, { pixfmt_sgbrg10_rgb, pixfmt_sgbrg10_tensor, pixfmt_sgbrg10_grey } },
+    { V4L2_PIX_FMT_SGRBG10, "BA10", 2, 1, { pixfmt_sgrbg10_rgb, pixfmt_sgrbg10_tensor, pixfmt_sgrbg10_grey } },
+    { V4L2_PIX_FMT_SRGGB10, "RG10", 2, 1, { pixfmt_srggb10_rgb, pixfmt_srggb10_tensor, pixfmt_srggb10_grey } },
+};
+
+#define PIXFMT_TABLE_SIZE ((int)(sizeof(pixfmt_table) / sizeof(pixfmt_table[0])))
+
+static inline int pixfmt_find(uint32_t fourcc) {
+    for (int i = 0; i < PIXFMT_TABLE_SIZE; i++)
+        if (pixfmt_table[i].fourcc == fourcc) return i;
+    return -1;
+}
+
+static inline const char *pixfmt_name(uint32_t fourcc) {
+    int i = pixfmt_find(fourcc);
+    return (i < 0) ? "?" : pixfmt_table[i].name;
+}
+
+// Fourcc for a table name ("YUYV", "NV12", "BA81", ...), 0 if unknown
+static inline uint32_t pixfmt_from_name(const char *name) {
+    for (int i = 0; i < PIXFMT_TABLE_SIZE; i++)
+        if (strcmp(pixfmt_table[i].name, name) == 0) return pixfmt_table[i].fourcc;
+    return 0;
+}
+
+// Size of one tightly packed source frame, 0 if the format is unknown
+static inline size_t pixfmt_frame_size(uint32_t fourcc, int width, int height) {
+    int i = pixfmt_find(fourcc);
+    if (i < 0) return 0;
+    return (size_t)width * height * pixfmt_table[i].bpp_num / pixfmt_table[i].bpp_den;
+}
+
+// Bytes per line of plane 0 for a tightly packed frame
+static inline int pixfmt_min_stride(uint32_t fourcc, int width) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_NV12: case V4L2_PIX_FMT_NV16: case V4L2_PIX_FMT_GREY: return width;
+        case V4L2_PIX_FMT_RGB24: case V4L2_PIX_FMT_BGR24: return width * 3;
+        case V4L2_PIX_FMT_SBGGR8: case V4L2_PIX_FMT_SGBRG8:
+        case V4L2_PIX_FMT_SGRBG8: case V4L2_PIX_FMT_SRGGB8: return width;
+        default: return width * 2;     // 4:2:2 packed and 10-bit Bayer
+    }
+}
+
+static inline size_t pixfmt_dst_size(int dst, int width, int height) {
+    return (size_t)width * height * (dst == PIXFMT_DST_GREY ? 1 : 3);
+}
+
+/* --- WORKER POOL --- */
+
+// Rows handed to worker idx; bands stay even so 4:2:0 chroma rows are never split
+static inline void pixfmt_band(const struct pixfmt_ctx *ctx, int idx, int *y0, int *y1) {
+    int pairs = ctx->job.height / 2;
+    *y0 = 2 * (pairs * idx / ctx->nthreads);
+    *y1 = 2 * (pairs * (idx + 1) / ctx->nthreads);
+    if (idx == ctx->nthreads - 1) *y1 = ctx->job.height;
+}
+
+static void *pixfmt_worker(void *p) {
+    struct pixfmt_worker_arg *a = p;
+    struct pixfmt_ctx *ctx = a->ctx;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        while (!ctx->quit && ctx->generation == seen)
+            pthread_cond_wait(&ctx->start_cv, &ctx->lock);
+        if (ctx->quit) break;
+        seen = ctx->generation;
+        pthread_mutex_unlock(&ctx->lock);
+
+        int y0, y1;
+        struct pixfmt_job job = ctx->job;
+        job.line = a->line;
+        pixfmt_band(ctx, a->idx, &y0, &y1);
+        if (y1 > y0) ctx->kernel(&job, y0, y1);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (--ctx->pending == 0) pthread_cond_signal(&ctx->done_cv);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+// nthreads includes the calling thread; 1 means no workers are started
+static inline int pixfmt_init(struct pixfmt_ctx *ctx, int nthreads) {
+    memset(ctx, 0, sizeof(*ctx));
+    pixfmt_build_tables();
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > PIXFMT_MAX_THREADS) nthreads = PIXFMT_MAX_THREADS;
+    ctx->nthreads = nthreads;
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->start_cv, NULL);
+    pthread_cond_init(&ctx->done_cv, NULL);
+    ctx->bayer.gain[0] = ctx->bayer.gain[1] = ctx->bayer.gain[2] = 256;
+    ctx->wb.gain[0] = ctx->wb.gain[1] = ctx->wb.gain[2] = 256;
+    pixfmt_wb_build(&ctx->wb);
+    pixfmt_bayer_build_luts(&ctx->bayer, &ctx->wb);
+
+    ctx->args[0].ctx = ctx;
+    for (int i = 1; i < nthreads; i++) {
+        ctx->args[i].ctx = ctx;
+        ctx->args[i].idx = i;
+        if (pthread_create(&ctx->threads[i], NULL, pixfmt_worker, &ctx->args[i]) != 0) {
+            perror("pixfmt: pthread_create");
+            ctx->nthreads = i;
+            break;
+        }
+    }
+    return 0;
+}
+
+static inline void pixfmt_destroy(struct pixfmt_ctx *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    ctx->quit = 1;
+    pthread_cond_broadcast(&ctx->start_cv);
+    pthread_mutex_unlock(&ctx->lock);
+    for (int i = 1; i < ctx->nthreads; i++)
+        pthread_join(ctx->threads[i], NULL);
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->start_cv);
+    pthread_cond_destroy(&ctx->done_cv);
+    for (int i = 0; i < PIXFMT_MAX_THREADS; i++) free(ctx->args[i].line);
+}
+
+// Line buffers for every hart, for frames up to width pixels wide. Done once
+// by pixfmt_calibrate(); a wider frame later grows them before the fan-out.
+static inline int pixfmt_lines(struct pixfmt_ctx *ctx, int width) {
+    if (width <= ctx->line_width) return 0;
+    for (int i = 0; i < ctx->nthreads; i++) {
+        uint8_t *l = realloc(ctx->args[i].line, PIXFMT_LINE_BYTES(width));
+        if (!l) {
+            fprintf(stderr, "pixfmt: no memory for %d px line buffers\n", width);
+            return -1;
+        }
+        ctx->args[i].line = l;
+    }
+    ctx->line_width = width;
+    return 0;
+}
+
+static inline pixfmt_kernel pixfmt_lookup(uint32_t fourcc, int dst) {
+    int i = pixfmt_find(fourcc);
+    if (i < 0 || dst < 0 || dst >= PIXFMT_DST_COUNT) return NULL;
+    return pixfmt_table[i].fn[dst];
+}
+
+// Black level (8-bit units) and R/G/B gains (Q8) for raw Bayer sources.
+// Not safe to call while a conversion is running.
+static inline void pixfmt_set_bayer(struct pixfmt_ctx *ctx, int black, int gain_r, int gain_g, int gain_b) {
+    ctx->bayer.black = black;
+    ctx->bayer.gain[0] = gain_r;
+    ctx->bayer.gain[1] = gain_g;
+    ctx->bayer.gain[2] = gain_b;
+    pixfmt_bayer_build_luts(&ctx->bayer, &ctx->wb);
+}
+
+// Per-channel gain (Q8) and offset applied to every RGB/tensor output; GREY
+// output is the uncorrected luma whatever the source. Call between frames,
+// with no pixfmt_convert_serial() running on ctx either; rebuilding the
+// tables takes a few microseconds.
+static inline void pixfmt_set_wb(struct pixfmt_ctx *ctx, const int gain[3], const int offset[3]) {
+    for (int c = 0; c < 3; c++) {
+        ctx->wb.gain[c] = gain[c];
+        ctx->wb.offset[c] = offset[c];
+    }
+    pixfmt_wb_build(&ctx->wb);
+    pixfmt_bayer_build_luts(&ctx->bayer, &ctx->wb);
+}
+
+// Convert one frame. stride is the source bytes per line (0 = tightly packed).
+// With PIXFMT_HALF (Bayer only) out is width/2 x height/2.
+// Returns 0 on success, -1 if there is no kernel for (fourcc, dst).
+static inline int pixfmt_convert_ex(struct pixfmt_ctx *ctx, uint32_t fourcc, int dst,
+                                    const uint8_t *src, int stride, uint8_t *out,
+                                    int width, int height, int flags) {
+    pixfmt_kernel fn = pixfmt_lookup(fourcc, dst);
+    if (!fn) {
+        fprintf(stderr, "pixfmt: no conversion %s -> %d\n", pixfmt_name(fourcc), dst);
+        return -1;
+    }
+    if ((flags & PIXFMT_HALF) && !pixfmt_is_bayer(fourcc)) {
+        fprintf(stderr, "pixfmt: half resolution needs a Bayer source\n");
+        return -1;
+    }
+    if (stride <= 0) stride = pixfmt_min_stride(fourcc, width);
+    if (pixfmt_lines(ctx, width) != 0) return -1;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->kernel = fn;
+    ctx->job.src = src;
+    ctx->job.stride = stride;
+    ctx->job.dst = out;
+    ctx->job.width = width;
+    ctx->job.height = height;
+    ctx->job.half = (flags & PIXFMT_HALF) != 0;
+    ctx->job.bayer = &ctx->bayer;
+    ctx->job.wb = &ctx->wb;
+    ctx->pending = ctx->nthreads - 1;
+    ctx->generation++;
+    pthread_cond_broadcast(&ctx->start_cv);
+    pthread_mutex_unlock(&ctx->lock);
+
+    // The caller takes band 0
+    int y0, y1;
+    struct pixfmt_job job = ctx->job;
+    job.line = ctx->args[0].line;
+    pixfmt_band(ctx, 0, &y0, &y1);
+    if (y1 > y0) fn(&job, y0, y1);
+
+    pthread_mutex_lock(&ctx->lock);
+    while (ctx->pending > 0)
+        pthread_cond_wait(&ctx->done_cv, &ctx->lock);
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+static inline int pixfmt_convert(struct pixfmt_ctx *ctx, uint32_t fourcc, int dst,
+                                 const uint8_t *src, int stride, uint8_t *out, int width, int height) {
+    return pixfmt_convert_ex(ctx, fourcc, dst, src, stride, out, width, height, 0);
+}
+
+// Convert a whole frame on the calling thread, bypassing the worker pool.
+// For callers that parallelise across frames instead of within one. Only
+// the Bayer and white balance tables are read from ctx, so several threads
+// may share it as long as neither pixfmt_set_bayer() nor pixfmt_set_wb()
+// runs meanwhile. Full resolution Bayer is limited to PIXFMT_SERIAL_MAX_WIDTH.
+static inline int pixfmt_convert_serial(const struct pixfmt_ctx *ctx, uint32_t fourcc, int dst,
+                                        const uint8_t *src, int stride, uint8_t *out,
+                                        int width, int height, int flags) {
+    pixfmt_kernel fn = pixfmt_lookup(fourcc, dst);
+    if (!fn || ((flags & PIXFMT_HALF) && !pixfmt_is_bayer(fourcc))) return -1;
+    if (pixfmt_is_bayer(fourcc) && !(flags & PIXFMT_HALF) && width > PIXFMT_SERIAL_MAX_WIDTH) return -1;
+
+    uint8_t line[PIXFMT_LINE_BYTES(PIXFMT_SERIAL_MAX_WIDTH)];
+    struct pixfmt_job job;
+    job.line = line;
+    job.src = src;
+    job.stride = (stride > 0) ? stride : pixfmt_min_stride(fourcc, width);
+    job.dst = out;
+    job.width = width;
+    job.height = height;
+    job.half = (flags & PIXFMT_HALF) != 0;
+    job.bayer = &ctx->bayer;
+    job.wb = &ctx->wb;
+    fn(&job, 0, height);
+    return 0;
+}
+
+/* --- COST MEASUREMENT AND NEGOTIATION --- */
+
+static inline double pixfmt_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Time every table entry on a synthetic frame of the capture size.
+// Costs are ns/pixel including the thread fan-out, so they reflect what the
+// capture path will actually pay.
+static inline int pixfmt_calibrate(struct pixfmt_ctx *ctx, int width, int height) {
+    const int reps = 5;
+    size_t src_size = (size_t)width * height * 3;
+    uint8_t *src = malloc(src_size);
+    uint8_t *dst = malloc(pixfmt_dst_size(PIXFMT_DST_RGB24, width, height));
+    if (!src || !dst || pixfmt_lines(ctx, width) != 0) { free(src); free(dst); return -1; }
+
+    // Mid-grey noise so the clamp and chroma paths are all exercised
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < src_size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        src[i] = (uint8_t)(seed >> 24);
+    }
+
+    for (int e = 0; e < PIXFMT_TABLE_SIZE; e++) {
+        for (int d = 0; d < PIXFMT_DST_COUNT; d++) {
+            double best = 1e30;
+            for (int r = 0; r < reps; r++) {
+                double t0 = pixfmt_now_ns();
+                pixfmt_convert(ctx, pixfmt_table[e].fourcc, d, src, 0, dst, width, height);
+                double t = pixfmt_now_ns() - t0;
+                if (t < best) best = t;
+            }
+            ctx->cost_ns[d][e] = best / ((double)width * height);
+        }
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
+
+// Enumerate the formats the device offers, pick the one with the lowest
+// measured conversion cost to dst and apply it with VIDIOC_S_FMT.
+// fmt must carry the wanted width/height; on return it holds what the driver set.
+// Falls back to YUYV if calibration has not run.
+static inline int pixfmt_negotiate(struct pixfmt_ctx *ctx, int fd, int dst, struct v4l2_format *fmt) {
+    struct v4l2_fmtdesc desc;
+    int best = -1;
+    double best_cost = 1e30;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        int e = pixfmt_find(desc.pixelformat);
+        if (e >= 0) {
+            double cost = ctx->cost_ns[dst][e];
+            if (cost <= 0) cost = (desc.pixelformat == V4L2_PIX_FMT_YUYV) ? 0.5 : 1.0;
+            printf("  %-6s supported, %.2f ns/px\n", pixfmt_table[e].name, cost);
+            if (cost < best_cost) { best_cost = cost; best = e; }
+        }
+        desc.index++;
+    }
+    if (best < 0) {
+        fprintf(stderr, "pixfmt: device offers no convertible format\n");
+        return -1;
+    }
+
+    int width = fmt->fmt.pix.width, height = fmt->fmt.pix.height;
+    fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt->fmt.pix.pixelformat = pixfmt_table[best].fourcc;
+    fmt->fmt.pix.field = V4L2_FIELD_NONE;
+    int r;
+    do { r = ioctl(fd, VIDIOC_S_FMT, fmt); } while (r == -1 && errno == EINTR);
+    if (r < 0) { perror("pixfmt: VIDIOC_S_FMT"); return -1; }
+
+    if ((int)fmt->fmt.pix.width != width || (int)fmt->fmt.pix.height != height)
+        printf("  driver adjusted size to %u x %u\n", fmt->fmt.pix.width, fmt->fmt.pix.height);
+    return 0;
+}
+
+#endif // PIXFMT_H
@@ -1,5 +1,14 @@
 // This is the integrated UART + PWM application. 
 // It reads the inputs given by the user through the Nextion display via UART and then depending upon the button pressed, either starts or stops the converyer belt motors via the PWM channel. 
+// PWM period/duty and the baud rate can be changed in the config file (config.h) while running.
+// A new binary started for the same UART takes the open UART and PWM fds over from the running one
+// (handoff.h) instead of re-initialising: the belt keeps running and no display input is flushed.
+// With hmi_poll_ms set it also reads HMI_QUERIES from the display every hmi_poll_ms, up to
+// hmi_window `get` queries in flight at once (nextion.h); changed values are printed.
+// With hmi_chart_id set, the samples other tools send to NX_CHART_SOCK (capture_loop: frames
+// archived per second, capture latency) are charted on that waveform, streamed in bulk with addt.
+//
+// Usage: serial_pwm [device] [baud] [config]
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,22 +19,47 @@
 #include <termios.h>
 #include <signal.h>
 #include <ctype.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include "telemetry.h"
+#include "config.h"
+#include "handoff.h"
+#include "nextion.h"
 
 /* --- PWM CONFIGURATION --- */
-#define PWM_CHIP_PATH "/sys/class/pwm/pwmchip0"
+#ifndef PWM_CHIP_PATH
+#define PWM_CHIP_PATH "/sys/class/pwm/pwmchip0"   // overridden by line_sim to point at a mock sysfs tree
+#endif
 #define PWM_CHANNEL   0
 #define PWM_PERIOD_NS 1000000  // 1 kHz
 #define PWM_DUTY_NS   500000   // 50% Duty Cycle
+#define CONFIG_PATH   "/etc/conveyor.conf"
+#define HANDOFF_DIR   "/run"
+#define HMI_TIMEOUT_MS 250     // per query; a 9600 baud round trip is ~25 ms
+
+static int pwm_period_ns = PWM_PERIOD_NS;
+static int pwm_duty_ns = PWM_DUTY_NS;
 
 static volatile int keep_running = 1;
+static volatile int dump_stats = 0;
+
+static struct tm_hist pwm_write_us = TM_HIST("pwm_write", "us");     // sysfs write (plus open the first time)
+static struct tm_counter belt_commands = TM_COUNTER("belt_commands");
 
 /* --- PWM HELPER FUNCTIONS --- */
 
+// The channel attributes stay open once written, so a new binary can be handed them;
+// export and unexport are opened for each write
+#define PWM_NATTR 3
+static const char *pwm_attrs[PWM_NATTR] = { "period", "duty_cycle", "enable" };
+static int pwm_fds[PWM_NATTR] = { -1, -1, -1 };
+
 // Helper to write string values to sysfs files
 int pwm_write_file(const char *filename, const char *value) {
     char path[256];
     int fd;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
     // Construct full path: /sys/class/pwm/pwmchip0/pwm0/<filename>
     // Exception: 'export' is in the chip root, not the channel folder
@@ -34,8 +68,21 @@ int pwm_write_file(const char *filename, const char *value) {
     } else {
         snprintf(path, sizeof(path), "%s/pwm%d/%s", PWM_CHIP_PATH, PWM_CHANNEL, filename);
     }
+    int attr = -1;
+    for (int i = 0; i < PWM_NATTR; i++)
+        if (strcmp(filename, pwm_attrs[i]) == 0) attr = i;
+
+    if (attr >= 0 && pwm_fds[attr] >= 0) {
+        if (pwrite(pwm_fds[attr], value, strlen(value), 0) < 0) {
+            fprintf(stderr, "Error writing to %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        tm_record(&pwm_write_us, (uint64_t)((t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000));
+        return 0;
+    }
 
-    fd = open(path, O_WRONLY);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
     if (fd < 0) {
         // It's okay if export fails because it's already exported (EBUSY)
         if (errno == EBUSY && strcmp(filename, "export") == 0) return 0;
@@ -50,7 +97,10 @@ int pwm_write_file(const char *filename, const char *value) {
         return -1;
     }
 
-    close(fd);
+    if (attr >= 0) pwm_fds[attr] = fd;
+    else close(fd);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    tm_record(&pwm_write_us, (uint64_t)((t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000));
     return 0;
 }
 
@@ -71,22 +121,40 @@ int pwm_init() {
     usleep(100000); 
 
     // 2. Set Period (Must be done before duty cycle if current duty > new period)
-    snprintf(buf, sizeof(buf), "%d", PWM_PERIOD_NS);
+    snprintf(buf, sizeof(buf), "%d", pwm_period_ns);
     if (pwm_write_file("period", buf) != 0) return -1;
 
     // 3. Set Duty Cycle
-    snprintf(buf, sizeof(buf), "%d", PWM_DUTY_NS);
+    snprintf(buf, sizeof(buf), "%d", pwm_duty_ns);
     if (pwm_write_file("duty_cycle", buf) != 0) return -1;
 
     // Ensure it starts disabled
     pwm_write_file("enable", "0");
 
-    printf("PWM Initialized (Period: %dns, Duty: %dns)\n", PWM_PERIOD_NS, PWM_DUTY_NS);
+    printf("PWM Initialized (Period: %dns, Duty: %dns)\n", pwm_period_ns, pwm_duty_ns);
+    return 0;
+}
+
+// Change period and duty cycle without stopping the belt. The kernel rejects
+// duty > period at every step, so the order depends on which way period moves.
+int pwm_set(int period_ns, int duty_ns) {
+    char p[32], d[32];
+    snprintf(p, sizeof(p), "%d", period_ns);
+    snprintf(d, sizeof(d), "%d", duty_ns);
+    if (period_ns >= pwm_period_ns) {
+        if (pwm_write_file("period", p) != 0 || pwm_write_file("duty_cycle", d) != 0) return -1;
+    } else {
+        if (pwm_write_file("duty_cycle", d) != 0 || pwm_write_file("period", p) != 0) return -1;
+    }
+    pwm_period_ns = period_ns;
+    pwm_duty_ns = duty_ns;
+    printf("PWM set (Period: %dns, Duty: %dns)\n", pwm_period_ns, pwm_duty_ns);
     return 0;
 }
 
 // Enable (1) or Disable (0) the PWM
 void pwm_control(int state) {
+    tm_count(&belt_commands, 1);
     if (state) {
         printf("\n---> [COMMAND] 'A' Received: PWM STARTED\n");
         pwm_write_file("enable", "1");
@@ -96,6 +164,16 @@ void pwm_control(int state) {
     }
 }
 
+// Act on one byte received from the Nextion display
+void handle_command(unsigned char c) {
+    if (c == 'A' || c == 'a') {
+        pwm_control(1); // Start
+    }
+    else if (c == 'B' || c == 'b') {
+        pwm_control(0); // Stop
+    }
+}
+
 /* --- SERIAL CONFIGURATION (Original Code) --- */
 
 void int_handler(int signum) {
@@ -103,6 +181,40 @@ void int_handler(int signum) {
     keep_running = 0;
 }
 
+// SIGUSR1: print the telemetry without stopping
+void usr1_handler(int signum) {
+    (void)signum;
+    dump_stats = 1;
+}
+
+static speed_t serial_speed(int baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 115200: return B115200;
+        default:
+            fprintf(stderr, "Unsupported baud %d, using 9600\n", baud);
+            return B9600;
+    }
+}
+
+// Speed only, once the output has gone out; unread input stays in the tty
+int set_serial_speed(int fd, int baud) {
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        perror("tcgetattr");
+        return -1;
+    }
+    cfsetispeed(&tty, serial_speed(baud));
+    cfsetospeed(&tty, serial_speed(baud));
+    if (tcsetattr(fd, TCSADRAIN, &tty) != 0) {
+        perror("tcsetattr");
+        return -1;
+    }
+    return 0;
+}
+
 int configure_serial(int fd, int baud) {
     struct termios tty;
     if (tcgetattr(fd, &tty) != 0) {
@@ -118,17 +230,7 @@ int configure_serial(int fd, int baud) {
     tty.c_cc[VMIN] = 1;    
     tty.c_cc[VTIME] = 0;   
 
-    speed_t speed;
-    switch (baud) {
-        case 9600: speed = B9600; break;
-        case 19200: speed = B19200; break;
-        case 38400: speed = B38400; break;
-        case 115200: speed = B115200; break;
-        default:
-            fprintf(stderr, "Unsupported baud %d, using 9600\n", baud);
-            speed = B9600;
-    }
-
+    speed_t speed = serial_speed(baud);
     cfsetispeed(&tty, speed);
     cfsetospeed(&tty, speed);
 
@@ -143,45 +245,273 @@ int configure_serial(int fd, int baud) {
 
 /* --- MAIN --- */
 
+#ifndef SERIAL_PWM_NO_MAIN
+static struct tm_counter uart_bytes = TM_COUNTER("uart_bytes");
+
+// Display state read back with `get`: page, speed slider, belt button
+static const char *hmi_queries[] = { "dp", "h0.val", "bt0.val" };
+#define HMI_NQUERIES ((int)(sizeof(hmi_queries) / sizeof(hmi_queries[0])))
+static int32_t hmi_values[HMI_NQUERIES];
+static int hmi_known[HMI_NQUERIES];            // 1 value read, -1 refused
+static uint64_t hmi_round_start;
+static int hmi_round_left;
+
+// Chart channels: value at the top of the chart, bin maximum (latency) or mean (rates)
+static const struct { double full; int use_max; } hmi_chart[] = {
+    [NX_CHART_THROUGHPUT] = { 60, 0 },      // frames/s
+    [NX_CHART_LATENCY]    = { 500, 1 },     // ms
+};
+#define HMI_CHART_NCH ((int)(sizeof(hmi_chart) / sizeof(hmi_chart[0])))
+
+static struct tm_hist hmi_round_us = TM_HIST("hmi_round", "us");     // all HMI_QUERIES answered
+
+// Bytes the display prints (not answers to a query)
+static void hmi_byte(void *arg, unsigned char c) {
+    (void)arg;
+    handle_command(c);
+
+    // Echo to console
+    if (isprint(c) || c == '\n' || c == '\r' || c == '\t') {
+        putchar(c);
+        fflush(stdout);
+    } else {
+        printf("[0x%02X]", c);
+        fflush(stdout);
+    }
+}
+
+static void hmi_value(void *arg, const char *expr, const struct nx_result *r) {
+    int i = (int)(intptr_t)arg;
+    if (r->status == NX_NUM && (hmi_known[i] != 1 || hmi_values[i] != r->num)) {
+        printf("\nHMI: %s = %d\n", expr, r->num);
+        hmi_values[i] = r->num;
+        hmi_known[i] = 1;
+    } else if (r->status == NX_ERR && hmi_known[i] != -1) {
+        fprintf(stderr, "HMI: %s refused (0x%02X)\n", expr, r->code);      // once, not every round
+        hmi_known[i] = -1;
+    }
+    if (--hmi_round_left == 0) tm_record(&hmi_round_us, (nx_now_ns() - hmi_round_start) / 1000);
+}
+
+static void hmi_chart_start(struct nx_wave *wv, struct nextion *nx, const struct cfg *c) {
+    nx_wave_init(wv, nx, c->hmi_chart_id, HMI_CHART_NCH, c->hmi_chart_pps, c->baud);
+    for (int i = 0; i < HMI_CHART_NCH; i++) nx_wave_scale(wv, i, hmi_chart[i].full, hmi_chart[i].use_max);
+    printf("Chart: waveform %d, %.1f points/s per channel\n", wv->id, wv->pps);
+}
+
+// Live upgrade state (fds: UART, then the open PWM attributes in pwm_attrs order)
+#define HANDOFF_SERIAL_PWM 2
+struct serial_handoff {
+    int period_ns, duty_ns, baud;
+    int have_attr[PWM_NATTR];
+};
+
 int main(int argc, char **argv)
 {
     // Fixed missing quote in the original code
     const char *dev = "/dev/ttyS0"; 
+    const char *config_path = CONFIG_PATH;
     int baud = 9600;
+    struct cfg_store cs;
 
     if (argc >= 2) dev = argv[1];
     if (argc >= 3) baud = atoi(argv[2]);
+    if (argc >= 4) config_path = argv[3];
+    if (!cfg_baud_ok(baud)) { fprintf(stderr, "ERROR: baud must be 9600, 19200, 38400 or 115200\n"); return 1; }
+
+    // 0. Config: the command line and #defines are the defaults
+    struct cfg def = cfg_builtin();
+    def.pwm_period_ns = PWM_PERIOD_NS;
+    def.pwm_duty_ns = PWM_DUTY_NS;
+    def.baud = baud;
+    if (cfg_init(&cs, config_path, &def) != 0) return 1;
+    const struct cfg *c = cfg_get(&cs);
+    pwm_period_ns = c->pwm_period_ns;
+    pwm_duty_ns = c->pwm_duty_ns;
+    baud = c->baud;
+
+    char sock_path[108];
+    const char *base = strrchr(dev, '/');
+    snprintf(sock_path, sizeof(sock_path), "%s/serial_pwm-%s.sock", HANDOFF_DIR, base ? base + 1 : dev);
+    struct serial_handoff h;
+    int fd, handed = 0;
+    int peer = handoff_connect(sock_path);
+    if (peer >= 0) {
+        // 1+2. Take the running instance's UART and PWM as they are: no pwm_init()
+        // (it would stop the belt) and no configure_serial() (it flushes input)
+        int fds[1 + PWM_NATTR], k = 1;
+        int nfds = handoff_recv(peer, HANDOFF_SERIAL_PWM, &h, sizeof(h), fds, 1 + PWM_NATTR);
+        if (nfds < 1) {
+            fprintf(stderr, "ERROR: cannot take over from the running serial_pwm\n");
+            return 2;
+        }
+        fd = fds[0];
+        for (int i = 0; i < PWM_NATTR; i++)
+            if (h.have_attr[i] && k < nfds) pwm_fds[i] = fds[k++];
+        if (handoff_ack(peer) != 0) { fprintf(stderr, "ERROR: predecessor went away during the handoff\n"); return 2; }
+        close(peer);
+        pwm_period_ns = h.period_ns;
+        pwm_duty_ns = h.duty_ns;
+        printf("Took over %s at %d baud, PWM %d/%d ns\n", dev, h.baud, pwm_period_ns, pwm_duty_ns);
+        // The config may have changed under the old binary
+        if ((c->pwm_period_ns != pwm_period_ns || c->pwm_duty_ns != pwm_duty_ns) && pwm_set(c->pwm_period_ns, c->pwm_duty_ns) != 0)
+            fprintf(stderr, "WARNING: PWM update failed, still %d/%d ns\n", pwm_period_ns, pwm_duty_ns);
+        if (c->baud != h.baud) {
+            if (set_serial_speed(fd, c->baud) == 0) {
+                printf("Serial now %d baud\n", c->baud);
+            } else {
+                fprintf(stderr, "WARNING: serial still %d baud\n", h.baud);
+                baud = h.baud;
+            }
+        }
+    } else {
+        // 1. Setup PWM first
+        if (pwm_init() != 0) {
+            fprintf(stderr, "WARNING: PWM setup failed. Continuing in monitor-only mode.\n");
+        }
 
-    // 1. Setup PWM first
-    if (pwm_init() != 0) {
-        fprintf(stderr, "WARNING: PWM setup failed. Continuing in monitor-only mode.\n");
-    }
+        // 2. Setup Serial
+        printf("Opening serial device: %s at %d baud\n", dev, baud);
 
-    // 2. Setup Serial
-    printf("Opening serial device: %s at %d baud\n", dev, baud);
+        fd = open(dev, O_RDWR | O_NOCTTY | O_SYNC | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "ERROR: cannot open %s: %s\n", dev, strerror(errno));
+            return 2;
+        }
 
-    int fd = open(dev, O_RDWR | O_NOCTTY | O_SYNC);
-    if (fd < 0) {
-        fprintf(stderr, "ERROR: cannot open %s: %s\n", dev, strerror(errno));
-        return 2;
+        if (configure_serial(fd, baud) != 0) {
+            fprintf(stderr, "ERROR: failed to configure serial port\n");
+            close(fd);
+            return 3;
+        }
     }
-
-    if (configure_serial(fd, baud) != 0) {
-        fprintf(stderr, "ERROR: failed to configure serial port\n");
-        close(fd);
-        return 3;
+    int hs = handoff_listen(sock_path);
+    struct nextion nx;
+    nx_init(&nx, fd, c->hmi_window, HMI_TIMEOUT_MS, hmi_byte, NULL);
+    nx_set_baud(&nx, baud);
+    uint64_t next_poll = 0;
+    struct nx_wave wv = {0};
+    int chart = -1;
+    int want_baud = 0;                  // reloaded baud rate, not yet on the line
+    if (c->hmi_chart_id >= 0) {
+        hmi_chart_start(&wv, &nx, c);
+        chart = nx_chart_listen();
     }
 
     signal(SIGINT, int_handler);
     signal(SIGTERM, int_handler);
 
+    // No SA_RESTART, so a blocked read() returns EINTR and the dump happens at once
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = usr1_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+
     unsigned char buf[256];
     ssize_t n;
 
     printf("Listening... (Press 'A' to Start PWM, 'B' to Stop PWM)\n");
 
     while (keep_running) {
-        n = read(fd, buf, sizeof(buf));
+        // New line speed once nothing is queued or in flight: an answer must not straddle the switch.
+        // TCSADRAIN lets the last command go out; unlike configure_serial() nothing is flushed.
+        if (want_baud && nx.head == nx.tail) {
+            if (set_serial_speed(fd, want_baud) == 0) {
+                printf("Serial now %d baud\n", want_baud);
+                baud = want_baud;
+                nx_set_baud(&nx, baud);
+                if (chart >= 0) nx_wave_rate(&wv, c->hmi_chart_pps, baud);
+            } else {
+                fprintf(stderr, "WARNING: serial still %d baud\n", baud);
+            }
+            want_baud = 0;
+        }
+
+        // HMI poll round, when the previous one is complete; none while a baud change waits for the queue
+        uint64_t now = nx_now_ns();
+        if (c->hmi_poll_ms && hmi_round_left == 0 && now >= next_poll && !want_baud) {
+            nx.window = c->hmi_window;
+            hmi_round_start = now;
+            hmi_round_left = HMI_NQUERIES;
+            for (int i = 0; i < HMI_NQUERIES; i++)
+                if (nx_get(&nx, hmi_queries[i], hmi_value, (void *)(intptr_t)i) != 0) hmi_round_left--;
+            next_poll = now + (uint64_t)c->hmi_poll_ms * 1000000;
+        }
+        if (chart >= 0 && !want_baud) nx_wave_tick(&wv);
+        int timeout = nx_timeout_ms(&nx);
+        if (c->hmi_poll_ms && hmi_round_left == 0) {
+            int t = next_poll > now ? (int)((next_poll - now + 999999) / 1000000) : 0;
+            if (timeout < 0 || t < timeout) timeout = t;
+        }
+        if (chart >= 0) {
+            int t = nx_wave_timeout_ms(&wv);
+            if (timeout < 0 || t < timeout) timeout = t;
+        }
+
+        // No handoff with queries or waveform data open: their answers would reach the new process as display input
+        struct pollfd pfd[4] = { { fd, POLLIN, 0 }, { cfg_fd(&cs), POLLIN, 0 }, { nx.head != nx.tail ? -1 : hs, POLLIN, 0 },
+                                 { chart, POLLIN, 0 } };
+        n = 0;
+        if (poll(pfd, 4, timeout) < 0) {
+            if (errno != EINTR) { perror("poll"); break; }
+        } else if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            n = read(fd, buf, sizeof(buf));
+        }
+        nx_expire(&nx);
+        if (chart >= 0 && (pfd[3].revents & POLLIN)) nx_chart_recv(chart, &wv);
+
+        // Config reload between commands, never in the middle of one
+        const struct cfg *old = c;
+        if (cfg_poll(&cs)) {
+            c = cfg_get(&cs);
+            unsigned what = cfg_diff(old, c);
+            cfg_print(c);
+            if ((what & CFG_APPLY_PWM) && pwm_set(c->pwm_period_ns, c->pwm_duty_ns) != 0)
+                fprintf(stderr, "WARNING: PWM update failed, still %d/%d ns\n", pwm_period_ns, pwm_duty_ns);
+            // The top of the loop switches once the queries in flight are answered
+            if (what & CFG_APPLY_UART) want_baud = c->baud;
+            if (c->hmi_chart_id != old->hmi_chart_id || c->hmi_chart_pps != old->hmi_chart_pps) {
+                if (c->hmi_chart_id < 0) {
+                    if (chart >= 0) close(chart);
+                    chart = -1;
+                } else if (chart < 0) {
+                    if (!wv.busy) hmi_chart_start(&wv, &nx, c);     // busy: an addt still reads wv.out
+                    chart = nx_chart_listen();
+                }
+                if (chart >= 0) {
+                    wv.id = c->hmi_chart_id;
+                    nx_wave_rate(&wv, c->hmi_chart_pps, baud);
+                }
+            }
+        }
+
+        // A new binary wants the UART and the belt: hand them over between commands.
+        // Anything the display sends meanwhile waits in the tty for the new process.
+        if (n == 0 && (pfd[2].revents & POLLIN) && (peer = handoff_accept(hs)) >= 0) {
+            int fds[1 + PWM_NATTR], k = 0;
+            memset(&h, 0, sizeof(h));
+            h.period_ns = pwm_period_ns;
+            h.duty_ns = pwm_duty_ns;
+            h.baud = baud;
+            fds[k++] = fd;
+            for (int i = 0; i < PWM_NATTR; i++)
+                if (pwm_fds[i] >= 0) { h.have_attr[i] = 1; fds[k++] = pwm_fds[i]; }
+            handed = handoff_send(peer, HANDOFF_SERIAL_PWM, &h, sizeof(h), fds, k) == 0 && handoff_wait_ack(peer) == 0;
+            close(peer);
+            if (handed) {
+                printf("\nHandoff: UART and PWM handed to the new binary\n");
+                break;
+            }
+        }
+
+        if (dump_stats) {
+            dump_stats = 0;
+            printf("\n");
+            if (c->hmi_poll_ms || chart >= 0) nx_print(&nx);
+            if (chart >= 0) nx_wave_print(&wv);
+            tm_print(stdout);
+            fflush(stdout);
+        }
         if (n < 0) {
             if (errno == EINTR) continue;
             perror("read");
@@ -189,35 +519,29 @@ int main(int argc, char **argv)
         } else if (n == 0) {
             continue;
         }
+        tm_count(&uart_bytes, n);
 
-        // Process received buffer
-        for (ssize_t i = 0; i < n; ++i) {
-            unsigned char c = buf[i];
-            
-            // --- NEW LOGIC START ---
-            if (c == 'A' || c == 'a') {
-                pwm_control(1); // Start
-            } 
-            else if (c == 'B' || c == 'b') {
-                pwm_control(0); // Stop
-            }
-            // --- NEW LOGIC END ---
-
-            // Echo to console
-            if (isprint(c) || c == '\n' || c == '\r' || c == '\t') {
-                putchar(c);
-                fflush(stdout);
-            } else {
-                printf("[0x%02X]", c);
-                fflush(stdout);
-            }
-        }
+        // Process received buffer: answers to queries, the rest goes to hmi_byte()
+        nx_input(&nx, buf, n);
     }
 
     // Cleanup: Turn off PWM on exit? (Optional, currently leaves it as is)
     // pwm_control(0); 
     
     printf("\nExiting %s\n", dev);
+    if (c->hmi_poll_ms || chart >= 0) nx_print(&nx);
+    if (chart >= 0) nx_wave_print(&wv);
+    tm_print(stdout);
+    cfg_destroy(&cs);
+    if (chart >= 0) {
+        close(chart);
+        if (!handed) unlink(NX_CHART_SOCK);
+    }
+    if (hs >= 0) {
+        close(hs);
+        if (!handed) unlink(sock_path);     // after a handoff the path is the new process's socket
+    }
     close(fd);
     return 0;
 }
+#endif // SERIAL_PWM_NO_MAIN
@@ -64,10 +64,36 @@ USAGE:
    where the callback is:
       void stbi_write_func(void *context, void *data, int size);
 
+   The JPEG writer can also hand back per-block DCT band energies, computed
+   from the quantized coefficients it already has (see stbi_jpg_block_energy):
+
+     int stbi_write_jpg_features(char const *filename, int w, int h, int comp, const void *data, int quality, stbi_jpg_block_energy *features);
+     int stbi_write_jpg_features_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int quality, stbi_jpg_block_energy *features);
+
+   To encode straight into caller-owned memory (e.g. an mmap'd archive segment)
+   without going through a callback per byte:
+
+     int stbi_write_jpg_to_buffer(unsigned char *buffer, int capacity, int w, int h, int comp, const void *data, int quality, stbi_jpg_block_energy *features);
+
+   It returns the number of bytes written, or 0 if the image did not fit.
+
+   The _ex variant takes explicit settings instead of a quality (see
+   stbi_jpg_params): chroma subsampling, how many zigzag coefficients to keep
+   per block, a COM segment, and a deadline callback after which the rest of
+   the image is coded DC-only (one flat 8x8 colour per block, no DCT):
+
+     int stbi_write_jpg_to_buffer_ex(unsigned char *buffer, int capacity, int w, int h, int comp, const void *data, stbi_jpg_params *params, stbi_jpg_block_energy *features);
+
    You can configure it with these global variables:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
       int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
       int stbi_write_force_png_filter;         // defaults to -1; set to 0..5 to force a filter mode
+      int stbi_write_checksum_impl;            // defaults to 0 (by size); 1 = bytewise, 2 = sliced CRC / word Adler
+
+   The PNG CRC-32 is also available on its own, for other containers (start
+   with crc 0 and pass the result back in to continue over more data):
+
+     unsigned int stbi_write_crc32(unsigned int crc, const unsigned char *data, int len);
 
 
    You can define STBI_WRITE_NO_STDIO to disable the file variant of these
@@ -170,6 +196,7 @@ LICENSE
 STBIWDEF int stbi_write_tga_with_rle;
 STBIWDEF int stbi_write_png_compression_level;
 STBIWDEF int stbi_write_force_png_filter;
+STBIWDEF int stbi_write_checksum_impl;
 #endif
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -192,6 +219,38 @@ STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int w,
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int quality);
 
+// Per 8x8 luma block energy (sum of |quantized coefficient|) by zigzag band,
+// exported by the *_features JPEG writers as a side product of encoding.
+// The map is row-major, ((x+7)/8) * ((y+7)/8) entries, values saturate at 65535.
+typedef struct {
+   unsigned short dc;     // |DC| coefficient
+   unsigned short low;    // zigzag 1..5
+   unsigned short mid;    // zigzag 6..27
+   unsigned short high;   // zigzag 28..63
+} stbi_jpg_block_energy;
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_jpg_features(char const *filename, int x, int y, int comp, const void *data, int quality, stbi_jpg_block_energy *features);
+#endif
+STBIWDEF int stbi_write_jpg_features_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality, stbi_jpg_block_energy *features);
+STBIWDEF int stbi_write_jpg_to_buffer(unsigned char *buffer, int capacity, int x, int y, int comp, const void *data, int quality, stbi_jpg_block_energy *features);
+
+// JPEG encoder settings for stbi_write_jpg_to_buffer_ex(). Zeroed fields give
+// the same output as the plain writers.
+typedef struct {
+   int quality;                  // 1..100, 0 = 90
+   int subsample;                // 0 = by quality (4:2:0 at <= 90), 1 = 4:2:0, 2 = 4:4:4
+   int coeffs;                   // zigzag coefficients kept per block, 1..64, 0 = all
+   const char *comment;          // written as a COM segment if not NULL
+   int (*expired)(void *user);   // polled once per MCU row; non-zero codes the rest DC-only
+   void *user;
+   int dc_only_rows;             // out: MCU rows coded DC-only
+} stbi_jpg_params;
+
+STBIWDEF int stbi_write_jpg_to_buffer_ex(unsigned char *buffer, int capacity, int x, int y, int comp, const void *data, stbi_jpg_params *params, stbi_jpg_block_energy *features);
+
+STBIWDEF unsigned int stbi_write_crc32(unsigned int crc, const unsigned char *data, int len);
+
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #endif//INCLUDE_STB_IMAGE_WRITE_H
@@ -247,14 +306,25 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
+#ifdef __GNUC__
+#define STBIW__ALIGNED(p,n) __builtin_assume_aligned(p,n)
+#else
+#define STBIW__ALIGNED(p,n) (p)
+#endif
+
+// Checksums over fewer bytes than this stay bytewise (stbi_write_checksum_impl == 0)
+#define STBIW__CKSUM_MIN 64
+
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi_write_png_compression_level = 8;
 static int stbi_write_tga_with_rle = 1;
 static int stbi_write_force_png_filter = -1;
+static int stbi_write_checksum_impl = 0;
 #else
 int stbi_write_png_compression_level = 8;
 int stbi_write_tga_with_rle = 1;
 int stbi_write_force_png_filter = -1;
+int stbi_write_checksum_impl = 0;
 #endif
 
 static int stbi__flip_vertically_on_write = 0;
@@ -270,6 +340,8 @@ typedef struct
    void *context;
    unsigned char buffer[64];
    int buf_used;
+   unsigned char *out, *out_end;   // direct output, bypasses func when set
+   int overflow;
 } stbi__write_context;
 
 // initialize a callback-based context
@@ -279,6 +351,25 @@ static void stbi__start_write_callbacks(stbi__write_context *s, stbi_write_func
    s->context = context;
 }
 
+// direct output into a fixed buffer: headers come through func, the bitstream through stbiw__putc
+static void stbi__buffer_write(void *context, void *data, int size)
+{
+   stbi__write_context *s = (stbi__write_context *) context;
+   if (s->out_end - s->out < size) {
+      s->overflow = 1;
+      return;
+   }
+   memcpy(s->out, data, size);
+   s->out += size;
+}
+
+static void stbi__start_write_buffer(stbi__write_context *s, unsigned char *buffer, int capacity)
+{
+   stbi__start_write_callbacks(s, stbi__buffer_write, s);
+   s->out = buffer;
+   s->out_end = buffer + capacity;
+}
+
 #ifndef STBI_WRITE_NO_STDIO
 
 static void stbi__stdio_write(void *context, void *data, int size)
@@ -393,6 +484,11 @@ static void stbiw__write_flush(stbi__write_context *s)
 
 static void stbiw__putc(stbi__write_context *s, unsigned char c)
 {
+   if (s->out) {
+      if (s->out < s->out_end) *s->out++ = c;
+      else s->overflow = 1;
+      return;
+   }
    s->func(s->context, &c, 1);
 }
 
@@ -890,6 +986,41 @@ static unsigned int stbiw__zhash(unsigned char *data)
 
 #define stbiw__ZHASH   16384
 
+// Adler-32 (zlib trailer), modulo deferred to every 5552 bytes as before.
+// Without a vector unit the fast path works on 8 bytes per 64-bit word: the
+// byte sum and the position-weighted sum that s2 needs come out of three
+// multiplies of 16-bit lanes, instead of sixteen dependent adds.
+static unsigned int stbiw__adler32(const unsigned char *data, int data_len)
+{
+   unsigned int s1=1, s2=0;
+   int blocklen = (int) (data_len % 5552), j=0, i;
+   int impl = stbi_write_checksum_impl ? stbi_write_checksum_impl : data_len >= STBIW__CKSUM_MIN ? 2 : 1;
+   while (j < data_len) {
+      const unsigned char *p = data + j;
+      i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      if (impl == 2) {
+         for (; i < blocklen && ((size_t) (p+i) & 7); ++i) { s1 += p[i]; s2 += s1; }
+         for (; i + 8 <= blocklen; i += 8) {
+            unsigned long long w, even, odd, pairs;
+            STBIW_MEMMOVE(&w, STBIW__ALIGNED(p+i, 8), 8);
+            even = w & 0x00FF00FF00FF00FFull;        // bytes 0,2,4,6 in 16-bit lanes 0..3
+            odd = (w >> 8) & 0x00FF00FF00FF00FFull;  // bytes 1,3,5,7
+            pairs = even + odd;
+            // s2 gets 8*s1 + sum (8-k)*byte[k] = 8*s1 + sum (8-2j)*pair[j] - sum odd[j]
+            s2 += 8*s1 + (unsigned int) ((pairs * 0x0008000600040002ull) >> 48) - (unsigned int) ((odd * 0x0001000100010001ull) >> 48);
+            s1 += (unsigned int) ((pairs * 0x0001000100010001ull) >> 48);
+         }
+      }
+#endif
+      for (; i < blocklen; ++i) { s1 += p[i]; s2 += s1; }
+      s1 %= 65521; s2 %= 65521;
+      j += blocklen;
+      blocklen = 5552;
+   }
+   return s1 | (s2 << 16);
+}
+
 #endif // STBIW_ZLIB_COMPRESS
 
 STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
@@ -1000,15 +1131,8 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
 
    {
       // compute adler32 on input
-      unsigned int s1=1, s2=0;
-      int blocklen = (int) (data_len % 5552);
-      j=0;
-      while (j < data_len) {
-         for (i=0; i < blocklen; ++i) { s1 += data[j+i]; s2 += s1; }
-         s1 %= 65521; s2 %= 65521;
-         j += blocklen;
-         blocklen = 5552;
-      }
+      unsigned int adler = stbiw__adler32(data, data_len);
+      unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
       stbiw__sbpush(out, STBIW_UCHAR(s2 >> 8));
       stbiw__sbpush(out, STBIW_UCHAR(s2));
       stbiw__sbpush(out, STBIW_UCHAR(s1 >> 8));
@@ -1021,55 +1145,123 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
 #endif // STBIW_ZLIB_COMPRESS
 }
 
+// CRC-32 (PNG chunks). Buffers of STBIW__CKSUM_MIN bytes and up go through
+// slicing-by-8: eight tables derived from the byte table on first use, one
+// aligned 8-byte step per iteration instead of eight dependent lookups.
+// There is no carry-less multiply to use on the U54 harts (no Zbc).
+
+static unsigned int stbiw__crc32_slice[8][256];
+static int stbiw__crc32_slice_ready;
+
+static const unsigned int stbiw__crc32_table[256] =
+{
+   0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+   0x0eDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+   0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+   0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+   0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+   0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+   0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+   0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+   0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+   0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+   0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+   0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+   0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+   0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+   0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+   0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+   0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+   0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+   0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+   0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+   0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+   0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+   0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+   0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+   0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+   0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+   0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+   0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+   0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+   0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+   0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+   0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+static unsigned int stbiw__crc32_bytewise(unsigned int crc, const unsigned char *buffer, int len)
+{
+   int i;
+   for (i=0; i < len; ++i)
+      crc = (crc >> 8) ^ stbiw__crc32_table[buffer[i] ^ (crc & 0xff)];
+   return crc;
+}
+
+static void stbiw__crc32_init_slice(void)
+{
+   int i, k;
+   // Concurrent first calls all write the same values
+   for (i=0; i < 256; ++i) {
+      unsigned int c = stbiw__crc32_table[i];
+      stbiw__crc32_slice[0][i] = c;
+      for (k=1; k < 8; ++k) {
+         c = (c >> 8) ^ stbiw__crc32_table[c & 0xff];
+         stbiw__crc32_slice[k][i] = c;
+      }
+   }
+#ifdef __GNUC__
+   __atomic_store_n(&stbiw__crc32_slice_ready, 1, __ATOMIC_RELEASE);
+#else
+   stbiw__crc32_slice_ready = 1;
+#endif
+}
+
+static unsigned int stbiw__crc32_slice8(unsigned int crc, const unsigned char *buffer, int len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   const unsigned int (*t)[256] = (const unsigned int (*)[256]) stbiw__crc32_slice;
+   int ready;
+#ifdef __GNUC__
+   ready = __atomic_load_n(&stbiw__crc32_slice_ready, __ATOMIC_ACQUIRE);
+#else
+   ready = stbiw__crc32_slice_ready;
+#endif
+   if (!ready) stbiw__crc32_init_slice();
+   // Byte steps up to 4-byte alignment; the harts trap on misaligned loads
+   while (len > 0 && ((size_t) buffer & 3)) {
+      crc = (crc >> 8) ^ stbiw__crc32_table[*buffer++ ^ (crc & 0xff)];
+      --len;
+   }
+   while (len >= 8) {
+      unsigned int lo, hi;
+      STBIW_MEMMOVE(&lo, STBIW__ALIGNED(buffer, 4), 4);
+      STBIW_MEMMOVE(&hi, STBIW__ALIGNED(buffer + 4, 4), 4);
+      lo ^= crc;
+      crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+      buffer += 8;
+      len -= 8;
+   }
+#endif
+   return stbiw__crc32_bytewise(crc, buffer, len);
+}
+
 static unsigned int stbiw__crc32(unsigned char *buffer, int len)
 {
 #ifdef STBIW_CRC32
     return STBIW_CRC32(buffer, len);
 #else
-   static unsigned int crc_table[256] =
-   {
-      0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
-      0x0eDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
-      0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-      0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
-      0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
-      0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-      0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
-      0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
-      0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-      0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
-      0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
-      0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-      0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
-      0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
-      0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-      0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
-      0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
-      0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-      0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
-      0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
-      0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-      0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
-      0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
-      0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-      0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
-      0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
-      0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-      0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
-      0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
-      0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-      0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
-      0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-   };
-
-   unsigned int crc = ~0u;
-   int i;
-   for (i=0; i < len; ++i)
-      crc = (crc >> 8) ^ crc_table[buffer[i] ^ (crc & 0xff)];
-   return ~crc;
+   int impl = stbi_write_checksum_impl ? stbi_write_checksum_impl : len >= STBIW__CKSUM_MIN ? 2 : 1;
+   return ~(impl == 2 ? stbiw__crc32_slice8(~0u, buffer, len) : stbiw__crc32_bytewise(~0u, buffer, len));
 #endif
 }
 
+STBIWDEF unsigned int stbi_write_crc32(unsigned int crc, const unsigned char *data, int len)
+{
+   int impl = stbi_write_checksum_impl ? stbi_write_checksum_impl : len >= STBIW__CKSUM_MIN ? 2 : 1;
+   return ~(impl == 2 ? stbiw__crc32_slice8(~crc, data, len) : stbiw__crc32_bytewise(~crc, data, len));
+}
+
 #define stbiw__wpng4(o,a,b,c,d) ((o)[0]=STBIW_UCHAR(a),(o)[1]=STBIW_UCHAR(b),(o)[2]=STBIW_UCHAR(c),(o)[3]=STBIW_UCHAR(d),(o)+=4)
 #define stbiw__wp32(data,v) stbiw__wpng4(data, (v)>>24,(v)>>16,(v)>>8,(v));
 #define stbiw__wptag(data,s) stbiw__wpng4(data, s[0],s[1],s[2],s[3])
@@ -1325,7 +1517,19 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+static void stbiw__jpg_bandEnergy(const int *DU, stbi_jpg_block_energy *e) {
+   unsigned int low = 0, mid = 0, high = 0;
+   int i;
+   for(i = 1; i < 6; ++i)   low  += DU[i] < 0 ? -DU[i] : DU[i];
+   for(i = 6; i < 28; ++i)  mid  += DU[i] < 0 ? -DU[i] : DU[i];
+   for(i = 28; i < 64; ++i) high += DU[i] < 0 ? -DU[i] : DU[i];
+   e->dc   = (unsigned short) (DU[0] < 0 ? -DU[0] : DU[0]);
+   e->low  = (unsigned short) (low  > 65535 ? 65535 : low);
+   e->mid  = (unsigned short) (mid  > 65535 ? 65535 : mid);
+   e->high = (unsigned short) (high > 65535 ? 65535 : high);
+}
+
+static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2], stbi_jpg_block_energy *energy, int coeffs) {
    const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
    const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
    int dataOff, i, j, n, diff, end0pos, x, y;
@@ -1351,6 +1555,13 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
          DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
       }
    }
+   if(energy) {
+      stbiw__jpg_bandEnergy(DU, energy);
+   }
+   // Drop the high frequencies (energy above still describes the full block)
+   for(i = coeffs; i < 64; ++i) {
+      DU[i] = 0;
+   }
 
    // Encode DC
    diff = DU[0] - DC;
@@ -1395,7 +1606,46 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
+// Deadline fallback: the DC coefficient is the block sum (the DCT is unscaled,
+// fdtbl carries the 1/8), so it can be coded without transforming the block.
+// The block's energy entry gets the DC only.
+static int stbiw__jpg_processDC(stbi__write_context *s, int *bitBuf, int *bitCnt, const float *CDU, int du_stride, const float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2], stbi_jpg_block_energy *energy) {
+   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+   float sum = 0, v;
+   int x, y, dc, diff;
+   for(y = 0; y < 8; ++y) {
+      for(x = 0; x < 8; ++x) {
+         sum += CDU[y*du_stride+x];
+      }
+   }
+   v = sum*fdtbl[0];
+   dc = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+   if(energy) {
+      energy->dc = (unsigned short) (dc < 0 ? -dc : dc);
+      energy->low = energy->mid = energy->high = 0;
+   }
+   diff = dc - DC;
+   if (diff == 0) {
+      stbiw__jpg_writeBits(s, bitBuf, bitCnt, HTDC[0]);
+   } else {
+      unsigned short bits[2];
+      stbiw__jpg_calcBits(diff, bits);
+      stbiw__jpg_writeBits(s, bitBuf, bitCnt, HTDC[bits[1]]);
+      stbiw__jpg_writeBits(s, bitBuf, bitCnt, bits);
+   }
+   stbiw__jpg_writeBits(s, bitBuf, bitCnt, EOB);
+   return dc;
+}
+
+// Feature map entry for luma block (bx,by) of the encoded image, NULL if not
+// wanted or in the MCU padding
+static stbi_jpg_block_energy *stbiw__jpg_blockEnergy(stbi_jpg_block_energy *features, int width, int height, int bx, int by) {
+   int bw = (width+7)/8, bh = (height+7)/8;
+   if(!features || bx >= bw || by >= bh) return NULL;
+   return &features[by*bw + bx];
+}
+
+static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, stbi_jpg_params *params, stbi_jpg_block_energy *features) {
    // Constants that don't pollute global namespace
    static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
    static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
@@ -1467,7 +1717,7 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
    static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
                                  1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
-   int row, col, i, k, subsample;
+   int row, col, i, k, subsample, quality, coeffs, dc_only;
    float fdtbl_Y[64], fdtbl_UV[64];
    unsigned char YTable[64], UVTable[64];
 
@@ -1475,8 +1725,11 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       return 0;
    }
 
-   quality = quality ? quality : 90;
-   subsample = quality <= 90 ? 1 : 0;
+   quality = params->quality ? params->quality : 90;
+   subsample = params->subsample ? params->subsample == 1 : quality <= 90;
+   coeffs = params->coeffs < 1 || params->coeffs > 64 ? 64 : params->coeffs;
+   params->dc_only_rows = 0;
+   dc_only = 0;
    quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
    quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
 
@@ -1500,7 +1753,18 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
       const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
                                       3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
-      s->func(s->context, (void*)head0, sizeof(head0));
+      // SOI + APP0, then the optional COM segment, then the DQT
+      s->func(s->context, (void*)head0, 20);
+      if(params->comment) {
+         int len = (int) strlen(params->comment);
+         if(len > 65533) len = 65533;
+         stbiw__putc(s, 0xFF);
+         stbiw__putc(s, 0xFE);
+         stbiw__putc(s, (unsigned char)((len+2)>>8));
+         stbiw__putc(s, STBIW_UCHAR(len+2));
+         s->func(s->context, (void*)params->comment, len);
+      }
+      s->func(s->context, (void*)(head0+20), sizeof(head0)-20);
       s->func(s->context, (void*)YTable, sizeof(YTable));
       stbiw__putc(s, 1);
       s->func(s->context, UVTable, sizeof(UVTable));
@@ -1532,6 +1796,8 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       int x, y, pos;
       if(subsample) {
          for(y = 0; y < height; y += 16) {
+            if(!dc_only && params->expired && params->expired(params->user)) dc_only = 1;
+            params->dc_only_rows += dc_only;
             for(x = 0; x < width; x += 16) {
                float Y[256], U[256], V[256];
                for(row = y, pos = 0; row < y+16; ++row) {
@@ -1547,10 +1813,17 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                      V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
                   }
                }
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+               if(dc_only) {
+                  DCY = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8,   y/8));
+                  DCY = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8+1, y/8));
+                  DCY = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8,   y/8+1));
+                  DCY = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8+1, y/8+1));
+               } else {
+                  DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8,   y/8),   coeffs);
+                  DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8+1, y/8),   coeffs);
+                  DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8,   y/8+1), coeffs);
+                  DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8+1, y/8+1), coeffs);
+               }
 
                // subsample U,V
                {
@@ -1563,13 +1836,20 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                         subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
                      }
                   }
-                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+                  if(dc_only) {
+                     DCU = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT, NULL);
+                     DCV = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT, NULL);
+                  } else {
+                     DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT, NULL, coeffs);
+                     DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT, NULL, coeffs);
+                  }
                }
             }
          }
       } else {
          for(y = 0; y < height; y += 8) {
+            if(!dc_only && params->expired && params->expired(params->user)) dc_only = 1;
+            params->dc_only_rows += dc_only;
             for(x = 0; x < width; x += 8) {
                float Y[64], U[64], V[64];
                for(row = y, pos = 0; row < y+8; ++row) {
@@ -1586,9 +1866,15 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                   }
                }
 
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
-               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+               if(dc_only) {
+                  DCY = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8, y/8));
+                  DCU = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT, NULL);
+                  DCV = stbiw__jpg_processDC(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT, NULL);
+               } else {
+                  DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT, stbiw__jpg_blockEnergy(features, width, height, x/8, y/8), coeffs);
+                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT, NULL, coeffs);
+                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT, NULL, coeffs);
+               }
             }
          }
       }
@@ -1607,8 +1893,35 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
 {
    stbi__write_context s = { 0 };
+   stbi_jpg_params p = { 0 };
+   p.quality = quality;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality);
+   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, &p, NULL);
+}
+
+STBIWDEF int stbi_write_jpg_features_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality, stbi_jpg_block_energy *features)
+{
+   stbi__write_context s = { 0 };
+   stbi_jpg_params p = { 0 };
+   p.quality = quality;
+   stbi__start_write_callbacks(&s, func, context);
+   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, &p, features);
+}
+
+STBIWDEF int stbi_write_jpg_to_buffer(unsigned char *buffer, int capacity, int x, int y, int comp, const void *data, int quality, stbi_jpg_block_energy *features)
+{
+   stbi_jpg_params p = { 0 };
+   p.quality = quality;
+   return stbi_write_jpg_to_buffer_ex(buffer, capacity, x, y, comp, data, &p, features);
+}
+
+STBIWDEF int stbi_write_jpg_to_buffer_ex(unsigned char *buffer, int capacity, int x, int y, int comp, const void *data, stbi_jpg_params *params, stbi_jpg_block_energy *features)
+{
+   stbi__write_context s = { 0 };
+   stbi__start_write_buffer(&s, buffer, capacity);
+   if (!stbi_write_jpg_core(&s, x, y, comp, (void *) data, params, features) || s.overflow)
+      return 0;
+   return (int) (s.out - buffer);
 }
 
 
@@ -1616,8 +1929,23 @@ STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x,
 STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const void *data, int quality)
 {
    stbi__write_context s = { 0 };
+   stbi_jpg_params p = { 0 };
+   p.quality = quality;
+   if (stbi__start_write_file(&s,filename)) {
+      int r = stbi_write_jpg_core(&s, x, y, comp, data, &p, NULL);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_jpg_features(char const *filename, int x, int y, int comp, const void *data, int quality, stbi_jpg_block_energy *features)
+{
+   stbi__write_context s = { 0 };
+   stbi_jpg_params p = { 0 };
+   p.quality = quality;
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_jpg_core(&s, x, y, comp, data, quality);
+      int r = stbi_write_jpg_core(&s, x, y, comp, data, &p, features);
       stbi__end_write_file(&s);
       return r;
    } else
@@ -0,0 +1,315 @@
+// strobe.h - Exposure-synchronized LED strobe on a PWM channel.
+//
+// Motion blur is belt speed times exposure time. Shortening the exposure
+// costs light; a strobe brings it back for only as long as the pulse, so
+// the effective exposure is the pulse width while the frame rate stays.
+//
+// A second channel of the PWM chip drives the LED: period = frame
+// interval, duty = pulse width. The sysfs interface has no phase control,
+// but enabling a channel starts its first period (output high) at that
+// moment, so the phase is set by *when* "1" is written to enable. After
+// that the channel runs freely; no per-frame userspace timing is involved.
+//
+// The frame clock comes from V4L2 buffer timestamps (CLOCK_MONOTONIC, the
+// same clock as clock_nanosleep here). Each frame's target is
+//   target = timestamp + offset_us
+// offset_us moves the pulse into the exposure: near 0 for drivers that
+// stamp the start of exposure (V4L2_BUF_FLAG_TSTAMP_SRC_SOE), minus the
+// readout time for those that stamp the end of the frame (most UVC).
+// strobe_frame() compares every target with where the running pulse train
+// puts its nearest pulse and records the error. The frame period and phase
+// are tracked with an alpha-beta filter over the timestamps, so single
+// late stamps do not move them. The camera's crystal and the PWM's differ,
+// so the tracked phase drifts against the pulses; once it is
+// STROBE_RESYNC_US off (or the frame interval changes, e.g. caprate idle
+// mode), the sync thread re-arms: period set to the tracked frame interval, channel disabled,
+// clock_nanosleep() to just before the next target, enable written. The
+// time that write takes is learned so it lands on the target.
+//
+// Testing without hardware: strobe_check drives this from a synthetic
+// frame clock against a mock sysfs tree. There the errors are exactly what
+// the algorithm and the scheduler contribute (a real PWM adds nothing).
+//
+// Usage:
+//   struct strobe sb;
+//   strobe_open(&sb, "/sys/class/pwm/pwmchip0", 1, 500, -8000);
+//   per frame: strobe_frame(&sb, ts_ns);
+//   strobe_print(&sb); strobe_close(&sb);
+//
+// Build with -lpthread.
+
+#ifndef STROBE_H
+#define STROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "telemetry.h"
+
+#define STROBE_TOL_US        100        // a pulse this far off its frame's target is counted as over
+#define STROBE_RESYNC_US     50         // re-arm when the tracked frame clock is this far off the pulses
+#define STROBE_LEAD_US       2000       // the sync thread needs at least this before the target
+#define STROBE_MIN_FRAMES    30         // frame clock settled after this many frames
+#define STROBE_PERIOD_TOL    0.002      // re-arm when the frame interval moves this much
+
+enum { STROBE_PERIOD = 0, STROBE_DUTY, STROBE_ENABLE, STROBE_NATTR };
+
+struct strobe {
+    char chan[256];                     // .../pwmchipN/pwmM
+    int fds[STROBE_NATTR];
+    int pulse_us, offset_us;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int running, quit, want_sync;
+
+    // Frame clock: alpha-beta tracker over the timestamps, so one late stamp moves it little
+    double ref_ns;                      // smoothed timestamp of the latest frame
+    double period_ns;                   // 0 until two frames were seen
+    uint64_t frames;
+
+    // Pulse train as last armed
+    int armed;
+    uint64_t anchor_ns;                 // when the first period started
+    uint32_t pwm_period_ns, duty_ns;
+    double write_ns;                    // learned enable write latency
+
+    // Stats
+    uint64_t syncs, checked, over;
+    int64_t err_min, err_max;           // pulse - target, ns
+    double err_sum, err_sq;
+};
+
+static struct tm_hist strobe_err_us = TM_HIST("strobe_err", "us");      // |pulse - target|, every frame
+static struct tm_hist strobe_arm_us = TM_HIST("strobe_arm", "us");      // |enable write - target| at a re-arm
+static struct tm_counter strobe_syncs = TM_COUNTER("strobe_syncs");
+
+static inline uint64_t strobe_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int strobe_write(struct strobe *sb, int attr, long long v) {
+    static const char *names[STROBE_NATTR] = { "period", "duty_cycle", "enable" };
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%lld", v);
+    if (pwrite(sb->fds[attr], buf, n, 0) < 0) {
+        fprintf(stderr, "strobe: %s/%s = %s: %s\n", sb->chan, names[attr], buf, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Program period and duty; the kernel refuses duty > period at every step
+static inline int strobe_program(struct strobe *sb, uint32_t period_ns, uint32_t duty_ns) {
+    if (duty_ns > period_ns / 2) duty_ns = period_ns / 2;
+    int r;
+    if (period_ns >= sb->pwm_period_ns) r = strobe_write(sb, STROBE_PERIOD, period_ns) || strobe_write(sb, STROBE_DUTY, duty_ns);
+    else r = strobe_write(sb, STROBE_DUTY, duty_ns) || strobe_write(sb, STROBE_PERIOD, period_ns);
+    if (r) return -1;
+    sb->pwm_period_ns = period_ns;
+    sb->duty_ns = duty_ns;
+    return 0;
+}
+
+// A re-arm needs a frame interval to repeat; lock held
+static inline int strobe_ready(const struct strobe *sb) {
+    return sb->period_ns > 0 && sb->frames >= STROBE_MIN_FRAMES;
+}
+
+// One re-arm: the pulse train restarts on the first target at least STROBE_LEAD_US away
+static inline void strobe_arm(struct strobe *sb) {
+    pthread_mutex_lock(&sb->lock);
+    uint32_t period = (uint32_t)(sb->period_ns + 0.5);
+    uint32_t duty = (uint32_t)sb->pulse_us * 1000;
+    int64_t target = (int64_t)sb->ref_ns + (int64_t)sb->offset_us * 1000;
+    pthread_mutex_unlock(&sb->lock);
+    if (!period) return;
+
+    if (strobe_write(sb, STROBE_ENABLE, 0) != 0 || strobe_program(sb, period, duty) != 0) return;
+    int64_t earliest = (int64_t)strobe_now_ns() + STROBE_LEAD_US * 1000LL;
+    if (target < earliest) target += ((earliest - target) / period + 1) * (int64_t)period;
+
+    uint64_t wake = (uint64_t)(target - (int64_t)sb->write_ns);
+    struct timespec ts = { (time_t)(wake / 1000000000), (long)(wake % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) ;
+    uint64_t t0 = strobe_now_ns();
+    int r = strobe_write(sb, STROBE_ENABLE, 1);
+    uint64_t t1 = strobe_now_ns();
+    if (r) return;
+
+    // The channel started somewhere inside the write; take the middle
+    uint64_t anchor = t0 + (t1 - t0) / 2;
+    double lat = (double)(anchor - wake);
+    int64_t miss = (int64_t)anchor - target;
+    tm_record(&strobe_arm_us, (uint64_t)(miss < 0 ? -miss : miss) / 1000);
+    tm_count(&strobe_syncs, 1);
+
+    pthread_mutex_lock(&sb->lock);
+    sb->write_ns = sb->syncs ? sb->write_ns + 0.25 * (lat - sb->write_ns) : lat;
+    sb->anchor_ns = anchor;
+    sb->armed = 1;
+    sb->syncs++;
+    pthread_mutex_unlock(&sb->lock);
+}
+
+static inline void *strobe_thread(void *arg) {
+    struct strobe *sb = arg;
+    pthread_mutex_lock(&sb->lock);
+    for (;;) {
+        while (!sb->quit && !(sb->want_sync && strobe_ready(sb))) pthread_cond_wait(&sb->cv, &sb->lock);
+        if (sb->quit) break;
+        pthread_mutex_unlock(&sb->lock);
+        strobe_arm(sb);
+        pthread_mutex_lock(&sb->lock);
+        sb->want_sync = 0;
+    }
+    pthread_mutex_unlock(&sb->lock);
+    return NULL;
+}
+
+// chip: the PWM chip's sysfs directory; the LED starts off until the frame interval is known
+static inline int strobe_open(struct strobe *sb, const char *chip, int channel, int pulse_us, int offset_us) {
+    static const char *names[STROBE_NATTR] = { "period", "duty_cycle", "enable" };
+    char path[320];
+    memset(sb, 0, sizeof(*sb));
+    sb->pulse_us = pulse_us;
+    sb->offset_us = offset_us;
+    sb->err_min = INT64_MAX;
+    sb->err_max = INT64_MIN;
+    for (int i = 0; i < STROBE_NATTR; i++) sb->fds[i] = -1;
+    snprintf(sb->chan, sizeof(sb->chan), "%s/pwm%d", chip, channel);
+
+    // Export (EBUSY: already exported)
+    snprintf(path, sizeof(path), "%s/export", chip);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        char buf[16];
+        int n = snprintf(buf, sizeof(buf), "%d", channel);
+        if (write(fd, buf, n) < 0 && errno != EBUSY) fprintf(stderr, "strobe: export %d: %s\n", channel, strerror(errno));
+        close(fd);
+    }
+    for (int i = 0; i < STROBE_NATTR; i++) {
+        snprintf(path, sizeof(path), "%s/%s", sb->chan, names[i]);
+        // A freshly exported channel's files show up a moment later
+        for (int tries = 0; (sb->fds[i] = open(path, O_WRONLY | O_CLOEXEC)) < 0 && tries < 20; tries++) usleep(5000);
+        if (sb->fds[i] < 0) {
+            fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno));
+            for (int j = 0; j < i; j++) close(sb->fds[j]);
+            return -1;
+        }
+    }
+    strobe_write(sb, STROBE_ENABLE, 0);
+
+    pthread_mutex_init(&sb->lock, NULL);
+    pthread_cond_init(&sb->cv, NULL);
+    if (pthread_create(&sb->thread, NULL, strobe_thread, sb) != 0) {
+        perror("strobe: pthread_create");
+        for (int i = 0; i < STROBE_NATTR; i++) close(sb->fds[i]);
+        return -1;
+    }
+    sb->running = 1;
+    printf("Strobe: %s, %d us pulse at frame %+d us\n", sb->chan, pulse_us, offset_us);
+    return 0;
+}
+
+// Live changes (config reload); a new pulse width re-arms, once the frame interval is known
+static inline void strobe_set(struct strobe *sb, int pulse_us, int offset_us) {
+    pthread_mutex_lock(&sb->lock);
+    if (pulse_us != sb->pulse_us) sb->want_sync = 1;
+    sb->pulse_us = pulse_us;
+    sb->offset_us = offset_us;
+    if (sb->want_sync && strobe_ready(sb)) pthread_cond_signal(&sb->cv);
+    pthread_mutex_unlock(&sb->lock);
+}
+
+// Pulse nearest t minus t, for the train as armed
+static inline int64_t strobe_phase_err(const struct strobe *sb, int64_t t) {
+    int64_t p = sb->pwm_period_ns, d = t - (int64_t)sb->anchor_ns;
+    int64_t k = d >= 0 ? (d + p / 2) / p : -((-d + p / 2) / p);
+    return (int64_t)sb->anchor_ns + k * p - t;
+}
+
+// Per frame, with its V4L2 timestamp in ns
+static inline void strobe_frame(struct strobe *sb, uint64_t ts_ns) {
+    pthread_mutex_lock(&sb->lock);
+    double ts = (double)ts_ns;
+    if (!sb->frames) {
+        sb->ref_ns = ts;
+    } else if (!sb->period_ns) {
+        sb->period_ns = ts - sb->ref_ns;
+        sb->ref_ns = ts;
+    } else {
+        // Skipped frames are whole periods; a residual over a quarter period is a new rate (idle mode)
+        double n = floor((ts - sb->ref_ns) / sb->period_ns + 0.5);
+        double r = ts - (sb->ref_ns + n * sb->period_ns);
+        if (n < 1 || r > sb->period_ns / 4 || r < -sb->period_ns / 4) {
+            if (ts > sb->ref_ns) sb->period_ns = ts - sb->ref_ns;
+            sb->ref_ns = ts;
+        } else {
+            // Period gain starts high and settles, so the first re-arm already has a good period
+            double beta = sb->frames < 100 ? 1.0 / sb->frames : 0.01;
+            sb->ref_ns += n * sb->period_ns + 0.125 * r;
+            sb->period_ns += beta * r / n;
+        }
+    }
+    sb->frames++;
+
+    int resync = !sb->armed;
+    if (sb->armed && !sb->want_sync) {
+        int64_t err = strobe_phase_err(sb, (int64_t)ts_ns + (int64_t)sb->offset_us * 1000);
+        sb->checked++;
+        if (err < sb->err_min) sb->err_min = err;
+        if (err > sb->err_max) sb->err_max = err;
+        sb->err_sum += err;
+        sb->err_sq += (double)err * err;
+        tm_record(&strobe_err_us, (uint64_t)(err < 0 ? -err : err) / 1000);
+        if (err > STROBE_TOL_US * 1000 || err < -STROBE_TOL_US * 1000) sb->over++;
+        // Re-arm on the tracked clock, not on one noisy stamp
+        int64_t drift = strobe_phase_err(sb, (int64_t)sb->ref_ns + (int64_t)sb->offset_us * 1000);
+        if (drift > STROBE_RESYNC_US * 1000 || drift < -STROBE_RESYNC_US * 1000) resync = 1;
+        if (sb->period_ns && (sb->pwm_period_ns > sb->period_ns * (1 + STROBE_PERIOD_TOL) ||
+                              sb->pwm_period_ns < sb->period_ns * (1 - STROBE_PERIOD_TOL))) resync = 1;
+    }
+    // A re-arm asked for before the interval was known (strobe_set) goes now
+    if (resync && sb->frames >= STROBE_MIN_FRAMES) sb->want_sync = 1;
+    if (sb->want_sync && strobe_ready(sb)) pthread_cond_signal(&sb->cv);
+    pthread_mutex_unlock(&sb->lock);
+}
+
+static inline void strobe_close(struct strobe *sb) {
+    if (!sb->running) return;
+    pthread_mutex_lock(&sb->lock);
+    sb->quit = 1;
+    pthread_cond_signal(&sb->cv);
+    pthread_mutex_unlock(&sb->lock);
+    pthread_join(sb->thread, NULL);
+    strobe_write(sb, STROBE_ENABLE, 0);
+    for (int i = 0; i < STROBE_NATTR; i++) close(sb->fds[i]);
+    pthread_mutex_destroy(&sb->lock);
+    pthread_cond_destroy(&sb->cv);
+    sb->running = 0;
+}
+
+static inline void strobe_print(struct strobe *sb) {
+    pthread_mutex_lock(&sb->lock);
+    printf("Strobe: %llu frames, %llu re-arms, %llu over %d us", (unsigned long long)sb->frames, (unsigned long long)sb->syncs,
+           (unsigned long long)sb->over, STROBE_TOL_US);
+    if (sb->checked) {
+        double mean = sb->err_sum / sb->checked, var = sb->err_sq / sb->checked - mean * mean;
+        printf(" (pulse - target us: min %.1f avg %.1f max %.1f, jitter %.1f rms; period %u ns, write %.1f us)", sb->err_min / 1e3,
+               mean / 1e3, sb->err_max / 1e3, (var > 0 ? sqrt(var) : 0) / 1e3, sb->pwm_period_ns, sb->write_ns / 1e3);
+    }
+    printf("\n");
+    pthread_mutex_unlock(&sb->lock);
+}
+
+#endif // STROBE_H
@@ -0,0 +1,87 @@
+// Strobe sync check (strobe.h) against a synthetic frame clock.
+// Generates frame timestamps the way a camera would - a nominal rate off
+// by drift_ppm, each stamped with up to jitter_us of noise, seen by the
+// loop about a millisecond late - feeds them to strobe_frame() and reports
+// how far the pulses land from their targets and how often the train had
+// to be re-armed. With "-" as the chip it builds a mock sysfs PWM tree in
+// /tmp, so it runs anywhere; on the board give the real chip and watch the
+// LED with a photodiode on a scope as well.
+//
+// Usage: strobe_check <pwmchip|-> [channel] [fps] [pulse_us] [offset_us] [frames] [drift_ppm] [jitter_us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "telemetry.h"
+#include "strobe.h"
+
+static char mock[64];
+
+// pwmchipN with export and pwmM/{period,duty_cycle,enable} as plain files
+static const char *mock_chip(int channel) {
+    static char chip[128];
+    char path[256];
+    snprintf(mock, sizeof(mock), "/tmp/strobe_mock.XXXXXX");
+    if (!mkdtemp(mock)) { perror("mkdtemp"); return NULL; }
+    snprintf(chip, sizeof(chip), "%s/pwmchip0", mock);
+    mkdir(chip, 0755);
+    snprintf(path, sizeof(path), "%s/pwm%d", chip, channel);
+    mkdir(path, 0755);
+    const char *files[] = { "export", "unexport" }, *attrs[] = { "period", "duty_cycle", "enable" };
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", chip, files[i]);
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/pwm%d/%s", chip, channel, attrs[i]);
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    return chip;
+}
+
+static void mock_remove(int channel) {
+    char cmd[128];
+    if (!mock[0]) return;
+    (void)channel;
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", mock);
+    if (system(cmd) != 0) fprintf(stderr, "WARNING: could not remove %s\n", mock);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <pwmchip|-> [channel] [fps] [pulse_us] [offset_us] [frames] [drift_ppm] [jitter_us]\n", argv[0]);
+        return 1;
+    }
+    int channel = (argc >= 3) ? atoi(argv[2]) : 1;
+    double fps = (argc >= 4) ? atof(argv[3]) : 30;
+    int pulse_us = (argc >= 5) ? atoi(argv[4]) : 500;
+    int offset_us = (argc >= 6) ? atoi(argv[5]) : 0;
+    int frames = (argc >= 7) ? atoi(argv[6]) : 300;
+    double drift_ppm = (argc >= 8) ? atof(argv[7]) : 50;
+    int jitter_us = (argc >= 9) ? atoi(argv[8]) : 20;
+    const char *chip = strcmp(argv[1], "-") ? argv[1] : mock_chip(channel);
+    struct strobe sb;
+
+    if (!chip || strobe_open(&sb, chip, channel, pulse_us, offset_us) != 0) return 1;
+
+    double period = 1e9 / fps * (1 + drift_ppm * 1e-6);
+    uint64_t start = strobe_now_ns() + 10000000;
+    srand(1);
+    for (int i = 0; i < frames; i++) {
+        uint64_t ts = start + (uint64_t)(i * period) + (jitter_us ? rand() % (2 * jitter_us + 1) - jitter_us : 0) * 1000LL;
+        uint64_t seen = ts + 1000000;       // dequeued ~1 ms after the timestamp
+        struct timespec t = { (time_t)(seen / 1000000000), (long)(seen % 1000000000) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) ;
+        strobe_frame(&sb, ts);
+    }
+
+    strobe_print(&sb);
+    tm_print(stdout);
+    strobe_close(&sb);
+    mock_remove(channel);
+    return 0;
+}
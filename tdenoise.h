@@ -0,0 +1,233 @@
+// tdenoise.h - Temporal denoising of packed 4:2:2 frames.
+//
+// Shorter exposures cut motion blur but raise sensor noise. While a box is
+// stopped or creeping along the belt, the last K frames show the same
+// thing, and averaging them cuts the noise by sqrt(K).
+//
+// Everything works on the YUYV / UYVY / YVYU bytes as they come from the
+// driver, so the output is another frame in the same format and goes into
+// pixfmt_convert() (RGB or tensor) or encpool_submit() unchanged.
+//
+// Alignment: the belt only moves things along x. Each new frame is matched
+// against the previous one by luma SAD on every TDN_ALIGN_STEP-th row over
+// shifts of up to TDN_MAX_SHIFT pixels, in whole macropixels (2 pixels, 4
+// bytes) so chroma pairs stay intact. Sensor noise alone leaves a residual
+// that grows as the exposure shortens, so that floor is tracked; a match
+// well above it (a new box, a lighting change) or one at the search limit
+// drops the history and averaging restarts.
+//
+// Cost per frame is O(pixels) whatever K is. The per-byte sums live in
+// 16-bit lanes in the coordinates of the newest frame; a new frame adds its
+// bytes, the oldest subtracts its own at the offset it has drifted by, and
+// a shift moves the sums along (memmove). Bytes shifted in from the edge
+// have fewer frames behind them, so each byte column keeps its own count
+// and the output divides by that count with a reciprocal table. Each frame
+// also keeps the byte columns it is still part of: a shift pushes some of
+// it out over the edge for good, even if a later shift back brings its
+// offset to 0 again, and it must only be subtracted where it was added.
+// Additions and subtractions go four lanes per 64-bit word (SWAR; the U54
+// has no vector unit), on 8-byte aligned rows.
+//
+// Usage:
+//   struct tdenoise td;
+//   tdn_init(&td, V4L2_PIX_FMT_YUYV, 320, 240, 4);
+//   per frame: tdn_push(&td, frame, stride);
+//              tdn_output(&td, out, 320 * 2);
+//   tdn_free(&td);
+
+#ifndef TDENOISE_H
+#define TDENOISE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/videodev2.h>
+
+#define TDN_MAX_K       16          // 16 * 255 still fits a 16-bit lane
+#define TDN_MAX_SHIFT   16          // pixels per frame, either way
+#define TDN_ALIGN_STEP  8           // rows used for alignment
+#define TDN_RESET_SAD   12          // mean luma difference over twice the noise floor that means a new scene
+
+struct tdenoise {
+    int width, height, k;
+    int luma;                       // byte offset of Y in a pixel pair
+    int rowb;                       // bytes per row, width * 2
+    uint8_t *ring[TDN_MAX_K];       // copies of the last k frames, rowb stride
+    int off[TDN_MAX_K];             // their x offset in pixels relative to the newest
+    int lo[TDN_MAX_K], hi[TDN_MAX_K];   // byte columns of sum/cnt they are still in
+    int head, n;                    // ring[head] is the newest
+    uint16_t *sum;                  // per byte, newest frame's coordinates
+    uint8_t *cnt;                   // frames behind each byte column
+    uint32_t recip[TDN_MAX_K + 1];  // 2^16 / n
+
+    double noise_sad;               // mean luma SAD of aligned same-scene frames, 0 until known
+    uint64_t frames, resets, shifted;
+    int last_shift;
+};
+
+static inline void tdn_free(struct tdenoise *t) {
+    for (int i = 0; i < TDN_MAX_K; i++) free(t->ring[i]);
+    free(t->sum);
+    free(t->cnt);
+    memset(t, 0, sizeof(*t));
+}
+
+// k frames of history (1 = pass-through). Returns -1 if fourcc is not packed 4:2:2.
+static inline int tdn_init(struct tdenoise *t, uint32_t fourcc, int width, int height, int k) {
+    memset(t, 0, sizeof(*t));
+    if (fourcc != V4L2_PIX_FMT_YUYV && fourcc != V4L2_PIX_FMT_YVYU && fourcc != V4L2_PIX_FMT_UYVY) return -1;
+    t->width = width & ~1;
+    t->height = height;
+    t->k = k < 1 ? 1 : k > TDN_MAX_K ? TDN_MAX_K : k;
+    t->luma = fourcc == V4L2_PIX_FMT_UYVY;
+    t->rowb = t->width * 2;
+    for (int i = 0; i < t->k; i++) {
+        t->ring[i] = aligned_alloc(8, ((size_t)t->rowb * height + 7) & ~(size_t)7);
+        if (!t->ring[i]) goto fail;
+    }
+    t->sum = aligned_alloc(8, (size_t)t->rowb * height * sizeof(*t->sum));
+    t->cnt = calloc(1, t->rowb);
+    if (!t->sum || !t->cnt) goto fail;
+    for (int i = 1; i <= TDN_MAX_K; i++) t->recip[i] = (65536 + i / 2) / i;
+    return 0;
+fail:
+    perror("Malloc failed");
+    tdn_free(t);
+    return -1;
+}
+
+// Drop the history. tdn_output() needs at least one frame pushed after this.
+static inline void tdn_reset(struct tdenoise *t) {
+    t->n = 0;
+}
+
+// Best x shift (pixels, even) of cur against prev: cur(x) ~ prev(x - shift).
+// *sad gets the mean absolute luma difference at that shift.
+static inline int tdn_align(const struct tdenoise *t, const uint8_t *cur, int cur_stride, const uint8_t *prev, int *sad) {
+    int best = 0;
+    uint64_t best_sad = UINT64_MAX;
+    long best_n = 1;
+    for (int d = -TDN_MAX_SHIFT; d <= TDN_MAX_SHIFT; d += 2) {
+        int x0 = d > 0 ? d : 0, x1 = d < 0 ? t->width + d : t->width;
+        uint64_t s = 0;
+        long n = 0;
+        for (int y = TDN_ALIGN_STEP / 2; y < t->height; y += TDN_ALIGN_STEP) {
+            const uint8_t *c = cur + (size_t)y * cur_stride + t->luma;
+            const uint8_t *p = prev + (size_t)y * t->rowb + t->luma;
+            for (int x = x0; x < x1; x += 2) {
+                int e = c[x * 2] - p[(x - d) * 2];
+                s += e < 0 ? -e : e;
+            }
+            n += (x1 - x0 + 1) / 2;
+        }
+        // Compare means (overlap shrinks with |d|); on a tie the smaller shift wins
+        if (n && (best_sad == UINT64_MAX || s * best_n < best_sad * n ||
+                  (s * best_n == best_sad * n && abs(d) < abs(best)))) {
+            best_sad = s;
+            best_n = n;
+            best = d;
+        }
+    }
+    *sad = best_n ? (int)(best_sad / best_n) : 255;
+    return best;
+}
+
+// Four bytes into four 16-bit lanes
+static inline uint64_t tdn_spread(uint32_t v) {
+    return (v & 0xff) | (uint64_t)(v & 0xff00) << 8 | (uint64_t)(v & 0xff0000) << 16 | (uint64_t)(v & 0xff000000) << 24;
+}
+
+// sum[dst .. dst+len) += / -= src[0 .. len), len and dst multiples of 4.
+// A lane must hold at least what is subtracted from it or the borrow runs
+// into the next one.
+static inline void tdn_accumulate(uint16_t *sum, const uint8_t *src, int len, int sub) {
+    uint64_t *s = (uint64_t *)sum;
+    const uint32_t *p = (const uint32_t *)src;
+    if (sub) for (int i = 0; i < len / 4; i++) s[i] -= tdn_spread(p[i]);
+    else     for (int i = 0; i < len / 4; i++) s[i] += tdn_spread(p[i]);
+}
+
+// Add a frame (any stride) to the history
+static inline void tdn_push(struct tdenoise *t, const uint8_t *frame, int stride) {
+    int rowb = t->rowb, h = t->height;
+    int shift = 0, sad = 0;
+    t->frames++;
+    if (t->n && t->k > 1) {
+        shift = tdn_align(t, frame, stride, t->ring[t->head], &sad);
+        if ((t->noise_sad && sad > t->noise_sad * 2 + TDN_RESET_SAD) || shift == TDN_MAX_SHIFT || shift == -TDN_MAX_SHIFT) {
+            t->resets++;
+            t->n = 0;
+            shift = 0;
+        } else {
+            t->noise_sad = t->noise_sad ? t->noise_sad + (sad - t->noise_sad) / 8 : sad;
+        }
+    }
+    t->last_shift = shift;
+
+    if (t->n == 0) {
+        memset(t->sum, 0, (size_t)rowb * h * sizeof(*t->sum));
+        memset(t->cnt, 0, rowb);
+    } else if (shift) {
+        // Move the sums to the new frame's coordinates; what moves in has no history
+        int b = shift * 2, keep = rowb - (b > 0 ? b : -b);
+        t->shifted++;
+        for (int y = 0; y < h; y++) {
+            uint16_t *row = t->sum + (size_t)y * rowb;
+            if (b > 0) { memmove(row + b, row, keep * sizeof(*row)); memset(row, 0, b * sizeof(*row)); }
+            else       { memmove(row, row - b, keep * sizeof(*row)); memset(row + keep, 0, -b * sizeof(*row)); }
+        }
+        if (b > 0) { memmove(t->cnt + b, t->cnt, keep); memset(t->cnt, 0, b); }
+        else       { memmove(t->cnt, t->cnt - b, keep); memset(t->cnt + keep, 0, -b); }
+        for (int i = 0; i < t->n; i++) {
+            int j = (t->head - i + t->k) % t->k;
+            t->off[j] += shift;
+            t->lo[j] = t->lo[j] + b < 0 ? 0 : t->lo[j] + b;
+            t->hi[j] = t->hi[j] + b > rowb ? rowb : t->hi[j] + b;
+        }
+    }
+
+    // The oldest frame leaves the columns it is still in: its x maps to x + off
+    if (t->n == t->k) {
+        int o = (t->head + 1) % t->k;
+        int ob = t->off[o] * 2, lo = t->lo[o], len = t->hi[o] - lo;
+        if (len > 0) {
+            for (int y = 0; y < h; y++)
+                tdn_accumulate(t->sum + (size_t)y * rowb + lo, t->ring[o] + (size_t)y * rowb + lo - ob, len, 1);
+            for (int x = lo; x < lo + len; x++) t->cnt[x]--;
+        }
+        t->n--;
+    }
+
+    // The new frame becomes the newest, at offset 0
+    t->head = (t->head + 1) % t->k;
+    uint8_t *dst = t->ring[t->head];
+    for (int y = 0; y < h; y++) memcpy(dst + (size_t)y * rowb, frame + (size_t)y * stride, rowb);
+    t->off[t->head] = 0;
+    t->lo[t->head] = 0;
+    t->hi[t->head] = rowb;
+    for (int y = 0; y < h; y++) tdn_accumulate(t->sum + (size_t)y * rowb, dst + (size_t)y * rowb, rowb, 0);
+    for (int x = 0; x < rowb; x++) t->cnt[x]++;
+    t->n++;
+}
+
+// The average of the history, in the newest frame's coordinates
+static inline void tdn_output(const struct tdenoise *t, uint8_t *out, int out_stride) {
+    if (t->n == 1) {
+        for (int y = 0; y < t->height; y++) memcpy(out + (size_t)y * out_stride, t->ring[t->head] + (size_t)y * t->rowb, t->rowb);
+        return;
+    }
+    for (int y = 0; y < t->height; y++) {
+        const uint16_t *s = t->sum + (size_t)y * t->rowb;
+        uint8_t *o = out + (size_t)y * out_stride;
+        for (int x = 0; x < t->rowb; x++) o[x] = (uint8_t)((s[x] * t->recip[t->cnt[x]] + 0x8000) >> 16);
+    }
+}
+
+static inline void tdn_print(const struct tdenoise *t) {
+    printf("Denoise: K=%d, %llu frames, %llu shifted, %llu restarts, history %d, last shift %d px, noise SAD %.1f\n", t->k,
+           (unsigned long long)t->frames, (unsigned long long)t->shifted, (unsigned long long)t->resets, t->n, t->last_shift,
+           t->noise_sad);
+}
+
+#endif // TDENOISE_H
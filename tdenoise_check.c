@@ -0,0 +1,170 @@
+// Temporal denoise check (tdenoise.h) on a synthetic belt.
+// Builds YUYV frames of a fixed texture that moves back and forth along x
+// by a few pixels per frame, with a little sensor noise on each, and pushes
+// them through tdn_push(). Alongside it keeps every frame of the history
+// with the byte columns it still covers after the shifts so far, and after
+// each push compares the running sums, the per-column counts and
+// tdn_output() with a direct average of those frames. Shifting out and back
+// again is what pushes a frame's columns over the edge while its offset
+// returns to 0, so the pattern does a lot of that.
+//
+// Usage: tdenoise_check [k] [width] [height] [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "telemetry.h"
+#include "tdenoise.h"
+
+static struct tm_hist push_us = TM_HIST("denoise_push", "us");
+
+// Belt motion per frame in pixels, repeated
+static const int pattern[] = { 4, -4, 4, -4, 0, 6, -6, 2, -8, 8, -2, 0, 10, -10, -4, 4 };
+
+struct ref_frame {
+    uint8_t *data;
+    uint8_t *mask;      // byte columns (newest frame's coordinates) it is still summed in
+    int off;            // x offset in pixels relative to the newest
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint8_t texture(int y, int c) {
+    uint32_t h = (uint32_t)y * 0x9e3779b1u ^ (uint32_t)(c + 4096) * 0x85ebca6bu;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 13;
+    return 40 + h % 176;
+}
+
+// Texture moved right by pos pixels plus up to +-3 of noise
+static void make_frame(uint8_t *f, int rowb, int h, int pos, uint32_t *seed) {
+    for (int y = 0; y < h; y++)
+        for (int c = 0; c < rowb; c++) {
+            *seed = *seed * 1664525u + 1013904223u;
+            f[(size_t)y * rowb + c] = texture(y, c - pos * 2) + (int)(*seed >> 29) - 3;
+        }
+}
+
+int main(int argc, char **argv) {
+    int k = argc > 1 ? atoi(argv[1]) : 3;
+    int width = argc > 2 ? atoi(argv[2]) : 64;
+    int height = argc > 3 ? atoi(argv[3]) : 16;
+    long frames = argc > 4 ? atol(argv[4]) : 200;
+
+    struct tdenoise td;
+    if (width < 4 * TDN_MAX_SHIFT || height < TDN_ALIGN_STEP || tdn_init(&td, V4L2_PIX_FMT_YUYV, width, height, k) != 0) {
+        fprintf(stderr, "Usage: %s [k] [width >= %d] [height >= %d] [frames]\n", argv[0], 4 * TDN_MAX_SHIFT, TDN_ALIGN_STEP);
+        return 1;
+    }
+    int rowb = td.rowb, h = td.height;
+    size_t size = (size_t)rowb * h;
+    printf("Denoise check: K=%d, %dx%d, %ld frames\n", td.k, td.width, h, frames);
+
+    struct ref_frame hist[TDN_MAX_K];
+    int nh = 0;
+    for (int i = 0; i < td.k; i++) {
+        hist[i].data = malloc(size);
+        hist[i].mask = malloc(rowb);
+    }
+    uint8_t *frame = malloc(size), *out = malloc(size), *mask = malloc(rowb);
+    uint32_t *sum = malloc(size * sizeof(*sum));
+    int *cnt = malloc(rowb * sizeof(*cnt));
+    if (!frame || !out || !mask || !sum || !cnt || !hist[td.k - 1].mask) { perror("Malloc failed"); return 1; }
+
+    uint32_t seed = 1;
+    int pos = 0;
+    long failures = 0;
+    for (long f = 0; f < frames; f++) {
+        int shift = f ? pattern[(f - 1) % (sizeof(pattern) / sizeof(pattern[0]))] : 0;
+        pos += shift;
+        make_frame(frame, rowb, h, pos, &seed);
+
+        uint64_t resets = td.resets, t0 = now_ns();
+        tdn_push(&td, frame, rowb);
+        tm_record(&push_us, (now_ns() - t0) / 1000);
+        if (td.resets != resets) {
+            nh = 0;
+        } else if (f && td.k > 1 && td.last_shift != shift) {
+            printf("frame %ld: aligned at %+d px, the belt moved %+d\n", f, td.last_shift, shift);
+            failures++;
+            nh = 0;
+        }
+
+        // The reference history: move every frame along, drop the oldest, add the new one
+        if (td.k == 1) nh = 0;
+        for (int i = 0; i < nh; i++) {
+            int b = td.last_shift * 2;
+            for (int c = 0; c < rowb; c++) mask[c] = c - b >= 0 && c - b < rowb ? hist[i].mask[c - b] : 0;
+            memcpy(hist[i].mask, mask, rowb);
+            hist[i].off += td.last_shift;
+        }
+        if (nh == td.k) {
+            struct ref_frame old = hist[0];
+            memmove(hist, hist + 1, (nh - 1) * sizeof(hist[0]));
+            hist[--nh] = old;
+        }
+        memcpy(hist[nh].data, frame, size);
+        memset(hist[nh].mask, 1, rowb);
+        hist[nh].off = 0;
+        nh++;
+
+        memset(sum, 0, size * sizeof(*sum));
+        memset(cnt, 0, rowb * sizeof(*cnt));
+        for (int i = 0; i < nh; i++) {
+            int ob = hist[i].off * 2;
+            for (int c = 0; c < rowb; c++) {
+                if (!hist[i].mask[c]) continue;
+                cnt[c]++;
+                for (int y = 0; y < h; y++) sum[(size_t)y * rowb + c] += hist[i].data[(size_t)y * rowb + c - ob];
+            }
+        }
+
+        long bad_cnt = 0, bad_sum = 0, bad_out = 0;
+        int first = -1;
+        if (td.n != nh) {
+            printf("frame %ld: history %d, expected %d\n", f, td.n, nh);
+            failures++;
+        }
+        tdn_output(&td, out, rowb);
+        for (int c = 0; c < rowb; c++) {
+            if (td.k > 1 && td.cnt[c] != cnt[c]) { bad_cnt++; if (first < 0) first = c; }
+            for (int y = 0; y < h; y++) {
+                size_t i = (size_t)y * rowb + c;
+                if (td.k > 1 && td.sum[i] != sum[i]) { bad_sum++; if (first < 0) first = c; }
+                int want = (sum[i] + cnt[c] / 2) / cnt[c];
+                if (abs(out[i] - want) > 1) { bad_out++; if (first < 0) first = c; }
+            }
+        }
+        if (bad_cnt || bad_sum || bad_out) {
+            int c = first;
+            printf("frame %ld (belt at %+d px): %ld counts, %ld sums, %ld outputs wrong; column %d: count %d (expected %d), "
+                   "row 0 sum %d (expected %u), out %d (expected %u)\n", f, pos, bad_cnt, bad_sum, bad_out, c,
+                   td.k > 1 ? td.cnt[c] : 1, cnt[c], td.k > 1 ? td.sum[c] : out[c], sum[0 * rowb + c], out[c],
+                   (sum[c] + cnt[c] / 2) / cnt[c]);
+            failures++;
+        }
+    }
+
+    tdn_print(&td);
+    tm_print(stdout);
+    printf("%s: %ld of %ld frames wrong\n", failures ? "FAIL" : "OK", failures, frames);
+
+    for (int i = 0; i < td.k; i++) {
+        free(hist[i].data);
+        free(hist[i].mask);
+    }
+    free(frame);
+    free(out);
+    free(mask);
+    free(sum);
+    free(cnt);
+    tdn_free(&td);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,254 @@
+// telemetry.h - Bounded-memory latency sketches and rolling counters.
+//
+// The board runs for weeks, so percentiles cannot come from stored samples.
+//
+// tm_hist: log-linear histogram in the style of HdrHistogram. Values below
+// 16 get their own bucket; above that every power of two is split into 16
+// sub-buckets, so a quantile is within ~3% of the true value. Values up to
+// 2^41 (36 min in ns, 25 days in us) fit in 608 buckets; larger ones
+// count in the top bucket.
+//
+// tm_counter: events per second over the last TM_WINDOW_S seconds, plus a
+// running total.
+//
+// Every thread writes its own shard (allocated on first use), so recording
+// is O(1) with uncontended relaxed atomics. Readers merge the shards
+// (tm_hist_read / tm_counter_rate) at export time. Metrics register
+// themselves on first use and tm_print() dumps them all.
+//
+// Usage:
+//   static struct tm_hist encode_us = TM_HIST("encode", "us");
+//   static struct tm_counter frames = TM_COUNTER("frames");
+//   tm_record(&encode_us, dt_us);
+//   tm_count(&frames, 1);
+//   tm_print(stdout);
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define TM_MAX_THREADS  16          // threads beyond this share the last shard
+#define TM_SUB_BITS     4
+#define TM_SUB          (1 << TM_SUB_BITS)
+#define TM_MAX_EXP      40
+#define TM_BUCKETS      ((TM_MAX_EXP - TM_SUB_BITS + 2) * TM_SUB)    // 16 linear, then exponents 4..TM_MAX_EXP
+#define TM_WINDOW_S     64          // rolling counter history
+#define TM_MAX_METRICS  64
+
+struct tm_hist_shard {
+    uint64_t count[TM_BUCKETS];
+    uint64_t n, sum, min, max;
+};
+
+struct tm_hist {
+    const char *name, *unit;
+    struct tm_hist_shard *shard[TM_MAX_THREADS];
+    int registered;
+};
+
+struct tm_counter_shard {
+    uint64_t stamp[TM_WINDOW_S];    // second each slot belongs to
+    uint64_t count[TM_WINDOW_S];
+    uint64_t total;
+};
+
+struct tm_counter {
+    const char *name;
+    struct tm_counter_shard *shard[TM_MAX_THREADS];
+    int registered;
+};
+
+// Merged view of a histogram
+struct tm_hist_snapshot {
+    uint64_t count[TM_BUCKETS];
+    uint64_t n, sum, min, max;
+};
+
+#define TM_HIST(name, unit)  { name, unit, {0}, 0 }
+#define TM_COUNTER(name)     { name, {0}, 0 }
+
+static struct tm_hist *tm_hists[TM_MAX_METRICS];
+static struct tm_counter *tm_counters[TM_MAX_METRICS];
+static int tm_nhists, tm_ncounters, tm_nthreads;
+static __thread int tm_thread = -1;
+
+static inline int tm_thread_index(void) {
+    if (tm_thread < 0) {
+        int t = __atomic_fetch_add(&tm_nthreads, 1, __ATOMIC_RELAXED);
+        tm_thread = t < TM_MAX_THREADS ? t : TM_MAX_THREADS - 1;
+    }
+    return tm_thread;
+}
+
+// Install a zeroed shard; losing a race (shared overflow shard) just frees ours
+static inline void *tm_shard(void **slot, size_t size) {
+    void *s = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (s) return s;
+    void *mine = calloc(1, size), *expected = NULL;
+    if (!mine) return NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, mine, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(mine);
+        return expected;
+    }
+    return mine;
+}
+
+static inline void tm_register(void **list, int *n, void *metric, int *registered) {
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(registered, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+    int i = __atomic_fetch_add(n, 1, __ATOMIC_RELAXED);
+    if (i < TM_MAX_METRICS) __atomic_store_n(&list[i], metric, __ATOMIC_RELEASE);
+}
+
+static inline int tm_bucket(uint64_t v) {
+    if (v < TM_SUB) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > TM_MAX_EXP) return TM_BUCKETS - 1;    // clamped into the top sub-bucket of 2^TM_MAX_EXP
+    return (e - TM_SUB_BITS + 1) * TM_SUB + (int)((v >> (e - TM_SUB_BITS)) & (TM_SUB - 1));
+}
+
+// Smallest value that lands in bucket b
+static inline uint64_t tm_bucket_low(int b) {
+    if (b < TM_SUB) return (uint64_t)b;
+    int e = b / TM_SUB + TM_SUB_BITS - 1;
+    return (uint64_t)(TM_SUB + b % TM_SUB) << (e - TM_SUB_BITS);
+}
+
+static inline void tm_record(struct tm_hist *h, uint64_t v) {
+    int t = tm_thread_index();
+    struct tm_hist_shard *s = h->shard[t];
+    if (!s) {
+        if (!(s = tm_shard((void **)&h->shard[t], sizeof(*s)))) return;
+        __atomic_store_n(&s->min, UINT64_MAX, __ATOMIC_RELAXED);
+        tm_register((void **)tm_hists, &tm_nhists, h, &h->registered);
+    }
+    __atomic_fetch_add(&s->count[tm_bucket(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->n, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->sum, v, __ATOMIC_RELAXED);
+    uint64_t m = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+    while (v > m && !__atomic_compare_exchange_n(&s->max, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    m = __atomic_load_n(&s->min, __ATOMIC_RELAXED);
+    while (v < m && !__atomic_compare_exchange_n(&s->min, &m, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+// Merge every shard into a snapshot (merge-on-read)
+static inline void tm_hist_read(struct tm_hist *h, struct tm_hist_snapshot *out) {
+    memset(out, 0, sizeof(*out));
+    out->min = UINT64_MAX;
+    for (int t = 0; t < TM_MAX_THREADS; t++) {
+        struct tm_hist_shard *s = __atomic_load_n(&h->shard[t], __ATOMIC_ACQUIRE);
+        if (!s) continue;
+        for (int b = 0; b < TM_BUCKETS; b++) out->count[b] += __atomic_load_n(&s->count[b], __ATOMIC_RELAXED);
+        out->n += __atomic_load_n(&s->n, __ATOMIC_RELAXED);
+        out->sum += __atomic_load_n(&s->sum, __ATOMIC_RELAXED);
+        uint64_t mn = __atomic_load_n(&s->min, __ATOMIC_RELAXED), mx = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+        if (mn < out->min) out->min = mn;
+        if (mx > out->max) out->max = mx;
+    }
+    if (!out->n) out->min = 0;
+}
+
+// Snapshots from other processes or nodes merge the same way
+static inline void tm_snapshot_merge(struct tm_hist_snapshot *into, const struct tm_hist_snapshot *from) {
+    for (int b = 0; b < TM_BUCKETS; b++) into->count[b] += from->count[b];
+    if (from->n && (!into->n || from->min < into->min)) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+    into->n += from->n;
+    into->sum += from->sum;
+}
+
+static inline double tm_quantile(const struct tm_hist_snapshot *s, double q) {
+    if (!s->n) return 0;
+    uint64_t rank = (uint64_t)(q * (s->n - 1)) + 1, seen = 0;
+    for (int b = 0; b < TM_BUCKETS; b++) {
+        seen += s->count[b];
+        if (seen >= rank) {
+            double lo = (double)tm_bucket_low(b), hi = (double)tm_bucket_low(b + 1);
+            double mid = b < TM_SUB ? lo : (lo + hi) / 2;
+            if (mid < s->min) mid = (double)s->min;
+            if (mid > s->max) mid = (double)s->max;
+            return mid;
+        }
+    }
+    return (double)s->max;
+}
+
+static inline uint64_t tm_now_s(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec;
+}
+
+static inline void tm_count(struct tm_counter *c, uint64_t v) {
+    int t = tm_thread_index();
+    struct tm_counter_shard *s = c->shard[t];
+    if (!s) {
+        if (!(s = tm_shard((void **)&c->shard[t], sizeof(*s)))) return;
+        tm_register((void **)tm_counters, &tm_ncounters, c, &c->registered);
+    }
+    uint64_t now = tm_now_s();
+    int i = (int)(now % TM_WINDOW_S);
+    if (__atomic_load_n(&s->stamp[i], __ATOMIC_RELAXED) != now) {
+        __atomic_store_n(&s->count[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->stamp[i], now, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_add(&s->count[i], v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total, v, __ATOMIC_RELAXED);
+}
+
+// Events per second over the last `seconds` complete seconds (<= TM_WINDOW_S - 1)
+static inline double tm_counter_rate(struct tm_counter *c, int seconds) {
+    uint64_t now = tm_now_s(), sum = 0;
+    if (seconds < 1) seconds = 1;
+    if (seconds > TM_WINDOW_S - 1) seconds = TM_WINDOW_S - 1;
+    for (int t = 0; t < TM_MAX_THREADS; t++) {
+        struct tm_counter_shard *s = __atomic_load_n(&c->shard[t], __ATOMIC_ACQUIRE);
+        if (!s) continue;
+        for (int k = 1; k <= seconds; k++) {
+            uint64_t sec = now - k;
+            int i = (int)(sec % TM_WINDOW_S);
+            if (__atomic_load_n(&s->stamp[i], __ATOMIC_ACQUIRE) == sec) sum += __atomic_load_n(&s->count[i], __ATOMIC_RELAXED);
+        }
+    }
+    return (double)sum / seconds;
+}
+
+static inline uint64_t tm_counter_total(struct tm_counter *c) {
+    uint64_t sum = 0;
+    for (int t = 0; t < TM_MAX_THREADS; t++) {
+        struct tm_counter_shard *s = __atomic_load_n(&c->shard[t], __ATOMIC_ACQUIRE);
+        if (s) sum += __atomic_load_n(&s->total, __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+// One line per metric that has been used
+static inline void tm_print(FILE *f) {
+    struct tm_hist_snapshot s;
+    int nh = __atomic_load_n(&tm_nhists, __ATOMIC_ACQUIRE), nc = __atomic_load_n(&tm_ncounters, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < nh && i < TM_MAX_METRICS; i++) {
+        struct tm_hist *h = __atomic_load_n(&tm_hists[i], __ATOMIC_ACQUIRE);
+        if (!h) continue;
+        tm_hist_read(h, &s);
+        fprintf(f, "  %-14s n %-9llu mean %-8.1f p50 %-8.1f p90 %-8.1f p99 %-8.1f p99.9 %-8.1f max %llu %s\n",
+                h->name, (unsigned long long)s.n, s.n ? (double)s.sum / s.n : 0.0, tm_quantile(&s, 0.5),
+                tm_quantile(&s, 0.9), tm_quantile(&s, 0.99), tm_quantile(&s, 0.999), (unsigned long long)s.max, h->unit);
+    }
+    for (int i = 0; i < nc && i < TM_MAX_METRICS; i++) {
+        struct tm_counter *c = __atomic_load_n(&tm_counters[i], __ATOMIC_ACQUIRE);
+        if (!c) continue;
+        fprintf(f, "  %-14s total %-9llu %.1f/s (10 s)  %.1f/s (60 s)\n", c->name,
+                (unsigned long long)tm_counter_total(c), tm_counter_rate(c, 10), tm_counter_rate(c, 60));
+    }
+}
+
+#endif // TELEMETRY_H
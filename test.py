@@ -3,6 +3,10 @@ import numpy as np
 from PIL import Image
 import math
 import os
+import sys
+import time
+import argparse
+from concurrent.futures import ThreadPoolExecutor
 
 MODEL_PATH = "model_cardboard.onnx"
 IMG_SIZE = 224
@@ -18,12 +22,32 @@ IMAGES = [
 
 CLASS_NAMES = ["defective", "undefective"]
 
+IMG_EXTS = (".jpg", ".jpeg", ".png", ".bmp")
+
+# Directory mode:
+#   python test.py --dir ./validate-dataset --batch 32 --workers 4 --intra 4 --inter 1
+# If the directory has one sub-folder per class (as train.py expects), accuracy is reported too.
+parser = argparse.ArgumentParser()
+parser.add_argument("--dir", help="evaluate every image under this directory")
+parser.add_argument("--batch", type=int, default=16, help="images per session.run")
+parser.add_argument("--workers", type=int, default=os.cpu_count() or 4, help="decode/preprocess threads")
+parser.add_argument("--prefetch", type=int, default=2, help="batches decoded ahead of inference")
+parser.add_argument("--intra", type=int, default=0, help="onnxruntime intra-op threads (0 = default)")
+parser.add_argument("--inter", type=int, default=0, help="onnxruntime inter-op threads (0 = default)")
+parser.add_argument("--quiet", action="store_true", help="only print the summary")
+args = parser.parse_args()
+
 
 def softmax(x):
     e = np.exp(x - np.max(x))
     return e / e.sum()
 
-session = ort.InferenceSession(MODEL_PATH, providers=["CPUExecutionProvider"])
+opts = ort.SessionOptions()
+opts.intra_op_num_threads = args.intra
+opts.inter_op_num_threads = args.inter
+if args.inter > 1:
+    opts.execution_mode = ort.ExecutionMode.ORT_PARALLEL
+session = ort.InferenceSession(MODEL_PATH, sess_options=opts, providers=["CPUExecutionProvider"])
 input_name = session.get_inputs()[0].name
 output_name = session.get_outputs()[0].name
 
@@ -63,6 +87,104 @@ def run_image(path):
     print(f"Prediction: {CLASS_NAMES[cls].upper()}  |  score={probs[cls]:.4f}")
     print("-" * 50)
 
+def list_images(root):
+    # (path, label) pairs; label is the class index when the sub-folder names a class
+    items = []
+    for dirpath, _, files in os.walk(root):
+        sub = os.path.relpath(dirpath, root).split(os.sep)[0]
+        label = CLASS_NAMES.index(sub) if sub in CLASS_NAMES else -1
+        for f in sorted(files):
+            if f.lower().endswith(IMG_EXTS):
+                items.append((os.path.join(dirpath, f), label))
+    items.sort()
+    return items
+
+def load_batch(paths):
+    return np.concatenate([load_image(p) for p in paths], axis=0)
+
+def percentile(values, q):
+    if not values:
+        return 0.0
+    v = sorted(values)
+    return v[min(len(v) - 1, int(q / 100.0 * len(v)))]
+
+def run_dir(root):
+    items = list_images(root)
+    if not items:
+        print("No images under", root)
+        return
+
+    batch = max(1, args.batch)
+    dim = session.get_inputs()[0].shape[0]
+    if isinstance(dim, int) and dim != batch:
+        print(f"Model has a fixed batch of {dim}, re-export with a dynamic batch axis")
+        batch = dim
+
+    chunks = [items[i:i + batch] for i in range(0, len(items), batch)]
+    print(f"Evaluating {len(items)} images in {len(chunks)} batches of {batch} "
+          f"({args.workers} workers, intra {args.intra}, inter {args.inter})")
+    print("-" * 50)
+
+    # Decoding runs on a thread pool (PIL releases the GIL), kept `prefetch` batches ahead
+    pool = ThreadPoolExecutor(max_workers=max(1, args.workers))
+    pending = []
+    next_chunk = 0
+
+    def fill():
+        nonlocal next_chunk
+        while next_chunk < len(chunks) and len(pending) <= args.prefetch:
+            paths = [p for p, _ in chunks[next_chunk]]
+            # Split each batch across workers so one batch is decoded in parallel
+            step = max(1, math.ceil(len(paths) / max(1, args.workers)))
+            pending.append([pool.submit(load_batch, paths[i:i + step]) for i in range(0, len(paths), step)])
+            next_chunk += 1
+
+    latencies, waits = [], []
+    correct = labelled = 0
+    counts = [0] * len(CLASS_NAMES)
+    t0 = time.perf_counter()
+
+    fill()
+    for chunk in chunks:
+        tw = time.perf_counter()
+        parts = pending.pop(0)
+        inp = np.concatenate([f.result() for f in parts], axis=0)
+        fill()
+        waits.append(time.perf_counter() - tw)
+
+        ti = time.perf_counter()
+        logits = session.run([output_name], {input_name: inp})[0]
+        latencies.append(time.perf_counter() - ti)
+
+        e = np.exp(logits - logits.max(axis=1, keepdims=True))
+        probs = e / e.sum(axis=1, keepdims=True)
+        for (path, label), p in zip(chunk, probs):
+            cls = int(np.argmax(p))
+            counts[cls] += 1
+            if label >= 0:
+                labelled += 1
+                correct += int(cls == label)
+            if not args.quiet:
+                print(f"{path}: {CLASS_NAMES[cls].upper()}  |  score={p[cls]:.4f}")
+
+    total = time.perf_counter() - t0
+    pool.shutdown()
+
+    ms = [l * 1000 for l in latencies]
+    print("-" * 50)
+    print(f"{len(items)} images in {total:.2f} s: {len(items) / total:.1f} images/s")
+    print(f"Batch latency ms: mean {sum(ms) / len(ms):.1f}  p50 {percentile(ms, 50):.1f}  "
+          f"p95 {percentile(ms, 95):.1f}  max {max(ms):.1f}")
+    print(f"Inference {sum(latencies) / total * 100:.0f}% of wall time, "
+          f"waiting on decode {sum(waits) / total * 100:.0f}%")
+    print("Predicted:", ", ".join(f"{n} {c}" for n, c in zip(CLASS_NAMES, counts)))
+    if labelled:
+        print(f"Accuracy: {correct}/{labelled} = {correct / labelled * 100:.2f}%")
+
+if args.dir:
+    run_dir(args.dir)
+    sys.exit(0)
+
 for img in IMAGES:
     if not os.path.exists(img):
         print(f"File missing: {img}")
@@ -0,0 +1,187 @@
+// texture_screen.h - Cheap defect pre-screen on JPEG block energies.
+//
+// stbi_write_jpg_features() hands back, per 8x8 luma block, the energy of the
+// quantized DCT coefficients in low/mid/high frequency bands. Tears, creases
+// and crush marks show up as blocks whose mid+high band energy is far above
+// what the box surface normally has, so they can be flagged without touching
+// the pixels again or running the CNN.
+//
+// Two references are supported:
+//   - a learned per-block baseline (texscreen_learn() on known-good frames),
+//     kept per SKU in <dir>/<sku>.texscreen by texscreen_save(),
+//   - until enough frames are learned, the frame itself: each block is
+//     compared against the median/MAD of all blocks in the same frame.
+//
+// Usage:
+//   struct texscreen ts;
+//   texscreen_init(&ts, WIDTH, HEIGHT);
+//   texscreen_load(&ts, "golden", "sku123");    // -1: no baseline yet
+//   stbi_write_jpg_features("image.jpg", w, h, 3, rgb, QUALITY, feat);
+//   texscreen_learn(&ts, feat);                  // known-good frames
+//   texscreen_save(&ts, "golden", "sku123");
+//   struct texscreen_result r;
+//   if (texscreen_eval(&ts, feat, &r)) ...  // suspicious, send to the CNN
+//   texscreen_free(&ts);
+
+#ifndef TEXTURE_SCREEN_H
+#define TEXTURE_SCREEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#ifndef INCLUDE_STB_IMAGE_WRITE_H
+#include "stb_image_write.h"    // declarations only; the implementation is included once by the tool
+#endif
+
+#define TEXSCREEN_MIN_TRAIN  20      // learned frames before the baseline is used
+#define TEXSCREEN_ALPHA      0.05f   // baseline update rate
+#define TEXSCREEN_Z          6.0f    // per-block z-score threshold
+#define TEXSCREEN_MIN_BLOCKS 3       // flagged blocks needed to call a frame suspicious
+
+struct texscreen {
+    int bw, bh;                 // block grid
+    float *mean, *var;          // learned baseline per block
+    int trained;
+    float *scratch;
+};
+
+struct texscreen_result {
+    int flagged;                // blocks over the threshold
+    float max_z;
+    int worst_bx, worst_by;
+    int learned;                // 1 if the learned baseline was used
+};
+
+static inline float texscreen_energy(const stbi_jpg_block_energy *e) {
+    return (float)e->mid + (float)e->high;
+}
+
+static inline size_t texscreen_blocks(int width, int height) {
+    return (size_t)((width + 7) / 8) * ((height + 7) / 8);
+}
+
+static inline int texscreen_init(struct texscreen *ts, int width, int height) {
+    memset(ts, 0, sizeof(*ts));
+    ts->bw = (width + 7) / 8;
+    ts->bh = (height + 7) / 8;
+    size_t n = (size_t)ts->bw * ts->bh;
+    ts->mean = calloc(n, sizeof(float));
+    ts->var = calloc(n, sizeof(float));
+    ts->scratch = calloc(n, sizeof(float));
+    if (!ts->mean || !ts->var || !ts->scratch) return -1;
+    return 0;
+}
+
+static inline void texscreen_free(struct texscreen *ts) {
+    free(ts->mean);
+    free(ts->var);
+    free(ts->scratch);
+}
+
+// Fold a known-good frame into the per-block baseline
+static inline void texscreen_learn(struct texscreen *ts, const stbi_jpg_block_energy *feat) {
+    int n = ts->bw * ts->bh;
+    // Plain average for the first frames, then an exponential moving average
+    float a = (ts->trained < TEXSCREEN_MIN_TRAIN) ? 1.0f / (ts->trained + 1) : TEXSCREEN_ALPHA;
+    for (int i = 0; i < n; i++) {
+        float e = texscreen_energy(&feat[i]);
+        float d = e - ts->mean[i];
+        ts->mean[i] += a * d;
+        ts->var[i] = (1.0f - a) * (ts->var[i] + a * d * d);
+    }
+    ts->trained++;
+}
+
+static int texscreen_cmp(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// Score a frame. Returns 1 if it looks suspicious.
+static inline int texscreen_eval(struct texscreen *ts, const stbi_jpg_block_energy *feat, struct texscreen_result *r) {
+    int n = ts->bw * ts->bh;
+    float med = 0, scale = 1;
+
+    memset(r, 0, sizeof(*r));
+    r->learned = ts->trained >= TEXSCREEN_MIN_TRAIN;
+
+    if (!r->learned) {
+        // Robust frame statistics: median and MAD (scaled to a sigma)
+        for (int i = 0; i < n; i++) ts->scratch[i] = texscreen_energy(&feat[i]);
+        qsort(ts->scratch, n, sizeof(float), texscreen_cmp);
+        med = ts->scratch[n / 2];
+        for (int i = 0; i < n; i++) ts->scratch[i] = fabsf(texscreen_energy(&feat[i]) - med);
+        qsort(ts->scratch, n, sizeof(float), texscreen_cmp);
+        scale = 1.4826f * ts->scratch[n / 2];
+        if (scale < 1.0f) scale = 1.0f;     // flat surfaces quantize to all-zero blocks
+    }
+
+    for (int i = 0; i < n; i++) {
+        float e = texscreen_energy(&feat[i]);
+        float z;
+        if (r->learned) {
+            float sd = sqrtf(ts->var[i]);
+            z = (e - ts->mean[i]) / (sd < 1.0f ? 1.0f : sd);
+        } else {
+            z = (e - med) / scale;
+        }
+        if (z > TEXSCREEN_Z) r->flagged++;
+        if (z > r->max_z) {
+            r->max_z = z;
+            r->worst_bx = i % ts->bw;
+            r->worst_by = i / ts->bw;
+        }
+    }
+    return r->flagged >= TEXSCREEN_MIN_BLOCKS;
+}
+
+/* --- BASELINE FILE --- */
+
+// Header, then mean and var as floats, block by block
+struct texscreen_file {
+    char magic[8];
+    int32_t bw, bh, trained;
+};
+
+#define TEXSCREEN_MAGIC "TEXSCR1"
+
+static inline int texscreen_save(const struct texscreen *ts, const char *dir, const char *sku) {
+    char path[512], tmp[520];
+    size_t n = (size_t)ts->bw * ts->bh;
+    struct texscreen_file h = { TEXSCREEN_MAGIC, ts->bw, ts->bh, ts->trained };
+    snprintf(path, sizeof(path), "%s/%s.texscreen", dir, sku);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { fprintf(stderr, "texscreen: cannot write %s: %s\n", tmp, strerror(errno)); return -1; }
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(ts->mean, sizeof(float), n, f) == n &&
+             fwrite(ts->var, sizeof(float), n, f) == n;
+    if (fclose(f) != 0 || !ok) { fprintf(stderr, "texscreen: cannot write %s\n", tmp); remove(tmp); return -1; }
+    return rename(tmp, path);
+}
+
+// Returns -1 if there is no baseline for the SKU (errno ENOENT) or it is for another block grid
+static inline int texscreen_load(struct texscreen *ts, const char *dir, const char *sku) {
+    char path[512];
+    size_t n = (size_t)ts->bw * ts->bh;
+    struct texscreen_file h;
+    snprintf(path, sizeof(path), "%s/%s.texscreen", dir, sku);
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, TEXSCREEN_MAGIC, sizeof(h.magic)) == 0;
+    if (ok && (h.bw != ts->bw || h.bh != ts->bh)) {
+        fprintf(stderr, "texscreen: %s is for a %dx%d block grid\n", path, h.bw, h.bh);
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    ok = ok && fread(ts->mean, sizeof(float), n, f) == n && fread(ts->var, sizeof(float), n, f) == n;
+    fclose(f);
+    if (!ok) { fprintf(stderr, "texscreen: %s is truncated or not a baseline\n", path); errno = EINVAL; return -1; }
+    ts->trained = h.trained;
+    return 0;
+}
+
+#endif // TEXTURE_SCREEN_H
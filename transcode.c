@@ -0,0 +1,281 @@
+// Offline transcoder for archived raw frames.
+// Memory-maps a file of back-to-back raw frames (as saved by the capture
+// path) and encodes every frame to JPEG or PNG, one frame per worker thread.
+// Results go through a small reorder window so files are written strictly
+// in frame order. The index of the next frame to write is kept in
+// <out_dir>/.progress, so an interrupted run picks up where it stopped.
+//
+// With "arc" each worker encodes JPEGs straight into its own mmap'd archive
+// segments (archive_sink.h) instead of writing one file per frame. Records
+// carry the frame number; after a resume a frame can appear twice, readers
+// keep the last one.
+//
+// Usage: transcode <frames.raw> <out_dir> <width> <height> [format] [jpg|png|arc] [quality] [threads]
+//        format is a pixfmt name (YUYV, UYVY, NV12, RGB24, GREY, BA81, RG10, ...), default YUYV
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "pixfmt.h"
+#include "archive_sink.h"
+
+#define DEFAULT_QUALITY  90
+#define PROGRESS_EVERY   32      // frames between .progress updates
+
+struct out_buf {
+    uint8_t *data;
+    size_t len, cap;
+};
+
+struct slot {
+    int ready;
+    long frame;
+    struct out_buf enc;
+    size_t bytes;               // encoded size (arc mode writes no buffer)
+};
+
+static volatile int keep_running = 1;
+
+// Shared by the workers
+static const uint8_t *input;
+static size_t frame_size;
+static long nframes, next_frame, next_write;
+static int width, height, use_png, use_arc, quality, window;
+static const char *out_dir;
+static uint32_t fourcc;
+static struct pixfmt_ctx conv;
+static struct slot *slots;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER, slot_ready = PTHREAD_COND_INITIALIZER;
+static int failed;
+
+void int_handler(int signum) {
+    (void)signum;
+    keep_running = 0;
+}
+
+static void buf_write(void *context, void *data, int size) {
+    struct out_buf *b = context;
+    if (b->len + size > b->cap) {
+        size_t cap = b->cap ? b->cap : 64 * 1024;
+        while (cap < b->len + size) cap *= 2;
+        uint8_t *d = realloc(b->data, cap);
+        if (!d) return;
+        b->data = d;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, size);
+    b->len += size;
+}
+
+static void *worker(void *arg) {
+    uint8_t *rgb = malloc(pixfmt_dst_size(PIXFMT_DST_RGB24, width, height));
+    struct out_buf enc = {0};
+    struct archive ar;
+    char prefix[32];
+    if (!rgb) { perror("Malloc failed"); return NULL; }
+    if (use_arc) {
+        snprintf(prefix, sizeof(prefix), "w%ld", (long)(intptr_t)arg);
+        archive_open(&ar, out_dir, prefix, ARCHIVE_SEGMENT_SIZE);
+    }
+
+    for (;;) {
+        // Claim a frame that fits in the reorder window
+        pthread_mutex_lock(&lock);
+        while (keep_running && !failed && next_frame < nframes && next_frame >= next_write + window)
+            pthread_cond_wait(&slot_free, &lock);
+        if (!keep_running || failed || next_frame >= nframes) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        long f = next_frame++;
+        pthread_mutex_unlock(&lock);
+
+        // Convert + encode, no locks held
+        pixfmt_convert_serial(&conv, fourcc, PIXFMT_DST_RGB24, input + f * frame_size, 0, rgb, width, height, 0);
+        enc.len = 0;
+        size_t bytes = 0;
+        int ok;
+        if (use_arc) {
+            int len = archive_write_jpg(&ar, f, 0, width, height, 3, rgb, quality, NULL);
+            ok = len > 0;
+            bytes = len;
+        } else if (use_png) {
+            int len;
+            unsigned char *png = stbi_write_png_to_mem(rgb, width * 3, width, height, 3, &len);
+            ok = png != NULL;
+            if (ok) { buf_write(&enc, png, len); STBIW_FREE(png); }
+            bytes = enc.len;
+        } else {
+            ok = stbi_write_jpg_to_func(buf_write, &enc, width, height, 3, rgb, quality);
+            bytes = enc.len;
+        }
+
+        // Hand the encoded frame to the writer
+        pthread_mutex_lock(&lock);
+        struct slot *s = &slots[f % window];
+        struct out_buf tmp = s->enc;
+        s->enc = enc;
+        enc = tmp;
+        s->frame = f;
+        s->bytes = bytes;
+        s->ready = ok ? 1 : -1;
+        pthread_cond_broadcast(&slot_ready);
+        pthread_mutex_unlock(&lock);
+    }
+
+    if (use_arc) archive_close(&ar);
+    free(enc.data);
+    free(rgb);
+    return NULL;
+}
+
+static long read_progress(const char *path) {
+    long done = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%ld", &done) != 1) done = 0;
+        fclose(f);
+    }
+    return done;
+}
+
+static void write_progress(const char *path, long done) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    fprintf(f, "%ld\n", done);
+    fclose(f);
+    rename(tmp, path);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <frames.raw> <out_dir> <width> <height> [format] [jpg|png|arc] [quality] [threads]\n", argv[0]);
+        return 1;
+    }
+    const char *in_path = argv[1];
+    out_dir = argv[2];
+    width = atoi(argv[3]);
+    height = atoi(argv[4]);
+    fourcc = V4L2_PIX_FMT_YUYV;
+    if (argc >= 6 && !(fourcc = pixfmt_from_name(argv[5]))) { fprintf(stderr, "Unknown format %s\n", argv[5]); return 1; }
+    use_png = (argc >= 7 && strcmp(argv[6], "png") == 0);
+    use_arc = (argc >= 7 && strcmp(argv[6], "arc") == 0);
+    quality = (argc >= 8) ? atoi(argv[7]) : DEFAULT_QUALITY;
+    int nthreads = (argc >= 9) ? atoi(argv[8]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+
+    // 1. Map the input
+    int fd = open(in_path, O_RDONLY);
+    if (fd < 0) { fprintf(stderr, "ERROR: cannot open %s: %s\n", in_path, strerror(errno)); return 1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); return 1; }
+    frame_size = pixfmt_frame_size(fourcc, width, height);
+    nframes = frame_size ? st.st_size / (off_t)frame_size : 0;
+    if (nframes == 0) { fprintf(stderr, "ERROR: %s holds no complete %dx%d frame\n", in_path, width, height); return 1; }
+    if (st.st_size % frame_size)
+        fprintf(stderr, "WARNING: ignoring %lld trailing bytes\n", (long long)(st.st_size % frame_size));
+
+    input = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (input == MAP_FAILED) { perror("Mapping input"); return 1; }
+    madvise((void *)input, st.st_size, MADV_SEQUENTIAL);
+
+    // 2. Resume
+    char progress[512];
+    mkdir(out_dir, 0755);
+    snprintf(progress, sizeof(progress), "%s/.progress", out_dir);
+    long start = read_progress(progress);
+    if (start >= nframes) { printf("All %ld frames already done\n", nframes); return 0; }
+    if (start > 0) printf("Resuming at frame %ld\n", start);
+    next_frame = next_write = start;
+
+    printf("Transcoding %ld frames (%dx%d %s) -> %s with %d threads\n",
+           nframes - start, width, height, pixfmt_name(fourcc), use_png ? "PNG" : use_arc ? "JPEG archive" : "JPEG", nthreads);
+
+    // 3. Workers
+    pixfmt_init(&conv, 1);      // frames are parallel, conversions are not
+    window = nthreads * 2;
+    slots = calloc(window, sizeof(*slots));
+    pthread_t *threads = calloc(nthreads, sizeof(*threads));
+    if (!slots || !threads) { perror("Malloc failed"); return 1; }
+
+    signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
+
+    double t0 = pixfmt_now_ns();
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, worker, (void *)(intptr_t)i);
+
+    // 4. Write in order
+    uint64_t out_bytes = 0;
+    char path[600];
+    pthread_mutex_lock(&lock);
+    while (next_write < nframes && !failed) {
+        struct slot *s = &slots[next_write % window];
+        while (!(s->ready && s->frame == next_write) && keep_running)
+            pthread_cond_wait(&slot_ready, &lock);
+        if (!keep_running) break;
+        pthread_mutex_unlock(&lock);
+
+        if (use_arc) {
+            // Already in the worker's archive segment
+            if (s->ready < 0) {
+                fprintf(stderr, "ERROR: frame %ld: encode/archive failed\n", next_write);
+                failed = 1;
+            }
+        } else {
+            snprintf(path, sizeof(path), "%s/frame_%06ld.%s", out_dir, next_write, use_png ? "png" : "jpg");
+            FILE *f = (s->ready > 0) ? fopen(path, "wb") : NULL;
+            if (!f || fwrite(s->enc.data, 1, s->enc.len, f) != s->enc.len) {
+                fprintf(stderr, "ERROR: frame %ld: %s\n", next_write, f ? strerror(errno) : "encode/open failed");
+                failed = 1;
+            }
+            if (f) fclose(f);
+        }
+        out_bytes += s->bytes;
+
+        pthread_mutex_lock(&lock);
+        if (failed) break;
+        s->ready = 0;
+        next_write++;
+        if (next_write % PROGRESS_EVERY == 0) write_progress(progress, next_write);
+        pthread_cond_broadcast(&slot_free);
+    }
+    pthread_cond_broadcast(&slot_free);
+    pthread_mutex_unlock(&lock);
+
+    // Wake anyone blocked after an interrupt
+    keep_running = 0;
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&slot_free);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+    write_progress(progress, next_write);
+
+    // 5. Report
+    double secs = (pixfmt_now_ns() - t0) / 1e9;
+    long done = next_write - start;
+    printf("%ld frames in %.2f s: %.1f frames/s, in %.1f MB/s, out %.1f MB/s\n", done, secs,
+           done / secs, done * frame_size / secs / 1e6, out_bytes / secs / 1e6);
+    if (next_write < nframes) printf("Stopped at frame %ld, rerun to resume\n", next_write);
+
+    for (int i = 0; i < window; i++) free(slots[i].enc.data);
+    free(slots);
+    free(threads);
+    munmap((void *)input, st.st_size);
+    close(fd);
+    pixfmt_destroy(&conv);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+// verdict.h - Verdict records and the batch wire format shared by the
+// node publisher (verdict_publisher.h) and the line aggregator.
+//
+// A batch on the wire (and in the node's spool file) is:
+//
+//   u32 frame_len                 bytes that follow, little endian
+//   u32 magic  'VRB1'
+//   u16 node_id
+//   u16 count                     records in the batch
+//   u64 seq                       session (high 32 bits) and batch counter
+//   payload                       columnar, see verdict_encode_batch()
+//
+// Records are compressed column by column: ids and timestamps are
+// delta coded, everything is zigzag/varint packed, then the thumbnails
+// (already JPEG) are appended raw. A batch of plain verdicts comes out at
+// roughly 6-8 bytes per record instead of 24.
+//
+// The aggregator answers every batch with an 8-byte ack holding its seq.
+// The session is a random number drawn each time a publisher starts and the
+// counter restarts from 0 with it, so no clock and no saved state is needed:
+// a batch is a duplicate only if its session has already delivered that
+// counter. Spooled batches keep the session they were written under.
+
+#ifndef VERDICT_H
+#define VERDICT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VERDICT_MAGIC        0x31425256u   // "VRB1"
+#define VERDICT_HDR_SIZE     16
+#define VERDICT_MAX_BATCH    1024          // records per batch
+#define VERDICT_MAX_FRAME    (8 * 1024 * 1024)
+#define VERDICT_DEFAULT_PORT 5600
+
+enum { VERDICT_GOOD = 0, VERDICT_DEFECTIVE = 1, VERDICT_UNKNOWN = 2 };
+
+struct verdict_record {
+    uint32_t id;            // box id on this line
+    uint64_t ts_us;         // capture time, CLOCK_REALTIME microseconds
+    uint8_t verdict;        // VERDICT_*
+    uint16_t score;         // classifier score x 10000
+    uint32_t latency_us;    // capture -> verdict
+    uint32_t thumb_len;     // 0 if no thumbnail
+    const uint8_t *thumb;   // JPEG bytes (decode: points into the batch)
+};
+
+static inline uint64_t verdict_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static inline uint32_t verdict_seq_session(uint64_t seq) { return (uint32_t)(seq >> 32); }
+static inline uint32_t verdict_seq_count(uint64_t seq) { return (uint32_t)seq; }
+
+/* --- LITTLE ENDIAN / VARINT HELPERS --- */
+
+static inline void verdict_put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static inline void verdict_put32(uint8_t *p, uint32_t v) { for (int i = 0; i < 4; i++) p[i] = v >> (8 * i); }
+static inline void verdict_put64(uint8_t *p, uint64_t v) { for (int i = 0; i < 8; i++) p[i] = v >> (8 * i); }
+static inline uint16_t verdict_get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t verdict_get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint64_t verdict_get64(const uint8_t *p) {
+    return verdict_get32(p) | ((uint64_t)verdict_get32(p + 4) << 32);
+}
+
+static inline uint8_t *verdict_put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) { *p++ = (uint8_t)(v | 0x80); v >>= 7; }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Returns NULL on truncated input
+static inline const uint8_t *verdict_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t r = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { *v = r; return p; }
+    }
+    return NULL;
+}
+
+static inline uint64_t verdict_zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t verdict_unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/* --- BATCH ENCODE / DECODE --- */
+
+// Worst case size of a framed batch
+static inline size_t verdict_batch_bound(const struct verdict_record *r, int n) {
+    size_t size = 4 + VERDICT_HDR_SIZE + (size_t)n * 40;
+    for (int i = 0; i < n; i++) size += r[i].thumb_len;
+    return size;
+}
+
+// Encode n records into out (at least verdict_batch_bound() bytes), including
+// the length prefix. Returns the total number of bytes written.
+static inline size_t verdict_encode_batch(uint8_t *out, uint16_t node_id, uint64_t seq,
+                                          const struct verdict_record *r, int n) {
+    uint8_t *p = out + 4;
+    verdict_put32(p, VERDICT_MAGIC);
+    verdict_put16(p + 4, node_id);
+    verdict_put16(p + 6, (uint16_t)n);
+    verdict_put64(p + 8, seq);
+    p += VERDICT_HDR_SIZE;
+
+    // Column 1: ids, delta to previous
+    uint32_t prev_id = 0;
+    for (int i = 0; i < n; i++) {
+        p = verdict_put_varint(p, verdict_zigzag((int64_t)r[i].id - prev_id));
+        prev_id = r[i].id;
+    }
+    // Column 2: timestamps, first absolute then deltas
+    uint64_t prev_ts = 0;
+    for (int i = 0; i < n; i++) {
+        p = verdict_put_varint(p, verdict_zigzag((int64_t)(r[i].ts_us - prev_ts)));
+        prev_ts = r[i].ts_us;
+    }
+    // Column 3: verdicts, 4 per byte
+    for (int i = 0; i < n; i += 4) {
+        uint8_t b = 0;
+        for (int k = 0; k < 4 && i + k < n; k++) b |= (r[i + k].verdict & 3) << (2 * k);
+        *p++ = b;
+    }
+    // Columns 4-6: score, latency, thumbnail length
+    for (int i = 0; i < n; i++) p = verdict_put_varint(p, r[i].score);
+    for (int i = 0; i < n; i++) p = verdict_put_varint(p, r[i].latency_us);
+    for (int i = 0; i < n; i++) p = verdict_put_varint(p, r[i].thumb_len);
+    // Thumbnails, raw
+    for (int i = 0; i < n; i++) {
+        if (r[i].thumb_len) memcpy(p, r[i].thumb, r[i].thumb_len);
+        p += r[i].thumb_len;
+    }
+
+    size_t total = (size_t)(p - out);
+    verdict_put32(out, (uint32_t)(total - 4));
+    return total;
+}
+
+// Decode a batch (without the length prefix). r must hold VERDICT_MAX_BATCH
+// records; thumbnails point into buf. Returns the record count or -1.
+static inline int verdict_decode_batch(const uint8_t *buf, size_t len, uint16_t *node_id,
+                                       uint64_t *seq, struct verdict_record *r) {
+    const uint8_t *p = buf, *end = buf + len;
+    uint64_t v;
+
+    if (len < VERDICT_HDR_SIZE || verdict_get32(p) != VERDICT_MAGIC) return -1;
+    *node_id = verdict_get16(p + 4);
+    int n = verdict_get16(p + 6);
+    *seq = verdict_get64(p + 8);
+    if (n > VERDICT_MAX_BATCH) return -1;
+    p += VERDICT_HDR_SIZE;
+
+    uint32_t prev_id = 0;
+    for (int i = 0; i < n; i++) {
+        if (!(p = verdict_get_varint(p, end, &v))) return -1;
+        r[i].id = prev_id = (uint32_t)(prev_id + verdict_unzigzag(v));
+    }
+    uint64_t prev_ts = 0;
+    for (int i = 0; i < n; i++) {
+        if (!(p = verdict_get_varint(p, end, &v))) return -1;
+        r[i].ts_us = prev_ts = prev_ts + (uint64_t)verdict_unzigzag(v);
+    }
+    if (end - p < (n + 3) / 4) return -1;
+    for (int i = 0; i < n; i++) r[i].verdict = (p[i / 4] >> (2 * (i % 4))) & 3;
+    p += (n + 3) / 4;
+    for (int i = 0; i < n; i++) {
+        if (!(p = verdict_get_varint(p, end, &v))) return -1;
+        r[i].score = (uint16_t)v;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!(p = verdict_get_varint(p, end, &v))) return -1;
+        r[i].latency_us = (uint32_t)v;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!(p = verdict_get_varint(p, end, &v))) return -1;
+        r[i].thumb_len = (uint32_t)v;
+    }
+    for (int i = 0; i < n; i++) {
+        if ((size_t)(end - p) < r[i].thumb_len) return -1;
+        r[i].thumb = r[i].thumb_len ? p : NULL;
+        p += r[i].thumb_len;
+    }
+    return n;
+}
+
+#endif // VERDICT_H
@@ -0,0 +1,530 @@
+// verdict_publisher.h - Node side of the line aggregator.
+//
+// vpub_submit() only copies the record into the pending batch, so it is
+// safe to call from the inspection path. A sender thread flushes the batch
+// every flush_ms (or when it is full), encodes it with verdict.h and streams
+// it to the aggregator over TCP. If the sender falls behind, full batches
+// queue up for it (VPUB_BACKLOG of them) rather than being dropped.
+//
+// When the link is down batches are appended to a local spool file. After a
+// reconnect the spool is replayed in order before any live batch is sent, and
+// only truncated once the aggregator has acked everything in it. Batches that
+// were in flight when the link dropped are re-spooled, so delivery is
+// at-least-once; the aggregator drops duplicates by (session, counter), see
+// verdict.h. Ack ages and timeouts run on CLOCK_MONOTONIC. A peer
+// that stops acking for VPUB_ACK_TIMEOUT_MS counts as a dropped link, so a
+// half-open connection cannot stall the sender.
+//
+// Usage:
+//   struct vpub pub;
+//   vpub_init(&pub, "192.168.1.10", VERDICT_DEFAULT_PORT, 3, "/var/spool/verdicts.bin");
+//   vpub_submit(&pub, box_id, VERDICT_DEFECTIVE, 9731, latency_us, jpg, jpg_len);
+//   vpub_close(&pub);
+//
+// Build with -lpthread.
+
+#ifndef VERDICT_PUBLISHER_H
+#define VERDICT_PUBLISHER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "verdict.h"
+#include "telemetry.h"
+
+#define VPUB_FLUSH_MS      100                 // batch at most this long
+#define VPUB_WINDOW        64                  // unacked batches on the wire
+#define VPUB_THUMB_BUDGET  (4 * 1024 * 1024)   // pending thumbnail bytes
+#define VPUB_RETRY_MS      1000                // reconnect backoff
+#define VPUB_ACK_TIMEOUT_MS 5000               // oldest unacked batch -> link is dead
+#define VPUB_BACKLOG       8                   // full batches queued for the sender
+
+struct vpub_inflight {
+    uint64_t seq;
+    uint8_t *data;          // live batch (owned), NULL if it came from the spool
+    size_t len;
+    int nrecs;
+    off_t spool_end;        // spool offset just past this batch
+    uint64_t sent_us;       // CLOCK_MONOTONIC
+};
+
+static struct tm_hist vpub_inference_us = TM_HIST("inference", "us");    // as reported in each verdict
+static struct tm_hist vpub_ack_us = TM_HIST("verdict_ack", "us");        // batch send -> aggregator ack
+static struct tm_counter vpub_verdicts = TM_COUNTER("verdicts");
+
+struct vpub_pending {
+    struct verdict_record recs[VERDICT_MAX_BATCH];
+    size_t thumb_off[VERDICT_MAX_BATCH];
+    int n;
+    uint8_t *thumbs;
+    size_t thumbs_len, thumbs_cap;
+    struct vpub_pending *next;
+};
+
+struct vpub {
+    char host[128];
+    int port;
+    uint16_t node_id;
+    char spool_path[256];
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int quit;
+    struct vpub_pending *pending;       // filled by vpub_submit
+    struct vpub_pending *full;          // full batches for the sender, oldest first
+    int nfull;
+    struct vpub_pending *spare;         // shipped batches for reuse
+
+    // Sender thread only
+    int sock;
+    uint64_t seq;
+    uint64_t last_attempt_ms;
+    int spool_fd;
+    off_t spool_read, spool_acked, spool_size;
+    struct vpub_inflight inflight[VPUB_WINDOW];
+    int ninflight;
+    uint8_t ackbuf[8];
+    int acklen;
+
+    // Stats
+    uint64_t submitted, sent_batches, acked_batches, spooled_batches;
+    uint64_t dropped;                   // records; updated from both sides, atomically
+};
+
+static inline void vpub_drop(struct vpub *pub, int n) {
+    __atomic_add_fetch(&pub->dropped, n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t vpub_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t vpub_mono_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Session id for the high half of seq; getrandom() only fails on ancient kernels
+static inline uint32_t vpub_session(void) {
+    uint32_t s;
+    if (getrandom(&s, sizeof(s), GRND_NONBLOCK) == (ssize_t)sizeof(s)) return s;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint32_t)(ts.tv_nsec ^ ts.tv_sec * 2654435761u ^ (uint32_t)getpid() << 16 ^ vpub_mono_us());
+}
+
+/* --- SOCKET --- */
+
+static int vpub_send_all(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void vpub_try_connect(struct vpub *pub) {
+    struct addrinfo hints = {0}, *res = NULL;
+    char port[16];
+
+    uint64_t now = vpub_now_ms();
+    if (now - pub->last_attempt_ms < VPUB_RETRY_MS) return;
+    pub->last_attempt_ms = now;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", pub->port);
+    if (getaddrinfo(pub->host, port, &hints, &res) != 0) return;
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0) {
+        struct timeval tv = { 2, 0 };
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+            printf("vpub: connected to %s:%d\n", pub->host, pub->port);
+            pub->sock = fd;
+            pub->acklen = 0;
+        } else {
+            close(fd);
+        }
+    }
+    freeaddrinfo(res);
+}
+
+// Drop the connection. Live batches in flight go to the end of the spool
+// (the spool is empty while live batches are sent, so order is kept);
+// spooled ones are simply re-read from the last acked offset.
+static void vpub_disconnect(struct vpub *pub) {
+    if (pub->sock < 0) return;
+    fprintf(stderr, "vpub: link to %s:%d lost, spooling\n", pub->host, pub->port);
+    close(pub->sock);
+    pub->sock = -1;
+
+    for (int i = 0; i < pub->ninflight; i++) {
+        struct vpub_inflight *f = &pub->inflight[i];
+        if (f->data) {
+            if (pwrite(pub->spool_fd, f->data, f->len, pub->spool_size) == (ssize_t)f->len) {
+                pub->spool_size += f->len;
+                pub->spooled_batches++;
+            } else {
+                vpub_drop(pub, f->nrecs);
+            }
+            free(f->data);
+        }
+    }
+    pub->ninflight = 0;
+    pub->spool_read = pub->spool_acked;
+}
+
+// Consume acks. block_ms > 0 waits for at least one.
+static void vpub_read_acks(struct vpub *pub, int block_ms) {
+    if (pub->sock < 0) return;
+    struct pollfd pfd = { pub->sock, POLLIN, 0 };
+    if (poll(&pfd, 1, block_ms) <= 0) return;
+
+    for (;;) {
+        ssize_t n = recv(pub->sock, pub->ackbuf + pub->acklen, sizeof(pub->ackbuf) - pub->acklen, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            vpub_disconnect(pub);
+            return;
+        }
+        if (n < 0) return;
+        pub->acklen += n;
+        if (pub->acklen < (int)sizeof(pub->ackbuf)) continue;
+        pub->acklen = 0;
+
+        // Acks come in order; seqs of different sessions do not compare, so match exactly
+        uint64_t seq = verdict_get64(pub->ackbuf);
+        int k = 0;
+        while (k < pub->ninflight && pub->inflight[k].seq != seq) k++;
+        if (k == pub->ninflight) continue;
+        uint64_t now = vpub_mono_us();
+        for (int i = 0; i <= k; i++) {
+            struct vpub_inflight *f = &pub->inflight[i];
+            if (f->data) free(f->data);
+            else pub->spool_acked = f->spool_end;
+            tm_record(&vpub_ack_us, now - f->sent_us);
+            pub->acked_batches++;
+        }
+        k++;
+        memmove(pub->inflight, pub->inflight + k, (pub->ninflight - k) * sizeof(pub->inflight[0]));
+        pub->ninflight -= k;
+
+        // Everything spooled has been acked: start the spool over
+        if (pub->spool_size > 0 && pub->spool_acked == pub->spool_size && pub->ninflight == 0) {
+            if (ftruncate(pub->spool_fd, 0) == 0)
+                pub->spool_size = pub->spool_read = pub->spool_acked = 0;
+        }
+    }
+}
+
+// Acks come back in order, so an old head of the window means the peer has
+// stopped acking (half-open link, hung aggregator)
+static void vpub_check_acks(struct vpub *pub) {
+    if (pub->sock < 0 || pub->ninflight == 0) return;
+    uint64_t age_ms = (vpub_mono_us() - pub->inflight[0].sent_us) / 1000;
+    if (age_ms < VPUB_ACK_TIMEOUT_MS) return;
+    fprintf(stderr, "vpub: no ack from %s:%d for %llu ms\n", pub->host, pub->port, (unsigned long long)age_ms);
+    vpub_disconnect(pub);
+}
+
+static void vpub_wait_window(struct vpub *pub) {
+    while (pub->sock >= 0 && pub->ninflight >= VPUB_WINDOW) {
+        vpub_read_acks(pub, 500);
+        vpub_check_acks(pub);
+    }
+}
+
+// Replay spooled batches while the link is up
+static void vpub_drain_spool(struct vpub *pub) {
+    uint8_t hdr[4 + VERDICT_HDR_SIZE];
+
+    while (pub->sock >= 0 && pub->spool_read < pub->spool_size) {
+        vpub_wait_window(pub);
+        if (pub->sock < 0) break;
+
+        if (pread(pub->spool_fd, hdr, sizeof(hdr), pub->spool_read) != (ssize_t)sizeof(hdr)) break;
+        size_t len = 4 + verdict_get32(hdr);
+        if (len > VERDICT_MAX_FRAME || verdict_get32(hdr + 4) != VERDICT_MAGIC) {
+            // Torn write from a power cut: the rest of the spool is unusable
+            fprintf(stderr, "vpub: corrupt spool at offset %lld, discarding tail\n", (long long)pub->spool_read);
+            pub->spool_size = pub->spool_read;
+            if (ftruncate(pub->spool_fd, pub->spool_size) != 0) perror("vpub: ftruncate");
+            break;
+        }
+        uint8_t *frame = malloc(len);
+        if (!frame) break;
+        if (pread(pub->spool_fd, frame, len, pub->spool_read) != (ssize_t)len) { free(frame); break; }
+
+        int rc = vpub_send_all(pub->sock, frame, len);
+        free(frame);
+        if (rc < 0) { vpub_disconnect(pub); break; }
+
+        struct vpub_inflight *f = &pub->inflight[pub->ninflight++];
+        f->seq = verdict_get64(hdr + 12);
+        f->data = NULL;
+        f->len = len;
+        f->nrecs = 0;
+        f->spool_end = pub->spool_read + len;
+        f->sent_us = vpub_mono_us();
+        pub->spool_read += len;
+        pub->sent_batches++;
+    }
+}
+
+/* --- SENDER THREAD --- */
+
+// A batch to fill, reused from the spare list when possible. Call with the lock held.
+static struct vpub_pending *vpub_pending_get(struct vpub *pub) {
+    struct vpub_pending *b = pub->spare;
+    if (b) {
+        pub->spare = b->next;
+        b->next = NULL;
+        return b;
+    }
+    return calloc(1, sizeof(*b));
+}
+
+static void vpub_pending_free(struct vpub_pending *b) {
+    while (b) {
+        struct vpub_pending *next = b->next;
+        free(b->thumbs);
+        free(b);
+        b = next;
+    }
+}
+
+static void vpub_ship(struct vpub *pub, struct vpub_pending *b) {
+    for (int i = 0; i < b->n; i++)
+        b->recs[i].thumb = b->recs[i].thumb_len ? b->thumbs + b->thumb_off[i] : NULL;
+
+    size_t bound = verdict_batch_bound(b->recs, b->n);
+    uint8_t *frame = malloc(bound);
+    if (!frame) { vpub_drop(pub, b->n); return; }
+    size_t len = verdict_encode_batch(frame, pub->node_id, pub->seq++, b->recs, b->n);
+
+    if (pub->sock >= 0 && pub->spool_size == 0) {
+        vpub_wait_window(pub);
+        if (pub->sock >= 0 && vpub_send_all(pub->sock, frame, len) == 0) {
+            struct vpub_inflight *f = &pub->inflight[pub->ninflight++];
+            f->seq = pub->seq - 1;
+            f->data = frame;
+            f->len = len;
+            f->nrecs = b->n;
+            f->spool_end = 0;
+            f->sent_us = vpub_mono_us();
+            pub->sent_batches++;
+            return;
+        }
+        vpub_disconnect(pub);
+    }
+
+    if (pwrite(pub->spool_fd, frame, len, pub->spool_size) == (ssize_t)len) {
+        pub->spool_size += len;
+        pub->spooled_batches++;
+    } else {
+        perror("vpub: spool write");
+        vpub_drop(pub, b->n);
+    }
+    free(frame);
+}
+
+static void *vpub_thread(void *arg) {
+    struct vpub *pub = arg;
+    int quit = 0;
+
+    while (!quit) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += VPUB_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+
+        // Take the queued batches and the pending one so submitters never
+        // wait on the network
+        pthread_mutex_lock(&pub->lock);
+        while (!pub->quit && !pub->full && pub->pending->n < VERDICT_MAX_BATCH) {
+            if (pthread_cond_timedwait(&pub->cv, &pub->lock, &deadline) == ETIMEDOUT) break;
+        }
+        quit = pub->quit;
+        struct vpub_pending *list = pub->full;
+        if (pub->pending->n > 0) {
+            struct vpub_pending *nb = vpub_pending_get(pub);
+            if (nb) {
+                struct vpub_pending **tail = &list;
+                while (*tail) tail = &(*tail)->next;
+                *tail = pub->pending;
+                pub->pending = nb;
+            }
+        }
+        pub->full = NULL;
+        pub->nfull = 0;
+        pthread_mutex_unlock(&pub->lock);
+
+        if (pub->sock < 0) vpub_try_connect(pub);
+        vpub_drain_spool(pub);
+        for (struct vpub_pending *b = list; b; b = b->next) vpub_ship(pub, b);
+        vpub_read_acks(pub, 0);
+        vpub_check_acks(pub);
+
+        pthread_mutex_lock(&pub->lock);
+        while (list) {
+            struct vpub_pending *b = list;
+            list = b->next;
+            b->n = 0;
+            b->thumbs_len = 0;
+            b->next = pub->spare;
+            pub->spare = b;
+        }
+        pthread_mutex_unlock(&pub->lock);
+    }
+
+    // Give outstanding acks a moment, then leave the rest in the spool
+    for (int i = 0; i < 10 && pub->sock >= 0 && (pub->ninflight > 0 || pub->spool_read < pub->spool_size); i++) {
+        vpub_drain_spool(pub);
+        vpub_read_acks(pub, 200);
+        vpub_check_acks(pub);
+    }
+    if (pub->ninflight > 0) {
+        vpub_disconnect(pub);
+    } else if (pub->sock >= 0) {
+        close(pub->sock);
+        pub->sock = -1;
+    }
+    return NULL;
+}
+
+/* --- API --- */
+
+static inline int vpub_init(struct vpub *pub, const char *host, int port, uint16_t node_id, const char *spool_path) {
+    struct stat st;
+
+    memset(pub, 0, sizeof(*pub));
+    snprintf(pub->host, sizeof(pub->host), "%s", host);
+    snprintf(pub->spool_path, sizeof(pub->spool_path), "%s", spool_path);
+    pub->port = port;
+    pub->node_id = node_id;
+    pub->sock = -1;
+    pub->pending = vpub_pending_get(pub);
+    if (!pub->pending) {
+        perror("Malloc failed");
+        return -1;
+    }
+    // A fresh session: the aggregator only calls a batch a duplicate within one
+    pub->seq = (uint64_t)vpub_session() << 32;
+
+    pub->spool_fd = open(spool_path, O_RDWR | O_CREAT, 0644);
+    if (pub->spool_fd < 0) {
+        fprintf(stderr, "vpub: cannot open spool %s: %s\n", spool_path, strerror(errno));
+        vpub_pending_free(pub->pending);
+        return -1;
+    }
+    if (fstat(pub->spool_fd, &st) == 0) pub->spool_size = st.st_size;
+    if (pub->spool_size > 0)
+        printf("vpub: %lld spooled bytes from a previous run will be replayed\n", (long long)pub->spool_size);
+
+    pthread_mutex_init(&pub->lock, NULL);
+    pthread_cond_init(&pub->cv, NULL);
+    if (pthread_create(&pub->thread, NULL, vpub_thread, pub) != 0) {
+        perror("vpub: pthread_create");
+        close(pub->spool_fd);
+        vpub_pending_free(pub->pending);
+        return -1;
+    }
+    return 0;
+}
+
+// Queue one verdict. Never blocks on the network; a full batch is handed to
+// the sender (which spools it if the link is down). Only when VPUB_BACKLOG
+// batches are already waiting is the record dropped and counted.
+static inline int vpub_submit(struct vpub *pub, uint32_t id, int verdict, uint16_t score,
+                              uint32_t latency_us, const uint8_t *thumb, uint32_t thumb_len) {
+    int rc = 0;
+    pthread_mutex_lock(&pub->lock);
+    struct vpub_pending *b = pub->pending;
+    if (b->n >= VERDICT_MAX_BATCH && pub->nfull < VPUB_BACKLOG) {
+        struct vpub_pending *nb = vpub_pending_get(pub);
+        if (nb) {
+            struct vpub_pending **tail = &pub->full;
+            while (*tail) tail = &(*tail)->next;
+            *tail = b;
+            pub->nfull++;
+            pub->pending = b = nb;
+            pthread_cond_signal(&pub->cv);
+        }
+    }
+    if (b->n >= VERDICT_MAX_BATCH) {
+        vpub_drop(pub, 1);
+        rc = -1;
+    } else {
+        struct verdict_record *r = &b->recs[b->n];
+        r->id = id;
+        r->ts_us = verdict_now_us();
+        r->verdict = (uint8_t)verdict;
+        r->score = score;
+        r->latency_us = latency_us;
+        r->thumb_len = 0;
+
+        if (thumb && thumb_len && b->thumbs_len + thumb_len <= VPUB_THUMB_BUDGET) {
+            if (b->thumbs_len + thumb_len > b->thumbs_cap) {
+                size_t cap = b->thumbs_cap ? b->thumbs_cap * 2 : 64 * 1024;
+                while (cap < b->thumbs_len + thumb_len) cap *= 2;
+                uint8_t *t = realloc(b->thumbs, cap);
+                if (t) { b->thumbs = t; b->thumbs_cap = cap; }
+            }
+            if (b->thumbs_len + thumb_len <= b->thumbs_cap) {
+                memcpy(b->thumbs + b->thumbs_len, thumb, thumb_len);
+                b->thumb_off[b->n] = b->thumbs_len;
+                b->thumbs_len += thumb_len;
+                r->thumb_len = thumb_len;
+            }
+        }
+        b->n++;
+        pub->submitted++;
+        tm_record(&vpub_inference_us, latency_us);
+        tm_count(&vpub_verdicts, 1);
+        if (b->n == VERDICT_MAX_BATCH) pthread_cond_signal(&pub->cv);
+    }
+    pthread_mutex_unlock(&pub->lock);
+    return rc;
+}
+
+// Flush what is pending and stop the sender. Anything not acked stays spooled.
+static inline void vpub_close(struct vpub *pub) {
+    pthread_mutex_lock(&pub->lock);
+    pub->quit = 1;
+    pthread_cond_signal(&pub->cv);
+    pthread_mutex_unlock(&pub->lock);
+    pthread_join(pub->thread, NULL);
+
+    close(pub->spool_fd);
+    vpub_pending_free(pub->pending);
+    vpub_pending_free(pub->full);
+    vpub_pending_free(pub->spare);
+    pthread_mutex_destroy(&pub->lock);
+    pthread_cond_destroy(&pub->cv);
+}
+
+#endif // VERDICT_PUBLISHER_H
@@ -0,0 +1,204 @@
+// vlease.h - Reference-counted leases on V4L2 capture buffers.
+//
+// A dequeued buffer is the frame itself: consumers (encoder harts, the
+// motion check, an evidence grab) can read it in place instead of copying
+// it out, but only while the driver does not have it back. Each DQBUF
+// becomes a struct vframe holding one reference for the caller; a consumer
+// that keeps the frame takes its own with vlease_get() and drops it with
+// vlease_put(), from any thread. The last put requeues the buffer (QBUF),
+// so nobody has to know who else still looks at it.
+//
+// Leases cost the driver buffers: with too few left queued it has nothing
+// to capture into and drops frames at the sensor. When a DQBUF leaves
+// fewer than min_queued with the driver, the frame is copied into one of
+// VLEASE_SPARES heap buffers and the driver buffer goes straight back;
+// the caller gets the copy's vframe and cannot tell the difference. No
+// free spare either: the caller gets the driver buffer and the driver runs
+// short (counted as starved).
+//
+// Usage:
+//   struct vlease vl;
+//   vlease_init(&vl, fd, 2);  for each mmap'd buffer: vlease_add(&vl, start, length);
+//   struct vframe *f = vlease_dequeue(&vl);         // NULL: errno (EAGAIN: nothing ready)
+//   vlease_get(f); hand f->data to a worker, which calls vlease_put(f) when done
+//   vlease_put(f);                                  // the caller's own reference
+//   vlease_print(&vl); vlease_free(&vl);            // every lease returned
+
+#ifndef VLEASE_H
+#define VLEASE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include "telemetry.h"
+
+#define VLEASE_MAX     32               // driver buffers
+#define VLEASE_SPARES  4                // copies for when the driver runs short
+
+struct vlease;
+
+struct vframe {
+    struct vlease *vl;
+    int index;                          // driver buffer, -1 for a copy
+    int spare;                          // copy slot, -1 for a driver buffer
+    const uint8_t *data;
+    uint32_t bytesused, sequence;
+    uint64_t ts_us;                     // driver timestamp
+    uint64_t leased_ns;
+    int refs;
+};
+
+struct vlease {
+    int fd, nbuf, min_queued;
+    void *start[VLEASE_MAX];
+    size_t length[VLEASE_MAX], max_length;
+    struct vframe frames[VLEASE_MAX + VLEASE_SPARES];
+    uint8_t *spare[VLEASE_SPARES];
+    int spare_used[VLEASE_SPARES];
+    int queued, low;                    // with the driver now, fewest after a dequeue
+
+    uint64_t leases, copies, starved;
+};
+
+static struct tm_hist vlease_hold_us = TM_HIST("vlease_hold", "us");      // DQBUF to QBUF of a leased buffer
+static struct tm_counter vlease_copies = TM_COUNTER("vlease_copies");
+
+static inline uint64_t vlease_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Every buffer added must be queued with the driver
+static inline void vlease_init(struct vlease *vl, int fd, int min_queued) {
+    memset(vl, 0, sizeof(*vl));
+    vl->fd = fd;
+    vl->min_queued = min_queued;
+    for (int i = 0; i < VLEASE_MAX + VLEASE_SPARES; i++) {
+        vl->frames[i].vl = vl;
+        vl->frames[i].index = i < VLEASE_MAX ? i : -1;
+        vl->frames[i].spare = i < VLEASE_MAX ? -1 : i - VLEASE_MAX;
+    }
+}
+
+// Buffer index nbuf, as mapped
+static inline int vlease_add(struct vlease *vl, void *start, size_t length) {
+    if (vl->nbuf == VLEASE_MAX) return -1;
+    vl->start[vl->nbuf] = start;
+    vl->length[vl->nbuf] = length;
+    if (length > vl->max_length) vl->max_length = length;
+    vl->nbuf++;
+    vl->queued = vl->low = vl->nbuf;
+    return 0;
+}
+
+static inline int vlease_qbuf(struct vlease *vl, int index) {
+    struct v4l2_buffer buf = {0};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    int r;
+    do { r = ioctl(vl->fd, VIDIOC_QBUF, &buf); } while (r == -1 && errno == EINTR);
+    if (r < 0) { perror("vlease: QBUF"); return -1; }
+    __atomic_add_fetch(&vl->queued, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// A free copy slot, allocated on first use; -1 if all are leased
+static inline int vlease_spare(struct vlease *vl) {
+    for (int s = 0; s < VLEASE_SPARES; s++) {
+        int expect = 0;
+        if (!__atomic_compare_exchange_n(&vl->spare_used[s], &expect, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) continue;
+        if (!vl->spare[s] && !(vl->spare[s] = malloc(vl->max_length))) {
+            __atomic_store_n(&vl->spare_used[s], 0, __ATOMIC_RELEASE);
+            return -1;
+        }
+        return s;
+    }
+    return -1;
+}
+
+// DQBUF into a lease the caller holds one reference to; NULL with errno set
+static inline struct vframe *vlease_dequeue(struct vlease *vl) {
+    struct v4l2_buffer buf = {0};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    int r;
+    do { r = ioctl(vl->fd, VIDIOC_DQBUF, &buf); } while (r == -1 && errno == EINTR);
+    if (r < 0) return NULL;
+    if ((int)buf.index >= vl->nbuf) { errno = EINVAL; return NULL; }
+    int queued = __atomic_sub_fetch(&vl->queued, 1, __ATOMIC_RELAXED);
+    if (queued < vl->low) vl->low = queued;
+
+    struct vframe *f = &vl->frames[buf.index];
+    f->data = vl->start[buf.index];
+    f->bytesused = buf.bytesused;
+    f->sequence = buf.sequence;
+    f->ts_us = (uint64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    f->leased_ns = vlease_now_ns();
+    f->refs = 1;
+    vl->leases++;
+    if (queued >= vl->min_queued || !buf.bytesused) return f;
+
+    // The driver is running short: copy out and give the buffer back now
+    int s = vlease_spare(vl);
+    if (s < 0) {
+        vl->starved++;
+        return f;
+    }
+    struct vframe *c = &vl->frames[VLEASE_MAX + s];
+    memcpy(vl->spare[s], f->data, f->bytesused);
+    c->data = vl->spare[s];
+    c->bytesused = f->bytesused;
+    c->sequence = f->sequence;
+    c->ts_us = f->ts_us;
+    c->leased_ns = f->leased_ns;
+    c->refs = 1;
+    f->refs = 0;
+    vlease_qbuf(vl, buf.index);
+    vl->copies++;
+    tm_count(&vlease_copies, 1);
+    return c;
+}
+
+static inline void vlease_get(struct vframe *f) {
+    __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+}
+
+// Last reference: back to the driver (or the copy slot freed)
+static inline void vlease_put(struct vframe *f) {
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    struct vlease *vl = f->vl;
+    if (f->index >= 0) {
+        tm_record(&vlease_hold_us, (vlease_now_ns() - f->leased_ns) / 1000);
+        vlease_qbuf(vl, f->index);
+    } else {
+        __atomic_store_n(&vl->spare_used[f->spare], 0, __ATOMIC_RELEASE);
+    }
+}
+
+static inline int vlease_queued(const struct vlease *vl) {
+    return __atomic_load_n(&vl->queued, __ATOMIC_RELAXED);
+}
+
+static inline void vlease_print(struct vlease *vl) {
+    printf("Leases: %llu frames, %llu copied out (driver below %d queued), %llu starved, %d of %d queued now, %d at least\n",
+           (unsigned long long)vl->leases, (unsigned long long)vl->copies, vl->min_queued, (unsigned long long)vl->starved,
+           vlease_queued(vl), vl->nbuf, vl->low);
+}
+
+// Every lease must have been put
+static inline void vlease_free(struct vlease *vl) {
+    for (int i = 0; i < VLEASE_MAX + VLEASE_SPARES; i++)
+        if (__atomic_load_n(&vl->frames[i].refs, __ATOMIC_RELAXED))
+            fprintf(stderr, "vlease: frame %d still leased\n", i);
+    for (int s = 0; s < VLEASE_SPARES; s++) free(vl->spare[s]);
+    memset(vl->spare, 0, sizeof(vl->spare));
+}
+
+#endif // VLEASE_H
@@ -0,0 +1,385 @@
+// vledger.h - Append-only verdict ledger with group commit.
+//
+// Every verdict is written to a local ledger that survives a power cut, for
+// traceability independent of whether the aggregator ever received it. An
+// fdatasync per record would cap the node at a few hundred verdicts per
+// second on eMMC, so records are committed in groups: vledger_append() only
+// copies the record into the pending batch and returns its log sequence
+// number (LSN); a committer thread writes the batch and issues one
+// fdatasync for all of it once VLEDGER_COMMIT_MS have passed since its
+// first record or VLEDGER_MAX_BATCH records are waiting, whichever comes
+// first. Callers that must not go on before their record is durable call
+// vledger_wait(lsn).
+//
+// File layout, little-endian, everything 32 bytes:
+//   header: magic "VLG1" u32 | version u16 | record size u16 | base LSN u64 |
+//           salt u64 | reserved u32 | CRC-32 of the first 28 bytes u32
+//   record: LSN u64 | ts_us u64 | id u32 | latency_us u32 | score u16 |
+//           verdict u8 | 0 u8 | CRC-32 of the first 28 bytes, seeded with the salt u32
+// Record i holds LSN base + i, so a record that is torn, or left over from
+// an older ledger at the same path (different salt), fails its check.
+//
+// Recovery: only the batch being written at the crash can be damaged, and
+// everything before it was synced. vledger_open() therefore checks just the
+// last 2 * VLEDGER_MAX_BATCH records (all of them with full_scan), cuts the
+// file at the first bad one and syncs the cut before appending.
+//
+// Usage:
+//   struct vledger lg;
+//   vledger_open(&lg, "/data/verdicts.vlg", 0);
+//   uint64_t lsn = vledger_append(&lg, id, ts_us, VERDICT_GOOD, 9731, latency_us);
+//   vledger_wait(&lg, lsn);          // only where durability gates the next step
+//   vledger_close(&lg);
+//
+// Build with -lpthread.
+
+#ifndef VLEDGER_H
+#define VLEDGER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "telemetry.h"
+
+#define VLEDGER_MAGIC      0x31474c56u     // "VLG1"
+#define VLEDGER_VERSION    1
+#define VLEDGER_REC_SIZE   32
+#define VLEDGER_HDR_SIZE   32
+#define VLEDGER_COMMIT_MS  20              // oldest pending record waits at most this long
+#define VLEDGER_MAX_BATCH  1024            // records per fdatasync
+#define VLEDGER_RETRY_MS   200             // after a failed write or sync
+
+static struct tm_hist vledger_commit_us = TM_HIST("ledger_commit", "us");    // append -> durable, per record
+static struct tm_hist vledger_sync_us = TM_HIST("ledger_sync", "us");        // pwrite + fdatasync, per batch
+static struct tm_counter vledger_records = TM_COUNTER("ledger_records");
+
+struct vledger_batch {
+    uint8_t data[VLEDGER_MAX_BATCH * VLEDGER_REC_SIZE];
+    uint64_t t_ns[VLEDGER_MAX_BATCH];       // append time, for the commit latency
+    uint64_t first_lsn;
+    int n;
+};
+
+struct vledger {
+    char path[256];
+    int fd;
+    uint64_t salt, base_lsn;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work, durable;
+    int quit, stopped;
+    struct vledger_batch bufs[2];
+    struct vledger_batch *pending;          // filled by vledger_append
+    uint64_t next_lsn;                      // next to hand out
+    uint64_t durable_lsn;                   // every LSN below this is on disk
+
+    // Stats
+    uint64_t records, batches, stalls, errors;
+    uint64_t recovered, cut;                // at open: records kept, bytes discarded
+    double scan_ms;
+    double t_open;
+};
+
+static inline uint64_t vledger_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t vledger_crc32(uint32_t crc, const uint8_t *p, size_t len) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (len--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline void vledger_put(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint64_t vledger_get(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static inline int vledger_record_ok(const struct vledger *l, const uint8_t *r, uint64_t lsn) {
+    return vledger_get(r, 8) == lsn &&
+           vledger_get(r + 28, 4) == vledger_crc32((uint32_t)l->salt, r, 28);
+}
+
+// Write and sync one batch; retried by the caller until it works
+static inline int vledger_write(struct vledger *l, const struct vledger_batch *b) {
+    size_t len = (size_t)b->n * VLEDGER_REC_SIZE, done = 0;
+    off_t off = VLEDGER_HDR_SIZE + (off_t)(b->first_lsn - l->base_lsn) * VLEDGER_REC_SIZE;
+    while (done < len) {
+        ssize_t n = pwrite(l->fd, b->data + done, len - done, off + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("vledger: write");
+            return -1;
+        }
+        done += n;
+    }
+    if (fdatasync(l->fd) != 0) {
+        perror("vledger: fdatasync");
+        return -1;
+    }
+    return 0;
+}
+
+static void *vledger_thread(void *arg) {
+    struct vledger *l = arg;
+    int quit = 0;
+
+    while (!quit) {
+        pthread_mutex_lock(&l->lock);
+        // Sleep until there is something, then until the batch is full or old enough
+        while (!l->quit && l->pending->n == 0) pthread_cond_wait(&l->work, &l->lock);
+        if (l->pending->n > 0) {
+            uint64_t due = l->pending->t_ns[0] + VLEDGER_COMMIT_MS * 1000000ull;
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            uint64_t now = vledger_now_ns();
+            if (due > now) {
+                deadline.tv_sec += (due - now) / 1000000000;
+                deadline.tv_nsec += (due - now) % 1000000000;
+                if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+                while (!l->quit && l->pending->n < VLEDGER_MAX_BATCH) {
+                    if (pthread_cond_timedwait(&l->work, &l->lock, &deadline) == ETIMEDOUT) break;
+                }
+            }
+        }
+        quit = l->quit;
+        struct vledger_batch *b = l->pending;
+        l->pending = (b == &l->bufs[0]) ? &l->bufs[1] : &l->bufs[0];
+        l->pending->n = 0;
+        l->pending->first_lsn = l->next_lsn;
+        pthread_cond_broadcast(&l->durable);       // appenders stalled on a full batch
+        pthread_mutex_unlock(&l->lock);
+
+        if (b->n == 0) continue;
+        uint64_t t0 = vledger_now_ns();
+        int ok = 1;
+        while (vledger_write(l, b) != 0) {
+            l->errors++;
+            if (quit) { ok = 0; break; }
+            usleep(VLEDGER_RETRY_MS * 1000);
+        }
+        if (!ok) break;
+        uint64_t t1 = vledger_now_ns();
+        tm_record(&vledger_sync_us, (t1 - t0) / 1000);
+        for (int i = 0; i < b->n; i++) tm_record(&vledger_commit_us, (t1 - b->t_ns[i]) / 1000);
+        tm_count(&vledger_records, b->n);
+
+        pthread_mutex_lock(&l->lock);
+        l->durable_lsn = b->first_lsn + b->n;
+        l->batches++;
+        pthread_cond_broadcast(&l->durable);
+        pthread_mutex_unlock(&l->lock);
+    }
+
+    pthread_mutex_lock(&l->lock);
+    l->stopped = 1;                 // nothing more will become durable
+    pthread_cond_broadcast(&l->durable);
+    pthread_mutex_unlock(&l->lock);
+    return NULL;
+}
+
+/* --- RECOVERY --- */
+
+static inline int vledger_new(struct vledger *l) {
+    uint8_t h[VLEDGER_HDR_SIZE] = {0};
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    l->salt = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    l->base_lsn = 0;
+    vledger_put(h, VLEDGER_MAGIC, 4);
+    vledger_put(h + 4, VLEDGER_VERSION, 2);
+    vledger_put(h + 6, VLEDGER_REC_SIZE, 2);
+    vledger_put(h + 8, l->base_lsn, 8);
+    vledger_put(h + 16, l->salt, 8);
+    vledger_put(h + 28, vledger_crc32(0, h, 28), 4);
+    if (ftruncate(l->fd, 0) != 0 || pwrite(l->fd, h, sizeof(h), 0) != (ssize_t)sizeof(h) || fsync(l->fd) != 0) {
+        perror("vledger: create");
+        return -1;
+    }
+    return 0;
+}
+
+// Validate the header and the tail; cut at the first bad record
+static inline int vledger_recover(struct vledger *l, int full_scan) {
+    uint8_t h[VLEDGER_HDR_SIZE];
+    struct stat st;
+    if (fstat(l->fd, &st) != 0) { perror("vledger: stat"); return -1; }
+    if (st.st_size < VLEDGER_HDR_SIZE) return vledger_new(l);    // new, or the header never made it
+
+    if (pread(l->fd, h, sizeof(h), 0) != (ssize_t)sizeof(h) || vledger_get(h, 4) != VLEDGER_MAGIC ||
+        vledger_get(h + 28, 4) != vledger_crc32(0, h, 28) || vledger_get(h + 6, 2) != VLEDGER_REC_SIZE) {
+        fprintf(stderr, "ERROR: %s is not a verdict ledger (or its header is damaged), not touching it\n", l->path);
+        return -1;
+    }
+    l->base_lsn = vledger_get(h + 8, 8);
+    l->salt = vledger_get(h + 16, 8);
+
+    uint64_t n = (st.st_size - VLEDGER_HDR_SIZE) / VLEDGER_REC_SIZE;
+    uint64_t first = full_scan || n < 2 * VLEDGER_MAX_BATCH ? 0 : n - 2 * VLEDGER_MAX_BATCH;
+    uint64_t good = first;
+    size_t chunk_size = 64 * 1024;
+    uint8_t *chunk = malloc(chunk_size);
+    if (!chunk) { perror("Malloc failed"); return -1; }
+    for (int bad = 0; !bad && good < n;) {
+        size_t want = (n - good) * VLEDGER_REC_SIZE < chunk_size ? (n - good) * VLEDGER_REC_SIZE : chunk_size;
+        ssize_t got = pread(l->fd, chunk, want, VLEDGER_HDR_SIZE + (off_t)good * VLEDGER_REC_SIZE);
+        if (got < VLEDGER_REC_SIZE) break;
+        for (ssize_t o = 0; o + VLEDGER_REC_SIZE <= got; o += VLEDGER_REC_SIZE) {
+            if (!vledger_record_ok(l, chunk + o, l->base_lsn + good)) { bad = 1; break; }
+            good++;
+        }
+    }
+    free(chunk);
+
+    off_t end = VLEDGER_HDR_SIZE + (off_t)good * VLEDGER_REC_SIZE;
+    if (end < st.st_size) {
+        l->cut = st.st_size - end;
+        fprintf(stderr, "vledger: %s: torn tail at record %llu, discarding %llu bytes\n", l->path,
+                (unsigned long long)good, (unsigned long long)l->cut);
+        if (ftruncate(l->fd, end) != 0 || fsync(l->fd) != 0) { perror("vledger: truncate"); return -1; }
+    }
+    l->recovered = good;
+    return 0;
+}
+
+// A new file's directory entry is only durable once the directory is synced
+static inline int vledger_sync_dir(const struct vledger *l) {
+    char dir[sizeof(l->path)];
+    snprintf(dir, sizeof(dir), "%s", l->path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == dir) dir[1] = 0;
+    else *slash = 0;
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0) {
+        fprintf(stderr, "vledger: cannot sync directory %s: %s\n", dir, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* --- API --- */
+
+// Open or create the ledger at path and start the committer. full_scan
+// checks every record instead of just the tail.
+static inline int vledger_open(struct vledger *l, const char *path, int full_scan) {
+    memset(l, 0, sizeof(*l));
+    snprintf(l->path, sizeof(l->path), "%s", path);
+    int created = 1;
+    l->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (l->fd < 0 && errno == EEXIST) {
+        created = 0;
+        l->fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+    if (l->fd < 0) {
+        fprintf(stderr, "vledger: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    uint64_t t0 = vledger_now_ns();
+    if (vledger_recover(l, full_scan) != 0 || (created && vledger_sync_dir(l) != 0)) {
+        close(l->fd);
+        return -1;
+    }
+    l->scan_ms = (vledger_now_ns() - t0) / 1e6;
+    l->next_lsn = l->durable_lsn = l->base_lsn + l->recovered;
+    l->pending = &l->bufs[0];
+    l->pending->first_lsn = l->next_lsn;
+    l->t_open = vledger_now_ns() / 1e9;
+    printf("vledger: %s, %llu records (%s scan %.1f ms), next LSN %llu\n", path, (unsigned long long)l->recovered,
+           full_scan ? "full" : "tail", l->scan_ms, (unsigned long long)l->next_lsn);
+
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->work, NULL);
+    pthread_cond_init(&l->durable, NULL);
+    if (pthread_create(&l->thread, NULL, vledger_thread, l) != 0) {
+        perror("vledger: pthread_create");
+        close(l->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Queue one verdict; returns its LSN. Blocks only while a full batch waits
+// for the previous commit to finish.
+static inline uint64_t vledger_append(struct vledger *l, uint32_t id, uint64_t ts_us, int verdict, uint16_t score,
+                                      uint32_t latency_us) {
+    pthread_mutex_lock(&l->lock);
+    while (l->pending->n == VLEDGER_MAX_BATCH) {
+        l->stalls++;
+        pthread_cond_signal(&l->work);
+        pthread_cond_wait(&l->durable, &l->lock);
+    }
+    struct vledger_batch *b = l->pending;
+    uint64_t lsn = l->next_lsn++;
+    uint8_t *r = b->data + (size_t)b->n * VLEDGER_REC_SIZE;
+    vledger_put(r, lsn, 8);
+    vledger_put(r + 8, ts_us, 8);
+    vledger_put(r + 16, id, 4);
+    vledger_put(r + 20, latency_us, 4);
+    vledger_put(r + 24, score, 2);
+    r[26] = (uint8_t)verdict;
+    r[27] = 0;
+    vledger_put(r + 28, vledger_crc32((uint32_t)l->salt, r, 28), 4);
+    b->t_ns[b->n++] = vledger_now_ns();
+    l->records++;
+    if (b->n == 1 || b->n == VLEDGER_MAX_BATCH) pthread_cond_signal(&l->work);
+    pthread_mutex_unlock(&l->lock);
+    return lsn;
+}
+
+// Block until lsn is on disk. Returns -1 if the committer gave up first.
+static inline int vledger_wait(struct vledger *l, uint64_t lsn) {
+    pthread_mutex_lock(&l->lock);
+    while (l->durable_lsn <= lsn && !l->stopped) pthread_cond_wait(&l->durable, &l->lock);
+    int rc = l->durable_lsn > lsn ? 0 : -1;
+    pthread_mutex_unlock(&l->lock);
+    return rc;
+}
+
+// Commit what is pending and stop the committer
+static inline void vledger_close(struct vledger *l) {
+    pthread_mutex_lock(&l->lock);
+    l->quit = 1;
+    pthread_cond_signal(&l->work);
+    pthread_mutex_unlock(&l->lock);
+    pthread_join(l->thread, NULL);
+    close(l->fd);
+    pthread_mutex_destroy(&l->lock);
+    pthread_cond_destroy(&l->work);
+    pthread_cond_destroy(&l->durable);
+}
+
+static inline void vledger_print(const struct vledger *l) {
+    double elapsed = vledger_now_ns() / 1e9 - l->t_open;
+    printf("vledger: %llu records (%.1f/s), %llu commits (%.1f records each), %llu stalls, %llu write errors, "
+           "durable up to LSN %llu\n", (unsigned long long)l->records, elapsed > 0 ? l->records / elapsed : 0,
+           (unsigned long long)l->batches, l->batches ? (double)l->records / l->batches : 0,
+           (unsigned long long)l->stalls, (unsigned long long)l->errors, (unsigned long long)l->durable_lsn);
+}
+
+#endif // VLEDGER_H